@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Deterministic archive of files and directories, for the outputs kept in the
+// task cache. Entries are sorted by path and carry nothing but their type,
+// path, executable bit and contents: no mtimes, owners or other permissions,
+// so the same tree always packs to the same bytes, and the same blob.
+//
+// The stream is cut into chunks deflated independently of each other, on
+// every core while the next ones are being read, and inflated the same way
+// on extraction, which writes each file as soon as its contents come in.
+//
+// Layout: "ULPMAR01", then frames of [u32 raw size][u32 packed size][data]
+// (data left as is when deflating didn't shrink it) up to a frame of raw size
+// 0. Once inflated, records of [u8 type][u32 path size][path][u64 size] and
+// then size bytes of contents, or of symlink target.
+// Integers are little-endian.
+
+struct archive_stats_t
+{
+    uint64_t files = 0, dirs = 0, links = 0;
+    uint64_t bytes  = 0;  // contents of the files, unpacked
+    uint64_t packed = 0;  // the whole archive
+};
+
+// Takes the next len bytes of the archive, false to abort
+using archive_sink_t = std::function<bool(const char* data, size_t len)>;
+
+// Packs paths (relative, directories taken whole) into sink.
+// Returns false, after a warning, if a file couldn't be read or sink gave up.
+bool pack_archive(const std::vector<std::string>& paths, const archive_sink_t& sink, archive_stats_t* stats = nullptr);
+
+// Unpacks an archive handed to it piece by piece, as it gets downloaded or
+// read, under dir. Paths escaping dir are refused.
+class ArchiveExtractor
+{
+public:
+    explicit ArchiveExtractor(std::string dir);
+    ~ArchiveExtractor();
+
+    ArchiveExtractor(const ArchiveExtractor&)            = delete;
+    ArchiveExtractor& operator=(const ArchiveExtractor&) = delete;
+
+    // false once the archive turned out invalid or couldn't be written,
+    // see error()
+    bool feed(const char* data, size_t len);
+    // Whether the whole archive came in and got written
+    bool finish();
+
+    const std::string&     error() const { return m_error; }
+    const archive_stats_t& stats() const { return m_stats; }
+
+private:
+    struct frame_t
+    {
+        uint32_t    raw_size;
+        std::string data;
+    };
+
+    std::string          m_dir;
+    std::string          m_error;
+    archive_stats_t      m_stats;
+    std::string          m_in;  // bytes of the archive not made into frames yet
+    bool                 m_magic = false, m_end = false;
+    std::vector<frame_t> m_frames;  // waiting to be inflated together
+
+    // the record being unpacked
+    std::string m_header;
+    char        m_type = 0;
+    std::string m_path, m_target;
+    uint64_t    m_left = 0;
+    std::FILE*  m_file = nullptr;
+
+    std::unordered_set<std::string> m_links;  // symlinks unpacked so far, never gone through
+    std::unordered_set<std::string> m_paths;  // of every entry so far, each one may only come once
+
+    bool fail(std::string error);
+    bool inflateFrames();
+    bool unpack(const char* data, size_t len);
+    bool beginEntry();
+    bool endEntry();
+};
@@ -16,6 +16,18 @@ public:
     void generateFiles(const manifest_settings_t& common) override;
     bool syncPkgManifest(const manifest_settings_t& common, const manifest_update_t& upd) override;
 
+    // Runs package.json scripts itself for "<pm> run <script>", sparing the
+    // package manager startup. Anything it can't faithfully emulate (.npmrc,
+    // scripts reading npm config variables) is left to the package manager.
+    std::optional<int>       runNative(const std::vector<std::string>& argv, const TinyProcessLib::Config& config) override;
+    std::optional<task_t>    nativeTask(const std::vector<std::string>& argv) override;
+    std::vector<std::string> scriptNames() const override;
+
+    std::vector<std::string> installInputs(const manifest_settings_t& common) const override;
+    std::vector<std::string> installMarkers(const manifest_settings_t& common) const override;
+    std::vector<std::string>    artifactDirs() const override { return { "node_modules" }; }
+    std::vector<clean_target_t> cleanTargets() const override;
+
 private:
     std::string m_js_main_src     = "src/main.js";
     std::string m_js_runtime_bin  = "node";
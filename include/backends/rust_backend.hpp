@@ -15,6 +15,14 @@ public:
     void generateFiles(const manifest_settings_t& common) override;
     bool syncPkgManifest(const manifest_settings_t& common, const manifest_update_t& upd) override;
 
+    // the crates themselves live in the shared ~/.cargo registry
+    std::vector<std::string> installInputs(const manifest_settings_t& /*common*/) const override
+    {
+        return { "Cargo.toml", "Cargo.lock" };
+    }
+    std::vector<std::string>    artifactDirs() const override { return { "target" }; }
+    std::vector<clean_target_t> cleanTargets() const override;
+
 private:
     std::string m_rust_edition = "2024";
 
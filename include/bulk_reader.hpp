@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Reads whole files by the thousand. On Linux it goes through io_uring: the
+// openat, read and close of a window of files are queued as linked requests
+// and submitted together, so a batch costs a few syscalls instead of three
+// per file. Where io_uring is missing or not allowed (old kernels, seccomp),
+// or for files too large to read in one go, it falls back to blocking calls.
+class BulkReader
+{
+public:
+    enum class Mode
+    {
+        Auto,
+        Uring,
+        Blocking
+    };
+
+    // Called for every file on the thread calling read(), data is only valid
+    // until it returns. ok is false if the file couldn't be read.
+    using callback_t = std::function<void(size_t index, std::string_view data, bool ok)>;
+
+    explicit BulkReader(Mode mode = Mode::Auto);
+    ~BulkReader();
+
+    BulkReader(const BulkReader&)            = delete;
+    BulkReader& operator=(const BulkReader&) = delete;
+
+    bool usingUring() const { return m_ring != nullptr; }
+
+    // sizes are what the files are expected to be (from a stat), a file that
+    // turns out bigger is still read whole
+    void read(const std::vector<std::string>& paths, const std::vector<uint64_t>& sizes, const callback_t& f);
+
+    // Mode::Auto unless $ULPM_IO is "uring" or "blocking"
+    static Mode defaultMode();
+
+private:
+    struct ring_t;
+    ring_t* m_ring = nullptr;
+
+    void readUring(const std::vector<std::string>& paths, const std::vector<uint64_t>& sizes, const callback_t& f);
+};
+
+// Whole contents of path through blocking calls, false if it can't be read
+bool read_whole_file(const std::string& path, std::string& data, uint64_t size_hint = 0);
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+// Where the outputs of ulpm commands are cached, laid out like Bazel's remote
+// cache: an action cache (ac/) from the key of a command to what it produced,
+// and a content-addressed store (cas/) of blobs named after their SHA-256.
+// Bodies are streamed both ways, never held whole in memory.
+class CacheBackend
+{
+public:
+    enum class Store : uint8_t
+    {
+        Action,
+        Content
+    };
+
+    // Takes the next len bytes of a body, false to abort
+    using sink_t = std::function<bool(const char* data, size_t len)>;
+    // Fills buf with up to len bytes of a body, 0 at its end
+    using source_t = std::function<size_t(char* buf, size_t len)>;
+
+    virtual ~CacheBackend() = default;
+
+    virtual std::string describe() const = 0;
+
+    virtual bool contains(Store store, const std::string& hash) = 0;
+    // false on a miss, or if it couldn't be read whole
+    virtual bool get(Store store, const std::string& hash, const sink_t& sink) = 0;
+    virtual bool put(Store store, const std::string& hash, uint64_t size, const source_t& source) = 0;
+
+    bool getFile(Store store, const std::string& hash, const std::string& path);
+    bool putFile(Store store, const std::string& hash, const std::string& path);
+};
+
+// Directory of the local machine. Every hit, miss and write is appended to
+// an access log in it, which prune() evicts the least recently used entries
+// by and usage() reports on. Processes log under a shared lock of the
+// directory, prune() takes it exclusively.
+class FsCacheBackend : public CacheBackend
+{
+public:
+    // what the access log records
+    enum class Event : uint8_t
+    {
+        Hit,
+        Miss,
+        Put,
+        Touch  // used again, or compacted from older records
+    };
+
+    struct limits_t
+    {
+        uint64_t max_size = 0;  // bytes, 0 for no limit
+        int64_t  max_age  = 0;  // seconds since last used, 0 for no limit
+    };
+
+    struct usage_t
+    {
+        uint64_t actions = 0, blobs = 0, bytes = 0;  // in the cache now
+        uint64_t hits = 0, misses = 0;               // lookups of the action cache
+        uint64_t restored = 0, stored = 0;           // bytes of blobs read from and written to it
+        uint64_t evicted = 0, evicted_bytes = 0;
+        int64_t  since      = 0;  // first access logged, 0 if none
+        int64_t  last_prune = 0;
+    };
+
+    struct prune_stats_t
+    {
+        uint64_t entries = 0, bytes = 0;  // evicted
+        uint64_t kept = 0, kept_bytes = 0;
+    };
+
+    explicit FsCacheBackend(std::string dir) : m_dir(std::move(dir)) {}
+
+    std::string describe() const override { return m_dir; }
+
+    bool contains(Store store, const std::string& hash) override;
+    bool get(Store store, const std::string& hash, const sink_t& sink) override;
+    bool put(Store store, const std::string& hash, uint64_t size, const source_t& source) override;
+
+    usage_t usage();
+    // Evicts what wasn't used for longer than limits.max_age, then the least
+    // recently used entries until the cache fits in limits.max_size, and
+    // compacts the log. false, doing nothing, if the cache is in use and wait
+    // is false.
+    bool prune(const limits_t& limits, bool wait, prune_stats_t& stats);
+    // Whether the last prune() was a day ago or more
+    bool pruneDue();
+
+private:
+    std::string m_dir;
+
+    std::string path(Store store, const std::string& hash) const;
+    void        log(Event event, Store store, const std::string& hash, uint64_t bytes = 0);
+};
+
+// Bazel's HTTP/1.1 REST protocol: GET, HEAD and PUT on <url>/ac/<hash> and
+// <url>/cas/<hash>. Requests go through curl, like every other download of
+// ulpm, which brings TLS, proxies and credentials in the url for free.
+class HttpCacheBackend : public CacheBackend
+{
+public:
+    explicit HttpCacheBackend(std::string url);
+
+    std::string describe() const override { return m_url; }
+
+    bool contains(Store store, const std::string& hash) override;
+    bool get(Store store, const std::string& hash, const sink_t& sink) override;
+    bool put(Store store, const std::string& hash, uint64_t size, const source_t& source) override;
+
+private:
+    std::string m_url;
+
+    std::string url(Store store, const std::string& hash) const;
+};
+
+// An HttpCacheBackend for an http(s):// location, an FsCacheBackend otherwise
+std::unique_ptr<CacheBackend> make_cache_backend(const std::string& location);
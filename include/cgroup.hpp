@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Limits of a command, in the syntax of the cgroup v2 files of the same
+// name, left alone when empty
+struct cgroup_limits_t
+{
+    std::string cpu_max;     // "<quota> <period>" in µs, or "max"
+    std::string memory_max;  // bytes, or "max"
+    std::string io_weight;   // 1 to 10000, or "default <weight>"
+
+    bool empty() const { return cpu_max.empty() && memory_max.empty() && io_weight.empty(); }
+};
+
+// What a command and everything it started used, once it's over
+struct cgroup_stats_t
+{
+    uint64_t user_usec = 0, system_usec = 0;
+    uint64_t memory_peak = 0;  // bytes, 0 without the memory controller or before Linux 5.19
+    uint64_t read_bytes = 0, write_bytes = 0;  // 0 without the io controller
+};
+
+// A cgroup v2 of ulpm's own, with one cgroup per command it starts under it,
+// to limit them and account for all their descendants, even the ones they
+// don't wait for. Needs ulpm's cgroup to be delegated to its user, e.g.
+//     systemd-run --user --scope -p Delegate=yes ulpm run ...
+// and the controllers of the limits to be enabled in it. Otherwise commands
+// run where ulpm runs, and create() says so once if they have limits.
+//
+// A cgroup can't have both processes and controllers enabled for its
+// children, so if ulpm is alone in its cgroup it moves itself into a leaf,
+// and back in once done.
+class CgroupTree
+{
+public:
+    CgroupTree();
+    ~CgroupTree();
+
+    CgroupTree(const CgroupTree&)            = delete;
+    CgroupTree& operator=(const CgroupTree&) = delete;
+
+    bool available() const { return !m_root.empty(); }
+
+    // Makes the cgroup of command id and sets its limits. Returns a file
+    // descriptor of its cgroup.procs for the command to write itself to,
+    // see TinyProcessLib::Config::cgroup_procs_fd, -1 if it can't have one.
+    int create(size_t id, const cgroup_limits_t& limits);
+    // Kills what command id left running once it's over, and waits for it to
+    // be gone, to read what it all used and remove its cgroup
+    std::optional<cgroup_stats_t> release(size_t id);
+
+private:
+    struct group_t
+    {
+        std::string path;
+        int         procs_fd;
+    };
+
+    std::string                         m_base;  // ulpm's cgroup
+    std::string                         m_root;  // m_base/ulpm.<pid>, empty if unavailable
+    std::string                         m_leaf;  // where ulpm moved itself to, if it did
+    std::vector<std::string>            m_enabled;  // controllers enabled in m_base for m_root
+    std::mutex                          m_mutex;
+    std::unordered_map<size_t, group_t> m_groups;
+    std::unordered_set<std::string>     m_warned;  // what create() already warned about
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Resolved dependency graph of a lockfile, laid out to be cheap to query and
+// to dump as is to disk: every name/version is interned once in a string
+// pool, and the edges are stored as CSR (the deps of node n are
+// edges[edge_offsets[n] .. edge_offsets[n + 1]]).
+// A package installed several times (npm nesting) gets a node per copy.
+struct DepGraph
+{
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    std::string           strings;
+    std::vector<uint32_t> string_offsets{ 0 };
+    std::vector<uint32_t> node_name, node_version;  // string ids
+    std::vector<uint32_t> edge_offsets{ 0 };
+    std::vector<uint32_t> edges;
+    uint32_t              root = 0;  // the project itself
+
+    size_t nodeCount() const { return node_name.size(); }
+
+    std::string_view str(uint32_t id) const
+    {
+        return std::string_view(strings).substr(string_offsets[id], string_offsets[id + 1] - string_offsets[id]);
+    }
+    std::string_view name(uint32_t node) const { return str(node_name[node]); }
+    std::string_view version(uint32_t node) const { return str(node_version[node]); }
+
+    std::span<const uint32_t> deps(uint32_t node) const
+    {
+        return { edges.data() + edge_offsets[node], edges.data() + edge_offsets[node + 1] };
+    }
+
+    // BFS from the root: the node each one was first reached from, the
+    // root's own entry is itself and unreachable nodes get NONE.
+    std::vector<uint32_t> parents() const;
+};
+
+class DepGraphBuilder
+{
+public:
+    uint32_t addNode(std::string_view name, std::string_view version);
+    void     addEdge(uint32_t from, uint32_t to) { m_edges.emplace_back(from, to); }
+    void     setRoot(uint32_t node) { m_graph.root = node; }
+
+    // Sorts the edges into CSR, the builder is left empty
+    DepGraph finish();
+
+private:
+    DepGraph                                  m_graph;
+    std::unordered_map<std::string, uint32_t> m_ids;
+    std::vector<std::pair<uint32_t, uint32_t>> m_edges;
+
+    uint32_t intern(std::string_view str);
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "bulk_reader.hpp"
+#include "sha256.hpp"
+
+using file_hash_t = Sha256::digest_t;
+
+// Content hashes of the files under a root, kept in <root>/.ulpm/hashes.idx
+// along with the inode, size, mtime and ctime each one had: a file whose
+// stat didn't change isn't read again.
+// Small files are hashed (SHA-256) in batches across the cores, each batch
+// read through a BulkReader. Large ones are cut in chunks hashed in parallel,
+// and their hash is the one of the chunk hashes, so one big file doesn't keep
+// a single core busy.
+class FileHasher
+{
+public:
+    struct stats_t
+    {
+        size_t   files = 0, hashed = 0;
+        uint64_t bytes = 0;      // read to hash them
+        bool     uring = false;  // read through io_uring
+    };
+
+    explicit FileHasher(std::string root, BulkReader::Mode io = BulkReader::defaultMode());
+
+    // The hash of every file (relative to the root), none for the ones that
+    // can't be read. The cache is updated to hold only the files hashed.
+    // use_cache = false to hash them all again.
+    std::vector<std::optional<file_hash_t>> hash(const std::vector<std::string>& files, bool use_cache = true);
+
+    const stats_t& stats() const { return m_stats; }
+
+private:
+    struct record_t
+    {
+        uint64_t    ino = 0, size = 0;
+        int64_t     mtime = 0, ctime = 0;
+        file_hash_t hash{};
+    };
+
+    std::string                               m_root;
+    BulkReader::Mode                          m_io;
+    std::unordered_map<std::string, record_t> m_cache;
+    stats_t                                   m_stats;
+
+    bool loadCache();
+    void saveCache() const;
+};
+
+// Merkle root of every directory of a sorted (path, hash) list of files: the
+// hash of the names and hashes of its entries, "" for the root itself. Two
+// trees with the same root hash for a directory have the same files under it.
+std::unordered_map<std::string, file_hash_t> merkle_roots(
+    const std::vector<std::pair<std::string, file_hash_t>>& files);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+
+// Advisory lock on a file, created if needed, held until destroyed.
+// It's flock(): only binding on processes asking for it as well, and dropped
+// by the kernel if the holder dies. Always granted on Windows.
+class FileLock
+{
+public:
+    enum class Mode
+    {
+        Shared,
+        Exclusive
+    };
+
+    // wait = false to give up right away if someone else holds it
+    FileLock(const std::string& path, Mode mode, bool wait = true);
+    ~FileLock();
+
+    FileLock(const FileLock&)            = delete;
+    FileLock& operator=(const FileLock&) = delete;
+
+    bool locked() const { return m_locked; }
+
+private:
+    int  m_fd     = -1;
+    bool m_locked = false;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "file_hasher.hpp"
+
+// The content hash of every file of a tree, ignore files honoured, kept to
+// tell later which of them changed.
+// Saved in .ulpm/snapshots/<name> as "<sha-256 hex> <path>" lines, a file
+// that couldn't be read is left out and so always counts as changed.
+class FileSnapshot
+{
+public:
+    // Hashes every file under root, in parallel
+    static FileSnapshot capture(const std::string& root);
+
+    bool load(const std::string& path);
+    bool save(const std::string& path) const;
+
+    size_t size() const { return m_files.size(); }
+
+    // The files added, removed or modified since old, sorted
+    std::vector<std::string> changedSince(const FileSnapshot& old) const;
+
+private:
+    std::vector<std::pair<std::string, file_hash_t>> m_files;  // sorted by path
+};
+
+// Where the snapshot called name of the project at root is kept
+std::string snapshot_path(const std::string& root, const std::string& name);
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "terminal_display.hpp"
+
+// Off-screen replacement for termbox, used by TerminalDisplay when
+// ULPM_HEADLESS=<width>x<height> is set. It keeps the cells in memory,
+// replays keystrokes from a script and counts what every frame would cost.
+//
+// ULPM_HEADLESS_KEYS=<file>       raw terminal input to replay. Every line is
+//                                 delivered as a single burst, the newline
+//                                 itself is not a key (Enter is '\r').
+// ULPM_HEADLESS_SNAPSHOTS=<file>  append a text dump of every frame
+//
+// src/bench/menu_driver.cpp runs the menus on it for scripts/bench_menu.sh.
+class HeadlessScreen
+{
+public:
+    struct stats_t
+    {
+        size_t frames        = 0;
+        size_t events        = 0;
+        size_t cells_changed = 0;
+        size_t bytes         = 0;  // estimate of what termbox would have sent
+    };
+
+    HeadlessScreen(int width, int height);
+
+    // Parses "<width>x<height>", returns nullptr if malformed
+    static std::unique_ptr<HeadlessScreen> fromSpec(const std::string_view spec);
+
+    bool loadKeys(const std::string& path);
+    void setSnapshotPath(const std::string& path) { m_snapshot_path = path; }
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+    void clear();
+    void setCell(int x, int y, uint32_t ch, uintattr_t fg, uintattr_t bg);
+    void print(int x, int y, uintattr_t fg, uintattr_t bg, const std::string_view str);
+    void setCursor(int x, int y);
+    void hideCursor() { setCursor(-1, -1); }
+    void present();
+
+    // Pops the next scripted event. With wait=false only the current burst is
+    // looked at, like a zero-timeout peek. Returns false if there is none.
+    bool nextEvent(struct tb_event& ev, bool wait);
+
+    std::string    snapshot() const;
+    const stats_t& stats() const { return m_stats; }
+
+private:
+    struct cell_t
+    {
+        uint32_t   ch = U' ';
+        uintattr_t fg = TB_DEFAULT;
+        uintattr_t bg = TB_DEFAULT;
+
+        bool operator==(const cell_t&) const = default;
+    };
+
+    int                 m_width, m_height;
+    int                 m_cursor_x = -1, m_cursor_y = -1;
+    std::vector<cell_t> m_back, m_front;
+
+    std::deque<std::string> m_bursts;
+    std::string             m_pending;
+    std::string             m_snapshot_path;
+    stats_t                 m_stats;
+};
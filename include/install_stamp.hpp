@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "language_backend.hpp"
+
+// Lets "ulpm install" be skipped when neither the package manifest, the
+// lockfile nor the package manager changed since the last successful install,
+// and the installed tree is still the one that install left behind.
+// Kept in .ulpm/install.stamp
+class InstallStamp
+{
+public:
+    InstallStamp(const LanguageBackend&          backend,
+                 const manifest_settings_t&      common,
+                 const std::vector<std::string>& cmd);
+
+    // false if the backend can't tell what its install depends on
+    bool enabled() const { return !m_inputs.empty(); }
+
+    bool upToDate();
+    // Call after a successful install, the lockfile may have been rewritten.
+    void save();
+
+private:
+    static constexpr std::string_view STAMP_PATH = ".ulpm/install.stamp";
+
+    std::vector<std::string> m_inputs, m_markers, m_cmd;
+
+    // what the stamp on disk says
+    std::string m_saved_fingerprint, m_saved_marker, m_saved_pm_id, m_saved_pm_version;
+
+    std::string m_pm_version;
+
+    const std::string& pmVersion();
+    std::string        fingerprint();
+    std::string        markerState() const;
+};
@@ -1,10 +1,21 @@
 #pragma once
+#include <optional>
 #include <string>
 #include <string_view>
 #include <vector>
 
 #include "manifest_settings.hpp"
 #include "rapidjson/document.h"
+#include "task_runner.hpp"
+
+// ulpm clean <name> — a set of paths removed together
+struct clean_target_t
+{
+    std::string_view         name;
+    std::string_view         description;
+    std::vector<std::string> paths;
+    bool                     by_default = false;  // removed by a bare "ulpm clean"
+};
 
 class LanguageBackend
 {
@@ -36,4 +47,37 @@ public:
 
     // ulpm run/build/install — optional extra validation before running.
     virtual void validate(const manifest_settings_t& /*common*/) const {}
+
+    // ulpm run/build/install — run the resolved command line without going
+    // through the package manager, if the backend knows how to emulate it.
+    // The processes it starts get config's cgroup and priority.
+    // Returns the exit status, or std::nullopt to run argv as is.
+    virtual std::optional<int> runNative(const std::vector<std::string>& /*argv*/,
+                                         const TinyProcessLib::Config& /*config*/)
+    {
+        return std::nullopt;
+    }
+
+    // ulpm run -p/-s — same as runNative(), but as a task for run_tasks().
+    virtual std::optional<task_t> nativeTask(const std::vector<std::string>& /*argv*/) { return std::nullopt; }
+
+    // ulpm run -p/-s — the script names glob patterns are matched against.
+    virtual std::vector<std::string> scriptNames() const { return {}; }
+
+    // ulpm install — the files deciding what gets installed (package
+    // manifest, lockfile, package manager config). Empty to never skip it.
+    virtual std::vector<std::string> installInputs(const manifest_settings_t& /*common*/) const { return {}; }
+
+    // ulpm du — directories holding installed packages and build artifacts.
+    virtual std::vector<std::string> artifactDirs() const { return {}; }
+
+    // ulpm clean — what can be removed, defaults to all of artifactDirs().
+    virtual std::vector<clean_target_t> cleanTargets() const
+    {
+        return { { "all", "installed packages and build artifacts", artifactDirs(), true } };
+    }
+
+    // ulpm install — files the package manager rewrites on every install,
+    // the first one that exists stands for the installed tree.
+    virtual std::vector<std::string> installMarkers(const manifest_settings_t& /*common*/) const { return {}; }
 };
@@ -1,6 +1,8 @@
 #ifndef TINY_PROCESS_LIBRARY_HPP_
 #define TINY_PROCESS_LIBRARY_HPP_
+#include <condition_variable>
 #include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -12,6 +14,69 @@
 #endif
 
 namespace TinyProcessLib {
+#ifndef _WIN32
+/// Services the output pipes of many processes from a single thread (epoll on Linux, poll elsewhere),
+/// instead of one reader thread and buffer per process.
+/// Callbacks are invoked on the reactor thread and share its read buffer.
+/// Supported on Unix-like systems only.
+class Reactor {
+public:
+  Reactor(std::size_t buffer_size = 131072);
+  ~Reactor() noexcept;
+
+  Reactor(const Reactor &) = delete;
+  Reactor &operator=(const Reactor &) = delete;
+
+  /// Watch a non-blocking fd until EOF. on_close is invoked after the last on_read.
+  bool add(int fd, std::function<void(const char *bytes, size_t n)> on_read, std::function<void()> on_close);
+  /// Watch a pidfd until its process exits, then reap it and pass the exit status to on_exit.
+  bool add_exit(int pidfd, pid_t pid, std::function<void(int exit_status)> on_exit);
+  /// Wait until fd reached EOF (or its process exited) and is no longer watched.
+  void wait(int fd) noexcept;
+  /// Stop watching fd. Blocks until the reactor thread has let go of it.
+  void remove(int fd) noexcept;
+  /// Returns true while fd is watched.
+  bool watching(int fd) noexcept;
+
+private:
+  struct Entry {
+    std::function<void(const char *bytes, size_t n)> on_read;
+    std::function<void()> on_close;
+    pid_t pid{-1};
+    std::function<void(int exit_status)> on_exit;
+    bool removed{false};
+  };
+
+  std::size_t buffer_size;
+  int poll_fd{-1};
+  int wake_pipe[2]{-1, -1};
+  bool stopping{false};
+  std::mutex entries_mutex;
+  std::condition_variable entries_cv;
+  std::map<int, Entry> entries;
+  std::thread thread;
+
+  bool watch(int fd, Entry entry);
+  void run() noexcept;
+  void wake() noexcept;
+  void unwatch(int fd) noexcept;
+  bool read_fd(int fd, char *buffer) noexcept;
+  bool reap(int fd, Entry *entry) noexcept;
+};
+#endif
+
+/// How a process gets scheduled, applied between fork and exec. The defaults leave what it inherits alone.
+struct Priority {
+  /// On Linux only: the CPUs it may run on (sched_setaffinity()), all of the parent's if empty.
+  std::vector<int> cpus;
+  /// On Unix-like systems only: added to the niceness it inherits, like nice(1).
+  int nice = 0;
+  /// On Linux only: its I/O scheduling class like ionice(1), 1 realtime, 2 best-effort or 3 idle, 0 to inherit it.
+  int io_class = 0;
+  /// Within the realtime and best-effort classes, from 0 (highest) to 7.
+  int io_level = 4;
+};
+
 /// Additional parameters to Process constructors.
 struct Config {
   /// Buffer size for reading stdout and stderr. Default is 131072 (128 kB).
@@ -53,6 +118,30 @@ struct Config {
   /// Requires the flatpak `org.freedesktop.Flatpak` portal to be opened for the current sandbox.
   /// See https://docs.flatpak.org/en/latest/flatpak-command-reference.html#flatpak-spawn.
   bool flatpak_spawn_host = false;
+
+  /// On Linux only: if not negative, a cgroup.procs file of a cgroup v2 the process writes itself to before anything
+  /// else, so that it and all of its descendants are accounted and limited there. Left open.
+  int cgroup_procs_fd = -1;
+
+  /// See Priority.
+  Priority priority;
+
+#ifndef _WIN32
+  /// If not negative and stdin isn't opened, a file descriptor the process gets as its stdin instead of the parent's.
+  /// Left open.
+  int stdin_fd = -1;
+  /// If not negative and stdout isn't read, a file descriptor the process gets as its stdout instead of the parent's.
+  /// Left open.
+  int stdout_fd = -1;
+
+  /// If set, stdout and stderr are read by this reactor instead of a dedicated thread per process.
+  /// The reactor must outlive the process.
+  Reactor *reactor = nullptr;
+  /// If set together with reactor, the process exit is watched through a pidfd (Linux 5.3+),
+  /// and this is invoked on the reactor thread once the process has been reaped.
+  /// See Process::notifies_exit().
+  std::function<void(int exit_status)> on_exit = nullptr;
+#endif
 };
 
 /// Platform independent class for creating processes.
@@ -150,6 +239,9 @@ public:
 #ifndef _WIN32
   /// Send the signal signum to the process.
   void signal(int signum) noexcept;
+  /// Returns true if the exit of the process is reported through Config::on_exit.
+  /// Otherwise, get_exit_status() has to be called to find out.
+  bool notifies_exit() const noexcept { return exit_fd >= 0; }
 #endif
 
 private:
@@ -160,6 +252,7 @@ private:
   std::function<void(const char *bytes, size_t n)> read_stderr;
 #ifndef _WIN32
   std::thread stdout_stderr_thread;
+  fd_type exit_fd{-1}; // pidfd watched by config.reactor
 #else
   std::thread stdout_thread, stderr_thread;
 #endif
@@ -177,6 +270,10 @@ private:
 #endif
   void async_read() noexcept;
   void close_fds() noexcept;
+#ifndef _WIN32
+  void watch_exit() noexcept;
+  void unwatch_exit() noexcept;
+#endif
 };
 
 } // namespace TinyProcessLib
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "dep_graph.hpp"
+
+// The lockfile of the project: the one of package_manager when known,
+// otherwise the first one found. Empty if there is none.
+std::string find_lockfile(const std::string_view package_manager);
+
+// Dependency graph of package-lock.json/npm-shrinkwrap.json, yarn.lock
+// (classic and berry), pnpm-lock.yaml (v6+) or Cargo.lock.
+// The lockfile is only parsed when it changed since the last call, the graph
+// is kept in .ulpm/deps.idx otherwise.
+DepGraph load_dep_graph(const std::string& lockfile);
+
+// An entry of package-lock.json's "packages"
+struct npm_package_t
+{
+    std::string              path;  // "" for the project, else "node_modules/a/node_modules/b"
+    std::string              name, version, resolved, integrity;
+    bool                     link               = false;  // a workspace, resolved is where it lives
+    bool                     optional           = false;
+    bool                     in_bundle          = false;  // shipped inside the tarball of a parent package
+    bool                     has_install_script = false;
+    std::vector<std::string> deps;
+    std::vector<std::pair<std::string, std::string>> bins;  // command, file in the package
+};
+
+// The "packages" of a package-lock.json/npm-shrinkwrap.json, lockfileVersion 2 and later
+std::vector<npm_package_t> read_npm_lock(const std::string& path);
@@ -8,7 +8,9 @@
 class Manifest
 {
 public:
-    Manifest();
+    // With create false a missing ulpm.json is left alone and read as an empty one,
+    // for the commands that only look at it if it's there.
+    explicit Manifest(bool create = true);
 
     // Non-copyable
     Manifest(const Manifest&)            = delete;
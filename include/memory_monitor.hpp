@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// Follows how much memory trees of processes use, sampling /proc a few times
+// a second: the resident sets of a process and of all its descendants,
+// summed. Pages shared between them are counted once per process, so it errs
+// on the high side, and daemons leaving the tree aren't counted at all.
+// Only on Linux, it reports nothing elsewhere.
+class MemoryMonitor
+{
+public:
+    MemoryMonitor();
+    ~MemoryMonitor();
+
+    MemoryMonitor(const MemoryMonitor&)            = delete;
+    MemoryMonitor& operator=(const MemoryMonitor&) = delete;
+
+    // Starts following pid and its descendants under id
+    void watch(size_t id, int pid);
+    // Stops following id, what was seen of it is kept
+    void unwatch(size_t id);
+
+    // In bytes, as of the last sample
+    uint64_t current(size_t id) const;
+    uint64_t peak(size_t id) const;
+
+    // MemAvailable of /proc/meminfo in bytes, 0 if unknown
+    static uint64_t available();
+
+private:
+    static constexpr std::chrono::milliseconds INTERVAL{ 250 };
+
+    struct group_t
+    {
+        int      pid;
+        bool     watched = true;
+        uint64_t current = 0, peak = 0;
+    };
+
+    mutable std::mutex                  m_mutex;
+    std::condition_variable             m_cv;
+    std::unordered_map<size_t, group_t> m_groups;
+    bool                                m_stop = false;
+    std::thread                         m_thread;
+
+    void sample();
+};
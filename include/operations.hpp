@@ -2,13 +2,48 @@
 
 #include "manifest.hpp"
 
+// ulpm run -p a b -s c: scripts ran at once or one after the other
+struct run_group_t
+{
+    bool                     parallel = true;
+    std::vector<std::string> scripts;  // names or glob patterns
+};
+
 struct cmd_options_t
 {
     bool                     init_force = false;
     bool                     init_yes   = false;
     std::vector<std::string> arguments;  // for run
+    std::vector<run_group_t> run_groups;
+    bool                     keep_going       = false;
+    bool                     install_force    = false;
+    bool                     run_no_cache     = false;
+    size_t                   run_jobs         = 0;  // 0 for the default of each kind of run
+    bool                     run_explain      = false;
+    uint64_t                 run_memory       = 0;  // bytes, 0 for $ULPM_MEMORY_BUDGET or what's available
+    int64_t                  run_grace        = 5;  // seconds between SIGTERM and SIGKILL when cancelling
+    int                      deps_depth       = -1;  // ulpm deps tree, -1 for no limit
+    size_t                   du_top           = 20;
+    bool                     clean_list       = false;
+    bool                     clean_background = false;
+    bool                     projects_rescan  = false;
+    bool                     affected         = false;  // ulpm run --affected
+    std::string              affected_since   = "HEAD";
+    std::string              affected_save;
+    bool                     hash_files    = false;
+    bool                     hash_no_cache = false;
+    std::string              cache_max_size;  // ulpm cache prune, empty for ulpm.json's
+    std::string              cache_max_age;
 };
 
 void op_init(Manifest& manifest, const cmd_options_t& opts, const manifest_update_t& upd);
 void op_set(Manifest& manifest, const manifest_update_t& upd);
 void op_run(Manifest& manifest, const std::string& cmd, const cmd_options_t& opts);
+void op_deps(Manifest& manifest, const cmd_options_t& opts);
+void op_du(Manifest& manifest, const cmd_options_t& opts);
+void op_clean(Manifest& manifest, const cmd_options_t& opts);
+void op_store(Manifest& manifest, const cmd_options_t& opts);
+void op_projects(Manifest& manifest, const cmd_options_t& opts);
+void op_affected(Manifest& manifest, const cmd_options_t& opts);
+void op_hash(Manifest& manifest, const cmd_options_t& opts);
+void op_cache(Manifest& manifest, const cmd_options_t& opts);
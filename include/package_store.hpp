@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Content-addressed store of npm packages, shared by every project of the
+// user, in $XDG_CACHE_HOME/ulpm/store (or $ULPM_STORE_DIR):
+//     files/ab/cdef...[-x]   file contents, named after their SHA-512
+//     index/ab/cdef...       the files of a package, named after the SHA-512 of its tarball
+//     projects/<hash>        projects linked from the store, for gc
+// Files and indexes are written into tmp/ and then linked or renamed into
+// place, so several ulpm processes can fill the store at the same time.
+// Adding and materializing packages hold the lock file shared, gc() holds it
+// exclusively, so it never removes files an index is about to refer to.
+class PackageStore
+{
+public:
+    struct link_stats_t
+    {
+        std::atomic<uint64_t> cloned = 0, linked = 0, copied = 0;
+    };
+
+    struct gc_stats_t
+    {
+        uint64_t packages = 0, files = 0, bytes = 0;
+    };
+
+    PackageStore();
+
+    const std::string& path() const { return m_path; }
+
+    // Imports a package tarball, verifying it against integrity
+    // ("sha512-<base64>") if not empty. Returns the hex SHA-512 of the
+    // tarball, or an empty string on failure.
+    std::string add(const std::string& tarball, const std::string_view integrity = "");
+
+    bool has(const std::string& hex) const;
+
+    // Materializes the package into dir, reflinking each file out of the store
+    // where the filesystem supports it, hard linking it otherwise, copying it
+    // as a last resort.
+    bool materialize(const std::string& hex, const std::string& dir, link_stats_t& stats);
+
+    // Remembers that dir uses the store, until its package-lock.json is gone
+    void registerProject(const std::string& dir);
+
+    // Removes the packages no registered project's lockfile refers to, then
+    // the files no remaining package has.
+    gc_stats_t gc();
+
+    // The tarball npm's cache holds for integrity, empty if there is none
+    static std::string npmCacheTarball(const std::string_view integrity);
+
+private:
+    std::string m_path;
+
+    std::string indexPath(const std::string& hex) const;
+    std::string filePath(const std::string& hex, bool exec) const;
+    std::string tmpPath() const;
+};
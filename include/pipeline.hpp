@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "cgroup.hpp"
+#include "tiny-process-library/process.hpp"
+
+// How a stage of a pipeline went
+struct stage_result_t
+{
+    int                           status = 0;
+    std::chrono::milliseconds     time{ 0 };       // from the start of the pipeline to its exit
+    std::optional<cgroup_stats_t> usage;           // if it had a cgroup
+    bool                          cut    = false;  // killed by SIGPIPE, the next stage stopped reading first
+    bool                          failed = false;  // see run_pipeline()
+};
+
+// Runs argv of each stage with its stdout piped into the stdin of the next
+// one, like `a | b | c` without a shell in between. The first stage reads
+// ulpm's stdin and the last one writes to ulpm's stdout, stderr is shared.
+// Each stage is in a process group and, given cgroups, a cgroup of its own
+// (with the ids 0 to stages.size() - 1), so it's accounted for by itself.
+//
+// Returns one result per stage, once all of them are over. As with
+// `set -o pipefail`, a stage failing fails the pipeline, except for one
+// killed by SIGPIPE because the next one was done with its output, as long
+// as that one succeeded, like `yes | head` does.
+std::vector<stage_result_t> run_pipeline(const std::vector<std::vector<std::string>>& stages,
+                                         const TinyProcessLib::Config&                config,
+                                         CgroupTree*                                  cgroups = nullptr,
+                                         const cgroup_limits_t&                       limits  = {});
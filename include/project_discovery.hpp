@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Manifests that make a directory a project
+enum : uint8_t
+{
+    MANIFEST_ULPM         = 1 << 0,  // ulpm.json
+    MANIFEST_PACKAGE_JSON = 1 << 1,
+    MANIFEST_CARGO        = 1 << 2,  // Cargo.toml
+};
+
+struct project_t
+{
+    std::string path;  // relative to the root, "" for the root itself
+    uint8_t     manifests = 0;
+};
+
+// The patterns of a .gitignore/.ulpmignore, compiled once: literals and
+// "*.ext" suffixes skip the glob matcher.
+class IgnoreRules
+{
+public:
+    // base: the directory of the file, relative to the root
+    void add(std::string_view base, std::string_view content);
+
+    bool empty() const { return m_rules.empty(); }
+
+    // For path (relative to the root): 1 if the last rule matching it ignores
+    // it, 0 if it's a "!pattern" keeping it, -1 if none matches
+    int match(std::string_view path, std::string_view name, bool is_dir) const;
+
+private:
+    enum class Kind : uint8_t
+    {
+        Literal,
+        Suffix,
+        Glob
+    };
+
+    struct rule_t
+    {
+        std::string base;
+        std::string pattern;
+        std::string alt;  // pattern with "**/" matching no directory at all
+        Kind        kind;
+        bool        negate   = false;
+        bool        dir_only = false;
+        bool        anchored = false;  // matched against the path under base, else against the name
+    };
+
+    std::vector<rule_t> m_rules;
+
+    static bool matches(const rule_t& rule, std::string_view str);
+};
+
+// Finds every ulpm.json, package.json and Cargo.toml under a root with
+// TreeWalker, honouring .gitignore and .ulpmignore files and never going into
+// node_modules, target or .git.
+// What was found is kept in <root>/.ulpm/projects.idx along with the mtime of
+// every directory walked: the next scan only stats them, and only walks again
+// the subtrees of the ones that changed.
+class ProjectDiscovery
+{
+public:
+    struct stats_t
+    {
+        size_t dirs = 0, rescanned = 0;
+        bool   from_index = false;
+    };
+
+    explicit ProjectDiscovery(std::string root);
+
+    // use_index = false to walk everything again
+    std::vector<project_t> discover(bool use_index = true);
+
+    // Every file under the root the ignore files don't exclude, sorted.
+    // Always a full walk, the index only knows about directories.
+    std::vector<std::string> files();
+
+    const stats_t& stats() const { return m_stats; }
+
+private:
+    struct dir_record_t
+    {
+        std::string path;
+        int64_t     mtime     = 0;
+        uint8_t     manifests = 0;
+    };
+
+    struct ignore_record_t
+    {
+        std::string path;  // of the ignore file
+        int64_t     mtime = 0;
+    };
+
+    std::string                  m_root;
+    std::vector<dir_record_t>    m_dirs;
+    std::vector<ignore_record_t> m_ignores;
+    stats_t                      m_stats;
+
+    bool loadIndex();
+    void saveIndex() const;
+    // Adds what's under dir to m_dirs and m_ignores, and every file to files
+    // if not null
+    void walk(const std::string& dir, std::vector<std::string>* files = nullptr);
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "dep_graph.hpp"
+#include "project_discovery.hpp"
+
+// How the projects of a monorepo depend on each other, from the
+// dependencies their package.json and Cargo.toml declare: by package name,
+// or by path for Cargo's `path = "..."` ones.
+class ProjectGraph
+{
+public:
+    ProjectGraph(const std::string& root, std::vector<project_t> projects);
+
+    const std::vector<project_t>& projects() const { return m_projects; }
+
+    // package.json's or Cargo.toml's name, the path otherwise
+    std::string_view name(uint32_t project) const { return m_graph.version(project); }
+
+    // The innermost project file (relative to the root) is in, DepGraph::NONE
+    // if it isn't in any
+    uint32_t ownerOf(std::string_view file) const;
+
+    // The projects depending directly on project
+    std::span<const uint32_t> dependents(uint32_t project) const { return m_graph.deps(project); }
+
+    // seeds and every project depending on one of them, directly or not,
+    // sorted so that a project comes after its dependencies
+    std::vector<uint32_t> withDependents(const std::vector<uint32_t>& seeds) const;
+
+private:
+    std::vector<project_t> m_projects;  // sorted by path
+    // Node n is m_projects[n], named after its path with its package name as
+    // version, and its edges go to the projects depending on it
+    DepGraph                                  m_graph;
+    std::unordered_map<std::string, uint32_t> m_by_path;
+};
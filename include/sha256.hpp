@@ -0,0 +1,28 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// SHA-256 (FIPS 180-4), the digest function of Bazel's remote cache
+class Sha256
+{
+public:
+    using digest_t = std::array<uint8_t, 32>;
+
+    Sha256();
+
+    void     update(const void* data, size_t len);
+    digest_t finish();
+
+    static std::string hex(const digest_t& digest);
+
+private:
+    std::array<uint32_t, 8> m_state;
+    std::array<uint8_t, 64> m_block;
+    size_t                  m_used  = 0;
+    uint64_t                m_bytes = 0;
+
+    void compress(const uint8_t* block);
+};
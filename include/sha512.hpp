@@ -0,0 +1,33 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// SHA-512 (FIPS 180-4), the hash npm uses for its "sha512-<base64>" integrity
+class Sha512
+{
+public:
+    using digest_t = std::array<uint8_t, 64>;
+
+    Sha512();
+
+    void     update(const void* data, size_t len);
+    digest_t finish();
+
+    static std::string hex(const digest_t& digest);
+    static std::string base64(const digest_t& digest);
+
+private:
+    std::array<uint64_t, 8>  m_state;
+    std::array<uint8_t, 128> m_block;
+    size_t                   m_used  = 0;
+    uint64_t                 m_bytes = 0;
+
+    void compress(const uint8_t* block);
+};
+
+// Hex digest of a "sha512-<base64>" integrity string, empty if it isn't one
+std::string integrity_to_hex(std::string_view integrity);
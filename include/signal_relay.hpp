@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+// While it lives, SIGINT and SIGTERM don't kill ulpm but get passed on to
+// the process groups added to it. Commands are started in groups of their
+// own, so a Ctrl-C in the terminal only reaches ulpm, which has to hand it
+// on and wait for them. on_signal then runs on a thread of the relay.
+// Only one relay may be installed at a time, and none on Windows.
+class SignalRelay
+{
+public:
+    explicit SignalRelay(std::function<void(int sig)> on_signal = nullptr);
+    // Restores the handlers it replaced
+    ~SignalRelay();
+
+    SignalRelay(const SignalRelay&)            = delete;
+    SignalRelay& operator=(const SignalRelay&) = delete;
+
+    // Process groups (the pid of their leader) signals are passed on to
+    static void add(int pgid);
+    static void remove(int pgid);
+
+    // The first signal received, 0 if none was
+    int received() const { return m_received; }
+
+    // Dies of sig the way ulpm would have without a relay, for the shell to
+    // see it was interrupted
+    [[noreturn]] static void reraise(int sig);
+
+private:
+    std::function<void(int sig)> m_on_signal;
+    std::atomic<int>             m_received = 0;
+    int                          m_pipe[2]  = { -1, -1 };
+    std::thread                  m_thread;
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "cache_backend.hpp"
+
+// What a cached command reads and writes, from its entry in the "cache"
+// object of ulpm.json. Paths are relative to the project.
+struct cache_spec_t
+{
+    std::vector<std::string> inputs;   // files, directories or globs, every file if empty
+    std::vector<std::string> outputs;  // files or directories, restored on a hit
+};
+
+// Outputs of ulpm commands, saved after a successful run and restored
+// instead of running the command again when neither its command line nor
+// its inputs changed since.
+// The outputs are packed into a deterministic archive (see archive.hpp) kept
+// as a blob of the CAS, and the action cache maps the key of the command to
+// it. A hit is unpacked while it's being downloaded.
+class TaskCache
+{
+public:
+    TaskCache(std::unique_ptr<CacheBackend> backend, cache_spec_t spec);
+
+    CacheBackend& backend() { return *m_backend; }
+
+    // SHA-256 of argv and of the path and hash of every input file, none if
+    // one of them couldn't be read: its content would be left out of the key
+    std::optional<std::string> key(const std::vector<std::string>& argv) const;
+
+    // Puts back the outputs saved under key, false on a miss
+    bool restore(const std::string& key);
+    bool save(const std::string& key);
+
+private:
+    std::unique_ptr<CacheBackend> m_backend;
+    cache_spec_t                  m_spec;
+};
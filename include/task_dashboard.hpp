@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Live view of several concurrently running commands.
+// On a terminal it renders one row per task through TermBox, at a fixed
+// rate no matter how much the children print. Otherwise every output line
+// is forwarded as "[task] line" so logs stay readable.
+class TaskDashboard
+{
+public:
+    enum class State
+    {
+        Queued,
+        Running,
+        Done,
+        Failed,
+        Cancelled  // stopped by ulpm after another one failed or it got interrupted
+    };
+
+    explicit TaskDashboard(bool live = detectLive());
+    ~TaskDashboard();
+
+    // Whether stdout can show the live view (a terminal, or ULPM_HEADLESS)
+    static bool detectLive();
+
+    TaskDashboard(const TaskDashboard&)            = delete;
+    TaskDashboard& operator=(const TaskDashboard&) = delete;
+
+    size_t addTask(const std::string& name);
+    void   setState(size_t id, State state, int exit_status = 0);
+
+    // Called from the output readers, may be called from any thread.
+    void onOutput(size_t id, const char* bytes, size_t n);
+
+    void start();
+    // Draws the last frame, restores the terminal and prints a summary,
+    // including the tasks that never got started.
+    void stop();
+
+    bool isLive() const { return m_live; }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    // ~10 fps is plenty for a progress view
+    static constexpr std::chrono::milliseconds REFRESH_INTERVAL{ 100 };
+    // how much output is kept to show the tail of a failed task
+    static constexpr size_t TAIL_SIZE = 4096;
+
+    struct task_state_t
+    {
+        std::string       name;
+        State             state = State::Queued;
+        int               exit_status = 0;
+        clock::time_point start, end;
+        std::string       partial;  // incomplete line (non-live) or output tail (live)
+        size_t            bytes = 0;
+
+        // false for one cancelled before it was started, it has no duration
+        bool ran() const { return start != clock::time_point{}; }
+    };
+
+    bool                      m_live;
+    std::mutex                m_mutex;
+    std::condition_variable   m_cv;
+    std::vector<task_state_t> m_tasks;
+    std::thread               m_render_thread;
+    std::atomic<bool>         m_running = false;
+    size_t                    m_name_width = 0;
+    size_t                    m_frame      = 0;
+
+    void renderLoop();
+    void drawFrame();
+    void printSummary();
+    void forwardLines(task_state_t& task, std::string_view chunk, bool flush);
+};
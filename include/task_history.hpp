@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// How long tasks took when they last succeeded and how much memory they
+// needed at most, to guess what they'll take next time. Kept in a small
+// binary index, .ulpm/durations.idx of the directory ulpm runs them from:
+// durations as a moving average leaning on the last runs, peak memory as the
+// last one, or less than the previous ones for a while if it went down.
+class TaskHistory
+{
+public:
+    explicit TaskHistory(std::string path);
+
+    // In milliseconds, 0 if it never succeeded
+    uint64_t duration(const std::string& key) const;
+    // In bytes, 0 if unknown
+    uint64_t memory(const std::string& key) const;
+    void     record(const std::string& key, uint64_t ms, uint64_t peak_memory);
+
+    // Writes what was recorded, merged with what other processes did since
+    // it was loaded
+    void save();
+
+private:
+    struct record_t
+    {
+        uint64_t ms;
+        uint64_t runs;
+        uint64_t memory;
+    };
+
+    struct run_t
+    {
+        uint64_t ms, memory;
+    };
+
+    std::string                               m_path;
+    std::unordered_map<std::string, record_t> m_records;
+    std::unordered_map<std::string, run_t>    m_recorded;  // this time, to merge
+
+    static std::unordered_map<std::string, record_t> load(const std::string& path);
+    static void                                      add(record_t& r, const run_t& run);
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cgroup.hpp"
+#include "tiny-process-library/process.hpp"
+
+struct task_t
+{
+    std::string              name;
+    std::vector<std::string> argv;   // exec'd directly when not empty
+    std::string              shell;  // otherwise ran through /bin/sh -c
+    std::unordered_map<std::string, std::string> env;  // the whole environment, inherited if empty
+    std::string                                  cwd;  // the current one if empty
+    std::vector<size_t>                          after;  // tasks it has to wait for, by index
+    std::string                                  key;    // what its duration is remembered by, name if empty
+    cgroup_limits_t                              limits;
+    TinyProcessLib::Priority                     priority;
+};
+
+struct run_options_t
+{
+    size_t                    jobs       = 0;      // how many tasks may run at once, 0 for all of them
+    bool                      keep_going = false;  // keep starting tasks after one failed
+    std::string               history;             // TaskHistory file, durations are neither used nor kept if empty
+    bool                      explain = false;     // print the predicted schedule against the actual one once done
+    uint64_t                  memory  = 0;         // budget for the memory of the running tasks, bytes, 0 for what's available
+    std::chrono::milliseconds grace{ 5000 };       // between asking the tasks to stop and killing them
+    bool                      cgroups = false;     // a cgroup for every task, not only for the ones with limits
+};
+
+// Runs the tasks up to opts.jobs at a time, showing their progress through a
+// TaskDashboard. A task starts once the ones it comes after are over, failed
+// or not. Among the ready ones, the one with the longest chain of work left
+// behind it (itself and what comes after it, from the durations in
+// opts.history) goes first, so the longest tasks don't get left for last.
+// A task is also held back while the peaks the running ones and it reached
+// in the history wouldn't fit in opts.memory together.
+// When some tasks have limits, or opts.cgroups is set, each task runs in a
+// cgroup of its own with its limits where ulpm's cgroup is delegated, see
+// CgroupTree.
+// Unless opts.keep_going is set, no new task is started once one failed, and
+// the process groups of the running ones get SIGTERM, then SIGKILL after
+// opts.grace. SIGINT and SIGTERM sent to ulpm are passed on to them the same
+// way, and ulpm dies of it once they're over.
+// Returns how many of them failed.
+size_t run_tasks(const std::vector<task_t>& tasks, const run_options_t& opts = {});
@@ -1,7 +1,9 @@
 #ifndef _TERMINAL_DISPLAY_HPP_
 #define _TERMINAL_DISPLAY_HPP_
 
+#include <chrono>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -20,15 +22,28 @@
 
 #include "util.hpp"
 
-size_t utf8_len(const std::string& s);
+// Not part of termbox2: emitted by our bracketed paste extractor
+#define TB_KEY_PASTE_START (0xffff - 64)
+#define TB_KEY_PASTE_END   (0xffff - 65)
+
+size_t      utf8_len(const std::string& s);
+std::string codepoint_to_utf8(uint32_t cp);
+
+struct input_event_t
+{
+    struct tb_event ev = {};
+
+    // Whole pasted text, only set when ev.key == TB_KEY_PASTE_START
+    std::string paste;
+};
+
+class HeadlessScreen;
 
 // A similair clone of Adafruit_SSD130 for terminals
 class TerminalDisplay
 {
 public:
-    TerminalDisplay()
-        : m_has_init(false), m_width(0), m_height(0), m_cursor_x(0), m_cursor_y(0), m_fg_col(0), m_bg_col(0)
-    {}
+    TerminalDisplay();
     ~TerminalDisplay();
 
     bool begin();
@@ -47,6 +62,12 @@ public:
     void drawPixel(int x, int y, uint32_t ch);
     void display();
 
+    // Blocks for the next event, then keeps collecting everything that arrives
+    // until the next frame is due, so a burst of keys costs a single redraw.
+    // A bracketed paste is folded into one TB_KEY_PASTE_START event.
+    // Returns an empty vector if polling failed.
+    std::vector<input_event_t> pollInput();
+
     template <typename... Args>
     void print(const std::string_view fmt, Args&&... args)
     {
@@ -56,7 +77,7 @@ public:
         int max_width = 0;
         for (const std::string& line : text_lines)
         {
-            tb_print(m_cursor_x, m_cursor_y++, m_fg_col, m_bg_col, line.c_str());
+            printLine(m_cursor_x, m_cursor_y++, line);
             max_width = std::max<int>(max_width, utf8_len(line));
         }
 
@@ -86,7 +107,7 @@ public:
             int x = (m_width - static_cast<int>(utf8_len(line))) / 2;
             x     = std::max(0, x);
 
-            tb_print(x, current_y++, m_fg_col, m_bg_col, line.c_str());
+            printLine(x, current_y++, line);
             setCursor(x, current_y);
         }
     }
@@ -96,15 +117,30 @@ public:
     int  getCursorX() const { return m_cursor_x; }
     int  getCursorY() const { return m_cursor_y; }
     bool isInit() const { return m_has_init; }
+    bool isHeadless() const { return m_headless != nullptr; }
+
+    // the off-screen backend, nullptr on a real terminal
+    const HeadlessScreen* headless() const { return m_headless.get(); }
 
     int pctX(float p) const { return static_cast<int>(m_width * p); }
     int pctY(float p) const { return static_cast<int>(m_height * p); }
 
-    void hideCursor() { tb_hide_cursor(); }
-    void showCursor(int cx = 0, int cy = 0) { tb_set_cursor(cx, cy); }
-    void showCursor() { tb_set_cursor(m_cursor_x, m_cursor_y); }
+    void hideCursor();
+    void showCursor(int cx, int cy);
+    void showCursor() { showCursor(m_cursor_x, m_cursor_y); }
 
 private:
+    // ~60 fps, more than any terminal emulator will actually show
+    static constexpr std::chrono::milliseconds FRAME_INTERVAL{ 16 };
+    // how long to wait for the rest of a paste before giving up on its end marker
+    static constexpr int PASTE_TIMEOUT_MS = 100;
+
+    std::chrono::steady_clock::time_point m_last_frame;
+    std::unique_ptr<HeadlessScreen>       m_headless;
+
+    void printLine(int x, int y, const std::string& line);
+    int  waitEvent(struct tb_event* ev, int timeout_ms);
+
     bool       m_has_init;
     int        m_width, m_height;
     int        m_cursor_x, m_cursor_y;
@@ -36,9 +36,17 @@ Manage projects across multiple languages with a single universal CLI.
 Commands:
     init                Initialize a new project with interactive prompts.
     set                 Modify settings in ulpm.json and the package manager manifest.
-    install             Install/Add new dependencies.
+    install             Install/Add new dependencies, skipped if the lockfile didn't change.
     build               Build your project.
     run <script>        Run a script using the chosen package manager.
+    deps <query>        Query the dependency graph of the lockfile.
+    du [dirs...]        Show which packages take the most space in node_modules/target.
+    clean [targets...]  Remove installed packages and build artifacts.
+    store <action>      Share npm packages across projects through a global store.
+    projects [root]     List every project under a directory.
+    affected            List the projects changed since a git ref or a snapshot.
+    hash [dir]          Hash every file under a directory.
+    cache <action>      Show statistics of the task cache or evict old entries.
 
 Global options:
     -h, --help          Show this help message
@@ -101,11 +109,39 @@ Examples:
 
 inline constexpr std::string_view ulpm_help_run = (R"(
 Usage: ulpm run [options] <script> [args...]
+       ulpm run -p|-s <script>... [-p|-s <script>...]... [-- args...]
 
 Run a script using the chosen package manager.
+Scripts listed after -p run at once, the ones after -s one after the other,
+and each group starts once the previous one is done. A script name may be a
+glob pattern: '*' doesn't match ':', '**' does. With groups, the options
+below may come after the script names too.
+How long each script or project took is kept in .ulpm/durations.idx: when
+only some can run at once, the ones with the most work left behind them
+(themselves and what has to wait for them) are started first.
+Their peak memory use is kept there too, and a script only starts while the
+peaks of the running ones and its own fit in the memory budget.
 
 Options:
-    -h, --help           Show this help message
+    -h, --help                Show this help message
+    -p, --parallel            Start a group of scripts ran in parallel
+    -s, --sequential          Start a group of scripts ran sequentially
+    -k, --continue-on-error   Keep running the other scripts after one failed,
+                              instead of stopping them
+    -f, --force               ulpm install: install even if the lockfile and the
+                              installed tree didn't change since the last one
+    -a, --affected            Run the command in every project 'ulpm affected'
+                              lists that has a ulpm.json, dependencies first
+        --since <ref>         What --affected compares against (default: HEAD)
+    -n, --no-cache            Run the command even if its outputs are cached
+    -j, --jobs <n>            How many scripts (default: all of a -p group) or
+                              projects (default: one per core) run at once
+        --explain-schedule    Print the predicted schedule against the actual
+                              one once done
+    -m, --memory <size>       Memory budget of the scripts running at once
+                              (default: $ULPM_MEMORY_BUDGET, else MemAvailable)
+        --grace <duration>    How long stopped scripts get between SIGTERM and
+                              SIGKILL (default: 5s)
 
 Examples:
     ulpm run build
@@ -113,5 +149,205 @@ Examples:
 
     ulpm run test -- --watch
         Run the "test" script and pass "--watch" as an extra argument.
+
+    ulpm run -p lint typecheck "test:*" -s build
+        Run "lint", "typecheck" and every "test:" script at once, then "build".
+
+    ulpm run --affected --since main test
+        Run "test" in every project changed since the main branch, and in the
+        projects depending on them.
+
+Caching:
+    A command listed in the "cache" object of ulpm.json isn't ran when the
+    outputs of a previous run with the same arguments and inputs can be
+    restored, from a directory or a Bazel remote cache (HTTP REST):
+        "cache": {
+            "url": "http://cache.local:8080",
+            "commands": {
+                "build": { "inputs": ["src", "package.json"], "outputs": ["dist"] }
+            }
+        }
+    "inputs" are files, directories or globs, every file of the project if
+    left out. $ULPM_CACHE_URL overrides "url", which defaults to
+    ~/.cache/ulpm/tasks. A bazel-remote server needs
+    --disable_http_ac_validation, the action cache entries aren't protobufs.
+    A local cache is pruned once a day, see 'ulpm cache --help'.
+
+Limits:
+    A command listed in the "limits" object of ulpm.json runs in a cgroup v2
+    of its own, with the limits of the cgroup files of the same name, and
+    what it and everything it started used is printed once it's over:
+        "limits": {
+            "build": { "cpu.max": 2, "memory.max": "4G", "io.weight": 50 }
+        }
+    "cpu.max" is a number of CPUs or "<quota> <period>" in microseconds.
+    ulpm's cgroup has to be delegated to the user, with those controllers
+    enabled, e.g. by running it through
+        systemd-run --user --scope -p Delegate=yes ulpm run build
+    Commands without limits only run in cgroups of their own, for what they
+    used to be known exactly, when $ULPM_CGROUPS is set to 1.
+
+Priority:
+    A command listed in the "priority" object of ulpm.json gets the CPUs it
+    may run on, a niceness increment and an I/O scheduling class, without
+    going through taskset(1), nice(1) or ionice(1):
+        "priority": {
+            "test":  { "cpus": "0-3" },
+            "watch": { "nice": 19, "ionice": "idle" }
+        }
+    "cpus" is a list like "0-3,6" or an array of CPU numbers, "ionice" one
+    of "idle", "best-effort" or "realtime", with ":<level>" from 0 to 7.
+
+Pipelines:
+    A command can be an array of command arrays, each one piped into the
+    next like with '|', but without going through a shell:
+        "commands": {
+            "build": [["cargo", "build", "--message-format=json"], ["jq", ".reason"]]
+        }
+    Extra arguments go to the first one. Each one runs in a cgroup of its
+    own if the command has "limits", with them, and fails the command if it
+    fails, the last one failing being reported. One killed by SIGPIPE because
+    the next one stopped reading, like 'yes' in 'yes | head', doesn't fail it.
+)");
+
+inline constexpr std::string_view ulpm_help_deps = (R"(
+Usage: ulpm deps [options] <why <package>|dupes|tree>
+
+Query the dependency graph of the project's lockfile (package-lock.json,
+yarn.lock, pnpm-lock.yaml or Cargo.lock). The graph is cached in .ulpm/ and
+only rebuilt when the lockfile changes.
+
+Queries:
+    why <package>        Show how every installed copy of a package is pulled in
+    dupes                List the packages installed more than once
+    tree                 Print the dependency tree, (*) marks subtrees shown above
+
+Options:
+    -d, --depth <n>      Only print n levels of the tree
+    -h, --help           Show this help message
+)");
+
+inline constexpr std::string_view ulpm_help_du = (R"(
+Usage: ulpm du [options] [dirs...]
+
+Show the disk usage of node_modules or target/ (or the given directories),
+split by the package or crate every file belongs to. Files hard linked more
+than once are only counted once.
+
+Options:
+    -n, --top <n>        How many of the biggest packages to list (default 20)
+    -h, --help           Show this help message
+)");
+
+inline constexpr std::string_view ulpm_help_clean = (R"(
+Usage: ulpm clean [options] [targets...]
+
+Remove installed packages and build artifacts, e.g. node_modules or target/,
+using all cores. Without targets, removes the default ones of the project
+language, see --list.
+
+Options:
+    -b, --background     Move them into .ulpm/trash and return right away,
+                         removing them from a background process
+    -l, --list           List the targets of the project language
+    -h, --help           Show this help message
+)");
+
+inline constexpr std::string_view ulpm_help_store = (R"(
+Usage: ulpm store <action> [args...]
+
+Keep every file of every npm package once, in $XDG_CACHE_HOME/ulpm/store
+(or $ULPM_STORE_DIR), and build node_modules out of it with reflinks or
+hard links instead of copies.
+
+Actions:
+    link                 Build node_modules from package-lock.json, importing
+                         the tarballs npm's cache already has into the store.
+                         Install scripts aren't run.
+    add <tarball...>     Import package tarballs into the store
+    gc                   Remove what no linked project uses anymore
+    path                 Print where the store is
+
+Options:
+    -h, --help           Show this help message
+)");
+
+inline constexpr std::string_view ulpm_help_projects = (R"(
+Usage: ulpm projects [options] [root]
+
+List every directory under root (default: the current one) with a ulpm.json,
+package.json or Cargo.toml. .gitignore and .ulpmignore files are honoured,
+node_modules, target and .git are never looked into.
+What was found is cached in <root>/.ulpm/projects.idx: later runs only walk
+again the directories that changed since.
+
+Options:
+    -r, --rescan         Ignore the cache and walk everything
+    -h, --help           Show this help message
+)");
+
+inline constexpr std::string_view ulpm_help_affected = (R"(
+Usage: ulpm affected [options]
+
+List the projects under the current directory (see 'ulpm projects') with
+files changed since a git ref or a snapshot, then every project depending on
+them through its package.json or Cargo.toml, dependencies first.
+With git, the files changed since <ref> are the ones 'git diff <ref>' shows
+plus the untracked ones. A snapshot records the hash of every file, for trees
+that aren't in git or to compare against the last successful build.
+
+Options:
+    -s, --since <ref>    A git ref, or the name of a snapshot (default: HEAD)
+        --save <name>    Save a snapshot of the tree as <name>, in .ulpm/snapshots
+    -h, --help           Show this help message
+
+Examples:
+    ulpm affected --since origin/main
+        The projects a branch touches.
+
+    ulpm affected --save built && ulpm affected --since built
+        The projects changed since the snapshot called "built".
+)");
+
+inline constexpr std::string_view ulpm_help_hash = (R"(
+Usage: ulpm hash [options] [dir]
+
+Print the hash of the files under dir (default: the current one), the ones
+.gitignore and .ulpmignore exclude left out: the hash of the directory
+itself, computed from the ones of its files as a Merkle tree.
+Files are only read again if their size, mtime, ctime or inode changed since
+the last time, the hashes are cached in <dir>/.ulpm/hashes.idx.
+On Linux they're read through io_uring when available: set ULPM_IO to
+"blocking" to read them with blocking calls instead, or to "uring" to warn if
+it isn't.
+
+Options:
+    -f, --files          Print the hash of every file too
+    -n, --no-cache       Read and hash every file again
+    -h, --help           Show this help message
+)");
+
+inline constexpr std::string_view ulpm_help_cache = (R"(
+Usage: ulpm cache [options] <action>
+
+Look after the local directory the outputs of 'ulpm run' are cached in (see
+'ulpm run --help'). Every ulpm process logs what it reads from and writes to
+it in access.log, which the least recently used entries are evicted by.
+A directory used by ulpm gets pruned automatically once a day, right after
+saving outputs, down to "max_size" and "max_age" of the "cache" object of
+ulpm.json (or $ULPM_CACHE_MAX_SIZE and $ULPM_CACHE_MAX_AGE), 10G and 30d by
+default, 0 for no limit.
+
+Actions:
+    stats                Show the hit rate, the bytes restored and what the
+                         cache holds
+    prune                Evict what's over the limits, waiting for the ulpm
+                         processes using the cache
+    path                 Print where the cache is
+
+Options:
+    -s, --max-size <size>  Size limit for prune, e.g. 500M or 20G
+    -a, --max-age <age>    Age limit for prune since last used, e.g. 12h or 2w
+    -h, --help             Show this help message
 )");
 #endif  // !_TEXTS_HPP_
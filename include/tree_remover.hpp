@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct remove_stats_t
+{
+    uint64_t files = 0, dirs = 0;
+    uint64_t failed = 0;
+    int      error  = 0;  // errno of the first failure
+};
+
+// rm -rf, spread across one thread per core.
+// Every directory is opened with openat() and O_NOFOLLOW relative to the fd
+// of its parent, which stays open until it's empty, so one swapped for a
+// symlink midway can't lead it out of the tree. Files are unlinked relative to
+// that fd as soon as they're read, and a directory is removed once the last of
+// its entries is gone. A missing path isn't an error.
+remove_stats_t remove_tree(const std::string& path);
+
+// Renames path into trash_dir (created if needed), which has to be on the same
+// filesystem. Returns the new path, or an empty string if it couldn't be moved.
+std::string move_aside(const std::string& path, const std::string& trash_dir);
+
+// Removes paths from a detached process at a lower priority, so the caller
+// doesn't have to wait for it. Returns false if it couldn't be started.
+bool remove_in_background(const std::vector<std::string>& paths);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+// Multi-threaded directory walker. Every thread works off its own stack of
+// directories and steals from the others once it runs dry, so a single huge
+// subtree still gets spread across all of them.
+// On Linux entries are read with getdents64() and stat'ed with statx() and
+// AT_STATX_DONT_SYNC, relative to the fd of their directory.
+// Symlinks are reported but never followed.
+class TreeWalker
+{
+public:
+    struct dir_t
+    {
+        std::string path;  // relative to the root, "" for the root itself
+        uint32_t    tag;   // whatever the visitor attached to it, the root's is 0
+    };
+
+    struct entry_t
+    {
+        std::string_view name;  // NUL terminated
+        bool             is_dir = false;
+        int              dir_fd = -1;  // the directory being listed, only valid during the call (-1 on Windows)
+        // only filled when the walker was asked to stat
+        uint64_t dev = 0, ino = 0, nlink = 0;
+        uint64_t size   = 0;  // apparent size
+        uint64_t blocks = 0;  // allocated 512-byte blocks
+    };
+
+    // Called concurrently, with the index of the calling worker thread.
+    // For a directory, returns whether to descend into it, and may set the tag
+    // its own dir_t gets (the parent's by default).
+    using Visitor = std::function<bool(size_t worker, const dir_t& parent, const entry_t& entry, uint32_t& tag)>;
+
+    // threads = 0 for one per core
+    explicit TreeWalker(size_t threads = 0, bool stat = true);
+
+    size_t threads() const { return m_threads; }
+
+    // Returns false if root couldn't be opened
+    bool walk(const std::string& root, const Visitor& visit);
+
+private:
+    size_t m_threads;
+    bool   m_stat;
+};
@@ -25,11 +25,17 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <functional>
 #include <iostream>
+#include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -157,12 +163,59 @@ bool askUserYorN(bool def, const std::string_view fmt, Args&&... args)
 }
 
 bool        hasStart(const std::string_view fullString, const std::string_view start);
+std::string shell_quote(const std::string_view arg);
+// '?' and '*' don't match sep, "**" matches anything
+bool        glob_match(std::string_view pattern, std::string_view str, const char sep);
+// Looks up an executable like execvp() would, in path instead of $PATH.
+// Returns an empty string if not found.
+std::string find_in_path(const std::string_view name, const std::string_view path);
+// $XDG_CACHE_HOME/ulpm/<name>, or where the platform keeps such caches
+std::string user_cache_dir(const std::string_view name);
+// 1536 -> "1.5 KiB"
+std::string human_size(const uint64_t bytes);
+// "10G" -> 10737418240, false if it isn't a size
+bool        parse_size(const std::string_view str, uint64_t& bytes);
+// "30d" -> 2592000, false if it isn't a duration
+bool        parse_duration(const std::string_view str, int64_t& seconds);
+// path is dir itself or somewhere under it, every path is under ""
+bool        is_under(const std::string_view path, const std::string_view dir);
 int         str_to_enum(const std::unordered_map<std::string, int>& map, const std::string_view name);
 std::string draw_entry_menu(const std::string&              prompt,
                             const std::vector<std::string>& entries,
                             const std::string&              default_option);
 std::string draw_input_menu(const std::string& prompt, const std::string& default_option);
 
+// Writes path through write(f), into a temporary file renamed over it once
+// complete, so a concurrent reader never sees half of it. Its directory is
+// created if needed. False if write() failed or the file couldn't be written.
+bool atomic_write_file(const std::string& path, const std::function<bool(std::ostream& f)>& write);
+
+// The bytes of v as they are in memory, for the binary files kept in .ulpm/
+template <typename T>
+void write_pod(std::ostream& f, const T& v)
+{
+    f.write(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+// Moves n bytes from the front of data to v, false if there aren't as many
+bool read_bytes(std::string_view& data, void* v, const size_t n);
+
+// Runs f(i) for every i in [0, n), spread across the cores
+template <typename F>
+void parallel_for(const size_t n, F&& f)
+{
+    const size_t             nthreads = std::min<size_t>(n, std::max(1u, std::thread::hardware_concurrency()));
+    std::atomic<size_t>      next     = 0;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < nthreads; ++t)
+        threads.emplace_back([&] {
+            for (size_t i; (i = next++) < n;)
+                f(i);
+        });
+    for (std::thread& t : threads)
+        t.join();
+}
+
 namespace JsonUtils
 {
 
@@ -0,0 +1,39 @@
+#!/bin/sh
+
+# Compares reading files through io_uring against blocking calls, on a tree of
+# 50k small files: ulpm hash --no-cache reads and hashes every one of them.
+# usage: ./scripts/bench_hash.sh [ulpm binary] [tree dir] [runs]
+# Ran as root, the page cache is dropped before every run so the disk is hit.
+
+ULPM=${1-./build/release/ulpm}
+TREE=${2-/tmp/ulpm-bench-50k}
+RUNS=${3-5}
+
+if [ ! -x "$ULPM" ]; then
+    echo "$ULPM not found, build it first with 'make DEBUG=0'"
+    exit 1
+fi
+ULPM=$(realpath "$ULPM")
+
+if [ ! -d "$TREE" ]; then
+    echo "Creating 50000 files in $TREE"
+    for d in $(seq 0 99); do
+        mkdir -p "$TREE/d$d"
+        for f in $(seq 0 499); do
+            head -c $((f * 37 % 4000 + 100)) /dev/urandom > "$TREE/d$d/f$f.txt"
+        done
+    done
+fi
+
+cd "$TREE" || exit 1
+for mode in blocking uring; do
+    total=0
+    for run in $(seq 1 "$RUNS"); do
+        [ "$(id -u)" = 0 ] && sync && echo 3 > /proc/sys/vm/drop_caches
+        start=$(date +%s%N)
+        ULPM_IO=$mode "$ULPM" hash --no-cache . > /dev/null || exit 1
+        end=$(date +%s%N)
+        total=$((total + (end - start) / 1000000))
+    done
+    echo "$mode: $((total / RUNS))ms on average over $RUNS runs"
+done
@@ -0,0 +1,65 @@
+#!/bin/sh
+
+# Drives the menus through the headless backend with build/*/menu_driver:
+# checks the frames of a search and a text input against what they should
+# show, then scrolls a menu of 10k synthetic entries one keystroke at a time
+# and prints what it cost, in frames, bytes, allocations and time per frame.
+# usage: ./scripts/bench_menu.sh [menu_driver binary] [entries] [keystrokes]
+
+DRIVER=${1-./build/debug/menu_driver}
+ENTRIES=${2-10000}
+KEYS=${3-1000}
+
+if [ ! -x "$DRIVER" ]; then
+    echo "$DRIVER not found, build it first with 'make menu-driver'"
+    exit 1
+fi
+DRIVER=$(realpath "$DRIVER")
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT INT TERM
+cd "$DIR" || exit 1
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+# the last frame of the snapshots file, without its header
+last_frame() {
+    awk '/^--- frame/ { frame = ""; next } { frame = frame $0 "\n" } END { printf "%s", frame }' snapshots
+}
+
+drive() {
+    rm -f snapshots
+    ULPM_HEADLESS=120x40 ULPM_HEADLESS_KEYS=keys ULPM_HEADLESS_SNAPSHOTS=snapshots \
+        "$DRIVER" "$@" 2>&1 | grep -v '\[DEBUG\]' > out
+}
+
+# a search narrows the list down to 10 entries, then the third one is picked
+printf 'package-0999\n\033[B\n\033[B\n\033[B\n\r\n' > keys
+drive entry "$ENTRIES"
+grep -q '^result: package-09992$' out || fail "wrong entry picked: $(cat out)"
+sed -n '2,/^--- frame/p' snapshots | grep -q 'package-00000' || fail "the first frame doesn't list the first entry"
+last_frame | grep -q 'Search: package-0999' || fail "the query isn't shown: $(last_frame)"
+[ "$(last_frame | grep -c 'package-0999[0-9]')" -eq 10 ] || fail "the search didn't narrow the list: $(last_frame)"
+last_frame | grep -q 'package-00000' && fail "entries not matching the query are still shown"
+# the query is typed in one burst, so it costs one frame and not 12
+grep -q '^frames: 5 ' out || fail "the keystrokes of a burst weren't drawn at once: $(cat out)"
+echo "ok: entry menu frames"
+
+# typing, moving the cursor back and deleting the character before it
+printf 'world\n\033[D\033[D\n\177\n\r\n' > keys
+drive input "hello "
+grep -q '^result: hello wold$' out || fail "wrong input: $(cat out)"
+last_frame | grep -q 'hello wold' || fail "the input isn't shown: $(last_frame)"
+echo "ok: input menu frames"
+
+# every keystroke on its own, as a user scrolling through the list
+printf '\033[B\n' > keys
+for _ in $(seq 2 "$KEYS"); do
+    printf '\033[B\n'
+done >> keys
+rm -f snapshots
+ULPM_HEADLESS=120x40 ULPM_HEADLESS_KEYS=keys "$DRIVER" entry "$ENTRIES" 2>&1 | grep '^frames:' > out
+echo "scrolling $ENTRIES entries with $KEYS keystrokes: $(cat out)"
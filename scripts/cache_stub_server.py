@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+
+# In-memory stand-in for a Bazel remote cache speaking HTTP/1.1 REST, to try
+# ulpm's cache against without setting up bazel-remote:
+#     ./scripts/cache_stub_server.py 8080 &
+#     ULPM_CACHE_URL=http://127.0.0.1:8080 ulpm build
+# GET, HEAD and PUT on /ac/<sha256> and /cas/<sha256>, like the real thing.
+# CAS uploads are checked against their hash, action cache entries aren't
+# (bazel-remote --disable_http_ac_validation).
+# For tests, GET /_keys lists what's stored, one "<ac|cas> <sha256>" per line,
+# and a PUT with "X-Stub-Unchecked: 1" stores a CAS blob whatever its hash,
+# like a corrupted or tampered with cache would serve it.
+
+import hashlib
+import re
+import sys
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+PATH = re.compile(r"^(?:/[^/]+)*/(ac|cas)/([0-9a-f]{64})$")
+store = {}
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def key(self):
+        m = PATH.match(self.path)
+        if not m:
+            self.send_error(400, "expected /ac/<sha256> or /cas/<sha256>")
+            return None
+        return m.group(1), m.group(2)
+
+    def reply(self, code, body=b""):
+        self.send_response(code)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        return body
+
+    def do_HEAD(self):
+        key = self.key()
+        if key:
+            self.reply(200 if key in store else 404)
+
+    def do_GET(self):
+        if self.path == "/_keys":
+            self.wfile.write(self.reply(200, "".join(f"{kind} {h}\n" for kind, h in store).encode()))
+            return
+        key = self.key()
+        if key:
+            body = store.get(key)
+            self.wfile.write(self.reply(200, body) if body is not None else self.reply(404))
+
+    def do_PUT(self):
+        key = self.key()
+        if not key:
+            return
+        length = self.headers.get("Content-Length")
+        if length is None:
+            self.send_error(411)
+            return
+        body = self.rfile.read(int(length))
+        checked = self.headers.get("X-Stub-Unchecked") != "1"
+        if key[0] == "cas" and checked and hashlib.sha256(body).hexdigest() != key[1]:
+            self.reply(400)
+            return
+        store[key] = body
+        self.reply(200)
+
+
+if __name__ == "__main__":
+    port = int(sys.argv[1]) if len(sys.argv) > 1 else 8080
+    print(f"Serving a Bazel HTTP cache stub on 127.0.0.1:{port}")
+    ThreadingHTTPServer(("127.0.0.1", port), Handler).serve_forever()
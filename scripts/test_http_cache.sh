@@ -0,0 +1,84 @@
+#!/bin/sh
+
+# Checks ulpm's HTTP cache backend against scripts/cache_stub_server.py: a
+# cached command runs once, its outputs are restored the second time, and a
+# corrupted CAS blob is refused, the command running again instead.
+# usage: ./scripts/test_http_cache.sh [ulpm binary] [port]
+
+ULPM=${1-./build/debug/ulpm}
+PORT=${2-18080}
+STUB=$(realpath "$(dirname "$0")/cache_stub_server.py")
+URL=http://127.0.0.1:$PORT
+
+if [ ! -x "$ULPM" ]; then
+    echo "$ULPM not found, build it first with 'make'"
+    exit 1
+fi
+ULPM=$(realpath "$ULPM")
+
+DIR=$(mktemp -d)
+python3 "$STUB" "$PORT" > "$DIR/stub.log" 2>&1 &
+STUB_PID=$!
+trap 'kill $STUB_PID 2>/dev/null; rm -rf "$DIR"' EXIT INT TERM
+
+fail() {
+    echo "FAIL: $1"
+    exit 1
+}
+
+# the stub takes a moment to listen
+for _ in $(seq 1 50); do
+    curl -s "$URL/_keys" > /dev/null && break
+    sleep 0.1
+done
+
+cd "$DIR" || exit 1
+cat > ulpm.json << EOF
+{
+    "project": { "name": "cache-test", "language": "javascript", "package_manager": "npm" },
+    "commands": { "build": "sh build.sh" },
+    "javascript": { "main_src": "index.js", "runtime": { "name": "Node.js", "bin": "node" } },
+    "cache": {
+        "url": "$URL",
+        "commands": { "build": { "inputs": ["build.sh", "index.js"], "outputs": ["dist"] } }
+    }
+}
+EOF
+echo '{ "name": "cache-test" }' > package.json
+echo 'console.log("hi")' > index.js
+# counts its runs outside of its outputs
+cat > build.sh << 'EOF'
+echo run >> runs.log
+mkdir -p dist
+cp index.js dist/index.js
+head -c 100000 /dev/urandom > dist/blob
+EOF
+
+runs() { wc -l < runs.log 2>/dev/null || echo 0; }
+
+"$ULPM" build > out1.log 2>&1 || fail "first run failed: $(cat out1.log)"
+[ "$(runs)" -eq 1 ] || fail "the command didn't run the first time"
+curl -s "$URL/_keys" > keys
+grep -q '^cas ' keys || fail "nothing was uploaded to the CAS"
+sum=$(cksum < dist/blob)
+
+rm -rf dist
+"$ULPM" build > out2.log 2>&1 || fail "second run failed: $(cat out2.log)"
+[ "$(runs)" -eq 1 ] || fail "the command ran again instead of being restored: $(cat out2.log)"
+[ "$(cksum < dist/blob)" = "$sum" ] || fail "the restored outputs differ"
+grep -q 'Restored' out2.log || fail "no restore reported: $(cat out2.log)"
+echo "ok: outputs restored from $URL"
+
+# every CAS blob now gets served with a byte of it changed, still a valid
+# archive, only its hash tells
+grep '^cas ' keys | while read -r _ hash; do
+    curl -s "$URL/cas/$hash" > blob
+    printf 'X' | dd of=blob bs=1 seek=$(($(wc -c < blob) / 2)) conv=notrunc 2> /dev/null
+    curl -s -X PUT -H 'X-Stub-Unchecked: 1' --data-binary @blob "$URL/cas/$hash" > /dev/null
+done
+rm -rf dist
+"$ULPM" build > out3.log 2>&1 || fail "third run failed: $(cat out3.log)"
+[ "$(runs)" -eq 2 ] || fail "corrupted outputs were restored: $(cat out3.log)"
+grep -q 'corrupted' out3.log || fail "the corruption wasn't reported: $(cat out3.log)"
+[ "$(cksum < dist/blob)" != "$sum" ] || fail "dist wasn't rebuilt"
+echo "ok: corrupted CAS blob refused, the command ran again"
@@ -0,0 +1,593 @@
+#include "archive.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <thread>
+
+#include "util.hpp"
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static constexpr char     MAGIC[8]      = { 'U', 'L', 'P', 'M', 'A', 'R', '0', '1' };
+static constexpr size_t   FRAME_HEADER  = 8;
+static constexpr size_t   CHUNK_SIZE    = 1 << 20;
+static constexpr uint32_t MAX_PATH_SIZE = 1 << 16;
+
+static constexpr char TYPE_DIR  = 'd';
+static constexpr char TYPE_FILE = 'f';
+static constexpr char TYPE_EXEC = 'x';  // file with the executable bit
+static constexpr char TYPE_LINK = 'l';
+
+static void put_le(std::string& out, uint64_t v, const size_t bytes)
+{
+    for (size_t i = 0; i < bytes; ++i, v >>= 8)
+        out += static_cast<char>(v & 0xff);
+}
+
+static uint64_t get_le(const char* p, const size_t bytes)
+{
+    uint64_t v = 0;
+    for (size_t i = bytes; i-- > 0;)
+        v = (v << 8) | static_cast<unsigned char>(p[i]);
+    return v;
+}
+
+static size_t batch_size()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/*
+ * Packing
+ */
+
+namespace
+{
+
+struct entry_t
+{
+    std::string path;
+    char        type;
+    uint64_t    size;    // of the file
+    std::string target;  // of the symlink
+};
+
+// Cuts what it's given into chunks, deflated and handed to the sink a batch
+// at a time in the background while the next batch fills up
+class ChunkWriter
+{
+public:
+    explicit ChunkWriter(const archive_sink_t& sink) : m_sink(sink), m_chunk(CHUNK_SIZE, '\0')
+    {
+        m_ok = m_sink(MAGIC, sizeof(MAGIC));
+        m_packed += sizeof(MAGIC);
+    }
+
+    ~ChunkWriter()
+    {
+        if (m_pending.valid())
+            m_pending.wait();
+    }
+
+    bool     ok() const { return m_ok; }
+    uint64_t packed() const { return m_packed; }
+
+    void write(const char* data, size_t len)
+    {
+        while (len > 0)
+        {
+            const size_t n = std::min(len, room());
+            std::memcpy(tail(), data, n);
+            advance(n);
+            data += n;
+            len -= n;
+        }
+    }
+
+    // so files get read right into the chunk
+    char*  tail() { return m_chunk.data() + m_used; }
+    size_t room() const { return CHUNK_SIZE - m_used; }
+    void   advance(const size_t n)
+    {
+        m_used += n;
+        if (m_used == CHUNK_SIZE)
+            pushChunk();
+    }
+
+    bool finish()
+    {
+        if (m_used > 0)
+            pushChunk();
+        dispatch();
+        wait();
+        const std::string end(FRAME_HEADER, '\0');
+        m_ok = m_ok && m_sink(end.data(), end.size());
+        m_packed += end.size();
+        return m_ok;
+    }
+
+private:
+    const archive_sink_t&    m_sink;
+    std::string              m_chunk;
+    size_t                   m_used = 0;
+    std::vector<std::string> m_batch;
+    std::future<bool>        m_pending;
+    bool                     m_ok     = true;
+    uint64_t                 m_packed = 0;
+
+    void pushChunk()
+    {
+        m_chunk.resize(m_used);
+        m_batch.push_back(std::move(m_chunk));
+        m_chunk.assign(CHUNK_SIZE, '\0');
+        m_used = 0;
+        if (m_batch.size() == batch_size())
+            dispatch();
+    }
+
+    void wait()
+    {
+        if (m_pending.valid())
+            m_ok = m_pending.get() && m_ok;
+    }
+
+    void dispatch()
+    {
+        wait();
+        if (m_batch.empty() || !m_ok)
+        {
+            m_batch.clear();
+            return;
+        }
+        m_pending = std::async(std::launch::async, [this, batch = std::move(m_batch)] { return emit(batch); });
+        m_batch.clear();
+    }
+
+    bool emit(const std::vector<std::string>& batch)
+    {
+        std::vector<std::string> frames(batch.size());
+        parallel_for(batch.size(), [&](const size_t i) {
+            const std::string& raw   = batch[i];
+            std::string&       frame = frames[i];
+            uLongf             size  = compressBound(raw.size());
+            frame.resize(FRAME_HEADER + size);
+            if (compress2(reinterpret_cast<Bytef*>(frame.data() + FRAME_HEADER),
+                          &size,
+                          reinterpret_cast<const Bytef*>(raw.data()),
+                          raw.size(),
+                          Z_BEST_SPEED) != Z_OK ||
+                size >= raw.size())
+            {
+                frame.resize(FRAME_HEADER);
+                frame += raw;
+                size = raw.size();
+            }
+            frame.resize(FRAME_HEADER + size);
+
+            std::string header;
+            put_le(header, raw.size(), 4);
+            put_le(header, size, 4);
+            std::memcpy(frame.data(), header.data(), FRAME_HEADER);
+        });
+
+        for (const std::string& frame : frames)
+        {
+            if (!m_sink(frame.data(), frame.size()))
+                return false;
+            m_packed += frame.size();
+        }
+        return true;
+    }
+};
+
+}  // namespace
+
+static bool collect(const fs::path& path, std::vector<entry_t>& entries)
+{
+    std::error_code       ec;
+    const fs::file_status st = fs::symlink_status(path, ec);
+    if (ec)
+    {
+        warn("Failed to stat {}: {}", path.string(), ec.message());
+        return false;
+    }
+
+    entry_t entry{ path.lexically_normal().generic_string(), 0, 0, {} };
+    switch (st.type())
+    {
+        case fs::file_type::directory: entry.type = TYPE_DIR; break;
+        case fs::file_type::symlink:
+            entry.type   = TYPE_LINK;
+            entry.target = fs::read_symlink(path, ec).generic_string();
+            break;
+        case fs::file_type::regular:
+            entry.type = (st.permissions() & fs::perms::owner_exec) != fs::perms::none ? TYPE_EXEC : TYPE_FILE;
+            entry.size = fs::file_size(path, ec);
+            break;
+        default: return true;  // sockets, fifos and the like mean nothing once restored
+    }
+    if (ec)
+    {
+        warn("Failed to read {}: {}", path.string(), ec.message());
+        return false;
+    }
+    entries.push_back(std::move(entry));
+
+    if (st.type() == fs::file_type::directory)
+        for (const fs::directory_entry& child : fs::directory_iterator(path, ec))
+            if (!collect(child.path(), entries))
+                return false;
+    if (ec)
+    {
+        warn("Failed to list {}: {}", path.string(), ec.message());
+        return false;
+    }
+    return true;
+}
+
+bool pack_archive(const std::vector<std::string>& paths, const archive_sink_t& sink, archive_stats_t* stats)
+{
+    std::vector<entry_t> entries;
+    for (const std::string& path : paths)
+        if (!collect(path, entries))
+            return false;
+    std::sort(entries.begin(), entries.end(), [](const entry_t& a, const entry_t& b) { return a.path < b.path; });
+    entries.erase(std::unique(entries.begin(),
+                              entries.end(),
+                              [](const entry_t& a, const entry_t& b) { return a.path == b.path; }),
+                  entries.end());
+
+    archive_stats_t st;
+    ChunkWriter     out(sink);
+    std::string     header;
+    for (const entry_t& entry : entries)
+    {
+        const uint64_t size = entry.type == TYPE_LINK ? entry.target.size() : entry.size;
+        header.clear();
+        header += entry.type;
+        put_le(header, entry.path.size(), 4);
+        header += entry.path;
+        put_le(header, size, 8);
+        out.write(header.data(), header.size());
+
+        switch (entry.type)
+        {
+            case TYPE_DIR:  ++st.dirs; continue;
+            case TYPE_LINK:
+                ++st.links;
+                out.write(entry.target.data(), entry.target.size());
+                continue;
+        }
+
+        std::FILE* f = std::fopen(entry.path.c_str(), "rb");
+        if (!f)
+        {
+            warn("Failed to open {}: {}", entry.path, strerror(errno));
+            return false;
+        }
+        // the size is already written, so it's read no further even if it grew
+        uint64_t left = size;
+        while (left > 0 && out.ok())
+        {
+            const size_t n = std::fread(out.tail(), 1, std::min<uint64_t>(left, out.room()), f);
+            if (n == 0)
+                break;
+            out.advance(n);
+            left -= n;
+        }
+        std::fclose(f);
+        if (left > 0 && out.ok())
+        {
+            warn("{} changed while being packed", entry.path);
+            return false;
+        }
+        ++st.files;
+        st.bytes += size;
+    }
+
+    const bool ok = out.finish();
+    st.packed     = out.packed();
+    if (stats)
+        *stats = st;
+    return ok;
+}
+
+/*
+ * ArchiveExtractor
+ */
+
+// relative, and without any . or .. that could take it out of the directory
+static bool safe_path(const std::string& path)
+{
+    if (path.empty() || path.front() == '/' || path.find_first_of("\\:") != path.npos)
+        return false;
+    for (const std::string& part : split(path, '/'))
+        if (part.empty() || part == "." || part == "..")
+            return false;
+    return true;
+}
+
+// Creates the directories of rel under root, failing with ENOTDIR rather
+// than going through anything in the way that isn't a directory of its own
+static bool make_dirs(const std::string& root, const std::string& rel)
+{
+    std::error_code ec;
+    fs::create_directories(root, ec);
+    if (ec)
+    {
+        errno = ec.value();
+        return false;
+    }
+#ifndef _WIN32
+    std::string path = root;
+    for (const std::string& part : split(rel, '/'))
+    {
+        path += '/' + part;
+        struct stat st;
+        if (mkdir(path.c_str(), 0777) != 0 && (errno != EEXIST || lstat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)))
+        {
+            if (errno == EEXIST)
+                errno = ENOTDIR;
+            return false;
+        }
+    }
+    return true;
+#else
+    fs::create_directories(root + '/' + rel, ec);
+    errno = ec.value();
+    return !ec;
+#endif
+}
+
+// Creates a file that mustn't exist yet, and never through a symlink
+static std::FILE* create_file(const std::string& path, const bool exec)
+{
+#ifndef _WIN32
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, exec ? 0777 : 0666);
+    if (fd < 0)
+        return nullptr;
+    std::FILE* f = fdopen(fd, "wb");
+    if (!f)
+        close(fd);
+    return f;
+#else
+    (void)exec;
+    return std::fopen(path.c_str(), "wbx");
+#endif
+}
+
+static std::string parent_of(const std::string& path)
+{
+    const size_t slash = path.rfind('/');
+    return slash == path.npos ? "" : path.substr(0, slash);
+}
+
+ArchiveExtractor::ArchiveExtractor(std::string dir) : m_dir(std::move(dir)) {}
+
+ArchiveExtractor::~ArchiveExtractor()
+{
+    if (m_file)
+        std::fclose(m_file);
+}
+
+bool ArchiveExtractor::fail(std::string error)
+{
+    if (m_error.empty())
+        m_error = std::move(error);
+    return false;
+}
+
+bool ArchiveExtractor::feed(const char* data, size_t len)
+{
+    if (!m_error.empty())
+        return false;
+    if (m_end)
+        return len == 0 || fail("data after the end of the archive");
+    m_stats.packed += len;
+    m_in.append(data, len);
+
+    size_t off = 0;
+    if (!m_magic)
+    {
+        if (m_in.size() < sizeof(MAGIC))
+            return true;
+        if (std::memcmp(m_in.data(), MAGIC, sizeof(MAGIC)) != 0)
+            return fail("not an ulpm archive");
+        m_magic = true;
+        off     = sizeof(MAGIC);
+    }
+
+    while (m_in.size() - off >= FRAME_HEADER)
+    {
+        const uint32_t raw_size    = get_le(m_in.data() + off, 4);
+        const uint32_t packed_size = get_le(m_in.data() + off + 4, 4);
+        if (raw_size == 0)
+        {
+            m_end = true;
+            off += FRAME_HEADER;
+            if (off != m_in.size())
+                return fail("data after the end of the archive");
+            break;
+        }
+        if (raw_size > CHUNK_SIZE || packed_size > raw_size)
+            return fail("corrupted frame");
+        if (m_in.size() - off < FRAME_HEADER + packed_size)
+            break;
+
+        m_frames.push_back({ raw_size, m_in.substr(off + FRAME_HEADER, packed_size) });
+        off += FRAME_HEADER + packed_size;
+        if (m_frames.size() == batch_size() && !inflateFrames())
+            return false;
+    }
+    m_in.erase(0, off);
+    return !m_end || inflateFrames();
+}
+
+bool ArchiveExtractor::finish()
+{
+    if (!m_error.empty() || !inflateFrames())
+        return false;
+    if (!m_end || m_type != 0 || !m_header.empty())
+        return fail("truncated archive");
+    return true;
+}
+
+bool ArchiveExtractor::inflateFrames()
+{
+    std::vector<std::string> raw(m_frames.size());
+    std::vector<char>        ok(m_frames.size(), 1);
+    parallel_for(m_frames.size(), [&](const size_t i) {
+        frame_t& frame = m_frames[i];
+        if (frame.data.size() == frame.raw_size)
+        {
+            raw[i] = std::move(frame.data);
+            return;
+        }
+        uLongf size = frame.raw_size;
+        raw[i].resize(size);
+        ok[i] = uncompress(reinterpret_cast<Bytef*>(raw[i].data()),
+                           &size,
+                           reinterpret_cast<const Bytef*>(frame.data.data()),
+                           frame.data.size()) == Z_OK &&
+                size == frame.raw_size;
+    });
+    m_frames.clear();
+
+    for (size_t i = 0; i < raw.size(); ++i)
+    {
+        if (!ok[i])
+            return fail("corrupted frame");
+        if (!unpack(raw[i].data(), raw[i].size()))
+            return false;
+    }
+    return true;
+}
+
+bool ArchiveExtractor::unpack(const char* data, size_t len)
+{
+    while (len > 0)
+    {
+        if (m_type == 0)
+        {
+            size_t need = 5;
+            if (m_header.size() >= need)
+                need += get_le(m_header.data() + 1, 4) + 8;
+            const size_t n = std::min(len, need - m_header.size());
+            m_header.append(data, n);
+            data += n;
+            len -= n;
+
+            if (m_header.size() == 5)
+            {
+                if (get_le(m_header.data() + 1, 4) > MAX_PATH_SIZE)
+                    return fail("corrupted entry");
+                continue;
+            }
+            if (m_header.size() == need && !beginEntry())
+                return false;
+            continue;
+        }
+
+        const size_t n = std::min<uint64_t>(len, m_left);
+        if (m_type == TYPE_LINK)
+            m_target.append(data, n);
+        else if (std::fwrite(data, 1, n, m_file) != n)
+            return fail(fmt::format("failed to write {}: {}", m_path, strerror(errno)));
+        data += n;
+        len -= n;
+        m_left -= n;
+        if (m_left == 0 && !endEntry())
+            return false;
+    }
+    return true;
+}
+
+bool ArchiveExtractor::beginEntry()
+{
+    const uint32_t    path_size = get_le(m_header.data() + 1, 4);
+    const std::string path      = m_header.substr(5, path_size);
+    m_type                      = m_header[0];
+    m_left                      = get_le(m_header.data() + 5 + path_size, 8);
+    m_header.clear();
+
+    if (!safe_path(path))
+        return fail(fmt::format("unsafe path '{}'", path));
+    // nor through a symlink it brought along, or onto one
+    for (size_t i = path.find('/'); i != path.npos; i = path.find('/', i + 1))
+        if (m_links.count(path.substr(0, i)))
+            return fail(fmt::format("unsafe path '{}'", path));
+    if (!m_paths.insert(path).second)
+        return fail(fmt::format("duplicate path '{}'", path));
+    m_path = m_dir + '/' + path;
+
+    switch (m_type)
+    {
+        case TYPE_DIR:
+            if (m_left != 0)
+                return fail("corrupted entry");
+            if (!make_dirs(m_dir, path))
+                return fail(fmt::format("failed to create {}: {}", m_path, strerror(errno)));
+            ++m_stats.dirs;
+            break;
+
+        case TYPE_LINK:
+            if (m_left > MAX_PATH_SIZE)
+                return fail("corrupted entry");
+            m_target.clear();
+            m_links.insert(path);
+            break;
+
+        case TYPE_FILE:
+        case TYPE_EXEC:
+            // its directory may not be part of the archive
+            if (make_dirs(m_dir, parent_of(path)))
+                m_file = create_file(m_path, m_type == TYPE_EXEC);
+            if (!m_file)
+                return fail(fmt::format("failed to create {}: {}", m_path, strerror(errno)));
+            m_stats.bytes += m_left;
+            break;
+
+        default: return fail("corrupted entry");
+    }
+    return m_left > 0 || endEntry();
+}
+
+bool ArchiveExtractor::endEntry()
+{
+    std::error_code ec;
+    switch (m_type)
+    {
+        case TYPE_LINK:
+            if (!make_dirs(m_dir, parent_of(m_path.substr(m_dir.size() + 1))))
+                return fail(fmt::format("failed to create {}: {}", m_path, strerror(errno)));
+            fs::create_symlink(m_target, m_path, ec);
+            if (ec)
+                return fail(fmt::format("failed to create {}: {}", m_path, ec.message()));
+            ++m_stats.links;
+            break;
+
+        case TYPE_FILE:
+        case TYPE_EXEC:
+        {
+            const bool ok = std::fclose(m_file) == 0;
+            m_file        = nullptr;
+            if (!ok)
+                return fail(fmt::format("failed to write {}: {}", m_path, strerror(errno)));
+            ++m_stats.files;
+            break;
+        }
+    }
+    m_type = 0;
+    return true;
+}
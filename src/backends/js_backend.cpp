@@ -1,13 +1,24 @@
+#define RAPIDJSON_HAS_STDSTRING 1
 #include "backends/js_backend.hpp"
 
+#include <algorithm>
 #include <filesystem>
+#include <utility>
 #include <vector>
 
+#include "fmt/ranges.h"
 #include "rapidjson/document.h"
+#include "signal_relay.hpp"
+#include "tiny-process-library/process.hpp"
 #include "util.hpp"
 
+#ifndef _WIN32
+extern char** environ;
+#endif
+
 namespace fs = std::filesystem;
 using namespace JsonUtils;
+using TinyProcessLib::Process;
 
 void JsBackend::load(const rapidjson::Document& doc)
 {
@@ -125,3 +136,294 @@ bool JsBackend::syncPkgManifest(const manifest_settings_t& /*common*/, const man
 
     return dirty;
 }
+
+#ifndef _WIN32
+// Characters that never mean anything special to /bin/sh
+static constexpr std::string_view SHELL_SAFE_CHARS =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 _-./:=@%+,";
+
+// Where name resolves to in path, symlinks followed: the npm, yarn or pnpm
+// on PATH are links to their JS entry point
+static std::string resolve_exe(const std::string& name, const std::string& path)
+{
+    const std::string exe = find_in_path(name, path);
+    if (exe.empty())
+        return {};
+    std::error_code ec;
+    const fs::path  real = fs::canonical(exe, ec);
+    return ec ? exe : real.string();
+}
+
+static Process::environment_type script_env(const rapidjson::Document& pkg, const std::string& pm)
+{
+    Process::environment_type env;
+    for (char** e = environ; *e; ++e)
+    {
+        const std::string_view kv(*e);
+        const size_t           eq = kv.find('=');
+        if (eq != kv.npos)
+            env.emplace(kv.substr(0, eq), kv.substr(eq + 1));
+    }
+
+    // like npm, node_modules/.bin of the project and of every parent directory, closest first
+    // an empty entry would be the cwd, so no trailing ':' without a PATH to append
+    const std::string inherited = env["PATH"];
+    std::string       path;
+    for (fs::path dir = fs::current_path();; dir = dir.parent_path())
+    {
+        if (!path.empty())
+            path += ':';
+        path += (dir / "node_modules" / ".bin").string();
+        if (dir == dir.parent_path())
+            break;
+    }
+    env["PATH"] = inherited.empty() ? path : path + ":" + inherited;
+
+    // for scripts running the package manager or node again the way it would
+    // have been, like "npm run build" in a prepublish script
+    if (const std::string exe = resolve_exe(pm, inherited); !exe.empty())
+        env["npm_execpath"] = exe;
+    if (const std::string node = resolve_exe("node", inherited); !node.empty())
+        env["npm_node_execpath"] = node;
+
+    env["INIT_CWD"]              = fs::current_path().string();
+    env["npm_package_json"]      = fs::absolute("package.json").string();
+    env["npm_config_user_agent"] = "ulpm/" VERSION;
+    if (pkg.HasMember("name") && pkg["name"].IsString())
+        env["npm_package_name"] = pkg["name"].GetString();
+    if (pkg.HasMember("version") && pkg["version"].IsString())
+        env["npm_package_version"] = pkg["version"].GetString();
+
+    return env;
+}
+
+// Scripts that are a plain command line get exec'd without /bin/sh in between.
+// execvpe() would look them up in our own PATH, not env's, so resolve it here.
+static std::vector<std::string> split_plain_command(const std::string& script, const std::string& path)
+{
+    if (script.find_first_not_of(SHELL_SAFE_CHARS) != script.npos)
+        return {};
+
+    std::vector<std::string> argv;
+    for (const std::string& word : split(script, ' '))
+        if (!word.empty())
+            argv.push_back(word);
+    if (argv.empty() || argv[0].find('=') != argv[0].npos)  // VAR=value cmd
+        return {};
+
+    argv[0] = find_in_path(argv[0], path);
+    if (argv[0].empty())
+        return {};
+    return argv;
+}
+
+struct script_plan_t
+{
+    std::string                                      name;
+    std::vector<std::pair<std::string, std::string>> stages;  // pre<name>, <name>, post<name>
+    std::vector<std::string>                         args;
+    Process::environment_type                        env;
+};
+
+// Works out what "<pm> run <script> [args]" runs, if it can be done without the package manager
+static std::optional<script_plan_t> plan_script(const std::vector<std::string>& argv,
+                                                const std::vector<std::string>& pms)
+{
+    if (argv.size() < 3 || (argv[1] != "run" && argv[1] != "run-script") ||
+        std::find(pms.begin(), pms.end(), argv[0]) == pms.end())
+        return std::nullopt;
+
+    // .npmrc can change how scripts run (script-shell, node-options, ...)
+    if (!fs::exists("package.json") || fs::exists(".npmrc"))
+        return std::nullopt;
+
+    FileHandler         f;
+    rapidjson::Document doc;
+    f.open("package.json", "r");
+    populate_doc(f, doc);
+
+    if (!doc.IsObject() || !doc.HasMember("scripts") || !doc["scripts"].IsObject())
+        return std::nullopt;
+
+    const rapidjson::Value& scripts = doc["scripts"];
+    auto                    script  = [&](const std::string& key) -> std::string {
+        return scripts.HasMember(key) && scripts[key].IsString() ? scripts[key].GetString() : "";
+    };
+
+    script_plan_t plan;
+    plan.name = argv[2];
+
+    // unknown scripts are left for the package manager to report
+    if (script(plan.name).empty())
+        return std::nullopt;
+
+    // pnpm doesn't run pre/post scripts by default since v7
+    const bool hooks = argv[0] != "pnpm";
+    if (hooks && !script("pre" + plan.name).empty())
+        plan.stages.emplace_back("pre" + plan.name, script("pre" + plan.name));
+    plan.stages.emplace_back(plan.name, script(plan.name));
+    if (hooks && !script("post" + plan.name).empty())
+        plan.stages.emplace_back("post" + plan.name, script("post" + plan.name));
+
+    for (const auto& [stage, body] : plan.stages)
+        if (body.find("npm_config_") != body.npos || body.find("npm_package_config_") != body.npos)
+            return std::nullopt;
+
+    plan.args.assign(argv.begin() + 3, argv.end());
+    if (!plan.args.empty() && plan.args.front() == "--")
+        plan.args.erase(plan.args.begin());
+
+    plan.env = script_env(doc, argv[0]);
+    return plan;
+}
+
+// like the package manager, arguments only go to the script itself
+static task_t stage_task(const script_plan_t& plan, const std::string& stage, const std::string& body)
+{
+    task_t task;
+    task.name = stage;
+    task.env  = plan.env;
+    task.argv = split_plain_command(body, task.env["PATH"]);
+    if (!task.argv.empty())
+    {
+        if (stage == plan.name)
+            task.argv.insert(task.argv.end(), plan.args.begin(), plan.args.end());
+    }
+    else
+    {
+        task.shell = body;
+        if (stage == plan.name)
+            for (const std::string& arg : plan.args)
+                task.shell += " " + shell_quote(arg);
+    }
+
+    task.env["npm_lifecycle_event"]  = stage;
+    task.env["npm_lifecycle_script"] = body;
+    return task;
+}
+#endif
+
+std::optional<int> JsBackend::runNative(const std::vector<std::string>& argv, const TinyProcessLib::Config& config)
+{
+#ifdef _WIN32
+    // scripts are ran through cmd.exe there, leave it to the package manager
+    return std::nullopt;
+#else
+    const std::optional<script_plan_t> plan = plan_script(argv, packageManagers());
+    if (!plan)
+        return std::nullopt;
+
+    for (const auto& [stage, body] : plan->stages)
+    {
+        const task_t task = stage_task(*plan, stage, body);
+
+        int status;
+        if (!task.argv.empty())
+        {
+            debug("Running {} natively: {}", stage, task.argv);
+            Process proc(task.argv, "", task.env, nullptr, nullptr, false, config);
+            if (proc.get_id() > 0)
+                SignalRelay::add(proc.get_id());
+            status = proc.get_exit_status();
+            SignalRelay::remove(proc.get_id());
+        }
+        else
+        {
+            debug("Running {} natively: {}", stage, task.shell);
+            Process proc(task.shell, "", task.env, nullptr, nullptr, false, config);
+            if (proc.get_id() > 0)
+                SignalRelay::add(proc.get_id());
+            status = proc.get_exit_status();
+            SignalRelay::remove(proc.get_id());
+        }
+
+        if (status != 0)
+            return status;
+    }
+
+    return 0;
+#endif
+}
+
+std::optional<task_t> JsBackend::nativeTask(const std::vector<std::string>& argv)
+{
+#ifdef _WIN32
+    return std::nullopt;
+#else
+    const std::optional<script_plan_t> plan = plan_script(argv, packageManagers());
+    if (!plan)
+        return std::nullopt;
+
+    if (plan->stages.size() == 1)
+        return stage_task(*plan, plan->name, plan->stages.front().second);
+
+    // The hooks have to run one after the other within the same task, so
+    // chain them in one shell, each in a subshell with its own lifecycle vars.
+    task_t                   task = stage_task(*plan, plan->name, plan->stages.front().second);
+    std::vector<std::string> chain;
+    for (const auto& [stage, body] : plan->stages)
+    {
+        const task_t step = stage_task(*plan, stage, body);
+        std::string  cmd  = step.shell;
+        if (!step.argv.empty())
+        {
+            std::vector<std::string> quoted;
+            for (const std::string& arg : step.argv)
+                quoted.push_back(shell_quote(arg));
+            cmd = fmt::format("{}", fmt::join(quoted, " "));
+        }
+        chain.push_back(fmt::format("(export npm_lifecycle_event={} npm_lifecycle_script={}; {}\n)",
+                                    shell_quote(stage),
+                                    shell_quote(body),
+                                    cmd));
+    }
+
+    task.name = plan->name;
+    task.argv.clear();
+    task.shell = fmt::format("{}", fmt::join(chain, " && "));
+    return task;
+#endif
+}
+
+std::vector<std::string> JsBackend::scriptNames() const
+{
+    if (!fs::exists("package.json"))
+        return {};
+
+    FileHandler         f;
+    rapidjson::Document doc;
+    f.open("package.json", "r");
+    populate_doc(f, doc);
+
+    if (!doc.IsObject() || !doc.HasMember("scripts") || !doc["scripts"].IsObject())
+        return {};
+    return vec_from_members(doc["scripts"]);
+}
+
+std::vector<std::string> JsBackend::installInputs(const manifest_settings_t& common) const
+{
+    if (common.package_manager == "yarn")
+        return { "package.json", "yarn.lock", ".yarnrc", ".yarnrc.yml", ".npmrc" };
+    if (common.package_manager == "pnpm")
+        return { "package.json", "pnpm-lock.yaml", "pnpm-workspace.yaml", ".npmrc" };
+    return { "package.json", "package-lock.json", "npm-shrinkwrap.json", ".npmrc" };
+}
+
+std::vector<std::string> JsBackend::installMarkers(const manifest_settings_t& common) const
+{
+    if (common.package_manager == "yarn")
+        return { "node_modules/.yarn-state.yml", "node_modules/.yarn-integrity" };
+    if (common.package_manager == "pnpm")
+        return { "node_modules/.modules.yaml" };
+    return { "node_modules/.package-lock.json" };
+}
+
+std::vector<clean_target_t> JsBackend::cleanTargets() const
+{
+    return {
+        { "modules", "node_modules, the installed packages", { "node_modules" }, true },
+        { "cache",
+          "caches of build tools (babel, eslint, parcel, turbo, next)",
+          { "node_modules/.cache", ".eslintcache", ".parcel-cache", ".turbo", ".next/cache" } },
+    };
+}
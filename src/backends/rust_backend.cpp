@@ -108,3 +108,16 @@ bool RustBackend::syncPkgManifest(const manifest_settings_t& /*common*/, const m
     }
     return dirty;
 }
+
+std::vector<clean_target_t> RustBackend::cleanTargets() const
+{
+    return {
+        { "all", "the whole target directory", { "target" }, true },
+        { "debug", "dev profile builds", { "target/debug" } },
+        { "release", "release profile builds", { "target/release" } },
+        { "doc", "cargo doc output", { "target/doc" } },
+        { "incremental",
+          "incremental compilation caches",
+          { "target/debug/incremental", "target/release/incremental" } },
+    };
+}
@@ -0,0 +1,110 @@
+// Drives draw_entry_menu()/draw_input_menu() through the headless backend, for
+// benchmarking the menus and checking their frames without a terminal.
+// Built with `make menu-driver`, see scripts/bench_menu.sh.
+//
+// usage: menu_driver entry [entries]   pick from a list of synthetic entries
+//        menu_driver input [default]   edit a line of text
+//
+// The keystrokes come from ULPM_HEADLESS_KEYS and the frames go to
+// ULPM_HEADLESS_SNAPSHOTS, as for ulpm itself, ULPM_HEADLESS defaults to 120x40.
+// The chosen value is printed, then one line of stats.
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "backend_registry.hpp"
+#include "box.hpp"
+#include "fmt/format.h"
+#include "headless_screen.hpp"
+#include "terminal_display.hpp"
+#include "util.hpp"
+
+// what main.cpp defines for ulpm
+BackendRegistry g_registry;
+TerminalDisplay display;
+TermBox         termbox;
+
+static std::atomic<size_t> g_allocs{ 0 };
+
+void* operator new(size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+int main(int argc, char* argv[])
+{
+    const std::string_view mode = argc > 1 ? argv[1] : "entry";
+    if (mode != "entry" && mode != "input")
+        die("usage: {} entry [entries] | input [default]", argv[0]);
+
+    setenv("ULPM_HEADLESS", "120x40", 0);
+    if (!termbox.begin() || !termbox.headless())
+        die("ULPM_HEADLESS must be set to <width>x<height>");
+
+    std::vector<std::string> entries;
+    if (mode == "entry")
+    {
+        const size_t count = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 10000;
+        entries.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+            entries.push_back(fmt::format("package-{:05}", i));
+    }
+
+    const size_t allocs_before = g_allocs.load();
+    const auto   start         = std::chrono::steady_clock::now();
+
+    const std::string result = mode == "entry" ? draw_entry_menu("Choose a package", entries, "")
+                                               : draw_input_menu("Name", argc > 2 ? argv[2] : "");
+
+    const auto   elapsed = std::chrono::steady_clock::now() - start;
+    const size_t allocs  = g_allocs.load() - allocs_before;
+
+    // copied before shutdown() drops the backend
+    const HeadlessScreen::stats_t st = termbox.headless()->stats();
+    termbox.shutdown();
+
+    const double us = std::chrono::duration<double, std::micro>(elapsed).count();
+    fmt::println("result: {}", result);
+    fmt::println("frames: {} events: {} frames/event: {:.2f} bytes: {} cells: {} allocs: {} us/frame: {:.1f}",
+                 st.frames,
+                 st.events,
+                 st.events ? static_cast<double>(st.frames) / st.events : 0.0,
+                 st.bytes,
+                 st.cells_changed,
+                 allocs,
+                 st.frames ? us / st.frames : 0.0);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,403 @@
+#include "bulk_reader.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "util.hpp"
+
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <linux/io_uring.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#  define HAVE_IO_URING 1
+#elif !defined(_WIN32)
+#  include <fcntl.h>
+#  include <unistd.h>
+#else
+#  include <fstream>
+#endif
+
+bool read_whole_file(const std::string& path, std::string& data, const uint64_t size_hint)
+{
+    data.clear();
+#ifdef _WIN32
+    std::ifstream f(path, std::ios::binary);
+    if (!f)
+        return false;
+    data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    return !f.bad();
+#else
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    // one read more than the size, to see the end of the file
+    data.resize(size_hint + 1);
+    size_t  done = 0;
+    ssize_t n;
+    while ((n = ::read(fd, data.data() + done, data.size() - done)) > 0)
+    {
+        done += n;
+        if (done == data.size())
+            data.resize(data.size() * 2);
+    }
+    close(fd);
+    data.resize(done);
+    return n == 0;
+#endif
+}
+
+BulkReader::Mode BulkReader::defaultMode()
+{
+    const char* env = std::getenv("ULPM_IO");
+    if (env && std::string_view(env) == "uring")
+        return Mode::Uring;
+    if (env && std::string_view(env) == "blocking")
+        return Mode::Blocking;
+    return Mode::Auto;
+}
+
+#ifdef HAVE_IO_URING
+
+// No liburing: the few bits of it needed here, over the raw syscalls
+struct BulkReader::ring_t
+{
+    int    fd = -1;
+    void*  sq_ptr = MAP_FAILED;
+    void*  cq_ptr = MAP_FAILED;
+    size_t sq_len = 0, cq_len = 0;
+
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+
+    io_uring_sqe* sqes     = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t        sqes_len = 0;
+    io_uring_cqe* cqes     = nullptr;
+    unsigned      entries  = 0;
+
+    ~ring_t()
+    {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqes_len);
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+            munmap(cq_ptr, cq_len);
+        if (sq_ptr != MAP_FAILED)
+            munmap(sq_ptr, sq_len);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool setup(const unsigned depth, const unsigned nfiles)
+    {
+        io_uring_params p{};
+        fd = syscall(__NR_io_uring_setup, depth, &p);
+        if (fd < 0)
+            return false;
+        entries = p.sq_entries;
+
+        sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            sq_len = cq_len = std::max(sq_len, cq_len);
+
+        sq_ptr = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED)
+            return false;
+        cq_ptr = (p.features & IORING_FEAT_SINGLE_MMAP)
+                     ? sq_ptr
+                     : mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED)
+            return false;
+        sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+        sqes     = static_cast<io_uring_sqe*>(
+            mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED)
+            return false;
+
+        char* sq = static_cast<char*>(sq_ptr);
+        char* cq = static_cast<char*>(cq_ptr);
+        sq_head  = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        sq_tail  = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask  = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        cq_head  = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail  = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask  = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes     = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+        // Opening into the ring's file table (file_index) came with Linux
+        // 5.15. Older kernels ignore it, the opens would then leak plain fds
+        // and the closes close fd 0. LINKAT came in the same release, the
+        // probe tells those kernels apart.
+        if (!supports({ IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE, IORING_OP_LINKAT }))
+        {
+            errno = ENOSYS;
+            return false;
+        }
+
+        // the files are opened straight into a table of the ring, so the
+        // read and close linked after an open can refer to them
+        std::vector<int> fds(nfiles, -1);
+        return syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, fds.data(), nfiles) == 0;
+    }
+
+    bool supports(const std::initializer_list<unsigned> ops) const
+    {
+        static constexpr unsigned NOPS = 256;
+        std::vector<char>         buf(sizeof(io_uring_probe) + NOPS * sizeof(io_uring_probe_op));
+        io_uring_probe*           probe = reinterpret_cast<io_uring_probe*>(buf.data());
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, NOPS) != 0)
+            return false;
+        return std::all_of(ops.begin(), ops.end(), [probe](const unsigned op) {
+            return op < probe->ops_len && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+        });
+    }
+
+    // Only called with room left: at most `entries` are ever in flight
+    io_uring_sqe* next()
+    {
+        const unsigned tail = *sq_tail;
+        const unsigned idx  = tail & *sq_mask;
+        sq_array[idx]       = idx;
+        io_uring_sqe* sqe   = &sqes[idx];
+        std::memset(sqe, 0, sizeof(*sqe));
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        return sqe;
+    }
+
+    // Queued but not taken by the kernel yet, it may take fewer than asked
+    unsigned unsubmitted() const { return *sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE); }
+
+    int enter(const unsigned submit, const unsigned wait)
+    {
+        int ret;
+        do
+            ret = syscall(__NR_io_uring_enter, fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        while (ret < 0 && errno == EINTR);
+        return ret;
+    }
+};
+
+// The window of files in flight, each one a slot of the registered file table
+static constexpr unsigned URING_FILES = 64;
+// Larger files are read with blocking calls, not worth the buffer
+static constexpr uint64_t URING_MAX_SIZE = 1 << 20;
+
+enum : uint64_t
+{
+    OP_OPEN,
+    OP_READ,
+    OP_CLOSE
+};
+
+BulkReader::BulkReader(const Mode mode)
+{
+    if (mode == Mode::Blocking)
+        return;
+
+    m_ring = new ring_t;
+    if (!m_ring->setup(URING_FILES * 4, URING_FILES))
+    {
+        if (mode == Mode::Uring)
+            warn("io_uring is not available ({}), reading files with blocking calls", strerror(errno));
+        delete m_ring;
+        m_ring = nullptr;
+    }
+}
+
+BulkReader::~BulkReader()
+{
+    delete m_ring;
+}
+
+void BulkReader::readUring(const std::vector<std::string>& paths,
+                           const std::vector<uint64_t>&    sizes,
+                           const callback_t&               f)
+{
+    struct slot_t
+    {
+        size_t      index = 0;
+        std::string buf;
+        int         read_res = 0;
+        int         pending  = 0;  // completions still to come
+        unsigned    first    = 0;  // position of its open in the submission queue
+    };
+
+    ring_t&             ring = *m_ring;
+    std::vector<slot_t> slots(URING_FILES);
+    std::vector<int>    free_slots;
+    for (int i = URING_FILES - 1; i >= 0; --i)
+        free_slots.push_back(i);
+
+    std::vector<size_t> large;
+    size_t              next = 0, in_flight = 0;
+    bool                failed = false;
+
+    // once its three completions are in
+    auto complete = [&](const int slot) {
+        slot_t& s = slots[slot];
+        // read one byte past the stat'ed size, so a file that grew since
+        // gets its result only from the blocking path
+        if (s.read_res >= 0 && static_cast<uint64_t>(s.read_res) <= sizes[s.index])
+        {
+            f(s.index, std::string_view(s.buf.data(), s.read_res), true);
+        }
+        else
+        {
+            std::string data;
+            const bool  ok = read_whole_file(paths[s.index], data, sizes[s.index]);
+            f(s.index, data, ok);
+        }
+        free_slots.push_back(slot);
+        --in_flight;
+    };
+    auto reap = [&] {
+        unsigned       head = *ring.cq_head;
+        const unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            const io_uring_cqe& cqe  = ring.cqes[head & *ring.cq_mask];
+            const int           slot = cqe.user_data >> 2;
+            if ((cqe.user_data & 3) == OP_READ)
+                slots[slot].read_res = cqe.res;
+            if (--slots[slot].pending == 0)
+                complete(slot);
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    };
+
+    while (next < paths.size() || in_flight > 0)
+    {
+        // fill the window: open -> read -> close, hard linked so the close
+        // still runs after a short read or a failed open
+        while (next < paths.size() && !free_slots.empty())
+        {
+            const size_t i = next++;
+            if (sizes[i] > URING_MAX_SIZE)
+            {
+                large.push_back(i);
+                continue;
+            }
+
+            const int slot = free_slots.back();
+            free_slots.pop_back();
+            slot_t& s  = slots[slot];
+            s.index    = i;
+            s.read_res = 0;
+            s.pending  = 3;
+            s.first    = *ring.sq_tail;
+            s.buf.resize(sizes[i] + 1);
+
+            io_uring_sqe* sqe = ring.next();
+            sqe->opcode       = IORING_OP_OPENAT;
+            sqe->fd           = AT_FDCWD;
+            sqe->addr         = reinterpret_cast<uint64_t>(paths[i].c_str());
+            sqe->open_flags   = O_RDONLY;
+            sqe->file_index   = slot + 1;
+            sqe->flags        = IOSQE_IO_HARDLINK;
+            sqe->user_data    = static_cast<uint64_t>(slot) << 2 | OP_OPEN;
+
+            sqe            = ring.next();
+            sqe->opcode    = IORING_OP_READ;
+            sqe->fd        = slot;
+            sqe->addr      = reinterpret_cast<uint64_t>(s.buf.data());
+            sqe->len       = s.buf.size();
+            sqe->off       = 0;
+            sqe->flags     = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+            sqe->user_data = static_cast<uint64_t>(slot) << 2 | OP_READ;
+
+            sqe             = ring.next();
+            sqe->opcode     = IORING_OP_CLOSE;
+            sqe->file_index = slot + 1;
+            sqe->user_data  = static_cast<uint64_t>(slot) << 2 | OP_CLOSE;
+
+            ++in_flight;
+        }
+        if (in_flight == 0)
+            break;
+
+        if (ring.enter(ring.unsubmitted(), 1) >= 0)
+        {
+            reap();
+            continue;
+        }
+
+        // EAGAIN, EBUSY or ENOMEM under load, or a seccomp filter installed
+        // since the setup: the window is finished with blocking calls, and so
+        // is the rest. The requests the kernel didn't take never complete, the
+        // ones it did still write to their buffers and are waited for.
+        warn("io_uring_enter failed ({}), reading files with blocking calls", strerror(errno));
+        const unsigned sq_head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+        for (size_t slot = 0; slot < slots.size(); ++slot)
+        {
+            slot_t&   s       = slots[slot];
+            const int skipped = std::clamp(static_cast<int>(s.first + 3 - sq_head), 0, 3);
+            if (s.pending == 0 || skipped == 0)
+                continue;
+            if (skipped >= 2)
+                s.read_res = -ECANCELED;
+            if ((s.pending -= skipped) == 0)
+                complete(slot);
+        }
+        __atomic_store_n(ring.sq_tail, sq_head, __ATOMIC_RELEASE);
+        while (reap(), in_flight > 0)
+            usleep(1000);
+
+        for (; next < paths.size(); ++next)
+            large.push_back(next);
+        failed = true;
+        break;
+    }
+
+    std::string data;
+    for (const size_t i : large)
+    {
+        const bool ok = read_whole_file(paths[i], data, sizes[i]);
+        f(i, data, ok);
+    }
+
+    // the ring isn't trusted anymore, the next reads are blocking from the start
+    if (failed)
+    {
+        delete m_ring;
+        m_ring = nullptr;
+    }
+}
+
+#else
+
+struct BulkReader::ring_t
+{
+};
+
+BulkReader::BulkReader(const Mode mode)
+{
+    if (mode == Mode::Uring)
+        warn("io_uring is only available on Linux, reading files with blocking calls");
+}
+
+BulkReader::~BulkReader() = default;
+
+void BulkReader::readUring(const std::vector<std::string>&, const std::vector<uint64_t>&, const callback_t&) {}
+
+#endif
+
+void BulkReader::read(const std::vector<std::string>& paths, const std::vector<uint64_t>& sizes, const callback_t& f)
+{
+    if (m_ring)
+    {
+        readUring(paths, sizes, f);
+        return;
+    }
+
+    std::string data;
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        const bool ok = read_whole_file(paths[i], data, sizes[i]);
+        f(i, data, ok);
+    }
+}
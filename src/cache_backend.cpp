@@ -0,0 +1,510 @@
+#include "cache_backend.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+
+#include "file_lock.hpp"
+#include "tiny-process-library/process.hpp"
+#include "util.hpp"
+
+namespace fs = std::filesystem;
+
+static std::string_view store_dir(const CacheBackend::Store store)
+{
+    return store == CacheBackend::Store::Action ? "ac" : "cas";
+}
+
+bool CacheBackend::getFile(const Store store, const std::string& hash, const std::string& path)
+{
+    std::FILE* f = std::fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = get(store, hash, [f](const char* data, const size_t len) { return std::fwrite(data, 1, len, f) == len; });
+    ok      = std::fclose(f) == 0 && ok;
+    if (!ok)
+        std::remove(path.c_str());
+    return ok;
+}
+
+bool CacheBackend::putFile(const Store store, const std::string& hash, const std::string& path)
+{
+    std::error_code ec;
+    const uint64_t  size = fs::file_size(path, ec);
+    std::FILE*      f    = ec ? nullptr : std::fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+    const bool ok = put(store, hash, size, [f](char* buf, const size_t len) { return std::fread(buf, 1, len, f); });
+    std::fclose(f);
+    return ok;
+}
+
+/*
+ * FsCacheBackend
+ */
+
+static constexpr std::string_view LOG_FILE    = "access.log";
+static constexpr std::string_view TOTALS_FILE = "totals";
+static constexpr std::string_view LOCK_FILE   = "lock";
+
+static constexpr char    TOTALS_MAGIC[8] = { 'U', 'L', 'P', 'M', 'C', 'T', 'T', '1' };
+static constexpr int64_t DAY             = 24 * 60 * 60;
+
+// Appended whole by a single write, so records of concurrent processes never
+// interleave
+struct log_record_t
+{
+    int64_t  time;  // seconds since the epoch
+    uint64_t bytes;
+    uint8_t  hash[32];
+    uint8_t  event;
+    uint8_t  store;
+    uint8_t  pad[6];
+};
+static_assert(sizeof(log_record_t) == 56);
+
+// What the records compacted away counted
+struct totals_t
+{
+    char     magic[8];
+    uint64_t hits, misses;
+    uint64_t restored, stored;
+    uint64_t evicted, evicted_bytes;
+    int64_t  since, last_prune;
+};
+
+static int64_t now_seconds()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+static int hex_digit(const char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+static bool unhex(const std::string_view hex, uint8_t out[32])
+{
+    if (hex.size() != 64)
+        return false;
+    for (size_t i = 0; i < 32; ++i)
+    {
+        const int hi = hex_digit(hex[2 * i]), lo = hex_digit(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        out[i] = hi << 4 | lo;
+    }
+    return true;
+}
+
+// what a record is about, as a map key
+static std::string record_key(const uint8_t store, const uint8_t hash[32])
+{
+    std::string key(1, static_cast<char>(store));
+    key.append(reinterpret_cast<const char*>(hash), 32);
+    return key;
+}
+
+static std::vector<log_record_t> read_log(const std::string& path)
+{
+    std::vector<log_record_t> records;
+    std::error_code           ec;
+    const uint64_t            size = fs::file_size(path, ec);
+    std::FILE*                f    = ec ? nullptr : std::fopen(path.c_str(), "rb");
+    if (!f)
+        return records;
+    // a record cut short by a crash is dropped
+    records.resize(size / sizeof(log_record_t));
+    records.resize(std::fread(records.data(), sizeof(log_record_t), records.size(), f));
+    std::fclose(f);
+    return records;
+}
+
+static totals_t read_totals(const std::string& path)
+{
+    totals_t   totals{};
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (f)
+    {
+        if (std::fread(&totals, sizeof(totals), 1, f) != 1 || std::memcmp(totals.magic, TOTALS_MAGIC, 8) != 0)
+            totals = {};
+        std::fclose(f);
+    }
+    std::memcpy(totals.magic, TOTALS_MAGIC, 8);
+    return totals;
+}
+
+// Adds what a record counts for to totals
+static void add_record(totals_t& totals, const log_record_t& r)
+{
+    using Event       = FsCacheBackend::Event;
+    const bool action = r.store == static_cast<uint8_t>(CacheBackend::Store::Action);
+    switch (static_cast<Event>(r.event))
+    {
+        case Event::Hit:
+            if (action)
+                ++totals.hits;
+            else
+                totals.restored += r.bytes;
+            break;
+        case Event::Miss:
+            if (action)
+                ++totals.misses;
+            break;
+        case Event::Put:
+            if (!action)
+                totals.stored += r.bytes;
+            break;
+        default: return;
+    }
+    if (totals.since == 0 || r.time < totals.since)
+        totals.since = r.time;
+}
+
+static bool write_file(const std::string& path, const void* data, const size_t size)
+{
+    return atomic_write_file(path, [&](std::ostream& f) {
+        f.write(static_cast<const char*>(data), size);
+        return true;
+    });
+}
+
+// Calls f(path, hash, size, mtime) for every entry of the store under dir,
+// and for leftover temporary files with an empty hash
+template <typename F>
+static void for_each_entry(const std::string& dir, const CacheBackend::Store store, F&& f)
+{
+    std::error_code ec;
+    for (const fs::directory_entry& shard : fs::directory_iterator(fmt::format("{}/{}", dir, store_dir(store)), ec))
+    {
+        if (!shard.is_directory(ec) || shard.path().filename().string().size() != 2)
+            continue;
+        for (const fs::directory_entry& entry : fs::directory_iterator(shard.path(), ec))
+        {
+            const std::string name = entry.path().filename().string();
+            const uint64_t    size = entry.file_size(ec);
+            if (ec)
+                continue;
+            const int64_t mtime = std::chrono::duration_cast<std::chrono::seconds>(
+                                      std::chrono::file_clock::to_sys(entry.last_write_time(ec)).time_since_epoch())
+                                      .count();
+            const bool    tmp   = name.ends_with(".tmp");
+            f(entry.path().string(), tmp ? "" : shard.path().filename().string() + name, size, mtime);
+        }
+    }
+}
+
+std::string FsCacheBackend::path(const Store store, const std::string& hash) const
+{
+    return fmt::format("{}/{}/{}/{}", m_dir, store_dir(store), hash.substr(0, 2), hash.substr(2));
+}
+
+void FsCacheBackend::log(const Event event, const Store store, const std::string& hash, const uint64_t bytes)
+{
+    log_record_t r{};
+    if (!unhex(hash, r.hash))
+        return;
+    r.time  = now_seconds();
+    r.bytes = bytes;
+    r.event = static_cast<uint8_t>(event);
+    r.store = static_cast<uint8_t>(store);
+
+    std::error_code ec;
+    fs::create_directories(m_dir, ec);
+    // shared, only kept out while prune() rewrites the log
+    FileLock   lock(fmt::format("{}/{}", m_dir, LOCK_FILE), FileLock::Mode::Shared);
+    std::FILE* f = std::fopen(fmt::format("{}/{}", m_dir, LOG_FILE).c_str(), "ab");
+    if (!f)
+        return;
+    std::fwrite(&r, sizeof(r), 1, f);
+    std::fclose(f);
+}
+
+bool FsCacheBackend::contains(const Store store, const std::string& hash)
+{
+    std::error_code ec;
+    const bool      found = fs::is_regular_file(path(store, hash), ec);
+    // asked before reusing it, so it counts as used
+    if (found)
+        log(Event::Touch, store, hash);
+    return found;
+}
+
+bool FsCacheBackend::get(const Store store, const std::string& hash, const sink_t& sink)
+{
+    std::FILE* f = std::fopen(path(store, hash).c_str(), "rb");
+    if (!f)
+    {
+        log(Event::Miss, store, hash);
+        return false;
+    }
+
+    char     buf[65536];
+    size_t   n;
+    uint64_t read = 0;
+    bool     ok   = true;
+    while (ok && (n = std::fread(buf, 1, sizeof(buf), f)) > 0)
+    {
+        ok = sink(buf, n);
+        read += n;
+    }
+    ok = ok && !std::ferror(f);
+    std::fclose(f);
+    if (ok)
+        log(Event::Hit, store, hash, read);
+    return ok;
+}
+
+bool FsCacheBackend::put(const Store store, const std::string& hash, const uint64_t size, const source_t& source)
+{
+    const std::string dest    = path(store, hash);
+    uint64_t          written = 0;
+    const bool        ok      = atomic_write_file(dest, [&](std::ostream& f) {
+        char   buf[65536];
+        size_t n;
+        while ((n = source(buf, sizeof(buf))) > 0 && f.write(buf, n))
+            written += n;
+        return f && written == size;
+    });
+    if (!ok)
+    {
+        warn("Failed to write {}", dest);
+        return false;
+    }
+    log(Event::Put, store, hash, written);
+    return true;
+}
+
+FsCacheBackend::usage_t FsCacheBackend::usage()
+{
+    FileLock lock(fmt::format("{}/{}", m_dir, LOCK_FILE), FileLock::Mode::Shared);
+
+    totals_t totals = read_totals(fmt::format("{}/{}", m_dir, TOTALS_FILE));
+    for (const log_record_t& r : read_log(fmt::format("{}/{}", m_dir, LOG_FILE)))
+        add_record(totals, r);
+
+    usage_t usage;
+    usage.hits          = totals.hits;
+    usage.misses        = totals.misses;
+    usage.restored      = totals.restored;
+    usage.stored        = totals.stored;
+    usage.evicted       = totals.evicted;
+    usage.evicted_bytes = totals.evicted_bytes;
+    usage.since         = totals.since;
+    usage.last_prune    = totals.last_prune;
+    for (const Store store : { Store::Action, Store::Content })
+        for_each_entry(m_dir, store, [&](const std::string&, const std::string& hash, uint64_t size, int64_t) {
+            if (hash.empty())
+                return;
+            ++(store == Store::Action ? usage.actions : usage.blobs);
+            usage.bytes += size;
+        });
+    return usage;
+}
+
+bool FsCacheBackend::prune(const limits_t& limits, const bool wait, prune_stats_t& stats)
+{
+    std::error_code ec;
+    fs::create_directories(m_dir, ec);
+    FileLock lock(fmt::format("{}/{}", m_dir, LOCK_FILE), FileLock::Mode::Exclusive, wait);
+    if (!lock.locked())
+        return false;
+
+    const int64_t     now         = now_seconds();
+    const std::string log_path    = fmt::format("{}/{}", m_dir, LOG_FILE);
+    const std::string totals_path = fmt::format("{}/{}", m_dir, TOTALS_FILE);
+
+    totals_t                                 totals = read_totals(totals_path);
+    std::unordered_map<std::string, int64_t> last_used;
+    for (const log_record_t& r : read_log(log_path))
+    {
+        add_record(totals, r);
+        int64_t& used = last_used[record_key(r.store, r.hash)];
+        used          = std::max(used, r.time);
+    }
+
+    struct item_t
+    {
+        std::string path;
+        std::string key;
+        uint64_t    size;
+        int64_t     used;
+    };
+    std::vector<item_t> items;
+    uint64_t            total = 0;
+    for (const Store store : { Store::Action, Store::Content })
+        for_each_entry(m_dir, store, [&](const std::string& path, const std::string& hash, uint64_t size, int64_t mtime) {
+            uint8_t raw[32];
+            if (hash.empty() || !unhex(hash, raw))
+            {
+                // left behind by a process killed while writing it
+                if (now - mtime > DAY)
+                    fs::remove(path, ec);
+                return;
+            }
+            // entries the log doesn't know of were last used when written
+            std::string                    key = record_key(static_cast<uint8_t>(store), raw);
+            const auto                     it  = last_used.find(key);
+            items.push_back({ path, std::move(key), size, it != last_used.end() ? it->second : mtime });
+            total += size;
+        });
+    std::sort(items.begin(), items.end(), [](const item_t& a, const item_t& b) {
+        return a.used != b.used ? a.used < b.used : a.path < b.path;
+    });
+
+    std::vector<log_record_t> compacted;
+    for (const item_t& item : items)
+    {
+        const bool old  = limits.max_age > 0 && now - item.used > limits.max_age;
+        const bool over = limits.max_size > 0 && total > limits.max_size;
+        if ((old || over) && fs::remove(item.path, ec))
+        {
+            ++stats.entries;
+            stats.bytes += item.size;
+            total -= item.size;
+            continue;
+        }
+
+        ++stats.kept;
+        stats.kept_bytes += item.size;
+        log_record_t r{};
+        r.time  = item.used;
+        r.event = static_cast<uint8_t>(Event::Touch);
+        r.store = item.key[0];
+        std::memcpy(r.hash, item.key.data() + 1, 32);
+        compacted.push_back(r);
+    }
+
+    totals.evicted += stats.entries;
+    totals.evicted_bytes += stats.bytes;
+    totals.last_prune = now;
+    if (!write_file(totals_path, &totals, sizeof(totals)) ||
+        !write_file(log_path, compacted.data(), compacted.size() * sizeof(log_record_t)))
+        warn("Failed to compact the access log of {}", m_dir);
+    return true;
+}
+
+bool FsCacheBackend::pruneDue()
+{
+    return now_seconds() - read_totals(fmt::format("{}/{}", m_dir, TOTALS_FILE)).last_prune >= DAY;
+}
+
+/*
+ * HttpCacheBackend
+ */
+
+HttpCacheBackend::HttpCacheBackend(std::string url) : m_url(std::move(url))
+{
+    while (!m_url.empty() && m_url.back() == '/')
+        m_url.pop_back();
+}
+
+std::string HttpCacheBackend::url(const Store store, const std::string& hash) const
+{
+    return fmt::format("{}/{}/{}", m_url, store_dir(store), hash);
+}
+
+// curl prints the status code last on stderr (-w %{stderr}%{http_code}),
+// after its own error message if any
+static int http_status(const std::string& err)
+{
+    return err.size() >= 3 ? std::atoi(err.c_str() + err.size() - 3) : 0;
+}
+
+static std::string curl_error(const std::string& err)
+{
+    const std::string msg = err.size() > 3 ? err.substr(0, err.size() - 3) : "";
+    return msg.substr(0, msg.find('\n'));
+}
+
+bool HttpCacheBackend::contains(const Store store, const std::string& hash)
+{
+    std::string err;
+    TinyProcessLib::Process(
+        { "curl", "-sS", "-I", "-o", "/dev/null", "-w", "%{stderr}%{http_code}", url(store, hash) },
+        "",
+        nullptr,
+        [&](const char* bytes, size_t n) { err.append(bytes, n); })
+        .get_exit_status();
+    return http_status(err) == 200;
+}
+
+bool HttpCacheBackend::get(const Store store, const std::string& hash, const sink_t& sink)
+{
+    std::string             err;
+    bool                    sink_ok = true;
+    TinyProcessLib::Process curl(
+        { "curl", "-sS", "-f", "-w", "%{stderr}%{http_code}", url(store, hash) },
+        "",
+        [&](const char* bytes, size_t n) {
+            if (sink_ok)
+                sink_ok = sink(bytes, n);
+        },
+        [&](const char* bytes, size_t n) { err.append(bytes, n); });
+
+    const int status = curl.get_exit_status();
+    const int code   = http_status(err);
+    if (status != 0 && code != 404)
+        warn("GET {} failed: {}", url(store, hash), code ? fmt::format("HTTP {}", code) : curl_error(err));
+    return status == 0 && code == 200 && sink_ok;
+}
+
+bool HttpCacheBackend::put(const Store store, const std::string& hash, const uint64_t size, const source_t& source)
+{
+    // -T - streams stdin, chunked unless the length is given upfront and
+    // Transfer-Encoding dropped
+    std::string             err;
+    TinyProcessLib::Process curl({ "curl",
+                                   "-sS",
+                                   "-f",
+                                   "-o",
+                                   "/dev/null",
+                                   "-w",
+                                   "%{stderr}%{http_code}",
+                                   "-T",
+                                   "-",
+                                   "-H",
+                                   fmt::format("Content-Length: {}", size),
+                                   "-H",
+                                   "Transfer-Encoding:",
+                                   "-H",
+                                   "Content-Type: application/octet-stream",
+                                   url(store, hash) },
+                                 "",
+                                 nullptr,
+                                 [&](const char* bytes, size_t n) { err.append(bytes, n); },
+                                 true);
+
+    char     buf[65536];
+    size_t   n;
+    uint64_t sent = 0;
+    while ((n = source(buf, sizeof(buf))) > 0 && curl.write(buf, n))
+        sent += n;
+    curl.close_stdin();
+
+    const int status = curl.get_exit_status();
+    if (status != 0 || sent != size)
+    {
+        const int code = http_status(err);
+        warn("PUT {} failed: {}", url(store, hash), code ? fmt::format("HTTP {}", code) : curl_error(err));
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<CacheBackend> make_cache_backend(const std::string& location)
+{
+    if (hasStart(location, "http://") || hasStart(location, "https://"))
+        return std::make_unique<HttpCacheBackend>(location);
+    return std::make_unique<FsCacheBackend>(location);
+}
@@ -0,0 +1,374 @@
+#include "cgroup.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+#include "fmt/ranges.h"
+#include "util.hpp"
+
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <poll.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#ifdef __linux__
+
+static constexpr std::string_view CONTROLLERS[] = { "cpu", "memory", "io" };
+
+static std::optional<std::string> read_file(const std::string& path)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return {};
+    std::string ret;
+    char        buf[4096];
+    ssize_t     n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        ret.append(buf, n);
+    close(fd);
+    if (n < 0)
+        return {};
+    return ret;
+}
+
+// The kernel takes each write as a whole, and says what's wrong with it in errno
+static bool write_file(const std::string& path, const std::string_view value)
+{
+    const int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    const bool ok    = write(fd, value.data(), value.size()) == static_cast<ssize_t>(value.size());
+    const int  saved = errno;
+    close(fd);
+    errno = saved;
+    return ok;
+}
+
+static std::vector<std::string> words(const std::string_view text)
+{
+    std::vector<std::string> ret;
+    size_t                   i = 0;
+    while (i < text.size())
+    {
+        const size_t end = std::min(text.find_first_of(" \n", i), text.size());
+        if (end > i)
+            ret.emplace_back(text.substr(i, end - i));
+        i = end + 1;
+    }
+    return ret;
+}
+
+static bool contains(const std::vector<std::string>& list, const std::string_view word)
+{
+    return std::find(list.begin(), list.end(), word) != list.end();
+}
+
+// Where the cgroup2 hierarchy is mounted, which isn't always /sys/fs/cgroup
+// (hybrid setups have it at /sys/fs/cgroup/unified)
+static std::string cgroup2_mount()
+{
+    const std::optional<std::string> mountinfo = read_file("/proc/self/mountinfo");
+    if (!mountinfo)
+        return {};
+    for (const std::string& line : split(*mountinfo, '\n'))
+    {
+        // <id> <parent> <dev> <root> <mount point> <options> [<tags>...] - <type> <source> <options>
+        const std::vector<std::string> fields = split(line, ' ');
+        const auto                     sep    = std::find(fields.begin(), fields.end(), "-");
+        if (fields.size() > 4 && sep != fields.end() && sep + 1 != fields.end() && sep[1] == "cgroup2" &&
+            fields[3] == "/")
+            return fields[4];
+    }
+    return {};
+}
+
+// The cgroup2 path of the process, "/" for the root one
+static std::string own_cgroup()
+{
+    const std::optional<std::string> cgroup = read_file("/proc/self/cgroup");
+    if (!cgroup)
+        return {};
+    for (const std::string& line : split(*cgroup, '\n'))
+        if (hasStart(line, "0::"))
+            return line.substr(3);
+    return {};
+}
+
+// Whether ulpm is the only process in cgroup
+static bool alone_in(const std::string& cgroup)
+{
+    const std::optional<std::string> procs = read_file(cgroup + "/cgroup.procs");
+    if (!procs)
+        return false;
+    const std::string self = fmt::to_string(getpid());
+    for (const std::string& pid : words(*procs))
+        if (pid != self)
+            return false;
+    return true;
+}
+
+// Kills what's left in the cgroup at path, and waits up to a second for it to
+// be gone. Processes killed by the group are still exiting for a while.
+static bool empty_cgroup(const std::string& path)
+{
+    auto populated = [&] {
+        const std::optional<std::string> events = read_file(path + "/cgroup.events");
+        return !events || events->find("populated 0") == std::string::npos;
+    };
+    if (!populated())
+        return true;
+
+    // cgroup.kill is Linux 5.14+, before that each process has to be killed,
+    // and forks may get away
+    if (!write_file(path + "/cgroup.kill", "1"))
+        for (const std::string& pid : words(read_file(path + "/cgroup.procs").value_or("")))
+            kill(std::atoi(pid.c_str()), SIGKILL);
+
+    // cgroup.events gets POLLPRI once populated changes
+    const int fd = open((path + "/cgroup.events").c_str(), O_RDONLY | O_CLOEXEC);
+    bool      ok = false;
+    for (int i = 0; i < 20 && !(ok = !populated()); ++i)
+    {
+        if (fd < 0)
+        {
+            usleep(50 * 1000);
+            continue;
+        }
+        pollfd pfd = { fd, POLLPRI, 0 };
+        poll(&pfd, 1, 50);
+    }
+    if (fd >= 0)
+        close(fd);
+    return ok;
+}
+
+// rmdir() of an emptied cgroup, which still fails with EBUSY while the last
+// of its processes finish exiting, even once it's no longer populated
+static bool remove_cgroup(const std::string& path)
+{
+    for (int i = 0; i < 100; ++i)
+    {
+        if (rmdir(path.c_str()) == 0)
+            return true;
+        if (errno != EBUSY)
+            return false;
+        usleep(10 * 1000);
+    }
+    return false;
+}
+
+CgroupTree::CgroupTree()
+{
+    const std::string mount = cgroup2_mount();
+    const std::string own   = own_cgroup();
+    if (mount.empty() || own.empty())
+    {
+        debug("No cgroup v2 hierarchy, commands run in ulpm's cgroup");
+        return;
+    }
+    m_base = own == "/" ? mount : mount + own;
+    if (access((m_base + "/cgroup.procs").c_str(), W_OK) != 0 ||
+        access((m_base + "/cgroup.subtree_control").c_str(), W_OK) != 0)
+    {
+        debug("cgroup {} isn't delegated to ulpm, commands run in it", m_base);
+        return;
+    }
+
+    const std::string root = fmt::format("{}/ulpm.{}", m_base, getpid());
+    if (mkdir(root.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        debug("Failed to create the cgroup {}: {}", root, strerror(errno));
+        return;
+    }
+
+    // root only gets the controllers enabled in the subtree of m_base
+    const std::vector<std::string> available = words(read_file(m_base + "/cgroup.controllers").value_or(""));
+    const std::vector<std::string> enabled   = words(read_file(m_base + "/cgroup.subtree_control").value_or(""));
+    for (const std::string_view controller : CONTROLLERS)
+    {
+        if (!contains(available, controller) || contains(enabled, controller))
+            continue;
+        const std::string change = fmt::format("+{}", controller);
+        bool              ok     = write_file(m_base + "/cgroup.subtree_control", change);
+        if (!ok && errno == EBUSY && m_leaf.empty() && alone_in(m_base))
+        {
+            const std::string leaf = root + "/ulpm";
+            if ((mkdir(leaf.c_str(), 0755) == 0 || errno == EEXIST) &&
+                write_file(leaf + "/cgroup.procs", fmt::to_string(getpid())))
+            {
+                m_leaf = leaf;
+                ok     = write_file(m_base + "/cgroup.subtree_control", change);
+            }
+        }
+        if (ok)
+            m_enabled.emplace_back(controller);
+        else
+            debug("Failed to enable the {} controller in {}: {}", controller, m_base, strerror(errno));
+    }
+
+    const std::vector<std::string> delegated = words(read_file(root + "/cgroup.controllers").value_or(""));
+    for (const std::string_view controller : CONTROLLERS)
+        if (contains(delegated, controller))
+            write_file(root + "/cgroup.subtree_control", fmt::format("+{}", controller));
+
+    m_root = root;
+    debug("Commands run in cgroups under {} with the controllers: {}", m_root, fmt::join(delegated, " "));
+}
+
+CgroupTree::~CgroupTree()
+{
+    for (const auto& [id, group] : m_groups)
+    {
+        close(group.procs_fd);
+        empty_cgroup(group.path);
+        remove_cgroup(group.path);
+    }
+    if (m_root.empty())
+        return;
+
+    // controllers have to be disabled from the bottom up, and before ulpm
+    // can go back to a cgroup it used to have no process in
+    for (const std::string_view controller : CONTROLLERS)
+        write_file(m_root + "/cgroup.subtree_control", fmt::format("-{}", controller));
+    auto restore_base = [&] {
+        for (const std::string& controller : m_enabled)
+            if (!write_file(m_base + "/cgroup.subtree_control", fmt::format("-{}", controller)))
+                debug("Failed to disable the {} controller in {}: {}", controller, m_base, strerror(errno));
+    };
+    if (!m_leaf.empty())
+    {
+        restore_base();
+        if (!write_file(m_base + "/cgroup.procs", fmt::to_string(getpid())))
+            return;
+        rmdir(m_leaf.c_str());
+    }
+    if (!remove_cgroup(m_root))
+        debug("Failed to remove the cgroup {}: {}", m_root, strerror(errno));
+    if (m_leaf.empty())
+        restore_base();
+}
+
+int CgroupTree::create(const size_t id, const cgroup_limits_t& limits)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_root.empty())
+    {
+        if (!limits.empty() && m_warned.insert("tree").second)
+            warn("Commands can't be limited, ulpm isn't in a delegated cgroup v2 "
+                 "(see 'systemd-run --user --scope -p Delegate=yes')");
+        return -1;
+    }
+
+    const std::string path = fmt::format("{}/task.{}", m_root, id);
+    if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        debug("Failed to create the cgroup {}: {}", path, strerror(errno));
+        return -1;
+    }
+
+    const std::pair<const char*, const std::string&> settings[] = {
+        { "cpu.max", limits.cpu_max },
+        { "memory.max", limits.memory_max },
+        { "io.weight", limits.io_weight },
+    };
+    for (const auto& [file, value] : settings)
+    {
+        if (value.empty() || write_file(fmt::format("{}/{}", path, file), value))
+            continue;
+        if (m_warned.insert(file).second)
+            warn("Failed to set {} to '{}': {}",
+                 file,
+                 value,
+                 errno == ENOENT ? "its controller isn't enabled in ulpm's cgroup" : strerror(errno));
+    }
+
+    const int fd = open((path + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        rmdir(path.c_str());
+        return -1;
+    }
+    m_groups[id] = { path, fd };
+    return fd;
+}
+
+// The value of key in the "key value" lines of a stat file
+static uint64_t stat_value(const std::string_view text, const std::string_view key)
+{
+    for (size_t i = 0; i < text.size();)
+    {
+        const size_t end = std::min(text.find('\n', i), text.size());
+        if (const std::string_view line = text.substr(i, end - i); hasStart(line, key) && line.size() > key.size() &&
+                                                                    line[key.size()] == ' ')
+            return std::strtoull(std::string(line.substr(key.size() + 1)).c_str(), nullptr, 10);
+        i = end + 1;
+    }
+    return 0;
+}
+
+std::optional<cgroup_stats_t> CgroupTree::release(const size_t id)
+{
+    // only the lookup is under the lock, emptying and removing the cgroup
+    // can take a second and other commands are created meanwhile
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto                  it = m_groups.find(id);
+        if (it == m_groups.end())
+            return {};
+        path = it->second.path;
+        close(it->second.procs_fd);
+        m_groups.erase(it);
+    }
+
+    // what the command left behind goes with it, and is accounted for
+    if (!empty_cgroup(path))
+        debug("Processes of the cgroup {} are still there after being killed", path);
+
+    cgroup_stats_t stats;
+    if (const std::optional<std::string> cpu = read_file(path + "/cpu.stat"))
+    {
+        stats.user_usec   = stat_value(*cpu, "user_usec");
+        stats.system_usec = stat_value(*cpu, "system_usec");
+    }
+    if (const std::optional<std::string> peak = read_file(path + "/memory.peak"))
+        stats.memory_peak = std::strtoull(peak->c_str(), nullptr, 10);
+    // one line per device: <major>:<minor> rbytes=<n> wbytes=<n> rios=<n> ...
+    if (const std::optional<std::string> io = read_file(path + "/io.stat"))
+        for (const std::string& word : words(*io))
+        {
+            if (hasStart(word, "rbytes="))
+                stats.read_bytes += std::strtoull(word.c_str() + 7, nullptr, 10);
+            else if (hasStart(word, "wbytes="))
+                stats.write_bytes += std::strtoull(word.c_str() + 7, nullptr, 10);
+        }
+
+    if (!remove_cgroup(path))
+        debug("Failed to remove the cgroup {}: {}", path, strerror(errno));
+    return stats;
+}
+
+#else
+
+CgroupTree::CgroupTree() {}
+CgroupTree::~CgroupTree() {}
+
+int CgroupTree::create(const size_t, const cgroup_limits_t& limits)
+{
+    if (!limits.empty() && m_warned.insert("tree").second)
+        warn("Commands can only be limited on Linux");
+    return -1;
+}
+
+std::optional<cgroup_stats_t> CgroupTree::release(const size_t)
+{
+    return {};
+}
+
+#endif
@@ -0,0 +1,67 @@
+#include "dep_graph.hpp"
+
+#include <algorithm>
+
+std::vector<uint32_t> DepGraph::parents() const
+{
+    std::vector<uint32_t> parent(nodeCount(), NONE);
+    std::vector<uint32_t> queue;
+    if (nodeCount() == 0)
+        return parent;
+
+    queue.reserve(nodeCount());
+    queue.push_back(root);
+    parent[root] = root;
+    for (size_t i = 0; i < queue.size(); ++i)
+    {
+        for (const uint32_t dep : deps(queue[i]))
+        {
+            if (parent[dep] != NONE)
+                continue;
+            parent[dep] = queue[i];
+            queue.push_back(dep);
+        }
+    }
+    return parent;
+}
+
+uint32_t DepGraphBuilder::intern(std::string_view str)
+{
+    const auto [it, inserted] = m_ids.try_emplace(std::string(str), m_graph.string_offsets.size() - 1);
+    if (inserted)
+    {
+        m_graph.strings.append(str);
+        m_graph.string_offsets.push_back(m_graph.strings.size());
+    }
+    return it->second;
+}
+
+uint32_t DepGraphBuilder::addNode(std::string_view name, std::string_view version)
+{
+    m_graph.node_name.push_back(intern(name));
+    m_graph.node_version.push_back(intern(version));
+    return m_graph.node_name.size() - 1;
+}
+
+DepGraph DepGraphBuilder::finish()
+{
+    std::sort(m_edges.begin(), m_edges.end());
+    m_edges.erase(std::unique(m_edges.begin(), m_edges.end()), m_edges.end());
+
+    const size_t n = m_graph.nodeCount();
+    m_graph.edge_offsets.assign(n + 1, 0);
+    m_graph.edges.reserve(m_edges.size());
+    for (const auto& [from, to] : m_edges)
+    {
+        ++m_graph.edge_offsets[from + 1];
+        m_graph.edges.push_back(to);
+    }
+    for (size_t i = 0; i < n; ++i)
+        m_graph.edge_offsets[i + 1] += m_graph.edge_offsets[i];
+
+    DepGraph graph = std::move(m_graph);
+    m_graph        = {};
+    m_ids.clear();
+    m_edges.clear();
+    return graph;
+}
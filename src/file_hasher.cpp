@@ -0,0 +1,318 @@
+#include "file_hasher.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+
+#include "bulk_reader.hpp"
+#include "sha256.hpp"
+#include "util.hpp"
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static constexpr std::string_view CACHE_FILE     = ".ulpm/hashes.idx";
+static constexpr char             CACHE_MAGIC[8] = { 'U', 'L', 'P', 'M', 'H', 'S', 'H', '2' };
+
+static constexpr size_t   SMALL_BATCH = 1024;     // small files read per job, through one BulkReader
+static constexpr uint64_t LARGE_FILE  = 4 << 20;  // from there on hashed in chunks
+static constexpr uint64_t CHUNK_SIZE  = 1 << 20;
+
+static bool stat_file(const std::string& path, uint64_t& ino, uint64_t& size, int64_t& mtime, int64_t& ctime)
+{
+#ifdef _WIN32
+    std::error_code ec;
+    size = fs::file_size(path, ec);
+    if (ec)
+        return false;
+    mtime = fs::last_write_time(path, ec).time_since_epoch().count();
+    ino = ctime = 0;
+    return !ec;
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+    ino  = st.st_ino;
+    size = st.st_size;
+#  ifdef __APPLE__
+    mtime = st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+    ctime = st.st_ctimespec.tv_sec * 1000000000LL + st.st_ctimespec.tv_nsec;
+#  else
+    mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    ctime = st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+#  endif
+    return true;
+#endif
+}
+
+// SHA-256 of len bytes of path from offset, false if they couldn't all be read
+static bool hash_range(const std::string& path, const uint64_t offset, const uint64_t len, file_hash_t& hash)
+{
+    Sha256 sha;
+    char   buf[65536];
+#ifdef _WIN32
+    std::ifstream f(path, std::ios::binary);
+    if (!f || !f.seekg(offset))
+        return false;
+    for (uint64_t left = len; left > 0;)
+    {
+        if (!f.read(buf, std::min<uint64_t>(left, sizeof(buf))))
+            return false;
+        sha.update(buf, f.gcount());
+        left -= f.gcount();
+    }
+    hash = sha.finish();
+    return true;
+#else
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    uint64_t done = 0;
+    while (done < len)
+    {
+        const ssize_t n = pread(fd, buf, std::min<uint64_t>(len - done, sizeof(buf)), offset + done);
+        if (n <= 0)
+            break;
+        sha.update(buf, n);
+        done += n;
+    }
+    close(fd);
+    hash = sha.finish();
+    return done == len;
+#endif
+}
+
+// One level of tree: the chunks are hashed in parallel, then their hashes
+// in order
+static std::optional<file_hash_t> hash_large_file(const std::string&     path,
+                                                  const uint64_t         size,
+                                                  std::atomic<uint64_t>& bytes)
+{
+    const size_t             nchunks = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    std::vector<file_hash_t> chunks(nchunks);
+    std::atomic<bool>        ok = true;
+    parallel_for(nchunks, [&](const size_t i) {
+        const uint64_t len = std::min(CHUNK_SIZE, size - i * CHUNK_SIZE);
+        if (!hash_range(path, i * CHUNK_SIZE, len, chunks[i]))
+            ok = false;
+        bytes += len;
+    });
+    if (!ok)
+        return std::nullopt;
+
+    Sha256 sha;
+    for (const file_hash_t& chunk : chunks)
+        sha.update(chunk.data(), chunk.size());
+    return sha.finish();
+}
+
+FileHasher::FileHasher(std::string root, const BulkReader::Mode io) : m_root(std::move(root)), m_io(io)
+{
+    while (m_root.size() > 1 && m_root.back() == '/')
+        m_root.pop_back();
+}
+
+std::vector<std::optional<file_hash_t>> FileHasher::hash(const std::vector<std::string>& files, const bool use_cache)
+{
+    m_stats       = {};
+    m_stats.files = files.size();
+    if (use_cache)
+        loadCache();
+    else
+        m_cache.clear();
+
+    // A file modified in the same clock tick as it gets hashed could change
+    // again without its mtime moving, those aren't trusted next time
+    const int64_t started = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::system_clock::now().time_since_epoch())
+                                .count();
+
+    std::vector<record_t> records(files.size());
+    std::vector<char>     stale(files.size()), hashed(files.size());
+    parallel_for(files.size(), [&](const size_t i) {
+        record_t& r = records[i];
+        if (!stat_file(fmt::format("{}/{}", m_root, files[i]), r.ino, r.size, r.mtime, r.ctime))
+            return;
+
+        const auto it = m_cache.find(files[i]);
+        if (it != m_cache.end() && it->second.ino == r.ino && it->second.size == r.size &&
+            it->second.mtime == r.mtime && it->second.ctime == r.ctime)
+        {
+            r.hash    = it->second.hash;
+            hashed[i] = true;
+        }
+        else
+            stale[i] = true;
+    });
+
+    std::vector<size_t> small, large;
+    for (size_t i = 0; i < files.size(); ++i)
+        if (stale[i])
+            (records[i].size >= LARGE_FILE ? large : small).push_back(i);
+
+    std::atomic<uint64_t> bytes = 0;
+    std::atomic<bool>     uring = false;
+    parallel_for((small.size() + SMALL_BATCH - 1) / SMALL_BATCH, [&](const size_t batch) {
+        const size_t             begin = batch * SMALL_BATCH, end = std::min(small.size(), begin + SMALL_BATCH);
+        std::vector<std::string> paths;
+        std::vector<uint64_t>    sizes;
+        for (size_t j = begin; j < end; ++j)
+        {
+            paths.push_back(fmt::format("{}/{}", m_root, files[small[j]]));
+            sizes.push_back(records[small[j]].size);
+        }
+
+        BulkReader reader(m_io);
+        if (reader.usingUring())
+            uring = true;
+        reader.read(paths, sizes, [&](const size_t k, const std::string_view data, const bool ok) {
+            if (ok)
+            {
+                Sha256 sha;
+                sha.update(data.data(), data.size());
+                records[small[begin + k]].hash = sha.finish();
+                hashed[small[begin + k]]       = true;
+            }
+            bytes += data.size();
+        });
+    });
+    for (const size_t i : large)
+    {
+        if (const std::optional<file_hash_t> hash =
+                hash_large_file(fmt::format("{}/{}", m_root, files[i]), records[i].size, bytes))
+        {
+            records[i].hash = *hash;
+            hashed[i]       = true;
+        }
+    }
+
+    m_stats.hashed = small.size() + large.size();
+    m_stats.bytes  = bytes;
+    m_stats.uring  = uring;
+
+    std::vector<std::optional<file_hash_t>> hashes(files.size());
+    m_cache.clear();
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        if (!hashed[i])
+            continue;
+        hashes[i] = records[i].hash;
+        if (records[i].mtime < started && records[i].ctime < started)
+            m_cache.emplace(files[i], records[i]);
+    }
+    if (m_stats.hashed > 0 || m_cache.size() != files.size())
+        saveCache();
+    return hashes;
+}
+
+bool FileHasher::loadCache()
+{
+    m_cache.clear();
+    std::ifstream f(fmt::format("{}/{}", m_root, CACHE_FILE), std::ios::binary | std::ios::ate);
+    if (!f)
+        return false;
+    std::string buf(static_cast<size_t>(f.tellg()), '\0');
+    if (!f.seekg(0).read(buf.data(), buf.size()) || !hasStart(buf, std::string_view(CACHE_MAGIC, sizeof(CACHE_MAGIC))))
+        return false;
+
+    std::string_view data = std::string_view(buf).substr(sizeof(CACHE_MAGIC));
+
+    uint64_t count = 0;
+    if (!read_bytes(data, &count, sizeof(count)) || count > buf.size() / sizeof(record_t))
+        return false;
+    m_cache.reserve(count);
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        uint32_t len = 0;
+        record_t r;
+        if (!read_bytes(data, &len, sizeof(len)) || data.size() < len)
+        {
+            m_cache.clear();
+            return false;
+        }
+        std::string path(data.substr(0, len));
+        data.remove_prefix(len);
+        if (!read_bytes(data, &r, sizeof(r)))
+        {
+            m_cache.clear();
+            return false;
+        }
+        m_cache.emplace(std::move(path), r);
+    }
+    return true;
+}
+
+void FileHasher::saveCache() const
+{
+    atomic_write_file(fmt::format("{}/{}", m_root, CACHE_FILE), [&](std::ostream& f) {
+        f.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        write_pod(f, static_cast<uint64_t>(m_cache.size()));
+        for (const auto& [file, r] : m_cache)
+        {
+            write_pod(f, static_cast<uint32_t>(file.size()));
+            f.write(file.data(), file.size());
+            write_pod(f, r);
+        }
+        return true;
+    });
+}
+
+static std::string_view base_name(const std::string_view path)
+{
+    const size_t slash = path.rfind('/');
+    return slash == path.npos ? path : path.substr(slash + 1);
+}
+
+std::unordered_map<std::string, file_hash_t> merkle_roots(
+    const std::vector<std::pair<std::string, file_hash_t>>& files)
+{
+    auto fold = [](Sha256& sha, const std::string_view name, const char kind, const file_hash_t& child) {
+        sha.update(&kind, 1);
+        sha.update(name.data(), name.size());
+        sha.update("/", 1);
+        sha.update(child.data(), child.size());
+    };
+
+    struct open_dir_t
+    {
+        std::string path;
+        Sha256      sha;
+    };
+
+    // Sorted paths keep every subtree in one run: the directories being
+    // hashed are a stack, each one folded into its parent once left
+    std::unordered_map<std::string, file_hash_t> roots;
+    std::vector<open_dir_t>                      stack(1);
+    auto                                         close_top = [&] {
+        open_dir_t dir = std::move(stack.back());
+        stack.pop_back();
+        const file_hash_t hash = dir.sha.finish();
+        fold(stack.back().sha, base_name(dir.path), 'd', hash);
+        roots.emplace(std::move(dir.path), hash);
+    };
+
+    for (const auto& [path, hash] : files)
+    {
+        const size_t           slash = path.rfind('/');
+        const std::string_view dir   = slash == path.npos ? std::string_view() : std::string_view(path).substr(0, slash);
+        while (!is_under(dir, stack.back().path))
+            close_top();
+        while (stack.back().path.size() < dir.size())
+        {
+            const size_t from = stack.back().path.empty() ? 0 : stack.back().path.size() + 1;
+            stack.push_back({ std::string(dir.substr(0, dir.find('/', from))), Sha256() });
+        }
+        fold(stack.back().sha, base_name(path), 'f', hash);
+    }
+    while (stack.size() > 1)
+        close_top();
+    roots.emplace("", stack.back().sha.finish());
+    return roots;
+}
@@ -0,0 +1,34 @@
+#include "file_lock.hpp"
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/file.h>
+#  include <unistd.h>
+
+#  include <cerrno>
+#endif
+
+FileLock::FileLock(const std::string& path, const Mode mode, const bool wait)
+{
+#ifdef _WIN32
+    m_locked = true;
+#else
+    m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+        return;
+
+    const int op = (mode == Mode::Shared ? LOCK_SH : LOCK_EX) | (wait ? 0 : LOCK_NB);
+    int       ret;
+    while ((ret = flock(m_fd, op)) < 0 && errno == EINTR)
+        ;
+    m_locked = ret == 0;
+#endif
+}
+
+FileLock::~FileLock()
+{
+#ifndef _WIN32
+    if (m_fd >= 0)
+        close(m_fd);  // releases the lock along with it
+#endif
+}
@@ -0,0 +1,150 @@
+#include "file_snapshot.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+#include "file_hasher.hpp"
+#include "project_discovery.hpp"
+#include "util.hpp"
+
+static constexpr std::string_view SNAPSHOT_DIR   = ".ulpm/snapshots";
+static constexpr std::string_view SNAPSHOT_MAGIC = "ULPMSNP2";
+
+FileSnapshot FileSnapshot::capture(const std::string& root)
+{
+    ProjectDiscovery         discovery(root);
+    std::vector<std::string> files = discovery.files();
+
+    FileHasher                                    hasher(root);
+    const std::vector<std::optional<file_hash_t>> hashes = hasher.hash(files);
+    debug("Hashed {} of {} files ({}), the rest from the cache",
+          hasher.stats().hashed,
+          files.size(),
+          human_size(hasher.stats().bytes));
+
+    FileSnapshot snap;
+    snap.m_files.reserve(files.size());
+    for (size_t i = 0; i < files.size(); ++i)
+        if (hashes[i])
+            snap.m_files.emplace_back(std::move(files[i]), *hashes[i]);
+    return snap;
+}
+
+static bool from_hex(const std::string_view hex, file_hash_t& digest)
+{
+    auto nibble = [](const char c) {
+        return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+    };
+    for (size_t i = 0; i < digest.size(); ++i)
+    {
+        const int hi = nibble(hex[i * 2]), lo = nibble(hex[i * 2 + 1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        digest[i] = hi << 4 | lo;
+    }
+    return true;
+}
+
+bool FileSnapshot::load(const std::string& path)
+{
+    std::ifstream f(path);
+    std::string   line;
+    if (!f || !std::getline(f, line) || line != SNAPSHOT_MAGIC)
+        return false;
+
+    m_files.clear();
+    while (std::getline(f, line))
+    {
+        file_hash_t hash;
+        if (line.size() < 66 || line[64] != ' ' || !from_hex(line, hash))
+            return false;
+        m_files.emplace_back(line.substr(65), hash);
+    }
+    std::sort(m_files.begin(), m_files.end());
+    return true;
+}
+
+bool FileSnapshot::save(const std::string& path) const
+{
+    return atomic_write_file(path, [&](std::ostream& f) {
+        f << SNAPSHOT_MAGIC << '\n';
+        for (const auto& [file, hash] : m_files)
+            f << fmt::format("{} {}\n", Sha256::hex(hash), file);
+        return true;
+    });
+}
+
+std::vector<std::string> FileSnapshot::changedSince(const FileSnapshot& old) const
+{
+    // The topmost directories with the same Merkle root on both sides,
+    // nothing under them needs to be compared
+    const auto               old_roots = merkle_roots(old.m_files);
+    const auto               new_roots = merkle_roots(m_files);
+    std::vector<std::string> same;
+    for (const auto& [dir, hash] : new_roots)
+        if (auto it = old_roots.find(dir); it != old_roots.end() && it->second == hash)
+            same.push_back(dir);
+    std::sort(same.begin(), same.end());
+
+    // The root of roots path is under, if any. Looked up by each of its
+    // parents, the closest one in sorting order may be a sibling like "a-b"
+    // sorting between "a" and "a/b".
+    std::vector<std::string> roots;
+    auto                     root_of = [&](const std::string_view path) -> const std::string* {
+        auto find = [&](const std::string_view dir) -> const std::string* {
+            auto it = std::lower_bound(roots.begin(), roots.end(), dir);
+            return it != roots.end() && *it == dir ? &*it : nullptr;
+        };
+        if (const std::string* root = find(""))
+            return root;
+        for (size_t i = path.find('/'); i != path.npos; i = path.find('/', i + 1))
+            if (const std::string* root = find(path.substr(0, i)))
+                return root;
+        return find(path);
+    };
+    // filtered into roots of their own rather than in place, a search of the
+    // vector being changed could see moved-from strings
+    for (const std::string& dir : same)
+        if (!root_of(dir))
+            roots.push_back(dir);
+
+    // both sorted by path, a single merge pass
+    std::vector<std::string> changed;
+    auto                     a = old.m_files.begin(), b = m_files.begin();
+    while (a != old.m_files.end() || b != m_files.end())
+    {
+        const std::string& path = (b == m_files.end() || (a != old.m_files.end() && a->first < b->first))
+                                      ? a->first
+                                      : b->first;
+        if (const std::string* root = root_of(path))
+        {
+            const std::string& dir   = *root;
+            auto               under = [&](const auto& file) { return is_under(file.first, dir); };
+            a                        = std::partition_point(a, old.m_files.end(), under);
+            b                        = std::partition_point(b, m_files.end(), under);
+            continue;
+        }
+
+        if (b == m_files.end() || (a != old.m_files.end() && a->first < b->first))
+        {
+            changed.push_back((a++)->first);
+        }
+        else if (a == old.m_files.end() || b->first < a->first)
+        {
+            changed.push_back((b++)->first);
+        }
+        else
+        {
+            if (a->second != b->second)
+                changed.push_back(b->first);
+            ++a;
+            ++b;
+        }
+    }
+    return changed;
+}
+
+std::string snapshot_path(const std::string& root, const std::string& name)
+{
+    return fmt::format("{}/{}/{}", root, SNAPSHOT_DIR, name);
+}
@@ -0,0 +1,175 @@
+#include "headless_screen.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+#include "fmt/format.h"
+#include "fmt/os.h"
+#include "utf8.h"
+#include "util.hpp"
+
+// The escape sequences our menus care about, as xterm sends them
+static constexpr std::pair<std::string_view, uint16_t> k_key_seqs[] = {
+    { "\x1b[A", TB_KEY_ARROW_UP },      { "\x1b[B", TB_KEY_ARROW_DOWN },        { "\x1b[C", TB_KEY_ARROW_RIGHT },
+    { "\x1b[D", TB_KEY_ARROW_LEFT },    { "\x1b[H", TB_KEY_HOME },              { "\x1b[F", TB_KEY_END },
+    { "\x1b[3~", TB_KEY_DELETE },       { "\x1b[200~", TB_KEY_PASTE_START },    { "\x1b[201~", TB_KEY_PASTE_END },
+};
+
+HeadlessScreen::HeadlessScreen(int width, int height)
+    : m_width(width),
+      m_height(height),
+      m_back(static_cast<size_t>(width * height)),
+      m_front(static_cast<size_t>(width * height))
+{}
+
+std::unique_ptr<HeadlessScreen> HeadlessScreen::fromSpec(const std::string_view spec)
+{
+    const size_t x = spec.find('x');
+    if (x == spec.npos)
+        return nullptr;
+
+    int w = 0, h = 0;
+    const auto [pw, ew] = std::from_chars(spec.data(), spec.data() + x, w);
+    const auto [ph, eh] = std::from_chars(spec.data() + x + 1, spec.data() + spec.size(), h);
+    if (ew != std::errc() || eh != std::errc() || w <= 0 || h <= 0)
+        return nullptr;
+
+    return std::make_unique<HeadlessScreen>(w, h);
+}
+
+bool HeadlessScreen::loadKeys(const std::string& path)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f)
+        return false;
+
+    const std::string script((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    for (const std::string& burst : split(script, '\n'))
+        if (!burst.empty())
+            m_bursts.push_back(burst);
+
+    return true;
+}
+
+void HeadlessScreen::clear()
+{
+    std::fill(m_back.begin(), m_back.end(), cell_t{});
+}
+
+void HeadlessScreen::setCell(int x, int y, uint32_t ch, uintattr_t fg, uintattr_t bg)
+{
+    if (x < 0 || x >= m_width || y < 0 || y >= m_height)
+        return;
+
+    m_back[y * m_width + x] = { ch, fg, bg };
+}
+
+void HeadlessScreen::print(int x, int y, uintattr_t fg, uintattr_t bg, const std::string_view str)
+{
+    // copy for the null terminator utf8codepoint() needs
+    const std::string  text(str);
+    const utf8_int8_t* it = reinterpret_cast<const utf8_int8_t*>(text.c_str());
+    while (*it)
+    {
+        utf8_int32_t cp = 0;
+        it              = utf8codepoint(it, &cp);
+        setCell(x++, y, static_cast<uint32_t>(cp), fg, bg);
+    }
+}
+
+void HeadlessScreen::setCursor(int x, int y)
+{
+    m_cursor_x = x;
+    m_cursor_y = y;
+}
+
+void HeadlessScreen::present()
+{
+    // Same diffing termbox does: only changed cells are sent, and a cursor
+    // move is needed whenever the changed cell doesn't follow the last one.
+    int last_x = -1, last_y = -1;
+    for (int y = 0; y < m_height; ++y)
+    {
+        for (int x = 0; x < m_width; ++x)
+        {
+            const size_t i = y * m_width + x;
+            if (m_back[i] == m_front[i])
+                continue;
+
+            if (x != last_x + 1 || y != last_y)
+                m_stats.bytes += fmt::formatted_size("\x1b[{};{}H", y + 1, x + 1);
+            m_stats.bytes += codepoint_to_utf8(m_back[i].ch).length();
+            ++m_stats.cells_changed;
+
+            m_front[i] = m_back[i];
+            last_x     = x;
+            last_y     = y;
+        }
+    }
+    ++m_stats.frames;
+
+    if (!m_snapshot_path.empty())
+    {
+        auto f = fmt::output_file(m_snapshot_path, fmt::file::CREATE | fmt::file::WRONLY | fmt::file::APPEND);
+        f.print("--- frame {} (cursor {},{}) ---\n{}", m_stats.frames, m_cursor_x, m_cursor_y, snapshot());
+    }
+}
+
+std::string HeadlessScreen::snapshot() const
+{
+    std::string out;
+    for (int y = 0; y < m_height; ++y)
+    {
+        std::string row;
+        for (int x = 0; x < m_width; ++x)
+            row += codepoint_to_utf8(m_front[y * m_width + x].ch);
+
+        row.erase(row.find_last_not_of(' ') + 1);
+        out += row;
+        out += '\n';
+    }
+    return out;
+}
+
+bool HeadlessScreen::nextEvent(struct tb_event& ev, bool wait)
+{
+    if (m_pending.empty())
+    {
+        if (!wait || m_bursts.empty())
+            return false;
+        m_pending = std::move(m_bursts.front());
+        m_bursts.pop_front();
+    }
+
+    ev      = {};
+    ev.type = TB_EVENT_KEY;
+    ++m_stats.events;
+
+    for (const auto& [seq, key] : k_key_seqs)
+    {
+        if (hasStart(m_pending, seq))
+        {
+            ev.key = key;
+            m_pending.erase(0, seq.length());
+            return true;
+        }
+    }
+
+    const unsigned char c = m_pending[0];
+    if (c < TB_KEY_SPACE || c == TB_KEY_BACKSPACE2)
+    {
+        ev.key = c;
+        m_pending.erase(0, 1);
+        return true;
+    }
+
+    utf8_int32_t       cp    = 0;
+    const utf8_int8_t* begin = reinterpret_cast<const utf8_int8_t*>(m_pending.c_str());
+    const utf8_int8_t* end   = utf8codepoint(begin, &cp);
+    ev.ch                    = static_cast<uint32_t>(cp);
+    m_pending.erase(0, end - begin);
+    return true;
+}
@@ -0,0 +1,140 @@
+#include "install_stamp.hpp"
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include "fmt/os.h"
+#include "fmt/ranges.h"
+#include "switch_fnv1a.hpp"
+#include "tiny-process-library/process.hpp"
+#include "util.hpp"
+
+namespace fs = std::filesystem;
+
+static long long mtime_of(const fs::path& path, std::error_code& ec)
+{
+    return static_cast<long long>(fs::last_write_time(path, ec).time_since_epoch().count());
+}
+
+InstallStamp::InstallStamp(const LanguageBackend&          backend,
+                           const manifest_settings_t&      common,
+                           const std::vector<std::string>& cmd)
+    : m_inputs(backend.installInputs(common)), m_markers(backend.installMarkers(common)), m_cmd(cmd)
+{
+    std::ifstream f{ std::string(STAMP_PATH) };
+    std::getline(f, m_saved_fingerprint);
+    std::getline(f, m_saved_marker);
+    std::getline(f, m_saved_pm_id);
+    std::getline(f, m_saved_pm_version);
+}
+
+// Asking the package manager its version costs a whole node startup for
+// npm/yarn/pnpm, so only do it when the binary itself changed.
+const std::string& InstallStamp::pmVersion()
+{
+    if (!m_pm_version.empty() || m_cmd.empty())
+        return m_pm_version;
+
+    std::string pm_id;
+    const char* path = std::getenv("PATH");
+    const std::string exe  = find_in_path(m_cmd[0], path ? path : "");
+    std::error_code   ec;
+    if (!exe.empty())
+    {
+        const fs::path real = fs::canonical(exe, ec);
+        if (!ec)
+            pm_id = fmt::format("{} {} {}", real.string(), fs::file_size(real, ec), mtime_of(real, ec));
+    }
+
+    if (!pm_id.empty() && pm_id == m_saved_pm_id)
+    {
+        m_pm_version = m_saved_pm_version;
+        return m_pm_version;
+    }
+
+    std::string out;
+    TinyProcessLib::Process({ m_cmd[0], "--version" }, "", [&](const char* bytes, size_t n) {
+        out.append(bytes, n);
+    }).get_exit_status();
+
+    m_saved_pm_id = pm_id;
+    m_pm_version  = out.substr(0, out.find_first_of("\r\n"));
+    if (m_pm_version.empty())
+        m_pm_version = UNKNOWN;
+    return m_pm_version;
+}
+
+std::string InstallStamp::fingerprint()
+{
+    using hasher = fnv1a<64>;
+
+    hasher::Type hash = fnv1a_traits<64>::Offset;
+    auto         feed = [&hash](const std::string_view data) {
+        hash = hasher::hash(data.data(), data.size(), nullptr, hash);
+        hash = hasher::hash("\0", 1, nullptr, hash);
+    };
+
+    feed(fmt::format("{}", fmt::join(m_cmd, " ")));
+    feed(pmVersion());
+    for (const std::string& input : m_inputs)
+    {
+        feed(input);
+        std::ifstream f(input, std::ios::binary);
+        if (!f)
+        {
+            feed("(missing)");
+            continue;
+        }
+        feed(std::string(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()));
+    }
+
+    return fmt::format("{:016x}", hash);
+}
+
+// The marker's mtime, "" when the backend has none, "-" when it's gone
+std::string InstallStamp::markerState() const
+{
+    if (m_markers.empty())
+        return {};
+
+    for (const std::string& marker : m_markers)
+    {
+        std::error_code ec;
+        const long long mtime = mtime_of(marker, ec);
+        if (!ec)
+            return fmt::format("{} {}", marker, mtime);
+    }
+    return "-";
+}
+
+bool InstallStamp::upToDate()
+{
+    if (!enabled() || m_saved_fingerprint.empty())
+        return false;
+
+    const std::string marker = markerState();
+    if (marker == "-" || marker != m_saved_marker)
+        return false;
+
+    return fingerprint() == m_saved_fingerprint;
+}
+
+void InstallStamp::save()
+{
+    if (!enabled())
+        return;
+
+    std::error_code ec;
+    fs::create_directories(fs::path(STAMP_PATH).parent_path(), ec);
+    if (ec)
+    {
+        warn("Failed to create {}: {}", fs::path(STAMP_PATH).parent_path().string(), ec.message());
+        return;
+    }
+
+    const std::string fp = fingerprint();
+    auto              f  = fmt::output_file(std::string(STAMP_PATH));
+    f.print("{}\n{}\n{}\n{}\n", fp, markerState(), m_saved_pm_id, pmVersion());
+}
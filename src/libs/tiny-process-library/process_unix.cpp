@@ -10,7 +10,13 @@
 #include <signal.h>
 #include <stdexcept>
 #include <string.h>
+#include <sys/resource.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#endif
 
 namespace TinyProcessLib {
 
@@ -116,6 +122,225 @@ static int portable_execvpe(const char *file, char *const argv[], char *const en
 #endif
 }
 
+Reactor::Reactor(std::size_t buffer_size) : buffer_size(buffer_size) {
+  if(pipe(wake_pipe) != 0)
+    throw std::runtime_error("Reactor: failed to create wake pipe");
+  fcntl(wake_pipe[0], F_SETFL, fcntl(wake_pipe[0], F_GETFL) | O_NONBLOCK);
+  fcntl(wake_pipe[0], F_SETFD, FD_CLOEXEC);
+  fcntl(wake_pipe[1], F_SETFD, FD_CLOEXEC);
+#ifdef __linux__
+  poll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if(poll_fd < 0)
+    throw std::runtime_error("Reactor: epoll_create1 failed");
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.fd = wake_pipe[0];
+  epoll_ctl(poll_fd, EPOLL_CTL_ADD, wake_pipe[0], &ev);
+#endif
+  thread = std::thread([this] { run(); });
+}
+
+Reactor::~Reactor() noexcept {
+  {
+    std::lock_guard<std::mutex> lock(entries_mutex);
+    stopping = true;
+  }
+  wake();
+  if(thread.joinable())
+    thread.join();
+  if(poll_fd >= 0)
+    close(poll_fd);
+  close(wake_pipe[0]);
+  close(wake_pipe[1]);
+}
+
+bool Reactor::add(int fd, std::function<void(const char *bytes, size_t n)> on_read, std::function<void()> on_close) {
+  Entry entry;
+  entry.on_read = std::move(on_read);
+  entry.on_close = std::move(on_close);
+  return watch(fd, std::move(entry));
+}
+
+bool Reactor::add_exit(int pidfd, pid_t pid, std::function<void(int exit_status)> on_exit) {
+  Entry entry;
+  entry.pid = pid;
+  entry.on_exit = std::move(on_exit);
+  return watch(pidfd, std::move(entry));
+}
+
+bool Reactor::watch(int fd, Entry entry) {
+  {
+    std::lock_guard<std::mutex> lock(entries_mutex);
+    entries[fd] = std::move(entry);
+  }
+#ifdef __linux__
+  epoll_event ev{};
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.fd = fd;
+  if(epoll_ctl(poll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    std::lock_guard<std::mutex> lock(entries_mutex);
+    entries.erase(fd);
+    return false;
+  }
+#else
+  wake(); // rebuild the pollfd set
+#endif
+  return true;
+}
+
+void Reactor::wait(int fd) noexcept {
+  std::unique_lock<std::mutex> lock(entries_mutex);
+  entries_cv.wait(lock, [this, fd] { return entries.count(fd) == 0; });
+}
+
+void Reactor::remove(int fd) noexcept {
+  {
+    std::lock_guard<std::mutex> lock(entries_mutex);
+    auto it = entries.find(fd);
+    if(it == entries.end())
+      return;
+    it->second.removed = true;
+  }
+  wake();
+  wait(fd);
+}
+
+bool Reactor::watching(int fd) noexcept {
+  std::lock_guard<std::mutex> lock(entries_mutex);
+  return entries.count(fd) != 0;
+}
+
+void Reactor::unwatch(int fd) noexcept {
+#ifdef __linux__
+  epoll_ctl(poll_fd, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+  {
+    std::lock_guard<std::mutex> lock(entries_mutex);
+    entries.erase(fd);
+  }
+  entries_cv.notify_all();
+}
+
+void Reactor::wake() noexcept {
+  const char c = 0;
+  while(::write(wake_pipe[1], &c, 1) < 0 && errno == EINTR) {
+  }
+}
+
+// Returns false once fd is done, and should no longer be watched.
+// Only the reactor thread erases entries, so the one used here stays valid without holding the lock.
+bool Reactor::read_fd(int fd, char *buffer) noexcept {
+  Entry *entry;
+  {
+    std::lock_guard<std::mutex> lock(entries_mutex);
+    auto it = entries.find(fd);
+    if(it == entries.end())
+      return false;
+    entry = &it->second;
+  }
+
+  if(entry->pid > 0)
+    return reap(fd, entry);
+
+  const ssize_t n = read(fd, buffer, buffer_size);
+  if(n > 0) {
+    if(entry->on_read)
+      entry->on_read(buffer, static_cast<size_t>(n));
+    return true;
+  }
+  if(n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+    return true;
+
+  if(entry->on_close)
+    entry->on_close();
+  unwatch(fd);
+  return false;
+}
+
+// A readable pidfd means its process exited, and reaping it here can't race with the pid being reused.
+bool Reactor::reap(int fd, Entry *entry) noexcept {
+  int exit_status;
+  pid_t pid;
+  do {
+    pid = waitpid(entry->pid, &exit_status, WNOHANG);
+  } while(pid < 0 && errno == EINTR);
+  if(pid == 0)
+    return true; // spurious wakeup, still running
+
+  if(pid < 0)
+    exit_status = -1;
+  else if(exit_status >= 256)
+    exit_status = exit_status >> 8;
+
+  if(entry->on_exit)
+    entry->on_exit(exit_status);
+  unwatch(fd);
+  return false;
+}
+
+void Reactor::run() noexcept {
+  // A single buffer serves every watched fd, callbacks run one at a time on this thread
+  auto buffer = std::unique_ptr<char[]>(new char[buffer_size]);
+  char drain[64];
+#ifdef __linux__
+  std::vector<epoll_event> events(64);
+#else
+  std::vector<pollfd> pollfds;
+#endif
+  while(true) {
+    std::vector<int> removed;
+    {
+      std::lock_guard<std::mutex> lock(entries_mutex);
+      for(auto &entry : entries) {
+        if(entry.second.removed)
+          removed.emplace_back(entry.first);
+      }
+    }
+    for(int fd : removed)
+      unwatch(fd);
+
+    {
+      std::lock_guard<std::mutex> lock(entries_mutex);
+      if(stopping && entries.empty())
+        return;
+#ifndef __linux__
+      pollfds.clear();
+      pollfds.push_back({wake_pipe[0], POLLIN, 0});
+      for(auto &entry : entries)
+        pollfds.push_back({entry.first, POLLIN, 0});
+#endif
+    }
+
+#ifdef __linux__
+    const int n = epoll_wait(poll_fd, events.data(), static_cast<int>(events.size()), -1);
+    if(n < 0 && errno != EINTR)
+      return;
+    for(int i = 0; i < n; ++i) {
+      if(events[i].data.fd == wake_pipe[0]) {
+        while(read(wake_pipe[0], drain, sizeof(drain)) > 0) {
+        }
+        continue;
+      }
+      read_fd(events[i].data.fd, buffer.get());
+    }
+#else
+    const int n = poll(pollfds.data(), static_cast<nfds_t>(pollfds.size()), -1);
+    if(n < 0 && errno != EINTR)
+      return;
+    for(auto &pfd : pollfds) {
+      if(!pfd.revents)
+        continue;
+      if(pfd.fd == wake_pipe[0]) {
+        while(read(wake_pipe[0], drain, sizeof(drain)) > 0) {
+        }
+        continue;
+      }
+      read_fd(pfd.fd, buffer.get());
+    }
+#endif
+  }
+}
+
 Process::Data::Data() noexcept : id(-1) {
 }
 
@@ -179,10 +404,17 @@ Process::id_type Process::open(const std::function<void()> &function) noexcept {
     return pid;
   }
   else if(pid == 0) {
+    // "0" stands for the writer, before it can start anything. Outside of its cgroup its limits wouldn't hold.
+    if(config.cgroup_procs_fd >= 0 && ::write(config.cgroup_procs_fd, "0", 1) != 1)
+      _exit(EXIT_FAILURE);
     if(stdin_fd)
       dup2(stdin_p[0], 0);
+    else if(config.stdin_fd >= 0)
+      dup2(config.stdin_fd, 0);
     if(stdout_fd)
       dup2(stdout_p[1], 1);
+    else if(config.stdout_fd >= 0)
+      dup2(config.stdout_fd, 1);
     if(stderr_fd)
       dup2(stderr_p[1], 2);
     if(stdin_fd) {
@@ -208,6 +440,28 @@ Process::id_type Process::open(const std::function<void()> &function) noexcept {
     }
 
     setpgid(0, 0);
+
+    // Failures are ignored, the process runs as it would have without them
+#ifdef __linux__
+    if(!config.priority.cpus.empty()) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      for(int cpu : config.priority.cpus) {
+        if(cpu >= 0 && cpu < CPU_SETSIZE)
+          CPU_SET(cpu, &cpus);
+      }
+      sched_setaffinity(0, sizeof(cpus), &cpus);
+    }
+    if(config.priority.io_class > 0)
+      syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0, (config.priority.io_class << 13) | config.priority.io_level);
+#endif
+    if(config.priority.nice != 0) {
+      // -1 is a valid niceness, only errno tells a failure
+      errno = 0;
+      const int niceness = getpriority(PRIO_PROCESS, 0);
+      if(errno == 0)
+        setpriority(PRIO_PROCESS, 0, niceness + config.priority.nice);
+    }
     // TODO: See here on how to emulate tty for colors: http://stackoverflow.com/questions/1401002/trick-an-application-into-thinking-its-stdin-is-interactive-not-a-pipe
     // TODO: One solution is: echo "command;exit"|script -q /dev/null
 
@@ -322,9 +576,24 @@ Process::id_type Process::open(const std::string &command, const std::string &pa
 }
 
 void Process::async_read() noexcept {
+  if(data.id > 0 && config.reactor && config.on_exit)
+    watch_exit();
+
   if(data.id <= 0 || (!stdout_fd && !stderr_fd))
     return;
 
+  if(config.reactor) {
+    if(stdout_fd) {
+      fcntl(*stdout_fd, F_SETFL, fcntl(*stdout_fd, F_GETFL) | O_NONBLOCK);
+      config.reactor->add(*stdout_fd, read_stdout, config.on_stdout_close);
+    }
+    if(stderr_fd) {
+      fcntl(*stderr_fd, F_SETFL, fcntl(*stderr_fd, F_GETFL) | O_NONBLOCK);
+      config.reactor->add(*stderr_fd, read_stderr, config.on_stderr_close);
+    }
+    return;
+  }
+
   stdout_stderr_thread = std::thread([this] {
     std::vector<pollfd> pollfds;
     std::bitset<2> fd_is_stdout;
@@ -385,10 +654,48 @@ void Process::async_read() noexcept {
   });
 }
 
+void Process::watch_exit() noexcept {
+#ifdef SYS_pidfd_open
+  // Opened right after fork(): the child can't have been reaped yet, so the pidfd refers to it for sure
+  const int pidfd = static_cast<int>(syscall(SYS_pidfd_open, data.id, 0));
+  if(pidfd < 0)
+    return; // ENOSYS on kernels older than 5.3, get_exit_status() still works
+  fcntl(pidfd, F_SETFD, FD_CLOEXEC);
+
+  exit_fd = pidfd;
+  if(!config.reactor->add_exit(pidfd, data.id, [this](int exit_status) {
+       data.exit_status = exit_status;
+       {
+         std::lock_guard<std::mutex> lock(close_mutex);
+         closed = true;
+       }
+       config.on_exit(exit_status);
+     })) {
+    close(pidfd);
+    exit_fd = -1;
+  }
+#endif
+}
+
+void Process::unwatch_exit() noexcept {
+  if(exit_fd < 0)
+    return;
+  config.reactor->remove(exit_fd);
+  close(exit_fd);
+  exit_fd = -1;
+}
+
 int Process::get_exit_status() noexcept {
   if(data.id <= 0)
     return -1;
 
+  if(exit_fd >= 0) {
+    // The reactor reaps the process, wait for it to do so
+    config.reactor->wait(exit_fd);
+    close_fds();
+    return data.exit_status;
+  }
+
   int exit_status;
   id_type pid;
   do {
@@ -421,6 +728,14 @@ bool Process::try_get_exit_status(int &exit_status) noexcept {
     return true;
   }
 
+  if(exit_fd >= 0) {
+    if(config.reactor->watching(exit_fd))
+      return false;
+    close_fds();
+    exit_status = data.exit_status;
+    return true;
+  }
+
   const id_type pid = waitpid(data.id, &exit_status, WNOHANG);
   if(pid < 0 && errno == ECHILD) {
     // PID doesn't exist anymore, set previously sampled exit status (or -1)
@@ -448,8 +763,15 @@ bool Process::try_get_exit_status(int &exit_status) noexcept {
 }
 
 void Process::close_fds() noexcept {
+  unwatch_exit();
   if(stdout_stderr_thread.joinable())
     stdout_stderr_thread.join();
+  if(config.reactor && data.id > 0) {
+    if(stdout_fd)
+      config.reactor->wait(*stdout_fd);
+    if(stderr_fd)
+      config.reactor->wait(*stderr_fd);
+  }
 
   if(stdin_fd)
     close_stdin();
@@ -527,6 +849,15 @@ void Process::kill(id_type id, bool force) noexcept {
 void Process::signal(int signum) noexcept {
   std::lock_guard<std::mutex> lock(close_mutex);
   if(data.id > 0 && !closed) {
+#ifdef SYS_pidfd_send_signal
+    // Can't hit an unrelated process that reused the pid. Once it got through, the leader isn't reaped yet,
+    // so its pid is still the id of its group, and the rest of the group can be signalled through it.
+    if(exit_fd >= 0) {
+      if(syscall(SYS_pidfd_send_signal, exit_fd, signum, nullptr, 0) == 0)
+        ::kill(-data.id, signum);
+      return;
+    }
+#endif
     ::kill(-data.id, signum);
     ::kill(data.id, signum);
   }
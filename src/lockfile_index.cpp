@@ -0,0 +1,870 @@
+#include "lockfile_index.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "rapidjson/error/en.h"
+#include "rapidjson/filereadstream.h"
+#include "rapidjson/reader.h"
+#include "util.hpp"
+
+#define TOML_HEADER_ONLY 0
+#include "toml++/toml.hpp"
+
+namespace fs = std::filesystem;
+
+static constexpr std::string_view INDEX_PATH = ".ulpm/deps.idx";
+static constexpr char             INDEX_MAGIC[8] = { 'U', 'L', 'P', 'M', 'D', 'E', 'P', '1' };
+
+using dep_list_t = std::vector<std::pair<std::string, std::string>>;  // name, range/version
+
+static std::string read_file(const std::string& path)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f)
+        die("Failed to open '{}': {}", path, strerror(errno));
+    return std::string(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+// "name@range", the name of a scoped package starts with '@' too
+static std::string_view name_of(const std::string_view descriptor)
+{
+    return descriptor.substr(0, descriptor.find('@', 1));
+}
+
+static std::string project_name()
+{
+    const std::string name = fs::current_path().filename().string();
+    return name.empty() ? "(root)" : name;
+}
+
+// package.json's name and every dependency it declares
+static std::pair<std::string, dep_list_t> read_package_json()
+{
+    std::pair<std::string, dep_list_t> ret{ project_name(), {} };
+    if (!fs::exists("package.json"))
+        return ret;
+
+    FileHandler         f;
+    rapidjson::Document doc;
+    f.open("package.json", "r");
+    JsonUtils::populate_doc(f, doc);
+    if (!doc.IsObject())
+        return ret;
+
+    if (doc.HasMember("name") && doc["name"].IsString())
+        ret.first = doc["name"].GetString();
+    for (const char* kind : { "dependencies", "devDependencies", "optionalDependencies" })
+    {
+        if (!doc.HasMember(kind) || !doc[kind].IsObject())
+            continue;
+        for (const auto& dep : doc[kind].GetObj())
+            if (dep.value.IsString())
+                ret.second.emplace_back(dep.name.GetString(), dep.value.GetString());
+    }
+    return ret;
+}
+
+/*
+ * package-lock.json
+ */
+
+// Only the "packages" map is kept, and only the bits of it a graph or
+// ulpm store link needs. Reading it through SAX never builds the DOM of a
+// file that can be tens of MB.
+struct NpmLockHandler : rapidjson::BaseReaderHandler<rapidjson::UTF8<>, NpmLockHandler>
+{
+    // 1 is the document, 2 "packages", 3 a package, 4 its dependencies or bins
+    int         depth   = 0;
+    int         skip    = 0;  // depth of the value being skipped, if any
+    bool        in_deps = false;
+    bool        in_bin  = false;
+    std::string key, root_name;
+
+    npm_package_t              cur;
+    std::vector<npm_package_t> packages;
+
+    bool Key(const char* str, rapidjson::SizeType len, bool)
+    {
+        key.assign(str, len);
+        return true;
+    }
+
+    bool StartObject()
+    {
+        ++depth;
+        if (skip)
+            return true;
+
+        if (depth == 2 && key != "packages")
+        {
+            skip = depth;
+        }
+        else if (depth == 3)
+        {
+            cur      = {};
+            cur.path = key;
+        }
+        else if (depth == 4)
+        {
+            // devDependencies are only installed for the project itself
+            in_deps = key == "dependencies" || key == "optionalDependencies" || key == "peerDependencies" ||
+                      (key == "devDependencies" && cur.path.empty());
+            in_bin = key == "bin";
+            if (!in_deps && !in_bin)
+                skip = depth;
+        }
+        else if (depth > 4)
+        {
+            skip = depth;
+        }
+        return true;
+    }
+
+    bool EndObject(rapidjson::SizeType)
+    {
+        if (skip == depth)
+            skip = 0;
+        else if (!skip && depth == 3)
+            packages.push_back(std::move(cur));
+        else if (!skip && depth == 4)
+            in_deps = in_bin = false;
+        --depth;
+        return true;
+    }
+
+    bool StartArray()
+    {
+        ++depth;
+        if (!skip)
+            skip = depth;
+        return true;
+    }
+
+    bool EndArray(rapidjson::SizeType)
+    {
+        if (skip == depth)
+            skip = 0;
+        --depth;
+        return true;
+    }
+
+    bool String(const char* str, rapidjson::SizeType len, bool)
+    {
+        if (skip)
+            return true;
+
+        if (depth == 1 && key == "name")
+            root_name.assign(str, len);
+        else if (depth == 3 && key == "name")
+            cur.name.assign(str, len);
+        else if (depth == 3 && key == "version")
+            cur.version.assign(str, len);
+        else if (depth == 3 && key == "resolved")
+            cur.resolved.assign(str, len);
+        else if (depth == 3 && key == "integrity")
+            cur.integrity.assign(str, len);
+        else if (depth == 4 && in_deps)
+            cur.deps.push_back(key);
+        else if (depth == 4 && in_bin)
+            cur.bins.emplace_back(key, std::string(str, len));
+        return true;
+    }
+
+    bool Bool(bool b)
+    {
+        if (skip || depth != 3)
+            return true;
+
+        if (key == "link")
+            cur.link = b;
+        else if (key == "optional")
+            cur.optional = b;
+        else if (key == "inBundle")
+            cur.in_bundle = b;
+        else if (key == "hasInstallScript")
+            cur.has_install_script = b;
+        return true;
+    }
+};
+
+std::vector<npm_package_t> read_npm_lock(const std::string& path)
+{
+    FileHandler f;
+    f.open(path, "rb");
+
+    char                      buf[UINT16_MAX];
+    rapidjson::FileReadStream stream(f, buf, sizeof(buf));
+    rapidjson::Reader         reader;
+    NpmLockHandler            handler;
+    if (!reader.Parse(stream, handler))
+        die("Failed to parse {}: {} At offset {}",
+            path,
+            rapidjson::GetParseError_En(reader.GetParseErrorCode()),
+            reader.GetErrorOffset());
+
+    std::vector<npm_package_t>& packages = handler.packages;
+    if (packages.empty())
+        die("{} has no \"packages\", only lockfileVersion 2 and later are supported.\n"
+            "Running 'npm install' with npm 7 or later upgrades it.",
+            path);
+
+    for (npm_package_t& pkg : packages)
+    {
+        if (pkg.path.empty() && pkg.name.empty())
+            pkg.name = handler.root_name;
+        else if (pkg.name.empty())
+            pkg.name = pkg.path.substr(pkg.path.rfind("node_modules/") + 13);
+    }
+    return std::move(packages);
+}
+
+static DepGraph parse_npm_lock(const std::string& path)
+{
+    const std::vector<npm_package_t> packages = read_npm_lock(path);
+
+    std::unordered_map<std::string_view, uint32_t> by_path;
+    for (uint32_t i = 0; i < packages.size(); ++i)
+        by_path.emplace(packages[i].path, i);
+    if (!by_path.count(""))
+        die("{} has no entry for the project itself", path);
+
+    DepGraphBuilder b;
+    for (const npm_package_t& pkg : packages)
+        b.addNode(pkg.name.empty() ? project_name() : pkg.name, pkg.link ? "link:" + pkg.resolved : pkg.version);
+    b.setRoot(by_path[""]);
+
+    // workspaces are linked into node_modules, the link stands for its target
+    auto target = [&](uint32_t i) {
+        if (packages[i].link)
+            if (auto it = by_path.find(packages[i].resolved); it != by_path.end())
+                return it->second;
+        return i;
+    };
+
+    // Node's resolution: the closest node_modules going up from the package
+    for (uint32_t i = 0; i < packages.size(); ++i)
+    {
+        for (const std::string& dep : packages[i].deps)
+        {
+            std::string_view dir = packages[i].path;
+            for (;;)
+            {
+                const std::string candidate =
+                    dir.empty() ? "node_modules/" + dep : fmt::format("{}/node_modules/{}", dir, dep);
+                if (auto it = by_path.find(candidate); it != by_path.end())
+                {
+                    b.addEdge(i, target(it->second));
+                    break;
+                }
+                if (dir.empty())
+                    break;
+
+                const size_t parent = dir.rfind("/node_modules/");
+                dir                 = parent == dir.npos ? std::string_view() : dir.substr(0, parent);
+            }
+        }
+    }
+
+    return b.finish();
+}
+
+/*
+ * Cargo.lock
+ */
+
+static DepGraph parse_cargo_lock(const std::string& path)
+{
+    toml::table lock;
+    try
+    {
+        lock = toml::parse_file(path);
+    }
+    catch (const toml::parse_error& err)
+    {
+        die("Parsing {} failed:\n"
+            "{}\n"
+            "\t(error occurred at line {} column {})",
+            path,
+            err.description(),
+            err.source().begin.line,
+            err.source().begin.column);
+    }
+
+    struct crate_t
+    {
+        std::string              name, version;
+        bool                     member;
+        std::vector<std::string> deps;
+    };
+
+    std::vector<crate_t> crates;
+    if (const toml::array* array = lock["package"].as_array())
+    {
+        for (const toml::node& node : *array)
+        {
+            const toml::table* tbl = node.as_table();
+            if (!tbl)
+                continue;
+
+            crate_t crate;
+            crate.name    = (*tbl)["name"].value_or(std::string());
+            crate.version = (*tbl)["version"].value_or(std::string());
+            // crates of the workspace itself don't come from any source
+            crate.member = !tbl->contains("source");
+            if (const toml::array* deps = (*tbl)["dependencies"].as_array())
+                for (const toml::node& dep : *deps)
+                    crate.deps.push_back(dep.value_or(std::string()));
+            crates.push_back(std::move(crate));
+        }
+    }
+
+    DepGraphBuilder                                        b;
+    std::unordered_map<std::string, std::vector<uint32_t>> by_name;
+    std::vector<uint32_t>                                  members;
+    for (const crate_t& crate : crates)
+    {
+        const uint32_t id = b.addNode(crate.name, crate.version);
+        by_name[crate.name].push_back(id);
+        if (crate.member)
+            members.push_back(id);
+    }
+
+    if (members.size() == 1)
+    {
+        b.setRoot(members.front());
+    }
+    else
+    {
+        const uint32_t root = b.addNode(project_name(), "");
+        for (const uint32_t member : members)
+            b.addEdge(root, member);
+        b.setRoot(root);
+    }
+
+    // a dependency is "name", or "name version [(source)]" when more than one
+    // version of it is locked
+    for (uint32_t id = 0; id < crates.size(); ++id)
+    {
+        for (const std::string& dep : crates[id].deps)
+        {
+            const std::vector<std::string> words = split(dep, ' ');
+            if (words.empty())
+                continue;
+
+            const auto it = by_name.find(words[0]);
+            if (it == by_name.end())
+                continue;
+
+            for (const uint32_t candidate : it->second)
+            {
+                if (words.size() == 1 || crates[candidate].version == words[1])
+                {
+                    b.addEdge(id, candidate);
+                    break;
+                }
+            }
+        }
+    }
+
+    return b.finish();
+}
+
+/*
+ * yarn.lock and pnpm-lock.yaml
+ */
+
+static std::string_view trim(std::string_view str)
+{
+    const size_t begin = str.find_first_not_of(" \t\r");
+    if (begin == str.npos)
+        return {};
+    return str.substr(begin, str.find_last_not_of(" \t\r") - begin + 1);
+}
+
+static std::string_view unquote(std::string_view str)
+{
+    str = trim(str);
+    if (str.length() >= 2 && (str[0] == '"' || str[0] == '\'') && str.back() == str[0])
+        return str.substr(1, str.length() - 2);
+    return str;
+}
+
+// Both formats are simple enough (block mappings, one key per line) that
+// splitting every line into indentation, key and value is all it takes.
+// Handles "key: value", "key:" and yarn classic's "key value".
+struct yaml_line_t
+{
+    size_t           indent = 0;
+    std::string_view key, value;
+};
+
+static bool parse_yaml_line(std::string_view line, yaml_line_t& out)
+{
+    const size_t indent = line.find_first_not_of(' ');
+    if (indent == line.npos || line[indent] == '#' || trim(line).empty())
+        return false;
+
+    out.indent = indent;
+    line       = trim(line.substr(indent));
+
+    size_t key_end;
+    if (line[0] == '"' || line[0] == '\'')
+    {
+        key_end = line.find(line[0], 1);
+        if (key_end == line.npos)
+            return false;
+        out.key = line.substr(1, key_end - 1);
+        line.remove_prefix(key_end + 1);
+        if (!line.empty() && line[0] == ':')
+            line.remove_prefix(1);
+        out.value = unquote(line);
+        return true;
+    }
+
+    if ((key_end = line.find(": ")) != line.npos)
+    {
+        out.key   = line.substr(0, key_end);
+        out.value = unquote(line.substr(key_end + 2));
+    }
+    else if (line.back() == ':')
+    {
+        out.key   = line.substr(0, line.length() - 1);
+        out.value = {};
+    }
+    else
+    {
+        key_end   = line.find(' ');
+        out.key   = line.substr(0, key_end);
+        out.value = key_end == line.npos ? std::string_view() : unquote(line.substr(key_end + 1));
+    }
+    return true;
+}
+
+template <typename F>
+static void for_each_line(const std::string_view text, F&& f)
+{
+    size_t pos = 0;
+    while (pos < text.length())
+    {
+        size_t end = text.find('\n', pos);
+        if (end == text.npos)
+            end = text.length();
+        f(text.substr(pos, end - pos));
+        pos = end + 1;
+    }
+}
+
+// yarn classic:                          yarn berry:
+//   "a@^1.0.0", a@^1.1.0:                  "a@npm:^1.0.0, a@npm:^1.1.0":
+//     version "1.2.0"                        version: 1.2.0
+//     dependencies:                          dependencies:
+//       b "^2.0.0"                             b: ^2.0.0
+static DepGraph parse_yarn_lock(const std::string& path)
+{
+    struct entry_t
+    {
+        std::string name, version;
+        dep_list_t  deps;
+    };
+
+    const std::string                         text = read_file(path);
+    std::vector<entry_t>                      entries;
+    std::unordered_map<std::string, uint32_t> by_descriptor;
+    std::optional<uint32_t>                   workspace_root;
+    bool                                      in_deps = false;
+    bool                                      in_entry = false;
+
+    for_each_line(text, [&](const std::string_view line) {
+        yaml_line_t l;
+        if (!parse_yaml_line(line, l))
+            return;
+
+        if (l.indent == 0)
+        {
+            in_entry = l.key != "__metadata";
+            in_deps  = false;
+            if (!in_entry)
+                return;
+
+            // The parsed key is only the first descriptor, take them all.
+            // Berry quotes the whole list, classic each descriptor.
+            std::string_view descriptors = trim(line);
+            descriptors.remove_suffix(1);  // ':'
+            entries.emplace_back();
+            for (const std::string& part : split(descriptors, ','))
+            {
+                std::string_view desc = trim(part);
+                if (!desc.empty() && desc.front() == '"')
+                    desc.remove_prefix(1);
+                if (!desc.empty() && desc.back() == '"')
+                    desc.remove_suffix(1);
+                if (desc.empty())
+                    continue;
+
+                if (entries.back().name.empty())
+                    entries.back().name = name_of(desc);
+                by_descriptor.emplace(desc, entries.size() - 1);
+                if (desc.ends_with("@workspace:."))
+                    workspace_root = entries.size() - 1;
+            }
+            return;
+        }
+
+        if (!in_entry)
+            return;
+
+        if (l.indent == 2)
+        {
+            in_deps = l.value.empty() && (l.key == "dependencies" || l.key == "optionalDependencies");
+            if (l.key == "version")
+                entries.back().version = l.value;
+        }
+        else if (l.indent == 4 && in_deps)
+        {
+            entries.back().deps.emplace_back(l.key, l.value);
+        }
+    });
+
+    // berry leaves the default npm: protocol out of the dependency ranges
+    auto resolve = [&](const std::string& name, const std::string& range) -> std::optional<uint32_t> {
+        for (const std::string& desc : { name + "@" + range, name + "@npm:" + range })
+            if (auto it = by_descriptor.find(desc); it != by_descriptor.end())
+                return it->second;
+        return std::nullopt;
+    };
+
+    DepGraphBuilder b;
+    for (const entry_t& entry : entries)
+        b.addNode(entry.name, entry.version);
+
+    for (uint32_t id = 0; id < entries.size(); ++id)
+        for (const auto& [name, range] : entries[id].deps)
+            if (const std::optional<uint32_t> dep = resolve(name, range))
+                b.addEdge(id, *dep);
+
+    // classic doesn't lock the project itself, its deps come from package.json
+    if (workspace_root)
+    {
+        b.setRoot(*workspace_root);
+    }
+    else
+    {
+        const auto [name, deps] = read_package_json();
+        const uint32_t root     = b.addNode(name, "");
+        for (const auto& [dep, range] : deps)
+            if (const std::optional<uint32_t> id = resolve(dep, range))
+                b.addEdge(root, *id);
+        b.setRoot(root);
+    }
+
+    return b.finish();
+}
+
+// lockfileVersion 6:                     9:
+//   dependencies:                          importers:
+//     a:                                     .:
+//       specifier: ^1.0.0                      dependencies:
+//       version: 1.2.0                           a:
+//   packages:                                      specifier: ^1.0.0
+//     /a@1.2.0:                                    version: 1.2.0
+//       dependencies:                      snapshots:
+//         b: 2.0.0(c@1.0.0)                  a@1.2.0:
+//                                              dependencies:
+//                                                b: 2.0.0(c@1.0.0)
+static DepGraph parse_pnpm_lock(const std::string& path)
+{
+    enum class Section
+    {
+        Other,
+        Importers,
+        RootDeps,
+        Packages
+    };
+
+    const std::string                         text = read_file(path);
+    std::vector<std::pair<std::string, dep_list_t>> entries;  // key ("name@version(peers)") and deps
+    std::unordered_map<std::string, uint32_t> by_key;
+    dep_list_t                                root_deps;
+    Section                                   section = Section::Other;
+    bool                                      in_deps = false;
+    std::string                               dep_name;
+
+    auto entry = [&](std::string_view key) {
+        if (key[0] == '/')
+            key.remove_prefix(1);
+        const auto [it, inserted] = by_key.try_emplace(std::string(key), entries.size());
+        if (inserted)
+            entries.emplace_back(key, dep_list_t{});
+        return it->second;
+    };
+
+    uint32_t cur = 0;
+    for_each_line(text, [&](const std::string_view line) {
+        yaml_line_t l;
+        if (!parse_yaml_line(line, l))
+            return;
+
+        if (l.indent == 0)
+        {
+            if (l.key == "lockfileVersion" && hasStart(l.value, "5"))
+                die("{} is too old (lockfileVersion {}), only 6 and later are supported", path, l.value);
+
+            in_deps = false;
+            if (l.key == "importers")
+                section = Section::Importers;
+            else if (l.key == "dependencies" || l.key == "devDependencies" || l.key == "optionalDependencies")
+                section = Section::RootDeps;
+            else if (l.key == "packages" || l.key == "snapshots")
+                section = Section::Packages;
+            else
+                section = Section::Other;
+            return;
+        }
+
+        // the deps of importers are "name:" followed by "version: x", or
+        // "name: x" at the same indentation, both relative to where the list starts
+        auto root_dep = [&](const size_t list_indent) {
+            if (l.indent == list_indent)
+            {
+                dep_name = l.key;
+                if (!l.value.empty())
+                    root_deps.emplace_back(dep_name, l.value);
+            }
+            else if (l.indent == list_indent + 2 && l.key == "version")
+            {
+                root_deps.emplace_back(dep_name, l.value);
+            }
+        };
+
+        switch (section)
+        {
+            case Section::Other: break;
+            case Section::Importers:
+                // every workspace package hangs off the project
+                if (l.indent == 4)
+                    in_deps = l.key == "dependencies" || l.key == "devDependencies" || l.key == "optionalDependencies";
+                else if (l.indent > 4 && in_deps)
+                    root_dep(6);
+                break;
+            case Section::RootDeps: root_dep(2); break;
+            case Section::Packages:
+                if (l.indent == 2)
+                {
+                    cur     = entry(l.key);
+                    in_deps = false;
+                }
+                else if (l.indent == 4)
+                {
+                    in_deps = l.value.empty() && (l.key == "dependencies" || l.key == "optionalDependencies");
+                }
+                else if (l.indent == 6 && in_deps)
+                {
+                    entries[cur].second.emplace_back(l.key, l.value);
+                }
+                break;
+        }
+    });
+
+    auto resolve = [&](const std::string& name, const std::string& version) -> std::optional<uint32_t> {
+        // link:../pkg are workspace packages, not in the lockfile
+        if (auto it = by_key.find(name + "@" + version); it != by_key.end())
+            return it->second;
+        return std::nullopt;
+    };
+
+    DepGraphBuilder b;
+    for (const auto& [key, deps] : entries)
+    {
+        const std::string_view k(key);
+        const std::string_view name = name_of(k);
+        std::string_view       version = k.substr(std::min(name.length() + 1, k.length()));
+        b.addNode(name, version.substr(0, version.find('(')));
+    }
+
+    for (uint32_t id = 0; id < entries.size(); ++id)
+        for (const auto& [name, version] : entries[id].second)
+            if (const std::optional<uint32_t> dep = resolve(name, version))
+                b.addEdge(id, *dep);
+
+    const uint32_t root = b.addNode(read_package_json().first, "");
+    for (const auto& [name, version] : root_deps)
+        if (const std::optional<uint32_t> dep = resolve(name, version))
+            b.addEdge(root, *dep);
+    b.setRoot(root);
+
+    return b.finish();
+}
+
+/*
+ * .ulpm/deps.idx
+ */
+
+// what the index was built from, if any of it changes the index is stale
+struct index_key_t
+{
+    std::string lockfile;
+    uint64_t    lock_size = 0, pkg_size = 0;
+    int64_t     lock_mtime = 0, pkg_mtime = 0;
+
+    bool operator==(const index_key_t&) const = default;
+};
+
+static index_key_t index_key_of(const std::string& lockfile)
+{
+    index_key_t     key;
+    std::error_code ec;
+    key.lockfile   = lockfile;
+    key.lock_size  = fs::file_size(lockfile, ec);
+    key.lock_mtime = fs::last_write_time(lockfile, ec).time_since_epoch().count();
+    // yarn classic and pnpm take the project's deps or name from there
+    if (fs::exists("package.json", ec))
+    {
+        key.pkg_size  = fs::file_size("package.json", ec);
+        key.pkg_mtime = fs::last_write_time("package.json", ec).time_since_epoch().count();
+    }
+    return key;
+}
+
+template <typename T>
+static bool read_pod(std::ifstream& f, T& v)
+{
+    return static_cast<bool>(f.read(reinterpret_cast<char*>(&v), sizeof(v)));
+}
+
+template <typename C>
+static void write_array(std::ostream& f, const C& c)
+{
+    write_pod(f, static_cast<uint64_t>(c.size()));
+    f.write(reinterpret_cast<const char*>(c.data()), c.size() * sizeof(c[0]));
+}
+
+// end is the file's size, a length that can't fit in what's left of it is junk
+template <typename C>
+static bool read_array(std::ifstream& f, C& c, const uint64_t end)
+{
+    uint64_t n = 0;
+    if (!read_pod(f, n))
+        return false;
+    const std::streamoff pos = f.tellg();
+    if (pos < 0 || n > (end - static_cast<uint64_t>(pos)) / sizeof(c[0]))
+        return false;
+    c.resize(n);
+    return static_cast<bool>(f.read(reinterpret_cast<char*>(c.data()), n * sizeof(c[0])));
+}
+
+static std::optional<DepGraph> load_index(const index_key_t& key)
+{
+    std::ifstream f{ std::string(INDEX_PATH), std::ios::binary | std::ios::ate };
+    if (!f)
+        return std::nullopt;
+    const std::streamoff end = f.tellg();
+    if (end < 0 || !f.seekg(0))
+        return std::nullopt;
+
+    char        magic[sizeof(INDEX_MAGIC)];
+    index_key_t saved;
+    DepGraph    graph;
+    if (!f.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), INDEX_MAGIC))
+        return std::nullopt;
+    if (!read_array(f, saved.lockfile, end) || !read_pod(f, saved.lock_size) || !read_pod(f, saved.lock_mtime) ||
+        !read_pod(f, saved.pkg_size) || !read_pod(f, saved.pkg_mtime) || !(saved == key))
+        return std::nullopt;
+
+    if (!read_pod(f, graph.root) || !read_array(f, graph.strings, end) ||
+        !read_array(f, graph.string_offsets, end) || !read_array(f, graph.node_name, end) ||
+        !read_array(f, graph.node_version, end) || !read_array(f, graph.edge_offsets, end) ||
+        !read_array(f, graph.edges, end))
+        return std::nullopt;
+
+    // don't trust a truncated or foreign file with out of bounds indices
+    const size_t n = graph.node_name.size();
+    if (graph.node_version.size() != n || graph.edge_offsets.size() != n + 1 || (n && graph.root >= n) ||
+        graph.string_offsets.empty() || graph.string_offsets.front() != 0 ||
+        graph.string_offsets.back() != graph.strings.size() || graph.edge_offsets.front() != 0 ||
+        graph.edge_offsets.back() != graph.edges.size())
+        return std::nullopt;
+    if (!std::is_sorted(graph.string_offsets.begin(), graph.string_offsets.end()) ||
+        !std::is_sorted(graph.edge_offsets.begin(), graph.edge_offsets.end()))
+        return std::nullopt;
+
+    const size_t nstrings = graph.string_offsets.size() - 1;
+    auto         in_range = [](const std::vector<uint32_t>& ids, const size_t bound) {
+        return std::all_of(ids.begin(), ids.end(), [bound](const uint32_t id) { return id < bound; });
+    };
+    if (!in_range(graph.node_name, nstrings) || !in_range(graph.node_version, nstrings) || !in_range(graph.edges, n))
+        return std::nullopt;
+
+    return graph;
+}
+
+static void save_index(const index_key_t& key, const DepGraph& graph)
+{
+    atomic_write_file(std::string(INDEX_PATH), [&](std::ostream& f) {
+        f.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        write_array(f, key.lockfile);
+        write_pod(f, key.lock_size);
+        write_pod(f, key.lock_mtime);
+        write_pod(f, key.pkg_size);
+        write_pod(f, key.pkg_mtime);
+
+        write_pod(f, graph.root);
+        write_array(f, graph.strings);
+        write_array(f, graph.string_offsets);
+        write_array(f, graph.node_name);
+        write_array(f, graph.node_version);
+        write_array(f, graph.edge_offsets);
+        write_array(f, graph.edges);
+        return true;
+    });
+}
+
+std::string find_lockfile(const std::string_view package_manager)
+{
+    static constexpr std::pair<std::string_view, std::string_view> lockfiles[] = {
+        { "npm", "package-lock.json" }, { "npm", "npm-shrinkwrap.json" }, { "yarn", "yarn.lock" },
+        { "pnpm", "pnpm-lock.yaml" },   { "cargo", "Cargo.lock" },
+    };
+
+    for (const auto& [pm, file] : lockfiles)
+        if ((package_manager.empty() || pm == package_manager) && fs::exists(file))
+            return std::string(file);
+    return {};
+}
+
+DepGraph load_dep_graph(const std::string& lockfile)
+{
+    const auto        start = std::chrono::steady_clock::now();
+    const index_key_t key   = index_key_of(lockfile);
+    if (std::optional<DepGraph> graph = load_index(key))
+        return std::move(*graph);
+
+    DepGraph          graph;
+    const std::string file = fs::path(lockfile).filename().string();
+    if (file == "Cargo.lock")
+        graph = parse_cargo_lock(lockfile);
+    else if (file == "yarn.lock")
+        graph = parse_yarn_lock(lockfile);
+    else if (file == "pnpm-lock.yaml")
+        graph = parse_pnpm_lock(lockfile);
+    else
+        graph = parse_npm_lock(lockfile);
+
+    debug("Indexed {} ({} packages, {} edges) in {}ms",
+          lockfile,
+          graph.nodeCount(),
+          graph.edges.size(),
+          std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+
+    save_index(key, graph);
+    return graph;
+}
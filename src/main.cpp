@@ -23,7 +23,10 @@
  *
  */
 
+#include <algorithm>
+#include <charconv>
 #include <cstdlib>
+#include <iterator>
 #include <memory>
 #include <optional>
 #include <string>
@@ -60,12 +63,28 @@ enum class Op
     None,
     Init,
     Set,
+    Deps,
+    Du,
+    Clean,
+    Store,
+    Projects,
+    Affected,
+    Hash,
+    Cache,
     External
 };
 
 static const std::unordered_map<std::string_view, Op> k_op_map = {
     { "init", Op::Init },
     { "set", Op::Set },
+    { "deps", Op::Deps },
+    { "du", Op::Du },
+    { "clean", Op::Clean },
+    { "store", Op::Store },
+    { "projects", Op::Projects },
+    { "affected", Op::Affected },
+    { "hash", Op::Hash },
+    { "cache", Op::Cache },
 };
 
 struct parse_result_t
@@ -155,20 +174,362 @@ static void parse_manifest_fields(int                    argc,
     }
 }
 
-static void parse_run_args(int argc, char* argv[], std::vector<std::string>& out_args)
+static void parse_run_args(int argc, char* argv[], cmd_options_t& opts)
 {
-    const struct option long_opts[] = { { "help", no_argument, nullptr, 'h' }, { 0, 0, 0, 0 } };
-    int                 opt;
-    while ((opt = getopt_long(argc, argv, "+h", long_opts, nullptr)) != -1)
-    {
+    // clang-format off
+    const struct option long_opts[] = {
+        {"help",              no_argument,       nullptr, 'h'},
+        {"parallel",          no_argument,       nullptr, 'p'},
+        {"sequential",        no_argument,       nullptr, 's'},
+        {"continue-on-error", no_argument,       nullptr, 'k'},
+        {"force",             no_argument,       nullptr, 'f'},
+        {"affected",          no_argument,       nullptr, 'a'},
+        {"since",             required_argument, nullptr, 'S'},
+        {"no-cache",          no_argument,       nullptr, 'n'},
+        {"jobs",              required_argument, nullptr, 'j'},
+        {"explain-schedule",  no_argument,       nullptr, 'E'},
+        {"memory",            required_argument, nullptr, 'm'},
+        {"grace",             required_argument, nullptr, 'G'},
+        {0, 0, 0, 0}
+    };
+    // clang-format on
+
+    const auto apply = [&](const int opt) {
         switch (opt)
         {
             case 'h': help(ulpm_help_run, EXIT_SUCCESS);
             case '?': help(ulpm_help_run, EXIT_FAILURE);
+            case 'p': opts.run_groups.push_back({ true, {} }); break;
+            case 's': opts.run_groups.push_back({ false, {} }); break;
+            case 'k': opts.keep_going = true; break;
+            case 'f': opts.install_force = true; break;
+            case 'a': opts.affected = true; break;
+            case 'S': opts.affected_since = optarg; break;
+            case 'n': opts.run_no_cache = true; break;
+            case 'E': opts.run_explain = true; break;
+            case 'j':
+            {
+                const std::string_view arg = optarg;
+                if (std::from_chars(arg.data(), arg.data() + arg.size(), opts.run_jobs).ec != std::errc() ||
+                    opts.run_jobs == 0)
+                    die("--jobs must be a positive number, got '{}'", arg);
+                break;
+            }
+            case 'm':
+                if (!parse_size(optarg, opts.run_memory))
+                    die("Invalid memory budget '{}'", optarg);
+                break;
+            case 'G':
+                if (!parse_duration(optarg, opts.run_grace))
+                    die("Invalid grace period '{}'", optarg);
+                break;
+        }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+hpskfanj:m:", long_opts, nullptr)) != -1)
+        apply(opt);
+
+    // a single script, the rest is passed to it untouched
+    if (opts.run_groups.empty())
+    {
+        for (int i = optind; i < argc; ++i)
+            opts.arguments.emplace_back(argv[i]);
+        return;
+    }
+
+    // getopt stops at the first script name, any option may follow the
+    // scripts too, -p and -s starting new groups
+    while (optind < argc)
+    {
+        const std::string_view arg = argv[optind];
+        if (arg == "--")
+        {
+            opts.arguments.assign(argv + optind + 1, argv + argc);
+            break;
+        }
+
+        if (arg.length() < 2 || arg[0] != '-')
+        {
+            opts.run_groups.back().scripts.emplace_back(arg);
+            ++optind;
+            continue;
+        }
+
+        if ((opt = getopt_long(argc, argv, "+hpskfanj:m:", long_opts, nullptr)) == -1)
+            break;
+        apply(opt);
+    }
+
+    std::erase_if(opts.run_groups, [](const run_group_t& group) { return group.scripts.empty(); });
+    if (opts.run_groups.empty())
+        help(ulpm_help_run, EXIT_FAILURE);
+}
+
+static void parse_deps_args(int argc, char* argv[], cmd_options_t& opts)
+{
+    // clang-format off
+    const struct option long_opts[] = {
+        {"help",  no_argument,       nullptr, 'h'},
+        {"depth", required_argument, nullptr, 'd'},
+        {0, 0, 0, 0}
+    };
+    // clang-format on
+
+    // options may come after the query too, getopt stops at the first positional
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+hd:", long_opts, nullptr)) != -1 || optind < argc)
+    {
+        if (opt == -1)
+        {
+            opts.arguments.emplace_back(argv[optind++]);
+            continue;
+        }
+
+        switch (opt)
+        {
+            case 'h': help(ulpm_help_deps, EXIT_SUCCESS);
+            case '?': help(ulpm_help_deps, EXIT_FAILURE);
+            case 'd':
+            {
+                const std::string_view arg = optarg;
+                if (std::from_chars(arg.data(), arg.data() + arg.size(), opts.deps_depth).ec != std::errc() ||
+                    opts.deps_depth < 0)
+                    die("--depth must be a positive number, got '{}'", arg);
+                break;
+            }
+        }
+    }
+
+    static constexpr std::string_view queries[] = { "why", "dupes", "tree" };
+    if (opts.arguments.empty() || std::find(std::begin(queries), std::end(queries), opts.arguments[0]) == std::end(queries))
+        help(ulpm_help_deps, EXIT_FAILURE);
+}
+
+static void parse_du_args(int argc, char* argv[], cmd_options_t& opts)
+{
+    // clang-format off
+    const struct option long_opts[] = {
+        {"help", no_argument,       nullptr, 'h'},
+        {"top",  required_argument, nullptr, 'n'},
+        {0, 0, 0, 0}
+    };
+    // clang-format on
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+hn:", long_opts, nullptr)) != -1 || optind < argc)
+    {
+        if (opt == -1)
+        {
+            opts.arguments.emplace_back(argv[optind++]);
+            continue;
+        }
+
+        switch (opt)
+        {
+            case 'h': help(ulpm_help_du, EXIT_SUCCESS);
+            case '?': help(ulpm_help_du, EXIT_FAILURE);
+            case 'n':
+            {
+                const std::string_view arg = optarg;
+                if (std::from_chars(arg.data(), arg.data() + arg.size(), opts.du_top).ec != std::errc())
+                    die("--top must be a positive number, got '{}'", arg);
+                break;
+            }
+        }
+    }
+}
+
+static void parse_clean_args(int argc, char* argv[], cmd_options_t& opts)
+{
+    // clang-format off
+    const struct option long_opts[] = {
+        {"help",       no_argument, nullptr, 'h'},
+        {"list",       no_argument, nullptr, 'l'},
+        {"background", no_argument, nullptr, 'b'},
+        {0, 0, 0, 0}
+    };
+    // clang-format on
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+hlb", long_opts, nullptr)) != -1 || optind < argc)
+    {
+        if (opt == -1)
+        {
+            opts.arguments.emplace_back(argv[optind++]);
+            continue;
+        }
+
+        switch (opt)
+        {
+            case 'h': help(ulpm_help_clean, EXIT_SUCCESS);
+            case '?': help(ulpm_help_clean, EXIT_FAILURE);
+            case 'l': opts.clean_list = true; break;
+            case 'b': opts.clean_background = true; break;
+        }
+    }
+}
+
+static void parse_store_args(int argc, char* argv[], cmd_options_t& opts)
+{
+    // clang-format off
+    const struct option long_opts[] = {
+        {"help", no_argument, nullptr, 'h'},
+        {0, 0, 0, 0}
+    };
+    // clang-format on
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+h", long_opts, nullptr)) != -1 || optind < argc)
+    {
+        if (opt == -1)
+        {
+            opts.arguments.emplace_back(argv[optind++]);
+            continue;
+        }
+
+        switch (opt)
+        {
+            case 'h': help(ulpm_help_store, EXIT_SUCCESS);
+            case '?': help(ulpm_help_store, EXIT_FAILURE);
+        }
+    }
+
+    static constexpr std::string_view actions[] = { "add", "link", "gc", "path" };
+    if (opts.arguments.empty() || std::find(std::begin(actions), std::end(actions), opts.arguments[0]) == std::end(actions))
+        help(ulpm_help_store, EXIT_FAILURE);
+}
+
+static void parse_projects_args(int argc, char* argv[], cmd_options_t& opts)
+{
+    // clang-format off
+    const struct option long_opts[] = {
+        {"help",   no_argument, nullptr, 'h'},
+        {"rescan", no_argument, nullptr, 'r'},
+        {0, 0, 0, 0}
+    };
+    // clang-format on
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+hr", long_opts, nullptr)) != -1 || optind < argc)
+    {
+        if (opt == -1)
+        {
+            opts.arguments.emplace_back(argv[optind++]);
+            continue;
+        }
+
+        switch (opt)
+        {
+            case 'h': help(ulpm_help_projects, EXIT_SUCCESS);
+            case '?': help(ulpm_help_projects, EXIT_FAILURE);
+            case 'r': opts.projects_rescan = true; break;
         }
     }
-    for (int i = optind; i < argc; ++i)
-        out_args.emplace_back(argv[i]);
+}
+
+static void parse_affected_args(int argc, char* argv[], cmd_options_t& opts)
+{
+    // clang-format off
+    const struct option long_opts[] = {
+        {"help",  no_argument,       nullptr, 'h'},
+        {"since", required_argument, nullptr, 's'},
+        {"save",  required_argument, nullptr, 'w'},
+        {0, 0, 0, 0}
+    };
+    // clang-format on
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+hs:", long_opts, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+            case 'h': help(ulpm_help_affected, EXIT_SUCCESS);
+            case '?': help(ulpm_help_affected, EXIT_FAILURE);
+            case 's': opts.affected_since = optarg; break;
+            case 'w': opts.affected_save = optarg; break;
+        }
+    }
+
+    if (optind < argc)
+        help(ulpm_help_affected, EXIT_FAILURE);
+}
+
+static void parse_hash_args(int argc, char* argv[], cmd_options_t& opts)
+{
+    // clang-format off
+    const struct option long_opts[] = {
+        {"help",     no_argument, nullptr, 'h'},
+        {"files",    no_argument, nullptr, 'f'},
+        {"no-cache", no_argument, nullptr, 'n'},
+        {0, 0, 0, 0}
+    };
+    // clang-format on
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+hfn", long_opts, nullptr)) != -1 || optind < argc)
+    {
+        if (opt == -1)
+        {
+            opts.arguments.emplace_back(argv[optind++]);
+            continue;
+        }
+
+        switch (opt)
+        {
+            case 'h': help(ulpm_help_hash, EXIT_SUCCESS);
+            case '?': help(ulpm_help_hash, EXIT_FAILURE);
+            case 'f': opts.hash_files = true; break;
+            case 'n': opts.hash_no_cache = true; break;
+        }
+    }
+
+    if (opts.arguments.size() > 1)
+        help(ulpm_help_hash, EXIT_FAILURE);
+}
+
+static void parse_cache_args(int argc, char* argv[], cmd_options_t& opts)
+{
+    // clang-format off
+    const struct option long_opts[] = {
+        {"help",     no_argument,       nullptr, 'h'},
+        {"max-size", required_argument, nullptr, 's'},
+        {"max-age",  required_argument, nullptr, 'a'},
+        {0, 0, 0, 0}
+    };
+    // clang-format on
+
+    uint64_t size;
+    int64_t  age;
+    int      opt;
+    while ((opt = getopt_long(argc, argv, "+hs:a:", long_opts, nullptr)) != -1 || optind < argc)
+    {
+        if (opt == -1)
+        {
+            opts.arguments.emplace_back(argv[optind++]);
+            continue;
+        }
+
+        switch (opt)
+        {
+            case 'h': help(ulpm_help_cache, EXIT_SUCCESS);
+            case '?': help(ulpm_help_cache, EXIT_FAILURE);
+            case 's':
+                if (!parse_size(optarg, size))
+                    die("Invalid size '{}'", optarg);
+                opts.cache_max_size = optarg;
+                break;
+            case 'a':
+                if (!parse_duration(optarg, age))
+                    die("Invalid age '{}'", optarg);
+                opts.cache_max_age = optarg;
+                break;
+        }
+    }
+
+    static constexpr std::string_view actions[] = { "stats", "prune", "path" };
+    if (opts.arguments.size() != 1 || std::find(std::begin(actions), std::end(actions), opts.arguments[0]) == std::end(actions))
+        help(ulpm_help_cache, EXIT_FAILURE);
 }
 
 static std::optional<parse_result_t> parseargs(int argc, char* argv[])
@@ -224,7 +585,15 @@ static std::optional<parse_result_t> parseargs(int argc, char* argv[])
     {
         case Op::Init:     parse_manifest_fields(sub_argc, sub_argv, true, ulpm_help_set, res.opts, res.update); break;
         case Op::Set:      parse_manifest_fields(sub_argc, sub_argv, false, ulpm_help_init, res.opts, res.update); break;
-        case Op::External: parse_run_args(sub_argc, sub_argv, res.opts.arguments); break;
+        case Op::Deps:     parse_deps_args(sub_argc, sub_argv, res.opts); break;
+        case Op::Du:       parse_du_args(sub_argc, sub_argv, res.opts); break;
+        case Op::Clean:    parse_clean_args(sub_argc, sub_argv, res.opts); break;
+        case Op::Store:    parse_store_args(sub_argc, sub_argv, res.opts); break;
+        case Op::Projects: parse_projects_args(sub_argc, sub_argv, res.opts); break;
+        case Op::Affected: parse_affected_args(sub_argc, sub_argv, res.opts); break;
+        case Op::Hash:     parse_hash_args(sub_argc, sub_argv, res.opts); break;
+        case Op::Cache:    parse_cache_args(sub_argc, sub_argv, res.opts); break;
+        case Op::External: parse_run_args(sub_argc, sub_argv, res.opts); break;
         default:           help(ulpm_help, EXIT_FAILURE); break;
     }
 
@@ -252,11 +621,20 @@ int main(int argc, char* argv[])
             parsed->update.project_version = "0.0.1";
     }
 
-    Manifest manifest;
+    // only init, set and running a command may start a ulpm.json, the rest just read one if it's there
+    Manifest manifest(parsed->op == Op::Init || parsed->op == Op::Set || parsed->op == Op::External);
     switch (parsed->op)
     {
         case Op::Init:     op_init(manifest, parsed->opts, parsed->update); break;
         case Op::Set:      op_set(manifest, parsed->update); break;
+        case Op::Deps:     op_deps(manifest, parsed->opts); break;
+        case Op::Du:       op_du(manifest, parsed->opts); break;
+        case Op::Clean:    op_clean(manifest, parsed->opts); break;
+        case Op::Store:    op_store(manifest, parsed->opts); break;
+        case Op::Projects: op_projects(manifest, parsed->opts); break;
+        case Op::Affected: op_affected(manifest, parsed->opts); break;
+        case Op::Hash:     op_hash(manifest, parsed->opts); break;
+        case Op::Cache:    op_cache(manifest, parsed->opts); break;
         case Op::External: op_run(manifest, parsed->cmd, parsed->opts); break;
 
         default: break;
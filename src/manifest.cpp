@@ -1,5 +1,7 @@
 #include "manifest.hpp"
 
+#include <filesystem>
+
 #include "backend_registry.hpp"
 #include "fmt/ranges.h"
 #include "manifest_settings.hpp"
@@ -31,7 +33,7 @@ static constexpr std::string_view config_json = R"({
     }
 })";
 
-Manifest::Manifest()
+Manifest::Manifest(bool create)
 {
     m_config_doc.Parse(config_json.data());
 
@@ -47,6 +49,12 @@ Manifest::Manifest()
         die("config_json root is not an object");
     }
 
+    if (!create && !std::filesystem::exists(MANIFEST_NAME))
+    {
+        m_doc.SetObject();
+        return;
+    }
+
     JsonUtils::autogen_empty_json(MANIFEST_NAME);
 
     m_file.open(MANIFEST_NAME, "r+");
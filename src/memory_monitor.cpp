@@ -0,0 +1,196 @@
+#include "memory_monitor.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef __linux__
+#  include <dirent.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+MemoryMonitor::MemoryMonitor()
+{
+#ifdef __linux__
+    m_thread = std::thread([this] {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_cv.wait_for(lock, INTERVAL, [this] { return m_stop; }))
+        {
+            lock.unlock();
+            sample();
+            lock.lock();
+        }
+    });
+#endif
+}
+
+MemoryMonitor::~MemoryMonitor()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void MemoryMonitor::watch(const size_t id, const int pid)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_groups[id] = { pid };
+}
+
+void MemoryMonitor::unwatch(const size_t id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (const auto it = m_groups.find(id); it != m_groups.end())
+    {
+        it->second.watched = false;
+        it->second.current = 0;
+    }
+}
+
+uint64_t MemoryMonitor::current(const size_t id) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto                  it = m_groups.find(id);
+    return it != m_groups.end() ? it->second.current : 0;
+}
+
+uint64_t MemoryMonitor::peak(const size_t id) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto                  it = m_groups.find(id);
+    return it != m_groups.end() ? it->second.peak : 0;
+}
+
+#ifdef __linux__
+
+// parent and resident pages from /proc/<pid>/stat, whose second field (the
+// command name) may contain anything, spaces and parentheses included
+static bool read_stat(const char* pid, int& ppid, uint64_t& rss_pages)
+{
+    char path[64];
+    std::snprintf(path, sizeof(path), "/proc/%s/stat", pid);
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    char          buf[1024];
+    const ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return false;
+    buf[n] = '\0';
+
+    const char* p = std::strrchr(buf, ')');
+    if (!p || p[1] == '\0')
+        return false;
+    // fields 3 (the state letter) to 24 (rss), counted from 1
+    char* end = const_cast<char*>(p + 2);
+    for (int field = 3; field <= 24 && *end; ++field)
+    {
+        while (*end == ' ')
+            ++end;
+        if (field == 3)
+        {
+            while (*end && *end != ' ')
+                ++end;
+            continue;
+        }
+        const unsigned long long v = std::strtoull(end, &end, 10);
+        if (field == 4)
+            ppid = static_cast<int>(v);
+        else if (field == 24)
+            rss_pages = v;
+    }
+    return true;
+}
+
+void MemoryMonitor::sample()
+{
+    std::vector<int> roots;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& [id, group] : m_groups)
+            if (group.watched)
+                roots.push_back(group.pid);
+    }
+    if (roots.empty())
+        return;
+
+    static const uint64_t page_size = sysconf(_SC_PAGESIZE);
+
+    std::unordered_map<int, std::vector<int>> children;
+    std::unordered_map<int, uint64_t>         rss;
+    if (DIR* dir = opendir("/proc"))
+    {
+        while (const dirent* entry = readdir(dir))
+        {
+            if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+                continue;
+            int      ppid  = 0;
+            uint64_t pages = 0;
+            if (!read_stat(entry->d_name, ppid, pages))
+                continue;
+            const int pid = std::atoi(entry->d_name);
+            children[ppid].push_back(pid);
+            rss[pid] = pages * page_size;
+        }
+        closedir(dir);
+    }
+
+    std::unordered_map<int, uint64_t> totals;
+    for (const int root : roots)
+    {
+        uint64_t         total = 0;
+        std::vector<int> stack{ root };
+        while (!stack.empty())
+        {
+            const int pid = stack.back();
+            stack.pop_back();
+            total += rss[pid];
+            if (const auto it = children.find(pid); it != children.end())
+                stack.insert(stack.end(), it->second.begin(), it->second.end());
+        }
+        totals[root] = total;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& [id, group] : m_groups)
+    {
+        const auto it = totals.find(group.pid);
+        if (!group.watched || it == totals.end())
+            continue;
+        group.current = it->second;
+        group.peak    = std::max(group.peak, group.current);
+    }
+}
+
+uint64_t MemoryMonitor::available()
+{
+    std::FILE* f = std::fopen("/proc/meminfo", "r");
+    if (!f)
+        return 0;
+    char               line[256];
+    unsigned long long kib = 0;
+    while (std::fgets(line, sizeof(line), f))
+        if (std::sscanf(line, "MemAvailable: %llu kB", &kib) == 1)
+            break;
+    std::fclose(f);
+    return kib * 1024;
+}
+
+#else
+
+void MemoryMonitor::sample() {}
+
+uint64_t MemoryMonitor::available()
+{
+    return 0;
+}
+
+#endif
@@ -1,17 +1,49 @@
 #include "operations.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
 #include <filesystem>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "backend_registry.hpp"
+#include "cgroup.hpp"
+#include "file_hasher.hpp"
+#include "file_snapshot.hpp"
 #include "fmt/ranges.h"
+#include "install_stamp.hpp"
+#include "lockfile_index.hpp"
+#include "package_store.hpp"
+#include "pipeline.hpp"
+#include "project_discovery.hpp"
+#include "project_graph.hpp"
+#include "sha512.hpp"
+#include "signal_relay.hpp"
+#include "task_cache.hpp"
+#include "task_runner.hpp"
 #include "terminal_display.hpp"
 #include "tiny-process-library/process.hpp"
+#include "tree_remover.hpp"
+#include "tree_walker.hpp"
 #include "util.hpp"
 
+#ifdef __linux__
+#  include <sched.h>
+#endif
+
 namespace fs = std::filesystem;
 
+static constexpr std::string_view DURATIONS_FILE = ".ulpm/durations.idx";
+
 static std::vector<std::string> get_licenses()
 {
     static std::vector<std::string> v;
@@ -158,8 +190,519 @@ void op_set(Manifest& manifest, const manifest_update_t& upd)
     }
 }
 
+// "<cmd> <script> [args]", so a pattern like "test:*" runs every matching script
+static std::vector<task_t> resolve_group(LanguageBackend&                backend,
+                                         const rapidjson::Value&         jcmd,
+                                         const run_group_t&              group,
+                                         const cmd_options_t&            opts,
+                                         const std::vector<std::string>& known)
+{
+    std::vector<std::string> names;
+    for (const std::string& pattern : group.scripts)
+    {
+        if (pattern.find_first_of("*?") == pattern.npos)
+        {
+            names.push_back(pattern);
+            continue;
+        }
+
+        size_t matched = 0;
+        for (const std::string& name : known)
+        {
+            if (glob_match(pattern, name, ':'))
+            {
+                names.push_back(name);
+                ++matched;
+            }
+        }
+        if (matched == 0)
+            die("No script matches '{}'", pattern);
+    }
+
+    std::vector<task_t> tasks;
+    for (const std::string& name : names)
+    {
+        if (std::any_of(tasks.begin(), tasks.end(), [&](const task_t& t) { return t.name == name; }))
+            continue;
+
+        task_t task;
+        if (jcmd.IsArray())
+        {
+            std::vector<std::string> argv = JsonUtils::vec_from_array(jcmd);
+            argv.push_back(name);
+            argv.insert(argv.end(), opts.arguments.begin(), opts.arguments.end());
+
+            if (std::optional<task_t> native = backend.nativeTask(argv))
+                task = std::move(*native);
+            else
+                task.argv = std::move(argv);
+        }
+        else
+        {
+            task.shell = fmt::format("{} {}", jcmd.GetString(), shell_quote(name));
+            for (const std::string& arg : opts.arguments)
+                task.shell += " " + shell_quote(arg);
+        }
+        task.name = name;
+        tasks.push_back(std::move(task));
+    }
+    return tasks;
+}
+
+// The "limits" entry of ulpm.json for cmd, if it has one: "cpu.max" as a
+// number of CPUs or "<quota> <period>", "memory.max" as a size and
+// "io.weight", any of them "max"/"default" like cgroup v2 takes them
+static cgroup_limits_t command_limits(const rapidjson::Document& doc, const std::string& cmd)
+{
+    cgroup_limits_t limits;
+    if (!doc.HasMember("limits") || !doc["limits"].IsObject() || !doc["limits"].HasMember(cmd.c_str()))
+        return limits;
+
+    const rapidjson::Value& entry = doc["limits"][cmd.c_str()];
+    if (!entry.IsObject())
+        die("limits.{} is not an object in " MANIFEST_NAME, cmd);
+
+    if (entry.HasMember("cpu.max"))
+    {
+        const rapidjson::Value& cpu = entry["cpu.max"];
+        if (cpu.IsNumber() && cpu.GetDouble() > 0)
+            limits.cpu_max = fmt::format("{} 100000", std::max<int64_t>(1000, std::llround(cpu.GetDouble() * 100000)));
+        else if (cpu.IsString())
+            limits.cpu_max = cpu.GetString();
+        else
+            die("limits.{}.cpu.max is neither a positive number of CPUs or a string in " MANIFEST_NAME, cmd);
+    }
+    if (entry.HasMember("memory.max"))
+    {
+        const rapidjson::Value& memory = entry["memory.max"];
+        uint64_t                bytes  = 0;
+        if (memory.IsUint64())
+            limits.memory_max = fmt::to_string(memory.GetUint64());
+        else if (memory.IsString() && std::string_view(memory.GetString()) == "max")
+            limits.memory_max = "max";
+        else if (memory.IsString() && parse_size(memory.GetString(), bytes))
+            limits.memory_max = fmt::to_string(bytes);
+        else
+            die("limits.{}.memory.max is not a size in " MANIFEST_NAME, cmd);
+    }
+    if (entry.HasMember("io.weight"))
+    {
+        const rapidjson::Value& weight = entry["io.weight"];
+        if (weight.IsUint() && weight.GetUint() >= 1 && weight.GetUint() <= 10000)
+            limits.io_weight = fmt::to_string(weight.GetUint());
+        else if (weight.IsString())
+            limits.io_weight = weight.GetString();
+        else
+            die("limits.{}.io.weight is not a weight from 1 to 10000 in " MANIFEST_NAME, cmd);
+    }
+    return limits;
+}
+
+// A CPU list like taskset(1) and /sys take them: "0-3,6"
+static bool parse_cpu_list(const std::string_view str, std::vector<int>& cpus)
+{
+    for (const std::string& range : split(str, ','))
+    {
+        const size_t dash  = range.find('-');
+        const auto   first = std::string_view(range).substr(0, dash);
+        const auto   last  = dash == range.npos ? first : std::string_view(range).substr(dash + 1);
+        int          from = 0, to = 0;
+        if (std::from_chars(first.data(), first.data() + first.size(), from).ec != std::errc() ||
+            std::from_chars(last.data(), last.data() + last.size(), to).ec != std::errc() || from > to)
+            return false;
+        for (int cpu = from; cpu <= to; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return !cpus.empty();
+}
+
+// The "priority" entry of ulpm.json for cmd, if it has one: "cpus" as a list
+// like "0-3,6" or an array, "nice" as an increment like nice(1) takes it, and
+// "ionice" as "idle", "best-effort" or "realtime", with ":<level>" from 0 to 7
+static TinyProcessLib::Priority command_priority(const rapidjson::Document& doc, const std::string& cmd)
+{
+    TinyProcessLib::Priority priority;
+    if (!doc.HasMember("priority") || !doc["priority"].IsObject() || !doc["priority"].HasMember(cmd.c_str()))
+        return priority;
+
+    const rapidjson::Value& entry = doc["priority"][cmd.c_str()];
+    if (!entry.IsObject())
+        die("priority.{} is not an object in " MANIFEST_NAME, cmd);
+
+    if (entry.HasMember("cpus"))
+    {
+        const rapidjson::Value& cpus = entry["cpus"];
+        if (cpus.IsArray())
+        {
+            for (const rapidjson::Value& cpu : cpus.GetArray())
+            {
+                if (!cpu.IsUint())
+                    die("priority.{}.cpus has something else than CPU numbers in " MANIFEST_NAME, cmd);
+                priority.cpus.push_back(cpu.GetUint());
+            }
+        }
+        else if (!cpus.IsString() || !parse_cpu_list(cpus.GetString(), priority.cpus))
+            die("priority.{}.cpus is neither a CPU list like \"0-3,6\" or an array in " MANIFEST_NAME, cmd);
+
+#ifdef __linux__
+        // CPU ids can have gaps, with CPUs offline or ulpm itself confined to
+        // some, so they're checked against the ones it's allowed to run on
+        cpu_set_t  allowed;
+        const bool known = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+        for (const int cpu : priority.cpus)
+            if (cpu < 0 || cpu >= CPU_SETSIZE || (known && !CPU_ISSET(cpu, &allowed)))
+                die("priority.{}.cpus has CPU {}, which ulpm isn't allowed to run on", cmd, cpu);
+#endif
+    }
+    if (entry.HasMember("nice"))
+    {
+        if (!entry["nice"].IsInt() || entry["nice"].GetInt() < -39 || entry["nice"].GetInt() > 39)
+            die("priority.{}.nice is not a niceness increment in " MANIFEST_NAME, cmd);
+        priority.nice = entry["nice"].GetInt();
+    }
+    if (entry.HasMember("ionice"))
+    {
+        const std::string_view ionice = entry["ionice"].IsString() ? entry["ionice"].GetString() : "";
+        const std::string_view name   = ionice.substr(0, ionice.find(':'));
+        const std::string_view level  = ionice.size() > name.size() ? ionice.substr(name.size() + 1) : "";
+
+        priority.io_class = name == "realtime" ? 1 : name == "best-effort" ? 2 : name == "idle" ? 3 : 0;
+        if (priority.io_class == 0 ||
+            (!level.empty() && (std::from_chars(level.data(), level.data() + level.size(), priority.io_level).ec !=
+                                    std::errc() ||
+                                priority.io_level < 0 || priority.io_level > 7)))
+            die("priority.{}.ionice is not \"idle\", \"best-effort[:<0-7>]\" or \"realtime[:<0-7>]\" in " MANIFEST_NAME,
+                cmd);
+    }
+    return priority;
+}
+
+// --memory, else $ULPM_MEMORY_BUDGET, else 0 for run_tasks() to go by MemAvailable
+static uint64_t memory_budget(const cmd_options_t& opts)
+{
+    uint64_t budget = opts.run_memory;
+    if (const char* str = std::getenv("ULPM_MEMORY_BUDGET"); budget == 0 && str && *str && !parse_size(str, budget))
+        die("Invalid memory budget '{}' in $ULPM_MEMORY_BUDGET", str);
+    return budget;
+}
+
+// Whether $ULPM_CGROUPS asks for commands to run in cgroups of their own even
+// without limits, for what they use to be known exactly
+static bool cgroups_wanted()
+{
+    const char* str = std::getenv("ULPM_CGROUPS");
+    return str && std::string_view(str) == "1";
+}
+
+// The stages of cmd if its entry is an array of argv arrays, a pipeline ulpm
+// wires up itself, e.g. [["cargo", "build", "--message-format=json"], ["jq", ".reason"]]
+static std::optional<std::vector<std::vector<std::string>>> command_pipeline(const rapidjson::Value& jcmd,
+                                                                             const std::string&      cmd)
+{
+    if (!jcmd.IsArray() || jcmd.Empty() || !jcmd[0].IsArray())
+        return {};
+
+    std::vector<std::vector<std::string>> stages;
+    for (const rapidjson::Value& stage : jcmd.GetArray())
+    {
+        if (!stage.IsArray() || stage.Empty() ||
+            !std::all_of(stage.Begin(), stage.End(), [](const rapidjson::Value& v) { return v.IsString(); }))
+            die("Each stage of the pipeline {} must be a non-empty array of strings", cmd);
+        stages.push_back(JsonUtils::vec_from_array(stage));
+    }
+    return stages;
+}
+
+static void run_groups(LanguageBackend&                backend,
+                       const rapidjson::Value&         jcmd,
+                       const cgroup_limits_t&          limits,
+                       const TinyProcessLib::Priority& priority,
+                       const cmd_options_t&            opts)
+{
+    const std::vector<std::string> known  = backend.scriptNames();
+    size_t                         failed = 0;
+    for (const run_group_t& group : opts.run_groups)
+    {
+        std::vector<task_t> tasks = resolve_group(backend, jcmd, group, opts, known);
+        for (task_t& task : tasks)
+        {
+            task.limits   = limits;
+            task.priority = priority;
+        }
+        if (!group.parallel)
+            for (size_t i = 1; i < tasks.size(); ++i)
+                tasks[i].after.push_back(i - 1);
+
+        run_options_t run_opts;
+        run_opts.jobs       = group.parallel ? opts.run_jobs : 1;
+        run_opts.keep_going = opts.keep_going;
+        run_opts.history    = DURATIONS_FILE;
+        run_opts.explain    = opts.run_explain;
+        run_opts.memory     = memory_budget(opts);
+        run_opts.cgroups    = cgroups_wanted();
+        run_opts.grace      = std::chrono::seconds(opts.run_grace);
+
+        failed += run_tasks(tasks, run_opts);
+        if (failed > 0 && !opts.keep_going)
+            break;
+    }
+
+    if (failed > 0)
+        die("{} script(s) failed", failed);
+}
+
+/*
+ * Affected projects
+ */
+
+// The files (relative to the current directory) changed since since: a
+// snapshot of that name if there's one, else a git ref
+static std::vector<std::string> changed_files(const std::string& since)
+{
+    const std::string snap_path = snapshot_path(".", since);
+    std::error_code   ec;
+    if (fs::is_regular_file(snap_path, ec))
+    {
+        FileSnapshot old;
+        if (!old.load(snap_path))
+            die("{} is not a valid snapshot", snap_path);
+        return FileSnapshot::capture(".").changedSince(old);
+    }
+
+    std::vector<std::string> files;
+    auto git = [&](const std::vector<std::string>& argv) {
+        std::string out, err;
+        const int   status = TinyProcessLib::Process(
+                               argv,
+                               "",
+                               [&](const char* bytes, size_t n) { out.append(bytes, n); },
+                               [&](const char* bytes, size_t n) { err.append(bytes, n); })
+                               .get_exit_status();
+        if (status != 0)
+            die("{} failed: {}", fmt::join(argv, " "), err.substr(0, err.find('\n')));
+        for (std::string& file : split(out, '\0'))
+            if (!file.empty())
+                files.push_back(std::move(file));
+    };
+    // not the state ulpm keeps in .ulpm/, which it writes itself, like snapshots don't
+    const std::string own = ":(exclude,glob)**/.ulpm/**";
+    git({ "git", "diff", "--name-only", "--relative", "-z", since, "--", ".", own });
+    git({ "git", "ls-files", "--others", "--exclude-standard", "-z", "--", ".", own });
+    return files;
+}
+
+struct affected_project_t
+{
+    project_t           project;
+    std::string         name;
+    bool                changed = false;  // else only depending on one that changed
+    std::vector<size_t> after;            // the affected projects it depends on, by index
+};
+
+static std::vector<affected_project_t> find_affected(const std::string& since, size_t& nchanged)
+{
+    const std::vector<std::string> files = changed_files(since);
+    nchanged                             = files.size();
+
+    ProjectDiscovery   discovery(".");
+    const ProjectGraph graph(".", discovery.discover());
+
+    std::vector<uint32_t> seeds;
+    for (const std::string& file : files)
+        if (const uint32_t owner = graph.ownerOf(file); owner != DepGraph::NONE)
+            seeds.push_back(owner);
+    std::sort(seeds.begin(), seeds.end());
+    seeds.erase(std::unique(seeds.begin(), seeds.end()), seeds.end());
+
+    const std::vector<uint32_t>            order = graph.withDependents(seeds);
+    std::unordered_map<uint32_t, size_t>   index;
+    std::vector<affected_project_t>        affected;
+    for (const uint32_t node : order)
+    {
+        index.emplace(node, affected.size());
+        affected.push_back({ graph.projects()[node],
+                             std::string(graph.name(node)),
+                             std::binary_search(seeds.begin(), seeds.end(), node),
+                             {} });
+    }
+    // only forward, the edges of a cycle going back are dropped
+    for (size_t i = 0; i < order.size(); ++i)
+        for (const uint32_t dependent : graph.dependents(order[i]))
+            if (const auto it = index.find(dependent); it != index.end() && it->second > i)
+                affected[it->second].after.push_back(i);
+    return affected;
+}
+
+static std::string self_exe()
+{
+    std::error_code ec;
+    const fs::path  self = fs::read_symlink("/proc/self/exe", ec);
+    if (!ec)
+        return self.string();
+    const char* path = std::getenv("PATH");
+    return find_in_path("ulpm", path ? path : "");
+}
+
+// ulpm <cmd> ran again in each affected project with a ulpm.json, a project
+// only once the ones it depends on are done
+static void run_affected(const std::string& cmd, const cmd_options_t& opts)
+{
+    size_t                                nchanged = 0;
+    const std::vector<affected_project_t> affected = find_affected(opts.affected_since, nchanged);
+
+    std::vector<std::string> argv{ self_exe(), cmd };
+    if (opts.keep_going)
+        argv.emplace_back("-k");
+    if (opts.install_force)
+        argv.emplace_back("-f");
+    if (opts.run_no_cache)
+        argv.emplace_back("-n");
+    if (opts.run_explain)
+        argv.emplace_back("--explain-schedule");
+    if (opts.run_jobs)
+        argv.insert(argv.end(), { "--jobs", std::to_string(opts.run_jobs) });
+    if (opts.run_memory)
+        argv.insert(argv.end(), { "--memory", std::to_string(opts.run_memory) });
+    argv.insert(argv.end(), { "--grace", fmt::format("{}s", opts.run_grace) });
+    for (const run_group_t& group : opts.run_groups)
+    {
+        argv.emplace_back(group.parallel ? "-p" : "-s");
+        argv.insert(argv.end(), group.scripts.begin(), group.scripts.end());
+    }
+    if (!opts.arguments.empty())
+    {
+        argv.emplace_back("--");
+        argv.insert(argv.end(), opts.arguments.begin(), opts.arguments.end());
+    }
+
+    // a skipped project passes what it depends on to its dependents, so
+    // they still wait for it
+    std::vector<task_t>              tasks;
+    std::vector<std::vector<size_t>> waits_for(affected.size());
+    for (size_t i = 0; i < affected.size(); ++i)
+    {
+        const affected_project_t& a = affected[i];
+        for (const size_t dep : a.after)
+            waits_for[i].insert(waits_for[i].end(), waits_for[dep].begin(), waits_for[dep].end());
+        std::sort(waits_for[i].begin(), waits_for[i].end());
+        waits_for[i].erase(std::unique(waits_for[i].begin(), waits_for[i].end()), waits_for[i].end());
+
+        if (!(a.project.manifests & MANIFEST_ULPM))
+        {
+            debug("Skipping {}, it has no {}", a.project.path.empty() ? "." : a.project.path, MANIFEST_NAME);
+            continue;
+        }
+
+        task_t task;
+        task.name  = a.project.path.empty() ? "." : a.project.path;
+        task.argv  = argv;
+        task.cwd   = task.name;
+        task.after = std::move(waits_for[i]);
+        task.key   = fmt::format("{}:{}", task.name, cmd);
+        waits_for[i] = { tasks.size() };
+        tasks.push_back(std::move(task));
+    }
+
+    if (tasks.empty())
+    {
+        info("No project affected by the {} file(s) changed since {}", nchanged, opts.affected_since);
+        return;
+    }
+
+    run_options_t run_opts;
+    run_opts.jobs       = opts.run_jobs ? opts.run_jobs : std::max(1u, std::thread::hardware_concurrency());
+    run_opts.keep_going = opts.keep_going;
+    run_opts.history    = DURATIONS_FILE;
+    run_opts.explain    = opts.run_explain;
+    run_opts.memory     = memory_budget(opts);
+    run_opts.cgroups    = cgroups_wanted();
+    run_opts.grace      = std::chrono::seconds(opts.run_grace);
+    if (const size_t failed = run_tasks(tasks, run_opts); failed > 0)
+        die("{} project(s) failed", failed);
+}
+
+// The "cache" entry of ulpm.json for cmd, if it has one
+static std::optional<cache_spec_t> cache_spec(const rapidjson::Document& doc, const std::string& cmd)
+{
+    if (!doc.HasMember("cache") || !doc["cache"].IsObject())
+        return {};
+    const rapidjson::Value& cache = doc["cache"];
+    if (!cache.HasMember("commands") || !cache["commands"].IsObject() || !cache["commands"].HasMember(cmd.c_str()))
+        return {};
+
+    const rapidjson::Value& entry = cache["commands"][cmd.c_str()];
+    if (!entry.IsObject())
+        die("cache.commands.{} is not an object in " MANIFEST_NAME, cmd);
+
+    cache_spec_t spec;
+    if (entry.HasMember("inputs") && entry["inputs"].IsArray())
+        spec.inputs = JsonUtils::vec_from_array(entry["inputs"]);
+    if (entry.HasMember("outputs") && entry["outputs"].IsArray())
+        spec.outputs = JsonUtils::vec_from_array(entry["outputs"]);
+    if (spec.outputs.empty())
+        die("cache.commands.{} has no outputs in " MANIFEST_NAME, cmd);
+    return spec;
+}
+
+// $ULPM_CACHE_URL, else cache.url of ulpm.json, else a directory of the user
+static std::string cache_location(const rapidjson::Document& doc)
+{
+    if (const char* url = std::getenv("ULPM_CACHE_URL"); url && *url)
+        return url;
+    if (doc.HasMember("cache") && doc["cache"].HasMember("url") && doc["cache"]["url"].IsString())
+        return doc["cache"]["url"].GetString();
+    return user_cache_dir("tasks");
+}
+
+// cache.max_size and cache.max_age of ulpm.json, unless overridden by
+// $ULPM_CACHE_MAX_SIZE and $ULPM_CACHE_MAX_AGE, then by the arguments
+static FsCacheBackend::limits_t cache_limits(const rapidjson::Document& doc,
+                                             std::string                size = "",
+                                             std::string                age  = "")
+{
+    auto setting = [&](std::string& value, const char* env, const char* name) {
+        if (!value.empty())
+            return;
+        if (const char* str = std::getenv(env); str && *str)
+            value = str;
+        else if (doc.HasMember("cache") && doc["cache"].HasMember(name) && doc["cache"][name].IsString())
+            value = doc["cache"][name].GetString();
+    };
+    setting(size, "ULPM_CACHE_MAX_SIZE", "max_size");
+    setting(age, "ULPM_CACHE_MAX_AGE", "max_age");
+
+    FsCacheBackend::limits_t limits{ 10ULL << 30, 30 * 24 * 60 * 60 };
+    if (!size.empty() && !parse_size(size, limits.max_size))
+        die("Invalid cache size limit '{}'", size);
+    if (!age.empty() && !parse_duration(age, limits.max_age))
+        die("Invalid cache age limit '{}'", age);
+    return limits;
+}
+
+// A bare "ulpm install" only syncs the tree with the lockfile, so it can be
+// skipped when nothing changed since the last one. The stamp to save once
+// it succeeded, none if this run isn't one of those.
+static std::optional<InstallStamp> install_stamp(Manifest&                       manifest,
+                                                 const std::string&              cmd,
+                                                 const std::vector<std::string>& argv,
+                                                 const cmd_options_t&            opts)
+{
+    if (cmd != "install" || !opts.arguments.empty())
+        return std::nullopt;
+    InstallStamp stamp(*manifest.backend(), manifest.settings(), argv);
+    if (!stamp.enabled())
+        return std::nullopt;
+    return stamp;
+}
+
 void op_run(Manifest& manifest, const std::string& cmd, const cmd_options_t& opts)
 {
+    if (opts.affected)
+    {
+        run_affected(cmd, opts);
+        return;
+    }
+
     if (!manifest.backend())
         die("No language set in {}. Run 'ulpm init' first.", MANIFEST_NAME);
 
@@ -174,8 +717,130 @@ void op_run(Manifest& manifest, const std::string& cmd, const cmd_options_t& opt
         die("Unknown command '{}' for package manager '{}'", cmd, pm);
 
     const rapidjson::Value& jcmd = doc["commands"][cmd.c_str()];
+    std::optional<std::vector<std::vector<std::string>>> pipeline = command_pipeline(jcmd, cmd);
+    if (pipeline)
+        pipeline->front().insert(pipeline->front().end(), opts.arguments.begin(), opts.arguments.end());
+
+    if (!opts.run_groups.empty())
+    {
+        if (pipeline)
+            die("The pipeline {} can't run scripts, use a command array or string", cmd);
+        if (jcmd.IsArray() && !std::all_of(jcmd.Begin(), jcmd.End(), [](const rapidjson::Value& v) { return v.IsString(); }))
+            die("Command array for {} must contain only strings", cmd);
+        if (!jcmd.IsArray() && !jcmd.IsString())
+            die("Command for {} is neither an array or string", cmd);
+
+        run_groups(*manifest.backend(), jcmd, command_limits(doc, cmd), command_priority(doc, cmd), opts);
+        return;
+    }
+
+    // A cached command isn't ran at all if its outputs for the same command
+    // line and inputs can be restored
+    std::unique_ptr<TaskCache> cache;
+    std::string                cache_key;
+    std::optional<cache_spec_t> spec = opts.run_no_cache ? std::nullopt : cache_spec(doc, cmd);
+    if (spec && (jcmd.IsArray() || jcmd.IsString()))
+    {
+        std::vector<std::string> argv;
+        if (pipeline)
+        {
+            for (const std::vector<std::string>& stage : *pipeline)
+            {
+                if (!argv.empty())
+                    argv.emplace_back("|");
+                argv.insert(argv.end(), stage.begin(), stage.end());
+            }
+        }
+        else
+        {
+            argv = jcmd.IsArray() ? JsonUtils::vec_from_array(jcmd) : std::vector<std::string>{ jcmd.GetString() };
+            argv.insert(argv.end(), opts.arguments.begin(), opts.arguments.end());
+        }
+
+        cache = std::make_unique<TaskCache>(make_cache_backend(cache_location(doc)), std::move(*spec));
+        if (std::optional<std::string> key = cache->key(argv))
+        {
+            cache_key = std::move(*key);
+            if (cache->restore(cache_key))
+            {
+                info("Restored the outputs of '{}' from {}", cmd, cache->backend().describe());
+                return;
+            }
+            debug("No outputs of '{}' cached under {}", cmd, cache_key);
+        }
+        else
+        {
+            cache.reset();
+        }
+    }
+
+    // The command is in a process group of its own, Ctrl-C has to be passed on
+    SignalRelay relay;
+
+    // A limited command runs in a cgroup of its own, or each stage of a
+    // limited pipeline does, which is gone before die() can skip its
+    // destructor
+    const cgroup_limits_t     limits = command_limits(doc, cmd);
+    std::optional<CgroupTree> cgroups;
+    TinyProcessLib::Config    config;
+    config.priority = command_priority(doc, cmd);
+    if (!limits.empty() || cgroups_wanted())
+    {
+        cgroups.emplace();
+        if (!pipeline)
+            config.cgroup_procs_fd = cgroups->create(0, limits);
+    }
+    // and ulpm dies of the signal once it's over, like it would have without the relay
+    auto report = [&] {
+        if (const std::optional<cgroup_stats_t> st = cgroups ? cgroups->release(0) : std::nullopt)
+            info("'{}' used {:.1f}s of CPU time, {} of memory at most, read {} and wrote {}",
+                 cmd,
+                 (st->user_usec + st->system_usec) / 1e6,
+                 st->memory_peak ? human_size(st->memory_peak) : "?",
+                 human_size(st->read_bytes),
+                 human_size(st->write_bytes));
+        cgroups.reset();
+        if (const int sig = relay.received())
+            SignalRelay::reraise(sig);
+    };
+
+    // `a | b | c` without a shell, the stages are wired up by ulpm
+    if (pipeline)
+    {
+        const std::vector<stage_result_t> results =
+            run_pipeline(*pipeline, config, cgroups ? &*cgroups : nullptr, limits);
+
+        size_t failed = results.size();
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const stage_result_t& result = results[i];
+            std::string           line   = fmt::format("Stage {} '{}' exited with {} after {:.1f}s",
+                                              i + 1,
+                                              (*pipeline)[i].front(),
+                                              result.status,
+                                              result.time.count() / 1e3);
+            if (result.cut && !result.failed)
+                line += " (SIGPIPE, the next one was done reading)";
+            if (const std::optional<cgroup_stats_t>& st = result.usage)
+                line += fmt::format(", used {:.1f}s of CPU time and {} of memory at most",
+                                    (st->user_usec + st->system_usec) / 1e6,
+                                    st->memory_peak ? human_size(st->memory_peak) : "?");
+            if (limits.empty())
+                debug("{}", line);
+            else
+                info("{}", line);
+
+            if (result.failed)
+                failed = i;
+        }
+        report();
+
+        // like `set -o pipefail`, the last stage that failed is the one to blame
+        if (failed < results.size())
+            die("Stage {} of the pipeline failed: {}", failed + 1, (*pipeline)[failed]);
+    }
     // excevp() like
-    if (jcmd.IsArray())
+    else if (jcmd.IsArray())
     {
         std::vector<std::string> arg_cmd;
 
@@ -186,23 +851,862 @@ void op_run(Manifest& manifest, const std::string& cmd, const cmd_options_t& opt
             arg_cmd.emplace_back(value.GetString());
         }
 
+        std::optional<InstallStamp> stamp = install_stamp(manifest, cmd, arg_cmd, opts);
+        if (stamp && !opts.install_force && stamp->upToDate())
+        {
+            info("Dependencies are up to date, skipping install (use --force to run it anyway)");
+            return;
+        }
+
         for (const std::string& arg : opts.arguments)
             arg_cmd.emplace_back(arg);
 
-        debug("Running: {}", arg_cmd);
-        if (TinyProcessLib::Process(arg_cmd).get_exit_status() != 0)
+        std::optional<int> status = manifest.backend()->runNative(arg_cmd, config);
+        if (!status)
+        {
+            debug("Running: {}", arg_cmd);
+            TinyProcessLib::Process proc(arg_cmd, "", nullptr, nullptr, false, config);
+            if (proc.get_id() > 0)
+                SignalRelay::add(proc.get_id());
+            status = proc.get_exit_status();
+            SignalRelay::remove(proc.get_id());
+        }
+        report();
+
+        if (*status != 0)
             die("Command failed: {}", arg_cmd);
+        if (stamp)
+            stamp->save();
     }
     // running in a shell
     else if (jcmd.IsString())
     {
+        // gated the same, its first word taken for the package manager
+        std::vector<std::string> words = split(jcmd.GetString(), ' ');
+        std::erase(words, "");
+        std::optional<InstallStamp> stamp = install_stamp(manifest, cmd, words, opts);
+        if (stamp && !opts.install_force && stamp->upToDate())
+        {
+            info("Dependencies are up to date, skipping install (use --force to run it anyway)");
+            return;
+        }
+
         const std::string exec = fmt::format("{} {}", jcmd.GetString(), fmt::join(opts.arguments, " "));
         debug("Running: {}", exec);
-        if (TinyProcessLib::Process(exec).get_exit_status() != 0)
+        TinyProcessLib::Process proc(exec, "", nullptr, nullptr, false, config);
+        if (proc.get_id() > 0)
+            SignalRelay::add(proc.get_id());
+        const int status = proc.get_exit_status();
+        SignalRelay::remove(proc.get_id());
+        report();
+        if (status != 0)
             die("Command failed: {}", exec);
+        if (stamp)
+            stamp->save();
     }
     else
     {
         die("Command for {} is neither an array or string");
     }
+
+    if (cache && cache->save(cache_key))
+    {
+        info("Saved the outputs of '{}' to {}", cmd, cache->backend().describe());
+
+        // skipped if another process is using the cache, it'll be for next time
+        FsCacheBackend::prune_stats_t stats;
+        FsCacheBackend*               local = dynamic_cast<FsCacheBackend*>(&cache->backend());
+        if (local && local->pruneDue() && local->prune(cache_limits(doc), false, stats) && stats.entries > 0)
+            info("Evicted {} old entries ({}) from the cache", stats.entries, human_size(stats.bytes));
+    }
+}
+
+static std::string dep_label(const DepGraph& graph, uint32_t node)
+{
+    if (graph.version(node).empty())
+        return std::string(graph.name(node));
+    return fmt::format("{}@{}", graph.name(node), graph.version(node));
+}
+
+// the shortest chain from the project to every installed copy of name
+static void deps_why(const DepGraph& graph, const std::string_view name)
+{
+    const std::vector<uint32_t> parent = graph.parents();
+
+    std::vector<std::vector<uint32_t>> dependents(graph.nodeCount());
+    for (uint32_t node = 0; node < graph.nodeCount(); ++node)
+        for (const uint32_t dep : graph.deps(node))
+            if (graph.name(dep) == name && parent[node] != DepGraph::NONE)
+                dependents[dep].push_back(node);
+
+    size_t found = 0;
+    for (uint32_t node = 0; node < graph.nodeCount(); ++node)
+    {
+        if (graph.name(node) != name || parent[node] == DepGraph::NONE || node == graph.root)
+            continue;
+        ++found;
+
+        std::vector<std::string> chain;
+        for (uint32_t n = node; n != graph.root; n = parent[n])
+            chain.push_back(dep_label(graph, n));
+        chain.push_back(dep_label(graph, graph.root));
+        std::reverse(chain.begin(), chain.end());
+
+        std::vector<std::string> by;
+        for (const uint32_t dependent : dependents[node])
+            by.push_back(dep_label(graph, dependent));
+
+        fmt::println("{}", dep_label(graph, node));
+        fmt::println("  {}", fmt::join(chain, " > "));
+        fmt::println("  required by {}: {}", by.size(), fmt::join(by, ", "));
+    }
+
+    if (found == 0)
+        die("{} is not installed", name);
+}
+
+// every package installed more than once, the most copies first
+static void deps_dupes(const DepGraph& graph)
+{
+    const std::vector<uint32_t> parent = graph.parents();
+
+    std::unordered_map<uint32_t, std::vector<uint32_t>> copies;  // name id -> nodes
+    for (uint32_t node = 0; node < graph.nodeCount(); ++node)
+        if (parent[node] != DepGraph::NONE && node != graph.root)
+            copies[graph.node_name[node]].push_back(node);
+
+    std::vector<std::pair<uint32_t, std::vector<uint32_t>>> dupes;
+    for (auto& [name, nodes] : copies)
+        if (nodes.size() > 1)
+            dupes.emplace_back(name, std::move(nodes));
+
+    std::sort(dupes.begin(), dupes.end(), [&](const auto& a, const auto& b) {
+        if (a.second.size() != b.second.size())
+            return a.second.size() > b.second.size();
+        return graph.str(a.first) < graph.str(b.first);
+    });
+
+    for (const auto& [name, nodes] : dupes)
+    {
+        std::vector<std::pair<std::string_view, size_t>> versions;
+        for (const uint32_t node : nodes)
+        {
+            auto it = std::find_if(versions.begin(), versions.end(), [&](const auto& v) {
+                return v.first == graph.version(node);
+            });
+            if (it == versions.end())
+                versions.emplace_back(graph.version(node), 1);
+            else
+                ++it->second;
+        }
+
+        std::vector<std::string> list;
+        for (const auto& [version, count] : versions)
+            list.push_back(count > 1 ? fmt::format("{} (x{})", version, count) : std::string(version));
+        fmt::println("{}: {} copies, {}", graph.str(name), nodes.size(), fmt::join(list, ", "));
+    }
+
+    if (dupes.empty())
+        info("No package is installed more than once");
+}
+
+// like "cargo tree", subtrees already shown are marked with (*)
+static void deps_tree(const DepGraph& graph, const int max_depth)
+{
+    std::vector<bool> expanded(graph.nodeCount());
+    std::string       out = dep_label(graph, graph.root) + "\n";
+    expanded[graph.root]  = true;
+
+    auto walk = [&](auto&& self, uint32_t node, const std::string& prefix, int depth) -> void {
+        const std::span<const uint32_t> deps = graph.deps(node);
+        for (size_t i = 0; i < deps.size(); ++i)
+        {
+            const uint32_t dep  = deps[i];
+            const bool     last = i + 1 == deps.size();
+            const bool     seen = expanded[dep] && !graph.deps(dep).empty();
+
+            out.append(prefix).append(last ? "└── " : "├── ").append(dep_label(graph, dep));
+            out.append(seen ? " (*)\n" : "\n");
+            if (expanded[dep] || (max_depth >= 0 && depth + 1 >= max_depth))
+                continue;
+
+            expanded[dep] = true;
+            self(self, dep, prefix + (last ? "    " : "│   "), depth + 1);
+        }
+    };
+    if (graph.nodeCount() > 0)
+        walk(walk, graph.root, "", 0);
+
+    std::fwrite(out.data(), 1, out.size(), stdout);
+}
+
+void op_deps(Manifest& manifest, const cmd_options_t& opts)
+{
+    const std::string& pm       = manifest.settings().package_manager;
+    const std::string  lockfile = find_lockfile(pm);
+    if (lockfile.empty())
+        die("No lockfile found{}. Run 'ulpm install' first.", pm.empty() ? "" : " for " + pm);
+
+    const DepGraph     graph = load_dep_graph(lockfile);
+    const std::string& query = opts.arguments[0];
+    if (query == "why")
+    {
+        if (opts.arguments.size() < 2)
+            die("Usage: ulpm deps why <package>");
+        deps_why(graph, opts.arguments[1]);
+    }
+    else if (query == "dupes")
+    {
+        deps_dupes(graph);
+    }
+    else if (query == "tree")
+    {
+        deps_tree(graph, opts.deps_depth);
+    }
+}
+
+static std::string_view basename_of(const std::string_view path)
+{
+    const size_t slash = path.rfind('/');
+    return slash == path.npos ? path : path.substr(slash + 1);
+}
+
+static std::string_view dirname_of(const std::string_view path)
+{
+    const size_t slash = path.rfind('/');
+    return slash == path.npos ? std::string_view() : path.substr(0, slash);
+}
+
+// "serde-1a2b3c4d5e6f7a8b", "libserde-1a2b3c4d5e6f7a8b.rlib" -> "serde"
+static std::string_view crate_of(std::string_view name, const bool artifact)
+{
+    if (artifact)
+    {
+        const size_t dot = name.find('.');
+        if (dot != name.npos)
+        {
+            const std::string_view ext = name.substr(dot + 1);
+            if (hasStart(name, "lib") && (ext == "rlib" || ext == "rmeta" || ext == "so" || ext == "a" || ext == "dylib"))
+                name.remove_prefix(3);
+            name = name.substr(0, name.find('.'));
+        }
+    }
+
+    const size_t dash = name.rfind('-');
+    if (dash != name.npos && name.length() - dash - 1 == 16 &&
+        name.find_first_not_of("0123456789abcdef", dash + 1) == name.npos)
+        name = name.substr(0, dash);
+    return name;
+}
+
+struct inode_hash
+{
+    size_t operator()(const std::pair<uint64_t, uint64_t>& id) const
+    {
+        return std::hash<uint64_t>()(id.first * 0x9e3779b97f4a7c15ULL ^ id.second);
+    }
+};
+
+struct du_usage_t
+{
+    uint64_t disk = 0, apparent = 0, files = 0;
+};
+
+// Sizes of one artifact directory, attributed to the package or crate they belong to
+static void du_scan(const std::string& root, const size_t top)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    enum class Layout
+    {
+        NodeModules,
+        CargoTarget,
+        Other
+    };
+    const std::string root_name = fs::absolute(root).lexically_normal().filename().string();
+    const Layout      layout    = root_name == "node_modules" ? Layout::NodeModules
+                                  : root_name == "target"     ? Layout::CargoTarget
+                                                              : Layout::Other;
+
+    // tag 0 is whatever doesn't belong to any package
+    std::mutex                                names_mutex;
+    std::vector<std::string>                  names{ "(other)" };
+    std::unordered_map<std::string, uint32_t> tags;
+    auto                                      tag_of = [&](const std::string_view name) {
+        std::lock_guard<std::mutex> lock(names_mutex);
+        const auto [it, inserted] = tags.try_emplace(std::string(name), names.size());
+        if (inserted)
+            names.emplace_back(name);
+        return it->second;
+    };
+
+    // (dev, ino) of files with more than one link, so they're counted once
+    static constexpr size_t SHARDS = 64;
+    struct shard_t
+    {
+        std::mutex                                                 mutex;
+        std::unordered_set<std::pair<uint64_t, uint64_t>, inode_hash> seen;
+    };
+
+    TreeWalker                           walker;
+    std::vector<std::vector<du_usage_t>> usage(walker.threads());
+    std::vector<uint64_t>                dirs(walker.threads()), linked(walker.threads());
+    std::vector<shard_t>                 shards(SHARDS);
+
+    auto visit = [&](size_t worker, const TreeWalker::dir_t& parent, const TreeWalker::entry_t& e, uint32_t& tag) {
+        const std::string_view parent_path = parent.path;
+        const std::string_view parent_name = parent_path.empty() ? std::string_view(root_name) : basename_of(parent_path);
+
+        if (e.is_dir)
+        {
+            ++dirs[worker];
+            switch (layout)
+            {
+                case Layout::NodeModules:
+                    // node_modules/<pkg>, node_modules/@scope/<pkg>, nested ones included
+                    if (parent_name == "node_modules" && e.name[0] != '@')
+                    {
+                        tag = tag_of(e.name);
+                    }
+                    else if (!parent_name.empty() && parent_name[0] == '@')
+                    {
+                        const std::string_view up = dirname_of(parent_path);
+                        if ((up.empty() ? std::string_view(root_name) : basename_of(up)) == "node_modules")
+                            tag = tag_of(fmt::format("{}/{}", parent_name, e.name));
+                    }
+                    break;
+                case Layout::CargoTarget:
+                    // target/<profile>/{build,.fingerprint,incremental}/<crate>-<hash>
+                    if (tag == 0 && (parent_name == "build" || parent_name == ".fingerprint" || parent_name == "incremental"))
+                        tag = tag_of(crate_of(e.name, false));
+                    break;
+                case Layout::Other:
+                    if (parent_path.empty())
+                        tag = tag_of(e.name);
+                    break;
+            }
+            return true;
+        }
+
+        // target/<profile>/deps/lib<crate>-<hash>.rlib and co.
+        if (layout == Layout::CargoTarget && tag == 0 && parent_name == "deps")
+            tag = tag_of(crate_of(e.name, true));
+        else if (layout == Layout::Other && parent_path.empty())
+            tag = tag_of(e.name);
+
+        if (e.nlink > 1)
+        {
+            shard_t&                    shard = shards[e.ino % SHARDS];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (!shard.seen.emplace(e.dev, e.ino).second)
+            {
+                ++linked[worker];
+                return false;
+            }
+        }
+
+        std::vector<du_usage_t>& mine = usage[worker];
+        if (mine.size() <= tag)
+            mine.resize(tag + 1);
+        mine[tag].disk += e.blocks * 512;
+        mine[tag].apparent += e.size;
+        ++mine[tag].files;
+        return false;
+    };
+
+    if (!walker.walk(root, visit))
+    {
+        warn("Can't open {}: {}", root, strerror(errno));
+        return;
+    }
+
+    std::vector<du_usage_t> total_by_tag(names.size());
+    du_usage_t              total;
+    for (const std::vector<du_usage_t>& mine : usage)
+    {
+        for (size_t tag = 0; tag < mine.size(); ++tag)
+        {
+            total_by_tag[tag].disk += mine[tag].disk;
+            total_by_tag[tag].apparent += mine[tag].apparent;
+            total_by_tag[tag].files += mine[tag].files;
+            total.disk += mine[tag].disk;
+            total.apparent += mine[tag].apparent;
+            total.files += mine[tag].files;
+        }
+    }
+
+    std::vector<uint32_t> order;
+    for (uint32_t tag = 0; tag < total_by_tag.size(); ++tag)
+        if (total_by_tag[tag].files > 0)
+            order.push_back(tag);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return total_by_tag[a].disk > total_by_tag[b].disk;
+    });
+
+    uint64_t total_dirs = 0, total_linked = 0;
+    for (size_t i = 0; i < walker.threads(); ++i)
+    {
+        total_dirs += dirs[i];
+        total_linked += linked[i];
+    }
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    info("{}: {} on disk ({} apparent), {} files, {} dirs, {} hard links counted once, scanned in {:.2f}s",
+         root,
+         human_size(total.disk),
+         human_size(total.apparent),
+         total.files,
+         total_dirs,
+         total_linked,
+         elapsed);
+
+    for (size_t i = 0; i < order.size() && i < top; ++i)
+    {
+        const du_usage_t& u = total_by_tag[order[i]];
+        fmt::println("{:>10}  {:>7} files  {}", human_size(u.disk), u.files, names[order[i]]);
+    }
+    if (order.size() > top)
+        fmt::println("{:>10}  ... and {} more", "", order.size() - top);
+}
+
+void op_du(Manifest& manifest, const cmd_options_t& opts)
+{
+    std::vector<std::string> roots = opts.arguments;
+    if (roots.empty() && manifest.backend())
+        roots = manifest.backend()->artifactDirs();
+    if (roots.empty())
+        roots = { "node_modules", "target" };
+
+    bool scanned = false;
+    for (const std::string& root : roots)
+    {
+        std::error_code ec;
+        if (!fs::is_directory(root, ec))
+        {
+            if (!opts.arguments.empty())
+                warn("{} is not a directory", root);
+            continue;
+        }
+
+        if (scanned)
+            fmt::println("");
+        du_scan(root, opts.du_top);
+        scanned = true;
+    }
+
+    if (!scanned)
+        die("Nothing to scan, no {} here", fmt::join(roots, " or "));
+}
+
+static constexpr std::string_view TRASH_DIR = ".ulpm/trash";
+
+static bool clean_path(const std::string& path, const std::string_view label)
+{
+    const auto           start = std::chrono::steady_clock::now();
+    const remove_stats_t stats = remove_tree(path);
+    const double         secs  = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (stats.failed > 0)
+    {
+        warn("Failed to remove {} entries of {}: {}", stats.failed, label, strerror(stats.error));
+        return false;
+    }
+    if (!label.empty())
+        info("Removed {} ({} files, {} dirs) in {:.2f}s", label, stats.files, stats.dirs, secs);
+    return true;
+}
+
+void op_clean(Manifest& manifest, const cmd_options_t& opts)
+{
+    if (!manifest.backend())
+        die("No language set in ulpm.json, don't know what to clean");
+
+    const std::vector<clean_target_t> targets = manifest.backend()->cleanTargets();
+    if (opts.clean_list)
+    {
+        for (const clean_target_t& target : targets)
+            fmt::println("{:<12} {}{}", target.name, target.description, target.by_default ? " (default)" : "");
+        return;
+    }
+
+    std::vector<std::string> paths;
+    for (const clean_target_t& target : targets)
+    {
+        const bool wanted = opts.arguments.empty()
+                                ? target.by_default
+                                : std::find(opts.arguments.begin(), opts.arguments.end(), target.name) !=
+                                      opts.arguments.end();
+        if (wanted)
+            paths.insert(paths.end(), target.paths.begin(), target.paths.end());
+    }
+    for (const std::string& arg : opts.arguments)
+        if (std::none_of(targets.begin(), targets.end(), [&](const clean_target_t& t) { return t.name == arg; }))
+            die("Unknown clean target '{}', see 'ulpm clean --list'", arg);
+
+    // node_modules/.cache goes away with node_modules already
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+    std::vector<std::string> existing;
+    for (const std::string& path : paths)
+    {
+        std::error_code ec;
+        if (!existing.empty() && hasStart(path, existing.back() + "/"))
+            continue;
+        if (fs::exists(fs::symlink_status(path, ec)))
+            existing.push_back(path);
+    }
+
+    // Whatever an earlier background removal didn't get to
+    std::vector<std::string> trash;
+    std::error_code          ec;
+    for (const fs::directory_entry& entry : fs::directory_iterator(std::string(TRASH_DIR), ec))
+        trash.push_back(entry.path().string());
+
+    if (existing.empty() && trash.empty())
+    {
+        info("Nothing to clean");
+        return;
+    }
+
+    bool ok = true;
+    if (opts.clean_background)
+    {
+        for (const std::string& path : existing)
+        {
+            const std::string moved = move_aside(path, std::string(TRASH_DIR));
+            if (moved.empty())
+            {
+                // most likely on another filesystem than .ulpm/
+                ok &= clean_path(path, path);
+                continue;
+            }
+            info("Moved {} aside, removing it in the background", path);
+            trash.push_back(moved);
+        }
+        if (!trash.empty() && !remove_in_background(trash))
+        {
+            warn("Couldn't start removing in the background, removing here instead");
+            for (const std::string& path : trash)
+                ok &= clean_path(path, "");
+        }
+    }
+    else
+    {
+        for (const std::string& path : existing)
+            ok &= clean_path(path, path);
+        for (const std::string& path : trash)
+            ok &= clean_path(path, "");
+    }
+
+    if (!ok)
+        die("Some files couldn't be removed");
+}
+
+static std::string first_few(const std::vector<std::string>& names)
+{
+    static constexpr size_t MAX = 5;
+    if (names.size() <= MAX)
+        return fmt::format("{}", fmt::join(names, ", "));
+    return fmt::format("{}, ... ({} more)", fmt::join(names.begin(), names.begin() + MAX, ", "), names.size() - MAX);
+}
+
+// node_modules as package-lock.json describes it, out of the store
+static void store_link(PackageStore& store, const std::string& pm)
+{
+    if (!pm.empty() && pm != "npm")
+        die("ulpm store link only knows package-lock.json, not the lockfile of {}", pm);
+    const std::string lockfile = find_lockfile("npm");
+    if (lockfile.empty())
+        die("No package-lock.json found. Run 'ulpm install' once first.");
+
+    const auto                       start    = std::chrono::steady_clock::now();
+    const std::vector<npm_package_t> packages = read_npm_lock(lockfile);
+
+    // bundled dependencies have no integrity of their own, they come with
+    // the files of the package bundling them
+    std::vector<const npm_package_t*> installs;
+    for (const npm_package_t& pkg : packages)
+        if (hasStart(pkg.path, "node_modules/") && !pkg.in_bundle)
+            installs.push_back(&pkg);
+
+    // Import what the store doesn't have yet from npm's cache
+    std::vector<std::string> hexes(installs.size());
+    std::vector<std::string> missing;
+    std::mutex               missing_mutex;
+    parallel_for(installs.size(), [&](const size_t i) {
+        const npm_package_t& pkg = *installs[i];
+        if (pkg.link)
+            return;
+
+        std::string hex = integrity_to_hex(pkg.integrity);
+        if (!hex.empty() && !store.has(hex))
+        {
+            const std::string tarball = PackageStore::npmCacheTarball(pkg.integrity);
+            hex                       = tarball.empty() ? "" : store.add(tarball, pkg.integrity);
+        }
+
+        // most likely meant for another platform
+        if (hex.empty() && !pkg.optional)
+        {
+            std::lock_guard<std::mutex> lock(missing_mutex);
+            missing.push_back(fmt::format("{}@{}", pkg.name, pkg.version));
+        }
+        hexes[i] = std::move(hex);
+    });
+    if (!missing.empty())
+        die("{} packages are neither in the store nor in npm's cache: {}\n"
+            "Run 'npm ci' once to fetch them.",
+            missing.size(),
+            first_few(missing));
+
+    // whatever is left could be a hard link into the store
+    if (const remove_stats_t removed = remove_tree("node_modules"); removed.failed > 0)
+        die("Failed to remove {} entries of node_modules: {}", removed.failed, strerror(removed.error));
+
+    PackageStore::link_stats_t stats;
+    std::atomic<size_t>        failed = 0;
+    parallel_for(installs.size(), [&](const size_t i) {
+        if (!hexes[i].empty() && !store.materialize(hexes[i], installs[i]->path, stats))
+            ++failed;
+    });
+
+    std::vector<std::string> scripts;
+    std::error_code          ec;
+    for (const npm_package_t* pkg : installs)
+    {
+        const fs::path path   = pkg->path;
+        const fs::path parent = path.parent_path();
+        if (pkg->link)
+        {
+            fs::create_directories(parent, ec);
+            fs::create_directory_symlink(fs::path(pkg->resolved).lexically_relative(parent), path, ec);
+            if (ec)
+                warn("Can't link {} to {}: {}", pkg->path, pkg->resolved, ec.message());
+            continue;
+        }
+
+        if (pkg->has_install_script)
+            scripts.push_back(pkg->name);
+
+        // node_modules/.bin/<cmd> -> ../<package>/<file>
+        const fs::path bin_dir = parent / ".bin";
+        for (const auto& [cmd, file] : pkg->bins)
+        {
+            const fs::path link = bin_dir / cmd;
+            fs::create_directories(link.parent_path(), ec);
+            fs::remove(link, ec);
+            fs::create_symlink((path / file).lexically_normal().lexically_relative(link.parent_path()), link, ec);
+            if (ec)
+                warn("Can't link {}: {}", link.string(), ec.message());
+        }
+    }
+
+    store.registerProject(".");
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    info("Linked {} packages from {} in {:.2f}s ({} files cloned, {} hard linked, {} copied)",
+         installs.size(),
+         store.path(),
+         elapsed,
+         stats.cloned.load(),
+         stats.linked.load(),
+         stats.copied.load());
+    if (!scripts.empty())
+        warn("{} packages have install scripts that weren't run: {}", scripts.size(), first_few(scripts));
+    if (failed > 0)
+        die("{} packages couldn't be linked", failed.load());
+}
+
+void op_store(Manifest& manifest, const cmd_options_t& opts)
+{
+    PackageStore       store;
+    const std::string& action = opts.arguments[0];
+    if (action == "path")
+    {
+        fmt::println("{}", store.path());
+    }
+    else if (action == "add")
+    {
+        if (opts.arguments.size() < 2)
+            die("Usage: ulpm store add <tarball...>");
+
+        bool ok = true;
+        for (size_t i = 1; i < opts.arguments.size(); ++i)
+        {
+            const std::string hex = store.add(opts.arguments[i]);
+            if (!hex.empty())
+                info("Added {}", opts.arguments[i]);
+            ok &= !hex.empty();
+        }
+        if (!ok)
+            die("Some tarballs couldn't be added");
+    }
+    else if (action == "link")
+    {
+        store_link(store, manifest.settings().package_manager);
+    }
+    else if (action == "gc")
+    {
+        const PackageStore::gc_stats_t stats = store.gc();
+        info("Removed {} packages and {} files from {}, {} freed",
+             stats.packages,
+             stats.files,
+             store.path(),
+             human_size(stats.bytes));
+    }
+}
+
+void op_cache(Manifest& manifest, const cmd_options_t& opts)
+{
+    const rapidjson::Document& doc      = manifest.doc();
+    const std::string          location = cache_location(doc);
+    const std::string&         action   = opts.arguments[0];
+    if (action == "path")
+    {
+        fmt::println("{}", location);
+        return;
+    }
+
+    std::unique_ptr<CacheBackend> backend = make_cache_backend(location);
+    FsCacheBackend*               local   = dynamic_cast<FsCacheBackend*>(backend.get());
+    if (!local)
+        die("{} is a remote cache, only local ones can be looked after by ulpm", location);
+
+    if (action == "prune")
+    {
+        const FsCacheBackend::limits_t limits = cache_limits(doc, opts.cache_max_size, opts.cache_max_age);
+        FsCacheBackend::prune_stats_t  stats;
+        if (!local->prune(limits, false, stats))
+        {
+            info("Waiting for the other ulpm processes using {}", location);
+            local->prune(limits, true, stats);
+        }
+        info("Evicted {} entries ({}) from {}, {} left ({})",
+             stats.entries,
+             human_size(stats.bytes),
+             location,
+             stats.kept,
+             human_size(stats.kept_bytes));
+    }
+    else if (action == "stats")
+    {
+        const FsCacheBackend::usage_t usage   = local->usage();
+        const uint64_t                lookups = usage.hits + usage.misses;
+        auto                          date    = [](const int64_t time) {
+            char             buf[32] = "never";
+            const std::time_t t      = time;
+            if (time > 0)
+                std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", std::localtime(&t));
+            return std::string(buf);
+        };
+
+        fmt::println("Cache:       {}", location);
+        fmt::println("Holds:       {} ({} actions, {} blobs)", human_size(usage.bytes), usage.actions, usage.blobs);
+        fmt::println("Hit rate:    {} ({} of {} lookups)",
+                     lookups ? fmt::format("{:.1f}%", 100.0 * usage.hits / lookups) : "-",
+                     usage.hits,
+                     lookups);
+        fmt::println("Restored:    {}", human_size(usage.restored));
+        fmt::println("Stored:      {}", human_size(usage.stored));
+        fmt::println("Evicted:     {} ({} entries)", human_size(usage.evicted_bytes), usage.evicted);
+        fmt::println("Since:       {}", date(usage.since));
+        fmt::println("Last prune:  {}", date(usage.last_prune));
+    }
+}
+
+void op_projects(Manifest& manifest, const cmd_options_t& opts)
+{
+    const std::string root  = opts.arguments.empty() ? "." : opts.arguments[0];
+    const auto        start = std::chrono::steady_clock::now();
+
+    std::error_code ec;
+    if (!fs::is_directory(root, ec))
+        die("{} is not a directory", root);
+
+    ProjectDiscovery             discovery(root);
+    const std::vector<project_t> projects = discovery.discover(!opts.projects_rescan);
+
+    for (const project_t& project : projects)
+    {
+        std::vector<std::string_view> kinds;
+        if (project.manifests & MANIFEST_ULPM)
+            kinds.push_back("ulpm.json");
+        if (project.manifests & MANIFEST_PACKAGE_JSON)
+            kinds.push_back("package.json");
+        if (project.manifests & MANIFEST_CARGO)
+            kinds.push_back("Cargo.toml");
+        fmt::println("{:<40} {}", project.path.empty() ? "." : project.path, fmt::join(kinds, ", "));
+    }
+
+    const ProjectDiscovery::stats_t& stats = discovery.stats();
+    info("{} projects in {} directories, {} in {}ms",
+         projects.size(),
+         stats.dirs,
+         stats.from_index ? "all from the index" : fmt::format("{} walked", stats.rescanned),
+         std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+void op_affected(Manifest& manifest, const cmd_options_t& opts)
+{
+    if (!opts.affected_save.empty())
+    {
+        const FileSnapshot snap = FileSnapshot::capture(".");
+        const std::string  path = snapshot_path(".", opts.affected_save);
+        if (!snap.save(path))
+            die("Failed to write {}: {}", path, strerror(errno));
+        info("Saved the hashes of {} files to {}", snap.size(), path);
+        return;
+    }
+
+    size_t                                nchanged = 0;
+    const std::vector<affected_project_t> affected = find_affected(opts.affected_since, nchanged);
+    for (const affected_project_t& a : affected)
+        fmt::println("{:<40} {:<30} {}",
+                     a.project.path.empty() ? "." : a.project.path,
+                     a.name,
+                     a.changed ? "changed" : "dependent");
+
+    info("{} file(s) changed since {}, {} project(s) affected", nchanged, opts.affected_since, affected.size());
+}
+
+void op_hash(Manifest& manifest, const cmd_options_t& opts)
+{
+    const std::string root  = opts.arguments.empty() ? "." : opts.arguments[0];
+    const auto        start = std::chrono::steady_clock::now();
+
+    std::error_code ec;
+    if (!fs::is_directory(root, ec))
+        die("{} is not a directory", root);
+
+    ProjectDiscovery               discovery(root);
+    const std::vector<std::string> files  = discovery.files();
+    const auto                     listed = std::chrono::steady_clock::now();
+
+    FileHasher                                    hasher(root);
+    const std::vector<std::optional<file_hash_t>> hashes = hasher.hash(files, !opts.hash_no_cache);
+
+    std::vector<std::pair<std::string, file_hash_t>> hashed;
+    hashed.reserve(files.size());
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        if (!hashes[i])
+        {
+            warn("Failed to read {}", files[i]);
+            continue;
+        }
+        if (opts.hash_files)
+            fmt::println("{} {}", Sha256::hex(*hashes[i]), files[i]);
+        hashed.emplace_back(files[i], *hashes[i]);
+    }
+    fmt::println("{} {}", Sha256::hex(merkle_roots(hashed)[""]), root);
+
+    auto ms = [](const auto d) { return std::chrono::duration_cast<std::chrono::milliseconds>(d).count(); };
+    const FileHasher::stats_t& stats = hasher.stats();
+    info("{} files listed in {}ms, {} read ({}) in {}ms through {}",
+         files.size(),
+         ms(listed - start),
+         stats.hashed,
+         human_size(stats.bytes),
+         ms(std::chrono::steady_clock::now() - listed),
+         stats.uring ? "io_uring" : "blocking calls");
 }
@@ -0,0 +1,446 @@
+#include "package_store.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <unordered_set>
+#include <vector>
+
+#include "file_lock.hpp"
+#include "fmt/format.h"
+#include "lockfile_index.hpp"
+#include "rapidjson/document.h"
+#include "sha512.hpp"
+#include "switch_fnv1a.hpp"
+#include "tiny-process-library/process.hpp"
+#include "tree_remover.hpp"
+#include "tree_walker.hpp"
+#include "util.hpp"
+
+#ifdef _WIN32
+#  include <process.h>
+#  define getpid _getpid
+#else
+#  include <fcntl.h>
+#  include <sys/ioctl.h>
+#  include <unistd.h>
+#endif
+#ifdef __linux__
+#  include <linux/fs.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static std::string getenv_str(const char* name)
+{
+    const char* value = std::getenv(name);
+    return value ? value : "";
+}
+
+static std::string hash_file(const std::string& path)
+{
+    std::FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f)
+        return {};
+
+    Sha512 sha;
+    char   buf[64 * 1024];
+    size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0)
+        sha.update(buf, n);
+    const bool failed = std::ferror(f);
+    std::fclose(f);
+    return failed ? std::string() : Sha512::hex(sha.finish());
+}
+
+static std::string read_text(const std::string& path)
+{
+    std::ifstream f(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+// The files package.json's "bin" points to, which have to be executable
+static std::unordered_set<std::string> bin_files(const std::string& package_json)
+{
+    std::unordered_set<std::string> ret;
+    rapidjson::Document             doc;
+    if (doc.Parse(read_text(package_json).c_str()).HasParseError() || !doc.IsObject() || !doc.HasMember("bin"))
+        return ret;
+
+    auto add = [&](const rapidjson::Value& v) {
+        if (v.IsString())
+            ret.insert(fs::path(v.GetString()).lexically_normal().generic_string());
+    };
+    if (doc["bin"].IsObject())
+        for (const auto& m : doc["bin"].GetObj())
+            add(m.value);
+    else
+        add(doc["bin"]);
+    return ret;
+}
+
+static constexpr std::string_view LOCK_FILE = "lock";
+
+PackageStore::PackageStore()
+{
+    if (std::string dir = getenv_str("ULPM_STORE_DIR"); !dir.empty())
+        m_path = std::move(dir);
+    else
+        m_path = user_cache_dir("store");
+}
+
+std::string PackageStore::indexPath(const std::string& hex) const
+{
+    return fmt::format("{}/index/{}/{}", m_path, hex.substr(0, 2), hex.substr(2));
+}
+
+std::string PackageStore::filePath(const std::string& hex, const bool exec) const
+{
+    return fmt::format("{}/files/{}/{}{}", m_path, hex.substr(0, 2), hex.substr(2), exec ? "-x" : "");
+}
+
+std::string PackageStore::tmpPath() const
+{
+    static std::atomic<uint64_t> counter = 0;
+    return fmt::format("{}/tmp/{}-{}", m_path, getpid(), counter++);
+}
+
+bool PackageStore::has(const std::string& hex) const
+{
+    std::error_code ec;
+    return fs::exists(indexPath(hex), ec);
+}
+
+std::string PackageStore::npmCacheTarball(const std::string_view integrity)
+{
+    const std::string hex = integrity_to_hex(integrity);
+    if (hex.empty())
+        return {};
+
+    std::string cache = getenv_str("npm_config_cache");
+#ifdef _WIN32
+    if (cache.empty())
+        cache = getenv_str("LOCALAPPDATA") + "\\npm-cache";
+#else
+    if (cache.empty())
+        cache = getenv_str("HOME") + "/.npm";
+#endif
+
+    // cacache keeps content under its own integrity
+    const std::string path =
+        fmt::format("{}/_cacache/content-v2/sha512/{}/{}/{}", cache, hex.substr(0, 2), hex.substr(2, 2), hex.substr(4));
+    std::error_code ec;
+    return fs::exists(path, ec) ? path : std::string();
+}
+
+std::string PackageStore::add(const std::string& tarball, const std::string_view integrity)
+{
+    const std::string hex = hash_file(tarball);
+    if (hex.empty())
+    {
+        warn("Can't read {}: {}", tarball, strerror(errno));
+        return {};
+    }
+    if (!integrity.empty() && integrity_to_hex(integrity) != hex)
+    {
+        warn("{} doesn't match its integrity {}, not adding it", tarball, integrity);
+        return {};
+    }
+    if (has(hex))
+        return hex;
+
+    // shared with other adds, gc() would remove the files renamed into
+    // files/ before the index referring to them is written
+    std::error_code ec;
+    fs::create_directories(m_path, ec);
+    const FileLock    lock(fmt::format("{}/{}", m_path, LOCK_FILE), FileLock::Mode::Shared);
+    const std::string staging = tmpPath();
+    fs::create_directories(staging, ec);
+    if (ec)
+    {
+        warn("Can't create {}: {}", staging, ec.message());
+        return {};
+    }
+
+    std::string tar_err;
+    const int   status = TinyProcessLib::Process(
+                           { "tar", "-xzf", tarball, "-C", staging, "--no-same-owner" },
+                           "",
+                           [](const char*, size_t) {},
+                           [&](const char* bytes, size_t n) { tar_err.append(bytes, n); })
+                           .get_exit_status();
+    if (status != 0)
+    {
+        warn("Failed to extract {}: {}", tarball, tar_err);
+        remove_tree(staging);
+        return {};
+    }
+
+    // npm tarballs have everything under package/, but some use another name
+    std::vector<fs::directory_entry> top;
+    for (const fs::directory_entry& entry : fs::directory_iterator(staging, ec))
+        top.push_back(entry);
+    const fs::path root = top.size() == 1 && top[0].is_directory(ec) ? top[0].path() : fs::path(staging);
+
+    const std::unordered_set<std::string> bins = bin_files((root / "package.json").string());
+
+    std::string index;
+    bool        ok = true;
+    std::error_code walk_ec;
+    for (auto it = fs::recursive_directory_iterator(root, walk_ec);
+         ok && !walk_ec && it != fs::recursive_directory_iterator();
+         it.increment(walk_ec))
+    {
+        if (!it->is_regular_file(ec) || it->is_symlink(ec))
+            continue;
+
+        const std::string rel  = it->path().lexically_relative(root).generic_string();
+        const bool        exec = bins.count(rel) ||
+                          (it->status(ec).permissions() & fs::perms::owner_exec) != fs::perms::none;
+        const std::string file_hex = hash_file(it->path().string());
+        if (file_hex.empty())
+        {
+            ok = false;
+            break;
+        }
+        const std::string dest = filePath(file_hex, exec);
+
+        // Already there is fine: same name, same content
+        if (!fs::exists(dest, ec))
+        {
+            fs::create_directories(fs::path(dest).parent_path(), ec);
+            fs::permissions(it->path(), exec ? fs::perms(0755) : fs::perms(0644), ec);
+            fs::rename(it->path(), dest, ec);
+            if (ec)
+            {
+                warn("Can't add {} to the store: {}", rel, ec.message());
+                ok = false;
+                break;
+            }
+        }
+        index += fmt::format("{} {} {}\n", exec ? 'x' : '-', file_hex, rel);
+    }
+
+    if (ok && walk_ec)
+    {
+        warn("Can't read {}: {}", root.string(), walk_ec.message());
+        ok = false;
+    }
+    if (ok)
+    {
+        const std::string tmp_index = staging + ".index";
+        const std::string dest      = indexPath(hex);
+        {
+            std::ofstream f(tmp_index, std::ios::binary);
+            f << index;
+            ok = f.good();
+        }
+        fs::create_directories(fs::path(dest).parent_path(), ec);
+        fs::rename(tmp_index, dest, ec);
+        if (ec)
+        {
+            warn("Can't write {}: {}", dest, ec.message());
+            fs::remove(tmp_index, ec);
+            ok = false;
+        }
+    }
+
+    remove_tree(staging);
+    return ok ? hex : std::string();
+}
+
+// Cleared once the filesystem turns out not to support reflinks
+static std::atomic<bool> g_try_reflink = true;
+
+static bool link_file(const std::string& src, const std::string& dst, const bool exec, PackageStore::link_stats_t& stats)
+{
+    // dst may be a hard link into the store left by an earlier run, writing
+    // through it would change the file for every project linked to it
+    std::error_code ec;
+    if (!fs::remove(dst, ec) && ec)
+    {
+        warn("Can't replace {}: {}", dst, ec.message());
+        return false;
+    }
+
+#ifdef FICLONE
+    if (g_try_reflink)
+    {
+        const int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+        const int out =
+            in < 0 ? -1 : open(dst.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, exec ? 0755 : 0644);
+        const bool cloned = out >= 0 && ioctl(out, FICLONE, in) == 0;
+        const int  err    = errno;
+        if (out >= 0)
+            close(out);
+        if (in >= 0)
+            close(in);
+
+        if (cloned)
+        {
+            ++stats.cloned;
+            return true;
+        }
+        if (out >= 0)
+        {
+            unlink(dst.c_str());
+            if (err == EOPNOTSUPP || err == EXDEV || err == EINVAL || err == ENOTTY)
+                g_try_reflink = false;
+        }
+    }
+#endif
+
+    fs::create_hard_link(src, dst, ec);
+    if (!ec)
+    {
+        ++stats.linked;
+        return true;
+    }
+
+    // EMLINK for a file every package has, EXDEV for a store on another filesystem
+    fs::copy_file(src, dst, ec);
+    if (!ec)
+    {
+        ++stats.copied;
+        return true;
+    }
+    warn("Can't link {}: {}", dst, ec.message());
+    return false;
+}
+
+bool PackageStore::materialize(const std::string& hex, const std::string& dir, link_stats_t& stats)
+{
+    // gc() may not remove the files of the package while they get linked
+    const FileLock lock(fmt::format("{}/{}", m_path, LOCK_FILE), FileLock::Mode::Shared);
+    std::ifstream  f(indexPath(hex));
+    if (!f)
+        return false;
+
+    std::error_code                 ec;
+    std::unordered_set<std::string> made_dirs;
+    std::string                     line;
+    while (std::getline(f, line))
+    {
+        // "<x|-> <hash> <path>"
+        if (line.size() < 4 || line[1] != ' ')
+            continue;
+        const size_t space = line.find(' ', 2);
+        if (space == line.npos)
+            continue;
+
+        const bool        exec = line[0] == 'x';
+        const std::string dst  = fmt::format("{}/{}", dir, std::string_view(line).substr(space + 1));
+        const std::string parent = fs::path(dst).parent_path().string();
+        if (made_dirs.insert(parent).second)
+            fs::create_directories(parent, ec);
+
+        if (!link_file(filePath(line.substr(2, space - 2), exec), dst, exec, stats))
+            return false;
+    }
+    return true;
+}
+
+void PackageStore::registerProject(const std::string& dir)
+{
+    const std::string abs  = fs::absolute(dir).lexically_normal().string();
+    const std::string path = fmt::format("{}/projects/{:016x}", m_path, fnv1a<64>::hash(abs.data(), abs.size()));
+
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    std::ofstream(path, std::ios::binary) << abs << '\n';
+}
+
+PackageStore::gc_stats_t PackageStore::gc()
+{
+    gc_stats_t      stats;
+    std::error_code ec;
+    // waits for the adds and materializations under way
+    fs::create_directories(m_path, ec);
+    const FileLock lock(fmt::format("{}/{}", m_path, LOCK_FILE), FileLock::Mode::Exclusive);
+
+    // The packages still used by some project
+    std::unordered_set<std::string> live;
+    for (const fs::directory_entry& entry : fs::directory_iterator(m_path + "/projects", ec))
+    {
+        std::string project = read_text(entry.path().string());
+        while (!project.empty() && (project.back() == '\n' || project.back() == '\r'))
+            project.pop_back();
+
+        std::string lockfile;
+        for (const char* name : { "package-lock.json", "npm-shrinkwrap.json" })
+            if (fs::exists(fmt::format("{}/{}", project, name), ec))
+                lockfile = fmt::format("{}/{}", project, name);
+        if (lockfile.empty())
+        {
+            fs::remove(entry.path(), ec);
+            continue;
+        }
+
+        for (const npm_package_t& pkg : read_npm_lock(lockfile))
+            if (std::string hex = integrity_to_hex(pkg.integrity); !hex.empty())
+                live.insert(std::move(hex));
+    }
+
+    // Drop the other packages, and keep note of the files of the rest
+    std::unordered_set<std::string> kept_files;
+    for (auto it = fs::recursive_directory_iterator(m_path + "/index", ec); !ec && it != fs::recursive_directory_iterator();
+         it.increment(ec))
+    {
+        if (!it->is_regular_file(ec))
+            continue;
+
+        const std::string hex = it->path().parent_path().filename().string() + it->path().filename().string();
+        if (!live.count(hex))
+        {
+            fs::remove(it->path(), ec);
+            ++stats.packages;
+            continue;
+        }
+
+        std::ifstream f(it->path());
+        std::string   line;
+        while (std::getline(f, line))
+            if (const size_t space = line.find(' ', 2); line.size() > 4 && space != line.npos)
+                kept_files.insert(line.substr(2, space - 2) + (line[0] == 'x' ? "-x" : ""));
+    }
+
+    // files/ab/cdef... -> "abcdef..."
+    TreeWalker            walker;
+    std::vector<uint64_t> files(walker.threads()), bytes(walker.threads());
+    walker.walk(m_path + "/files", [&](size_t worker, const TreeWalker::dir_t& parent, const TreeWalker::entry_t& e, uint32_t&) {
+        if (e.is_dir)
+            return parent.path.empty();
+        if (kept_files.count(fmt::format("{}{}", parent.path, e.name)))
+            return false;
+
+#ifndef _WIN32
+        if (unlinkat(e.dir_fd, e.name.data(), 0) != 0)
+            return false;
+#else
+        if (!fs::remove(fmt::format("{}/files/{}/{}", m_path, parent.path, e.name), ec))
+            return false;
+#endif
+        ++files[worker];
+        // still linked in some project's node_modules otherwise
+        if (e.nlink <= 1)
+            bytes[worker] += e.blocks * 512;
+        return false;
+    });
+    for (size_t i = 0; i < walker.threads(); ++i)
+    {
+        stats.files += files[i];
+        stats.bytes += bytes[i];
+    }
+
+    // Whatever an interrupted ulpm left in tmp/ a day ago
+    const auto day_ago = fs::file_time_type::clock::now() - std::chrono::hours(24);
+    for (const fs::directory_entry& entry : fs::directory_iterator(m_path + "/tmp", ec))
+        if (entry.last_write_time(ec) < day_ago)
+            remove_tree(entry.path().string());
+
+    return stats;
+}
@@ -0,0 +1,114 @@
+#include "pipeline.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include "fmt/ranges.h"
+#include "signal_relay.hpp"
+#include "util.hpp"
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <signal.h>
+#  include <unistd.h>
+#endif
+
+#ifndef _WIN32
+
+// pipe2() with O_CLOEXEC, which macOS doesn't have
+static bool open_pipe(int fds[2])
+{
+#ifdef __APPLE__
+    if (pipe(fds) != 0)
+        return false;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return true;
+#else
+    return pipe2(fds, O_CLOEXEC) == 0;
+#endif
+}
+
+std::vector<stage_result_t> run_pipeline(const std::vector<std::vector<std::string>>& stages,
+                                         const TinyProcessLib::Config&                config,
+                                         CgroupTree*                                  cgroups,
+                                         const cgroup_limits_t&                       limits)
+{
+    const size_t                count = stages.size();
+    std::vector<stage_result_t> results(count);
+
+    // stage i writes into the pipe of link i and stage i + 1 reads from it,
+    // nothing of ulpm sits in between
+    struct link_t
+    {
+        int fds[2] = { -1, -1 };
+    };
+    std::vector<link_t> links(count > 0 ? count - 1 : 0);
+    for (link_t& link : links)
+        if (!open_pipe(link.fds))
+            die("Failed to create a pipe: {}", strerror(errno));
+
+    const auto                                           start = std::chrono::steady_clock::now();
+    std::vector<std::unique_ptr<TinyProcessLib::Process>> procs;
+    for (size_t i = 0; i < count; ++i)
+    {
+        TinyProcessLib::Config stage = config;
+        stage.stdin_fd               = i > 0 ? links[i - 1].fds[0] : -1;
+        stage.stdout_fd              = i + 1 < count ? links[i].fds[1] : -1;
+        if (cgroups)
+            stage.cgroup_procs_fd = cgroups->create(i, limits);
+
+        debug("Running stage {}: {}", i + 1, stages[i]);
+        procs.push_back(std::make_unique<TinyProcessLib::Process>(stages[i], "", nullptr, nullptr, false, stage));
+        if (procs.back()->get_id() > 0)
+            SignalRelay::add(procs.back()->get_id());
+    }
+
+    // the stages have their ends now, each pipe has to be left with only the
+    // stages reading it and writing to it for EOF and EPIPE to get through
+    for (link_t& link : links)
+    {
+        close(link.fds[0]);
+        close(link.fds[1]);
+    }
+
+    std::vector<std::thread> waiters;
+    for (size_t i = 0; i < count; ++i)
+        waiters.emplace_back([&, i] {
+            results[i].status = procs[i]->get_exit_status();
+            results[i].time =
+                std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        });
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        waiters[i].join();
+        SignalRelay::remove(procs[i]->get_id());
+    }
+    if (cgroups)
+        for (size_t i = 0; i < count; ++i)
+            results[i].usage = cgroups->release(i);
+
+    // get_exit_status() gives the signal a process died of as its status,
+    // and SIGPIPE only comes from the next stage closing its end
+    for (size_t i = count; i-- > 0;)
+    {
+        results[i].cut    = i + 1 < count && results[i].status == SIGPIPE;
+        results[i].failed = results[i].status != 0 && !(results[i].cut && !results[i + 1].failed);
+    }
+    return results;
+}
+
+#else
+
+std::vector<stage_result_t> run_pipeline(const std::vector<std::vector<std::string>>&,
+                                         const TinyProcessLib::Config&,
+                                         CgroupTree*,
+                                         const cgroup_limits_t&)
+{
+    die("Pipeline commands are not supported on Windows, use a string command instead");
+}
+
+#endif
@@ -0,0 +1,529 @@
+#include "project_discovery.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include "tree_walker.hpp"
+#include "util.hpp"
+
+#ifdef _WIN32
+#  define AT_FDCWD -1
+#else
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static constexpr std::string_view INDEX_FILE     = ".ulpm/projects.idx";
+static constexpr char             INDEX_MAGIC[8] = { 'U', 'L', 'P', 'M', 'P', 'R', 'J', '1' };
+static constexpr std::string_view IGNORE_FILES[] = { ".gitignore", ".ulpmignore" };
+
+/*
+ * IgnoreRules
+ */
+
+void IgnoreRules::add(const std::string_view base, const std::string_view content)
+{
+    for (std::string_view line : split(content, '\n'))
+    {
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t'))
+            line.remove_suffix(1);
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        rule_t rule;
+        rule.base = base;
+        if (line[0] == '!')
+        {
+            rule.negate = true;
+            line.remove_prefix(1);
+        }
+        else if (line[0] == '\\')
+        {
+            line.remove_prefix(1);
+        }
+        if (line.size() > 1 && line.back() == '/')
+        {
+            rule.dir_only = true;
+            line.remove_suffix(1);
+        }
+
+        // "a/b" and "/a" are relative to the file's directory, "a" matches at any depth
+        rule.anchored = line.find('/') != line.npos;
+        if (line[0] == '/')
+            line.remove_prefix(1);
+        if (hasStart(line, "**/") && line.find('/', 3) == line.npos)
+        {
+            rule.anchored = false;
+            line.remove_prefix(3);
+        }
+        if (line.empty())
+            continue;
+
+        rule.pattern = line;
+        if (rule.anchored)
+        {
+            std::string alt = rule.pattern;
+            if (hasStart(alt, "**/"))
+                alt.erase(0, 3);
+            for (size_t pos; (pos = alt.find("/**/")) != alt.npos;)
+                alt.replace(pos, 4, "/");
+            if (alt != rule.pattern)
+                rule.alt = std::move(alt);
+        }
+
+        const size_t wildcard = rule.pattern.find_first_of("*?");
+        if (wildcard == rule.pattern.npos)
+            rule.kind = Kind::Literal;
+        else if (!rule.anchored && wildcard == 0 && rule.pattern.find_first_of("*?", 1) == rule.pattern.npos)
+            rule.kind = Kind::Suffix;
+        else
+            rule.kind = Kind::Glob;
+
+        m_rules.push_back(std::move(rule));
+    }
+}
+
+bool IgnoreRules::matches(const rule_t& rule, const std::string_view str)
+{
+    switch (rule.kind)
+    {
+        case Kind::Literal: return str == rule.pattern;
+        case Kind::Suffix:
+            return str.size() >= rule.pattern.size() - 1 &&
+                   str.substr(str.size() - (rule.pattern.size() - 1)) == std::string_view(rule.pattern).substr(1);
+        case Kind::Glob:
+            return glob_match(rule.pattern, str, '/') || (!rule.alt.empty() && glob_match(rule.alt, str, '/'));
+    }
+    return false;
+}
+
+int IgnoreRules::match(const std::string_view path, const std::string_view name, const bool is_dir) const
+{
+    for (auto it = m_rules.rbegin(); it != m_rules.rend(); ++it)
+    {
+        const rule_t& rule = *it;
+        if (rule.dir_only && !is_dir)
+            continue;
+
+        std::string_view sub = path;
+        if (!rule.base.empty())
+        {
+            if (path.size() <= rule.base.size() || !hasStart(path, rule.base) || path[rule.base.size()] != '/')
+                continue;
+            sub.remove_prefix(rule.base.size() + 1);
+        }
+
+        if (matches(rule, rule.anchored ? sub : name))
+            return rule.negate ? 0 : 1;
+    }
+    return -1;
+}
+
+/*
+ * ProjectDiscovery
+ */
+
+static int64_t mtime_of(const std::string& path)
+{
+#ifdef _WIN32
+    std::error_code ec;
+    const auto      time = fs::last_write_time(path, ec);
+    return ec ? -1 : static_cast<int64_t>(time.time_since_epoch().count());
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return -1;
+#  ifdef __APPLE__
+    return st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#  else
+    return st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#  endif
+#endif
+}
+
+// Whole contents and mtime of path, relative to dir_fd
+static bool read_file_at(const int dir_fd, const std::string& path, std::string& content, int64_t& mtime)
+{
+#ifdef _WIN32
+    std::ifstream f(path, std::ios::binary);
+    if (!f)
+        return false;
+    content.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    mtime = mtime_of(path);
+    return true;
+#else
+    const int fd = openat(dir_fd, path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    bool        ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (ok)
+    {
+#  ifdef __APPLE__
+        mtime = st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#  else
+        mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#  endif
+        char    buf[4096];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0)
+            content.append(buf, n);
+        ok = n == 0;
+    }
+    close(fd);
+    return ok;
+#endif
+}
+
+static std::string join_path(const std::string_view dir, const std::string_view name)
+{
+    if (dir.empty() || name.empty())
+        return std::string(dir.empty() ? name : dir);
+    return fmt::format("{}/{}", dir, name);
+}
+
+static uint8_t manifest_kind(const std::string_view name)
+{
+    if (name == "ulpm.json")
+        return MANIFEST_ULPM;
+    if (name == "package.json")
+        return MANIFEST_PACKAGE_JSON;
+    if (name == "Cargo.toml")
+        return MANIFEST_CARGO;
+    return 0;
+}
+
+// Never worth looking into, whatever the ignore files say
+static bool skipped_dir(const std::string_view name)
+{
+    return name == ".git" || name == "node_modules" || name == "target" || name == ".ulpm";
+}
+
+ProjectDiscovery::ProjectDiscovery(std::string root) : m_root(std::move(root))
+{
+    while (m_root.size() > 1 && m_root.back() == '/')
+        m_root.pop_back();
+}
+
+// The ignore files of every directory, innermost last
+struct ignore_ctx_t
+{
+    const ignore_ctx_t* parent = nullptr;
+    IgnoreRules         rules;
+
+    bool ignored(const std::string_view path, const std::string_view name, const bool is_dir) const
+    {
+        for (const ignore_ctx_t* ctx = this; ctx; ctx = ctx->parent)
+            if (const int m = ctx->rules.match(path, name, is_dir); m >= 0)
+                return m == 1;
+        return false;
+    }
+};
+
+void ProjectDiscovery::walk(const std::string& dir, std::vector<std::string>* files)
+{
+    const std::string abs = dir.empty() ? m_root : fmt::format("{}/{}", m_root, dir);
+
+    // Reads the ignore files of rel into rules, returns whether there were any.
+    // They're opened as at_path relative to at_fd, to spare resolving the
+    // whole path again for every directory walked.
+    auto load_ignores = [&](const std::string&            rel,
+                            const int                     at_fd,
+                            const std::string_view        at_path,
+                            IgnoreRules&                  rules,
+                            std::vector<ignore_record_t>* records) {
+        bool found = false;
+        for (const std::string_view file : IGNORE_FILES)
+        {
+            std::string content;
+            int64_t     mtime = 0;
+            if (!read_file_at(at_fd, fmt::format("{}/{}", at_path, file), content, mtime))
+                continue;
+
+            rules.add(rel, content);
+            if (records)
+                records->push_back({ join_path(rel, file), mtime });
+            found = true;
+        }
+        return found;
+    };
+
+    // The rules of every directory from the root down to dir itself.
+    // A deque so contexts can be added while others are in use.
+    std::mutex               ctx_mutex;
+    std::deque<ignore_ctx_t> contexts(1);
+    std::string              ancestor;
+    if (!dir.empty())
+    {
+        for (const std::string& part : split(dir, '/'))
+        {
+            load_ignores(ancestor, AT_FDCWD, join_path(m_root, ancestor), contexts[0].rules, nullptr);
+            ancestor = join_path(ancestor, part);
+        }
+    }
+    load_ignores(dir, AT_FDCWD, abs, contexts[0].rules, &m_ignores);
+
+    TreeWalker                                              walker(0, false);
+    std::vector<std::vector<dir_record_t>>                  dirs(walker.threads());
+    std::vector<std::vector<std::pair<std::string, uint8_t>>> manifests(walker.threads());
+    std::vector<std::vector<ignore_record_t>>               ignores(walker.threads());
+    std::vector<std::vector<std::string>>                   found(files ? walker.threads() : 0);
+
+    const int64_t dir_mtime = mtime_of(abs);
+    if (dir_mtime < 0)
+        return;
+
+    walker.walk(abs, [&](size_t worker, const TreeWalker::dir_t& parent, const TreeWalker::entry_t& e, uint32_t& tag) {
+        const uint8_t kind = e.is_dir ? 0 : manifest_kind(e.name);
+        if (e.is_dir ? skipped_dir(e.name) : (!kind && !files))
+            return false;
+
+        const std::string   parent_rel = join_path(dir, parent.path);
+        const std::string   rel        = join_path(parent_rel, e.name);
+        const ignore_ctx_t* ctx;
+        {
+            std::lock_guard<std::mutex> lock(ctx_mutex);
+            ctx = &contexts[parent.tag];
+        }
+        if (ctx->ignored(rel, e.name, e.is_dir))
+            return false;
+
+        if (!e.is_dir)
+        {
+            if (kind)
+                manifests[worker].emplace_back(parent_rel, kind);
+            if (files)
+                found[worker].push_back(rel);
+            return false;
+        }
+
+        // Its mtime before it gets listed, so whatever changes in it from now
+        // on is noticed the next time
+        int64_t mtime = -1;
+#ifndef _WIN32
+        struct stat st;
+        if (fstatat(e.dir_fd, e.name.data(), &st, AT_SYMLINK_NOFOLLOW) == 0)
+#  ifdef __APPLE__
+            mtime = st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#  else
+            mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#  endif
+#else
+        mtime = mtime_of(fmt::format("{}/{}", m_root, rel));
+#endif
+        dirs[worker].push_back({ rel, mtime, 0 });
+
+        IgnoreRules rules;
+#ifdef _WIN32
+        const bool has_rules = load_ignores(rel, AT_FDCWD, fmt::format("{}/{}", m_root, rel), rules, &ignores[worker]);
+#else
+        const bool has_rules = load_ignores(rel, e.dir_fd, e.name, rules, &ignores[worker]);
+#endif
+        if (has_rules)
+        {
+            std::lock_guard<std::mutex> lock(ctx_mutex);
+            contexts.push_back({ ctx, std::move(rules) });
+            tag = contexts.size() - 1;
+        }
+        return true;
+    });
+
+    m_dirs.push_back({ dir, dir_mtime, 0 });
+    for (size_t i = 0; i < walker.threads(); ++i)
+    {
+        m_dirs.insert(m_dirs.end(), std::make_move_iterator(dirs[i].begin()), std::make_move_iterator(dirs[i].end()));
+        m_ignores.insert(
+            m_ignores.end(), std::make_move_iterator(ignores[i].begin()), std::make_move_iterator(ignores[i].end()));
+        if (files)
+            files->insert(
+                files->end(), std::make_move_iterator(found[i].begin()), std::make_move_iterator(found[i].end()));
+    }
+
+    std::unordered_map<std::string_view, size_t> by_path;
+    for (size_t i = 0; i < m_dirs.size(); ++i)
+        by_path.emplace(m_dirs[i].path, i);
+    for (const auto& mine : manifests)
+        for (const auto& [path, kind] : mine)
+            if (auto it = by_path.find(path); it != by_path.end())
+                m_dirs[it->second].manifests |= kind;
+}
+
+static void write_str(std::ostream& f, const std::string& s)
+{
+    write_pod(f, static_cast<uint32_t>(s.size()));
+    f.write(s.data(), s.size());
+}
+
+// The whole index is read at once and decoded from memory, it has one record
+// per directory of the tree
+struct index_reader_t
+{
+    std::string_view data;
+    bool             ok = true;
+
+    template <typename T>
+    index_reader_t& operator>>(T& v)
+    {
+        ok = ok && read_bytes(data, &v, sizeof(v));
+        return *this;
+    }
+
+    index_reader_t& operator>>(std::string& s)
+    {
+        uint32_t n = 0;
+        *this >> n;
+        if (!ok || data.size() < n)
+        {
+            ok = false;
+        }
+        else
+        {
+            s.assign(data.data(), n);
+            data.remove_prefix(n);
+        }
+        return *this;
+    }
+};
+
+bool ProjectDiscovery::loadIndex()
+{
+    std::ifstream f(fmt::format("{}/{}", m_root, INDEX_FILE), std::ios::binary | std::ios::ate);
+    if (!f)
+        return false;
+    std::string buf(static_cast<size_t>(f.tellg()), '\0');
+    if (!f.seekg(0).read(buf.data(), buf.size()))
+        return false;
+
+    index_reader_t r{ buf };
+    if (!hasStart(buf, std::string_view(INDEX_MAGIC, sizeof(INDEX_MAGIC))))
+        return false;
+    r.data.remove_prefix(sizeof(INDEX_MAGIC));
+
+    std::string root;
+    uint64_t    ndirs = 0, nignores = 0;
+    r >> root >> ndirs >> nignores;
+    // every record takes at least 4 bytes, don't trust a corrupted count
+    if (!r.ok || root != fs::absolute(m_root).lexically_normal().string() || ndirs > buf.size() / 4 ||
+        nignores > buf.size() / 4)
+        return false;
+
+    m_dirs.resize(ndirs);
+    for (dir_record_t& d : m_dirs)
+        r >> d.path >> d.mtime >> d.manifests;
+    m_ignores.resize(nignores);
+    for (ignore_record_t& i : m_ignores)
+        r >> i.path >> i.mtime;
+    return r.ok;
+}
+
+void ProjectDiscovery::saveIndex() const
+{
+    atomic_write_file(fmt::format("{}/{}", m_root, INDEX_FILE), [&](std::ostream& f) {
+        f.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        write_str(f, fs::absolute(m_root).lexically_normal().string());
+        write_pod(f, static_cast<uint64_t>(m_dirs.size()));
+        write_pod(f, static_cast<uint64_t>(m_ignores.size()));
+        for (const dir_record_t& d : m_dirs)
+        {
+            write_str(f, d.path);
+            write_pod(f, d.mtime);
+            write_pod(f, d.manifests);
+        }
+        for (const ignore_record_t& i : m_ignores)
+        {
+            write_str(f, i.path);
+            write_pod(f, i.mtime);
+        }
+        return true;
+    });
+}
+
+std::vector<project_t> ProjectDiscovery::discover(const bool use_index)
+{
+    m_stats = {};
+    m_dirs.clear();
+    m_ignores.clear();
+
+    if (!use_index || !loadIndex())
+    {
+        m_dirs.clear();
+        m_ignores.clear();
+        walk("");
+        m_stats.rescanned = m_dirs.size();
+    }
+    else
+    {
+        std::vector<char> changed(m_dirs.size());
+        parallel_for(m_dirs.size(), [&](const size_t i) {
+            changed[i] = mtime_of(join_path(m_root, m_dirs[i].path)) != m_dirs[i].mtime;
+        });
+
+        std::vector<std::string> stale;
+        for (size_t i = 0; i < m_dirs.size(); ++i)
+            if (changed[i])
+                stale.push_back(m_dirs[i].path);
+        // an edited ignore file doesn't touch its directory
+        for (const ignore_record_t& ignore : m_ignores)
+            if (mtime_of(fmt::format("{}/{}", m_root, ignore.path)) != ignore.mtime)
+                stale.push_back(fs::path(ignore.path).parent_path().generic_string());
+
+        // Only the topmost of them, the rest gets walked along
+        std::sort(stale.begin(), stale.end());
+        std::vector<std::string> roots;
+        for (const std::string& path : stale)
+            if (roots.empty() || !is_under(path, roots.back()))
+                roots.push_back(path);
+
+        for (const std::string& root : roots)
+        {
+            std::erase_if(m_dirs, [&](const dir_record_t& d) { return is_under(d.path, root); });
+            std::erase_if(m_ignores, [&](const ignore_record_t& i) {
+                return is_under(fs::path(i.path).parent_path().generic_string(), root);
+            });
+
+            const size_t before = m_dirs.size();
+            walk(root);
+            m_stats.rescanned += m_dirs.size() - before;
+        }
+        m_stats.from_index = roots.empty();
+    }
+
+    if (!m_stats.from_index)
+    {
+        std::sort(m_dirs.begin(), m_dirs.end(), [](const dir_record_t& a, const dir_record_t& b) {
+            return a.path < b.path;
+        });
+        saveIndex();
+    }
+
+    m_stats.dirs = m_dirs.size();
+    std::vector<project_t> projects;
+    for (const dir_record_t& d : m_dirs)
+        if (d.manifests)
+            projects.push_back({ d.path, d.manifests });
+    return projects;
+}
+
+std::vector<std::string> ProjectDiscovery::files()
+{
+    m_stats = {};
+    m_dirs.clear();
+    m_ignores.clear();
+
+    std::vector<std::string> files;
+    walk("", &files);
+    m_stats.dirs = m_stats.rescanned = m_dirs.size();
+
+    std::sort(files.begin(), files.end());
+    return files;
+}
@@ -0,0 +1,200 @@
+#include "project_graph.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+#include "rapidjson/document.h"
+#include "rapidjson/error/en.h"
+#include "util.hpp"
+
+#define TOML_HEADER_ONLY 0
+#include "toml++/toml.hpp"
+
+namespace fs = std::filesystem;
+
+struct manifest_deps_t
+{
+    std::string              name;
+    std::vector<std::string> names;  // dependencies by package name
+    std::vector<std::string> paths;  // and by path, relative to the root
+};
+
+static void read_package_json(const std::string& path, manifest_deps_t& out)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f)
+        return;
+    const std::string content(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>{});
+
+    rapidjson::Document doc;
+    doc.Parse(content.c_str());
+    if (doc.HasParseError() || !doc.IsObject())
+    {
+        warn("Parsing {} failed: {}", path, rapidjson::GetParseError_En(doc.GetParseError()));
+        return;
+    }
+
+    if (doc.HasMember("name") && doc["name"].IsString())
+        out.name = doc["name"].GetString();
+    for (const char* kind : { "dependencies", "devDependencies", "peerDependencies", "optionalDependencies" })
+    {
+        if (!doc.HasMember(kind) || !doc[kind].IsObject())
+            continue;
+        for (const auto& dep : doc[kind].GetObj())
+            out.names.emplace_back(dep.name.GetString());
+    }
+}
+
+static void read_cargo_deps(const toml::table& tbl, const std::string& dir, manifest_deps_t& out)
+{
+    for (const char* kind : { "dependencies", "dev-dependencies", "build-dependencies" })
+    {
+        const toml::table* deps = tbl[kind].as_table();
+        if (!deps)
+            continue;
+
+        for (const auto& [key, value] : *deps)
+        {
+            const toml::table* dep = value.as_table();
+            if (dep && dep->contains("path"))
+            {
+                const fs::path path = fs::path(dir) / (*dep)["path"].value_or(std::string());
+                out.paths.push_back(path.lexically_normal().generic_string());
+            }
+            else
+            {
+                // a renamed dependency still refers to the package it names
+                out.names.emplace_back(dep ? (*dep)["package"].value_or(std::string(key.str())) : key.str());
+            }
+        }
+    }
+}
+
+static void read_cargo_toml(const std::string& path, const std::string& dir, manifest_deps_t& out)
+{
+    toml::table cargo;
+    try
+    {
+        cargo = toml::parse_file(path);
+    }
+    catch (const toml::parse_error& err)
+    {
+        warn("Parsing {} failed: {} (line {} column {})",
+             path,
+             err.description(),
+             err.source().begin.line,
+             err.source().begin.column);
+        return;
+    }
+
+    if (out.name.empty())
+        out.name = cargo["package"]["name"].value_or(std::string());
+    read_cargo_deps(cargo, dir, out);
+    if (const toml::table* targets = cargo["target"].as_table())
+        for (const auto& [cfg, target] : *targets)
+            if (const toml::table* tbl = target.as_table())
+                read_cargo_deps(*tbl, dir, out);
+}
+
+ProjectGraph::ProjectGraph(const std::string& root, std::vector<project_t> projects) : m_projects(std::move(projects))
+{
+    std::sort(m_projects.begin(), m_projects.end(), [](const project_t& a, const project_t& b) {
+        return a.path < b.path;
+    });
+
+    std::vector<manifest_deps_t> manifests(m_projects.size());
+    parallel_for(m_projects.size(), [&](const size_t i) {
+        const project_t&  project = m_projects[i];
+        const std::string dir     = project.path.empty() ? root : fmt::format("{}/{}", root, project.path);
+        if (project.manifests & MANIFEST_PACKAGE_JSON)
+            read_package_json(dir + "/package.json", manifests[i]);
+        if (project.manifests & MANIFEST_CARGO)
+            read_cargo_toml(dir + "/Cargo.toml", project.path, manifests[i]);
+    });
+
+    DepGraphBuilder                           builder;
+    std::unordered_map<std::string, uint32_t> by_name;
+    for (size_t i = 0; i < m_projects.size(); ++i)
+    {
+        const std::string& path = m_projects[i].path;
+        const std::string& name = manifests[i].name;
+        builder.addNode(path, name.empty() ? (path.empty() ? "." : path) : name);
+        m_by_path.emplace(path, i);
+        if (!name.empty())
+            by_name.emplace(name, i);
+    }
+
+    for (uint32_t i = 0; i < m_projects.size(); ++i)
+    {
+        for (const std::string& name : manifests[i].names)
+            if (auto it = by_name.find(name); it != by_name.end() && it->second != i)
+                builder.addEdge(it->second, i);
+        for (const std::string& path : manifests[i].paths)
+            if (auto it = m_by_path.find(path == "." ? "" : path); it != m_by_path.end() && it->second != i)
+                builder.addEdge(it->second, i);
+    }
+    m_graph = builder.finish();
+}
+
+uint32_t ProjectGraph::ownerOf(std::string_view file) const
+{
+    while (true)
+    {
+        const size_t slash = file.rfind('/');
+        file               = slash == file.npos ? std::string_view() : file.substr(0, slash);
+        if (auto it = m_by_path.find(std::string(file)); it != m_by_path.end())
+            return it->second;
+        if (file.empty())
+            return DepGraph::NONE;
+    }
+}
+
+std::vector<uint32_t> ProjectGraph::withDependents(const std::vector<uint32_t>& seeds) const
+{
+    std::vector<char>     in(m_projects.size());
+    std::vector<uint32_t> queue;
+    for (const uint32_t seed : seeds)
+        if (!in[seed])
+        {
+            in[seed] = true;
+            queue.push_back(seed);
+        }
+    for (size_t i = 0; i < queue.size(); ++i)
+        for (const uint32_t dependent : m_graph.deps(queue[i]))
+            if (!in[dependent])
+            {
+                in[dependent] = true;
+                queue.push_back(dependent);
+            }
+
+    // Kahn's algorithm over the subset, in path order among the ready ones
+    std::vector<uint32_t> pending(m_projects.size());
+    for (const uint32_t node : queue)
+        for (const uint32_t dependent : m_graph.deps(node))
+            ++pending[dependent];
+
+    std::vector<uint32_t> order, ready;
+    for (uint32_t node = 0; node < m_projects.size(); ++node)
+        if (in[node] && pending[node] == 0)
+            ready.push_back(node);
+    while (!ready.empty())
+    {
+        const auto     it   = std::min_element(ready.begin(), ready.end());
+        const uint32_t node = *it;
+        ready.erase(it);
+        order.push_back(node);
+        in[node] = false;
+        for (const uint32_t dependent : m_graph.deps(node))
+            if (--pending[dependent] == 0)
+                ready.push_back(dependent);
+    }
+
+    // whatever is left is in a cycle, no order is right for it
+    for (uint32_t node = 0; node < m_projects.size(); ++node)
+        if (in[node])
+            order.push_back(node);
+    return order;
+}
@@ -0,0 +1,197 @@
+#include "sha512.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+// clang-format off
+static constexpr uint64_t K[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+// clang-format on
+
+static constexpr std::string_view B64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static inline uint64_t rotr(const uint64_t x, const int n)
+{
+    return (x >> n) | (x << (64 - n));
+}
+
+Sha512::Sha512()
+    : m_state{ 0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+               0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL }
+{}
+
+void Sha512::compress(const uint8_t* block)
+{
+    uint64_t w[80];
+    for (int i = 0; i < 16; ++i)
+    {
+        w[i] = 0;
+        for (int j = 0; j < 8; ++j)
+            w[i] = (w[i] << 8) | block[i * 8 + j];
+    }
+    for (int i = 16; i < 80; ++i)
+    {
+        const uint64_t s0 = rotr(w[i - 15], 1) ^ rotr(w[i - 15], 8) ^ (w[i - 15] >> 7);
+        const uint64_t s1 = rotr(w[i - 2], 19) ^ rotr(w[i - 2], 61) ^ (w[i - 2] >> 6);
+        w[i]              = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint64_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+    uint64_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+    for (int i = 0; i < 80; ++i)
+    {
+        const uint64_t t1 = h + (rotr(e, 14) ^ rotr(e, 18) ^ rotr(e, 41)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        const uint64_t t2 = (rotr(a, 28) ^ rotr(a, 34) ^ rotr(a, 39)) + ((a & b) ^ (a & c) ^ (b & c));
+        h                 = g;
+        g                 = f;
+        f                 = e;
+        e                 = d + t1;
+        d                 = c;
+        c                 = b;
+        b                 = a;
+        a                 = t1 + t2;
+    }
+
+    m_state[0] += a;
+    m_state[1] += b;
+    m_state[2] += c;
+    m_state[3] += d;
+    m_state[4] += e;
+    m_state[5] += f;
+    m_state[6] += g;
+    m_state[7] += h;
+}
+
+void Sha512::update(const void* data, size_t len)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    m_bytes += len;
+
+    if (m_used > 0)
+    {
+        const size_t n = std::min(len, m_block.size() - m_used);
+        std::memcpy(m_block.data() + m_used, p, n);
+        m_used += n;
+        p += n;
+        len -= n;
+        if (m_used < m_block.size())
+            return;
+        compress(m_block.data());
+        m_used = 0;
+    }
+
+    for (; len >= m_block.size(); p += m_block.size(), len -= m_block.size())
+        compress(p);
+
+    std::memcpy(m_block.data(), p, len);
+    m_used = len;
+}
+
+Sha512::digest_t Sha512::finish()
+{
+    // 0x80, zeroes, then the length in bits as a 128-bit big endian number
+    const uint64_t bits = m_bytes * 8;
+    const uint8_t  pad  = 0x80;
+    update(&pad, 1);
+    const uint8_t zero = 0;
+    while (m_used != 112)
+        update(&zero, 1);
+
+    uint8_t len[16] = {};
+    for (int i = 0; i < 8; ++i)
+        len[15 - i] = static_cast<uint8_t>(bits >> (i * 8));
+    len[7] = static_cast<uint8_t>((m_bytes >> 61) & 0x7);
+    update(len, sizeof(len));
+
+    digest_t digest;
+    for (int i = 0; i < 8; ++i)
+        for (int j = 0; j < 8; ++j)
+            digest[i * 8 + j] = static_cast<uint8_t>(m_state[i] >> (56 - j * 8));
+    return digest;
+}
+
+std::string Sha512::hex(const digest_t& digest)
+{
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string           ret;
+    ret.reserve(digest.size() * 2);
+    for (const uint8_t byte : digest)
+    {
+        ret += digits[byte >> 4];
+        ret += digits[byte & 0xf];
+    }
+    return ret;
+}
+
+std::string Sha512::base64(const digest_t& digest)
+{
+    std::string ret;
+    size_t      i = 0;
+    for (; i + 3 <= digest.size(); i += 3)
+    {
+        const uint32_t n = (digest[i] << 16) | (digest[i + 1] << 8) | digest[i + 2];
+        ret += B64[(n >> 18) & 63];
+        ret += B64[(n >> 12) & 63];
+        ret += B64[(n >> 6) & 63];
+        ret += B64[n & 63];
+    }
+    // 64 bytes leave one over
+    const uint32_t n = digest[i] << 16;
+    ret += B64[(n >> 18) & 63];
+    ret += B64[(n >> 12) & 63];
+    ret += "==";
+    return ret;
+}
+
+std::string integrity_to_hex(std::string_view integrity)
+{
+    // there may be several space separated hashes, use the sha512 one
+    const size_t start = integrity.find("sha512-");
+    if (start == integrity.npos)
+        return {};
+    integrity.remove_prefix(start + 7);
+    integrity = integrity.substr(0, integrity.find_first_of(" ?"));
+
+    Sha512::digest_t digest;
+    size_t           out  = 0;
+    uint32_t         acc  = 0;
+    int              bits = 0;
+    for (const char c : integrity)
+    {
+        if (c == '=')
+            break;
+        const size_t v = B64.find(c);
+        if (v == B64.npos)
+            return {};
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            if (out == digest.size())
+                return {};
+            digest[out++] = static_cast<uint8_t>(acc >> bits);
+        }
+    }
+    return out == digest.size() ? Sha512::hex(digest) : std::string();
+}
@@ -0,0 +1,126 @@
+#include "signal_relay.hpp"
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_set>
+
+#include "util.hpp"
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#ifndef _WIN32
+
+static std::mutex              groups_mutex;
+static std::unordered_set<int> groups;
+static std::atomic<int>        wake_fd = -1;  // of the installed relay, written to by the handler
+
+static constexpr int SIGNALS[] = { SIGINT, SIGTERM };
+static struct sigaction previous[std::size(SIGNALS)];
+
+static void on_signal(const int sig)
+{
+    const int  saved = errno;
+    const char byte  = static_cast<char>(sig);
+    // with the pipe full, the relay has a wake up pending already
+    if (const int fd = wake_fd; fd >= 0)
+        [[maybe_unused]] const ssize_t written = write(fd, &byte, 1);
+    errno = saved;
+}
+
+SignalRelay::SignalRelay(std::function<void(int sig)> on_signal_)
+    : m_on_signal(std::move(on_signal_))
+{
+    if (pipe(m_pipe) != 0)
+    {
+        warn("Failed to create a pipe, signals won't be passed on to the commands");
+        return;
+    }
+    fcntl(m_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(m_pipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl(m_pipe[1], F_SETFL, O_NONBLOCK);
+    wake_fd = m_pipe[1];
+
+    m_thread = std::thread([this] {
+        char byte;
+        // a 0 written by the destructor stops it
+        while (read(m_pipe[0], &byte, 1) == 1 && byte != 0)
+        {
+            const int sig = static_cast<unsigned char>(byte);
+            int       expected = 0;
+            m_received.compare_exchange_strong(expected, sig);
+            {
+                std::lock_guard<std::mutex> lock(groups_mutex);
+                for (const int pgid : groups)
+                    kill(-pgid, sig);
+            }
+            if (m_on_signal)
+                m_on_signal(sig);
+        }
+    });
+
+    struct sigaction action = {};
+    action.sa_handler       = on_signal;
+    action.sa_flags         = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    for (size_t i = 0; i < std::size(SIGNALS); ++i)
+        sigaction(SIGNALS[i], &action, &previous[i]);
+}
+
+SignalRelay::~SignalRelay()
+{
+    if (m_pipe[0] < 0)
+        return;
+    for (size_t i = 0; i < std::size(SIGNALS); ++i)
+        sigaction(SIGNALS[i], &previous[i], nullptr);
+    wake_fd = -1;
+
+    const char stop = 0;
+    if (write(m_pipe[1], &stop, 1) == 1)
+        m_thread.join();
+    else
+        m_thread.detach();
+    close(m_pipe[0]);
+    close(m_pipe[1]);
+}
+
+void SignalRelay::add(const int pgid)
+{
+    // a failed fork leaves -1, and kill(-pgid) would hit init, or ulpm's own group for 0
+    if (pgid <= 0)
+        return;
+    std::lock_guard<std::mutex> lock(groups_mutex);
+    groups.insert(pgid);
+}
+
+void SignalRelay::remove(const int pgid)
+{
+    std::lock_guard<std::mutex> lock(groups_mutex);
+    groups.erase(pgid);
+}
+
+void SignalRelay::reraise(const int sig)
+{
+    std::fflush(nullptr);
+    std::signal(sig, SIG_DFL);
+    std::raise(sig);
+    std::_Exit(128 + sig);
+}
+
+#else
+
+SignalRelay::SignalRelay(std::function<void(int sig)> on_signal) : m_on_signal(std::move(on_signal)) {}
+SignalRelay::~SignalRelay() {}
+void SignalRelay::add(const int) {}
+void SignalRelay::remove(const int) {}
+
+void SignalRelay::reraise(const int sig)
+{
+    std::_Exit(128 + sig);
+}
+
+#endif
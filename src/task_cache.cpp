@@ -0,0 +1,211 @@
+#include "task_cache.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include "archive.hpp"
+#include "file_hasher.hpp"
+#include "fmt/ranges.h"
+#include "project_discovery.hpp"
+#include "sha256.hpp"
+#include "tree_remover.hpp"
+#include "util.hpp"
+
+#ifdef _WIN32
+#  include <process.h>
+#  define getpid _getpid
+#else
+#  include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static constexpr std::string_view ENTRY_MAGIC = "ulpm-task 2";
+
+static std::string normalized(const std::string& path)
+{
+    std::string ret = fs::path(path).lexically_normal().generic_string();
+    while (!ret.empty() && ret.back() == '/')
+        ret.pop_back();
+    return ret == "." ? "" : ret;
+}
+
+static std::atomic<unsigned> tmp_count = 0;
+
+static std::string tmp_file(const std::string_view ext)
+{
+    std::error_code ec;
+    return (fs::temp_directory_path(ec) / fmt::format("ulpm-{}-{}{}", getpid(), tmp_count++, ext)).string();
+}
+
+TaskCache::TaskCache(std::unique_ptr<CacheBackend> backend, cache_spec_t spec)
+    : m_backend(std::move(backend)), m_spec(std::move(spec))
+{
+    for (std::string& input : m_spec.inputs)
+        input = normalized(input);
+    for (std::string& output : m_spec.outputs)
+        output = normalized(output);
+}
+
+std::optional<std::string> TaskCache::key(const std::vector<std::string>& argv) const
+{
+    auto is_input = [&](const std::string& path) {
+        for (const std::string& output : m_spec.outputs)
+            if (is_under(path, output))
+                return false;
+        if (m_spec.inputs.empty())
+            return true;
+        for (const std::string& input : m_spec.inputs)
+        {
+            const bool glob = input.find_first_of("*?") != input.npos;
+            if (glob ? glob_match(input, path, '/') : is_under(path, input))
+                return true;
+        }
+        return false;
+    };
+
+    // every file is hashed, so the hash cache stays the same whatever the
+    // inputs of the command asking
+    ProjectDiscovery               discovery(".");
+    const std::vector<std::string> files = discovery.files();
+    FileHasher                                    hasher(".");
+    const std::vector<std::optional<file_hash_t>> hashes = hasher.hash(files);
+
+    Sha256 sha;
+    sha.update(ENTRY_MAGIC.data(), ENTRY_MAGIC.size());
+    for (const std::string& arg : argv)
+        sha.update(arg.c_str(), arg.size() + 1);
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        if (!is_input(files[i]))
+            continue;
+        if (!hashes[i])
+        {
+            warn("Failed to read {}, not caching", files[i]);
+            return std::nullopt;
+        }
+        const std::string line = fmt::format("\n{} {}", files[i], Sha256::hex(*hashes[i]));
+        sha.update(line.data(), line.size());
+    }
+    return Sha256::hex(sha.finish());
+}
+
+bool TaskCache::restore(const std::string& key)
+{
+    std::string entry;
+    if (!m_backend->get(CacheBackend::Store::Action, key, [&](const char* data, const size_t len) {
+            entry.append(data, len);
+            return entry.size() < 4096;
+        }))
+        return false;
+
+    const std::vector<std::string> lines = split(entry, '\n');
+    if (lines.size() < 2 || lines[0] != ENTRY_MAGIC || lines[1].size() < 66 || lines[1][64] != ' ')
+    {
+        warn("Invalid cache entry {}", key);
+        return false;
+    }
+    const std::string blob = lines[1].substr(0, 64);
+
+    // unpacked aside while it downloads, and only moved over the outputs once
+    // it's verified, the CAS is only trusted that far. Being in the project,
+    // it's most likely on the same filesystem as them.
+    const std::string staging = fmt::format(".ulpm/restore.{}.{}", getpid(), tmp_count++);
+    ArchiveExtractor  extractor(staging);
+    Sha256            sha;
+    bool              ok = m_backend->get(CacheBackend::Store::Content, blob, [&](const char* data, const size_t len) {
+        sha.update(data, len);
+        return extractor.feed(data, len);
+    });
+    ok                   = ok && extractor.finish();
+    if (!extractor.error().empty())
+        warn("Failed to unpack the cached outputs {}: {}", blob, extractor.error());
+    else if (ok && Sha256::hex(sha.finish()) != blob)
+    {
+        warn("Cached outputs {} are corrupted", blob);
+        ok = false;
+    }
+
+    if (ok)
+    {
+        const archive_stats_t& st = extractor.stats();
+        debug("Unpacked {} files ({}) from {}", st.files, human_size(st.bytes), human_size(st.packed));
+
+        std::error_code ec;
+        for (const std::string& output : m_spec.outputs)
+        {
+            remove_tree(output);
+            const std::string unpacked = fmt::format("{}/{}", staging, output);
+            if (!fs::exists(fs::symlink_status(unpacked, ec)))
+                continue;
+            if (fs::path(output).has_parent_path())
+                fs::create_directories(fs::path(output).parent_path(), ec);
+            fs::rename(unpacked, output, ec);
+            if (ec)
+            {
+                warn("Failed to move {} into place: {}", output, ec.message());
+                ok = false;
+            }
+        }
+    }
+    remove_tree(staging);
+    return ok;
+}
+
+bool TaskCache::save(const std::string& key)
+{
+    std::vector<std::string> outputs;
+    std::error_code          ec;
+    for (const std::string& output : m_spec.outputs)
+        if (fs::exists(output, ec))
+            outputs.push_back(output);
+    if (outputs.empty())
+    {
+        warn("None of the outputs of the command exist, nothing to cache");
+        return false;
+    }
+
+    const std::string tmp = tmp_file(".ulpmar");
+    std::FILE*        f   = std::fopen(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+
+    Sha256          sha;
+    archive_stats_t st;
+    const bool      packed = pack_archive(
+        outputs,
+        [&](const char* data, const size_t len) {
+            sha.update(data, len);
+            return std::fwrite(data, 1, len, f) == len;
+        },
+        &st);
+    const bool ok = std::fclose(f) == 0 && packed;
+    if (!ok)
+    {
+        warn("Failed to pack the outputs {}", fmt::join(outputs, ", "));
+        std::remove(tmp.c_str());
+        return false;
+    }
+    debug("Packed {} files ({}) into {}", st.files, human_size(st.bytes), human_size(st.packed));
+
+    const std::string blob = Sha256::hex(sha.finish());
+    bool              put  = m_backend->contains(CacheBackend::Store::Content, blob) ||
+                       m_backend->putFile(CacheBackend::Store::Content, blob, tmp);
+    std::remove(tmp.c_str());
+
+    if (put)
+    {
+        const std::string entry = fmt::format("{}\n{} {}\n", ENTRY_MAGIC, blob, st.packed);
+        size_t            off   = 0;
+        put = m_backend->put(CacheBackend::Store::Action, key, entry.size(), [&](char* buf, const size_t len) {
+            const size_t n = std::min(len, entry.size() - off);
+            std::memcpy(buf, entry.data() + off, n);
+            off += n;
+            return n;
+        });
+    }
+    return put;
+}
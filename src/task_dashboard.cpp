@@ -0,0 +1,409 @@
+#include "task_dashboard.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "box.hpp"
+#include "util.hpp"
+
+static constexpr std::string_view SPINNER[] = { "⠋", "⠙", "⠹", "⠸", "⠼", "⠴", "⠦", "⠧", "⠇", "⠏" };
+
+static double seconds_between(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b)
+{
+    return std::chrono::duration<double>(b - a).count();
+}
+
+// The last non-empty line of the output tail, where '\r' also starts a
+// new line since that's how progress bars redraw themselves.
+static std::string_view last_line_of(std::string_view tail)
+{
+    const size_t end = tail.find_last_not_of("\r\n");
+    if (end == tail.npos)
+        return {};
+    tail = tail.substr(0, end + 1);
+
+    const size_t begin = tail.find_last_of("\r\n");
+    return begin == tail.npos ? tail : tail.substr(begin + 1);
+}
+
+// Index past the escape sequence starting at line[i]: CSI ones like colors
+// run up to a final byte, OSC ones like window titles up to BEL or ST
+static size_t skip_escape(const std::string_view line, size_t i)
+{
+    if (++i >= line.size())
+        return i;
+    const char kind = line[i++];
+    if (kind == '[')
+    {
+        while (i < line.size() && !(line[i] >= 0x40 && line[i] <= 0x7e))
+            ++i;
+        return i + 1;
+    }
+    if (kind == ']' || kind == 'P' || kind == 'X' || kind == '^' || kind == '_')
+    {
+        for (; i < line.size(); ++i)
+            if (line[i] == '\a')
+                return i + 1;
+            else if (line[i] == '\x1b' && i + 1 < line.size() && line[i + 1] == '\\')
+                return i + 2;
+        return i;
+    }
+    // nF ones like ESC ( B have intermediate bytes before their final one,
+    // the others end with the byte after ESC
+    if (kind >= 0x20 && kind <= 0x2f)
+    {
+        while (i < line.size() && line[i] >= 0x20 && line[i] <= 0x2f)
+            ++i;
+        return i + 1;
+    }
+    return i;
+}
+
+// The line as it can be drawn in its cells: escape sequences and other
+// control characters dropped, tabs as spaces, malformed UTF-8 skipped, and
+// cut after max_width codepoints rather than in the middle of one
+static std::string printable_line(const std::string_view line, const size_t max_width)
+{
+    std::string out;
+    size_t      width = 0;
+    for (size_t i = 0; i < line.size() && width < max_width;)
+    {
+        const unsigned char c = line[i];
+        if (c == '\x1b')
+        {
+            i = skip_escape(line, i);
+            continue;
+        }
+        if (c == '\t')
+        {
+            out += ' ';
+            ++width;
+            ++i;
+            continue;
+        }
+
+        const size_t len = c < 0x80 ? 1 : (c & 0xe0) == 0xc0 ? 2 : (c & 0xf0) == 0xe0 ? 3 : (c & 0xf8) == 0xf0 ? 4 : 0;
+        bool         ok  = len > 0 && i + len <= line.size() && c >= 0x20 && c != 0x7f;
+        for (size_t j = 1; ok && j < len; ++j)
+            ok = (static_cast<unsigned char>(line[i + j]) & 0xc0) == 0x80;
+        // the C1 controls, U+0080 to U+009F
+        ok = ok && !(c == 0xc2 && static_cast<unsigned char>(line[i + 1]) < 0xa0);
+        if (!ok)
+        {
+            ++i;
+            continue;
+        }
+        out.append(line.substr(i, len));
+        ++width;
+        i += len;
+    }
+    return out;
+}
+
+TaskDashboard::TaskDashboard(bool live) : m_live(live) {}
+
+TaskDashboard::~TaskDashboard()
+{
+    if (m_running)
+        stop();
+}
+
+bool TaskDashboard::detectLive()
+{
+    return isatty(fileno(stdout)) || std::getenv("ULPM_HEADLESS");
+}
+
+size_t TaskDashboard::addTask(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tasks.push_back({});
+    m_tasks.back().name = name;
+    m_name_width        = std::max(m_name_width, name.length());
+    return m_tasks.size() - 1;
+}
+
+void TaskDashboard::setState(size_t id, State state, int exit_status)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    task_state_t&               task = m_tasks[id];
+
+    task.state       = state;
+    task.exit_status = exit_status;
+    if (state == State::Running)
+    {
+        task.start = clock::now();
+        return;
+    }
+    if (state == State::Queued)
+        return;
+
+    task.end = clock::now();
+    if (m_live)
+        return;
+
+    forwardLines(task, {}, true);
+    if (state == State::Done)
+        info("{} finished in {:.1f}s", task.name, seconds_between(task.start, task.end));
+    else if (state == State::Cancelled && !task.ran())
+        warn("{} cancelled before it started", task.name);
+    else if (state == State::Cancelled)
+        warn("{} cancelled after {:.1f}s", task.name, seconds_between(task.start, task.end));
+    else
+        error("{} failed with exit status {}", task.name, task.exit_status);
+}
+
+void TaskDashboard::onOutput(size_t id, const char* bytes, size_t n)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    task_state_t&               task = m_tasks[id];
+    std::string_view            chunk(bytes, n);
+
+    task.bytes += n;
+    if (!m_live)
+    {
+        forwardLines(task, chunk, false);
+        return;
+    }
+
+    // Only keep a bounded tail, the renderer digs the last line out of it.
+    // This keeps the cost per chunk constant however fast the child writes.
+    if (chunk.length() >= TAIL_SIZE)
+    {
+        task.partial.assign(chunk.substr(chunk.length() - TAIL_SIZE));
+    }
+    else
+    {
+        const size_t keep = std::min(task.partial.length(), TAIL_SIZE - chunk.length());
+        task.partial.erase(0, task.partial.length() - keep);
+        task.partial.append(chunk);
+    }
+}
+
+void TaskDashboard::forwardLines(task_state_t& task, std::string_view chunk, bool flush)
+{
+    const std::string prefix = "[" + task.name + "] ";
+    std::string       out;
+    size_t            pos;
+    while ((pos = chunk.find('\n')) != chunk.npos)
+    {
+        out.append(prefix).append(task.partial).append(chunk.substr(0, pos + 1));
+        task.partial.clear();
+        chunk.remove_prefix(pos + 1);
+    }
+    task.partial.append(chunk);
+
+    // output without newlines, like \r progress bars, is forwarded in pieces
+    // rather than held on to for good
+    if ((flush || task.partial.length() >= TAIL_SIZE) && !task.partial.empty())
+    {
+        out.append(prefix).append(task.partial).append("\n");
+        task.partial.clear();
+    }
+
+    // one write per chunk, and under m_mutex, so lines of different tasks never mix
+    if (!out.empty())
+    {
+        std::fwrite(out.data(), 1, out.size(), stdout);
+        std::fflush(stdout);
+    }
+}
+
+void TaskDashboard::start()
+{
+    if (!m_live || m_running)
+        return;
+
+    if (!termbox.isInit())
+        termbox.begin();
+
+    m_running       = true;
+    m_render_thread = std::thread(&TaskDashboard::renderLoop, this);
+}
+
+void TaskDashboard::stop()
+{
+    if (m_running)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running = false;
+        }
+        m_cv.notify_all();
+        m_render_thread.join();
+
+        drawFrame();
+        termbox.shutdown();
+    }
+
+    printSummary();
+}
+
+void TaskDashboard::renderLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running)
+    {
+        lock.unlock();
+        drawFrame();
+        lock.lock();
+        m_cv.wait_for(lock, REFRESH_INTERVAL, [this] { return !m_running; });
+    }
+}
+
+void TaskDashboard::drawFrame()
+{
+    struct row_t
+    {
+        std::string name, line, elapsed;
+        State       state;
+        int         exit_status;
+        size_t      bytes;
+    };
+
+    std::vector<row_t> rows;
+    size_t             finished = 0, failed = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const clock::time_point     now = clock::now();
+
+        rows.reserve(m_tasks.size());
+        for (const task_state_t& task : m_tasks)
+        {
+            std::string elapsed;
+            if (task.state == State::Running)
+                elapsed = fmt::format("{:.1f}s", seconds_between(task.start, now));
+            else if (task.state != State::Queued && task.ran())
+                elapsed = fmt::format("{:.1f}s", seconds_between(task.start, task.end));
+
+            finished += (task.state == State::Done || task.state == State::Failed || task.state == State::Cancelled);
+            failed += (task.state == State::Failed);
+            rows.push_back({ task.name,
+                             std::string(last_line_of(task.partial)),
+                             std::move(elapsed),
+                             task.state,
+                             task.exit_status,
+                             task.bytes });
+        }
+    }
+    ++m_frame;
+
+    termbox.clearDisplay();
+    const int width  = termbox.getWidth();
+    const int height = termbox.getHeight();
+
+    termbox.setCursor(1, 0);
+    termbox.setTextColor(TB_BOLD);
+    termbox.print("ulpm: running {} tasks", rows.size());
+    termbox.resetColors();
+
+    int y = 2;
+    for (const row_t& row : rows)
+    {
+        // keep the last two lines for the aggregate bar
+        if (y >= height - 2)
+            break;
+
+        std::string_view glyph = "·";
+        std::string      state = "queued";
+        switch (row.state)
+        {
+            case State::Queued: break;
+            case State::Running:
+                glyph = SPINNER[m_frame % std::size(SPINNER)];
+                state = "running";
+                termbox.setTextColor(TB_YELLOW);
+                break;
+            case State::Done:
+                glyph = "✓";
+                state = "done";
+                termbox.setTextColor(TB_GREEN);
+                break;
+            case State::Failed:
+                glyph = "✗";
+                state = fmt::format("failed({})", row.exit_status);
+                termbox.setTextColor(TB_RED);
+                break;
+            case State::Cancelled:
+                glyph = "-";
+                state = "cancelled";
+                termbox.setTextColor(TB_DIM);
+                break;
+        }
+
+        termbox.setCursor(1, y);
+        // how much it printed, a task going quiet for long stands out
+        termbox.print("{} {:<{}} {:<10} {:>8} {:>10}",
+                      glyph,
+                      row.name,
+                      m_name_width,
+                      state,
+                      row.elapsed,
+                      row.elapsed.empty() ? "" : human_size(row.bytes));
+        termbox.resetColors();
+
+        const int line_x = 1 + 2 + static_cast<int>(m_name_width) + 1 + 10 + 1 + 8 + 1 + 10 + 2;
+        if (line_x < width - 1 && !row.line.empty())
+        {
+            termbox.setCursor(line_x, y);
+            termbox.setTextColor(TB_DIM);
+            termbox.print("{}", printable_line(row.line, width - 1 - line_x));
+            termbox.resetColors();
+        }
+        ++y;
+    }
+
+    // aggregate bar
+    const int bar_y = std::min(y + 1, height - 1);
+    const int bar_w = std::max(10, width - 32);
+    const int done  = rows.empty() ? bar_w : static_cast<int>(bar_w * finished / rows.size());
+    for (int i = 0; i < bar_w; ++i)
+        termbox.drawPixel(2 + i, bar_y, i < done ? U'█' : U'░');
+
+    termbox.setCursor(2 + bar_w + 1, bar_y);
+    termbox.print(" {}/{} done{}", finished, rows.size(), failed ? fmt::format(", {} failed", failed) : "");
+
+    termbox.hideCursor();
+    termbox.display();
+}
+
+void TaskDashboard::printSummary()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const task_state_t& task : m_tasks)
+    {
+        // otherwise finished tasks were already reported as they ended
+        if (!m_live && task.state != State::Queued)
+            continue;
+
+        const double elapsed = seconds_between(task.start, task.end);
+        if (task.state == State::Done)
+        {
+            info("{} finished in {:.1f}s", task.name, elapsed);
+        }
+        else if (task.state == State::Failed && !task.ran())
+        {
+            error("{} failed with exit status {}", task.name, task.exit_status);
+        }
+        else if (task.state == State::Failed)
+        {
+            error("{} failed with exit status {} after {:.1f}s", task.name, task.exit_status, elapsed);
+            if (!task.partial.empty())
+                fmt::print(stderr, "{}{}", task.partial, task.partial.back() == '\n' ? "" : "\n");
+        }
+        else if (task.state == State::Cancelled && !task.ran())
+        {
+            warn("{} cancelled before it started", task.name);
+        }
+        else if (task.state == State::Cancelled)
+        {
+            warn("{} cancelled after {:.1f}s", task.name, elapsed);
+        }
+        else
+        {
+            warn("{} did not run", task.name);
+        }
+    }
+}
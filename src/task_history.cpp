@@ -0,0 +1,91 @@
+#include "task_history.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+#include "util.hpp"
+
+static constexpr char HISTORY_MAGIC[8] = { 'U', 'L', 'P', 'M', 'D', 'U', 'R', '2' };
+
+TaskHistory::TaskHistory(std::string path) : m_path(std::move(path)), m_records(load(m_path)) {}
+
+std::unordered_map<std::string, TaskHistory::record_t> TaskHistory::load(const std::string& path)
+{
+    std::unordered_map<std::string, record_t> records;
+    std::ifstream                             f(path, std::ios::binary | std::ios::ate);
+    if (!f)
+        return records;
+    std::string buf(static_cast<size_t>(f.tellg()), '\0');
+    if (!f.seekg(0).read(buf.data(), buf.size()) ||
+        !hasStart(buf, std::string_view(HISTORY_MAGIC, sizeof(HISTORY_MAGIC))))
+        return records;
+
+    std::string_view data = std::string_view(buf).substr(sizeof(HISTORY_MAGIC));
+
+    uint32_t len;
+    record_t r;
+    while (read_bytes(data, &len, sizeof(len)) && data.size() >= len)
+    {
+        std::string key(data.substr(0, len));
+        data.remove_prefix(len);
+        if (!read_bytes(data, &r, sizeof(r)))
+            break;
+        records.emplace(std::move(key), r);
+    }
+    return records;
+}
+
+// A quarter of the new run for the duration, so one slow run is forgotten
+// after a few others. Memory going up is trusted right away, running out of
+// it costs more than waiting.
+void TaskHistory::add(record_t& r, const run_t& run)
+{
+    r.ms     = r.runs == 0 ? run.ms : (r.ms * 3 + run.ms) / 4;
+    r.memory = run.memory >= r.memory ? run.memory : (r.memory * 3 + run.memory) / 4;
+    ++r.runs;
+}
+
+uint64_t TaskHistory::duration(const std::string& key) const
+{
+    const auto it = m_records.find(key);
+    return it != m_records.end() ? it->second.ms : 0;
+}
+
+uint64_t TaskHistory::memory(const std::string& key) const
+{
+    const auto it = m_records.find(key);
+    return it != m_records.end() ? it->second.memory : 0;
+}
+
+void TaskHistory::record(const std::string& key, const uint64_t ms, const uint64_t peak_memory)
+{
+    // 0 is for never ran
+    const run_t run{ std::max<uint64_t>(ms, 1), peak_memory };
+    add(m_records[key], run);
+    m_recorded[key] = run;
+}
+
+void TaskHistory::save()
+{
+    if (m_recorded.empty())
+        return;
+
+    std::unordered_map<std::string, record_t> records = load(m_path);
+    for (const auto& [key, run] : m_recorded)
+        add(records[key], run);
+
+    const bool saved = atomic_write_file(m_path, [&](std::ostream& f) {
+        f.write(HISTORY_MAGIC, sizeof(HISTORY_MAGIC));
+        for (const auto& [key, r] : records)
+        {
+            write_pod(f, static_cast<uint32_t>(key.size()));
+            f.write(key.data(), key.size());
+            write_pod(f, r);
+        }
+        return true;
+    });
+    if (!saved)
+        return;
+    m_records = std::move(records);
+    m_recorded.clear();
+}
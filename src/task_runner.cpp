@@ -0,0 +1,595 @@
+#include "task_runner.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <thread>
+
+#include "cgroup.hpp"
+#include "memory_monitor.hpp"
+#include "signal_relay.hpp"
+#include "task_dashboard.hpp"
+#include "task_history.hpp"
+#include "tiny-process-library/process.hpp"
+#include "util.hpp"
+
+using TinyProcessLib::Process;
+using clock_type = std::chrono::steady_clock;
+
+// a task nothing is known of is guessed to take that long, if no other is known either
+static constexpr uint64_t DEFAULT_ESTIMATE_MS = 1000;
+
+namespace
+{
+
+// What the scheduler goes by
+struct plan_t
+{
+    std::vector<uint64_t>            estimate;  // ms
+    std::vector<char>                known;     // whether the estimate comes from the history
+    std::vector<uint64_t>            chain;     // estimate of the longest chain of tasks from this one to the end
+    std::vector<uint64_t>            memory;    // peak it's expected to need, bytes
+    std::vector<std::vector<size_t>> dependents;
+    std::vector<size_t>              waiting;   // how many tasks it comes after
+};
+
+// Ready tasks, the one with the longest chain behind it first, the first
+// given one among equals
+class ReadyQueue
+{
+public:
+    explicit ReadyQueue(const plan_t& plan, bool by_chain = true) : m_plan(plan), m_by_chain(by_chain) {}
+
+    bool empty() const { return m_ready.empty(); }
+    void push(size_t id) { m_ready.push_back(id); }
+
+    // The first of the ones fits() lets through, NONE if there's none
+    template <typename F>
+    size_t best(F&& fits) const
+    {
+        size_t id = NONE;
+        for (const size_t i : m_ready)
+            if ((id == NONE || before(i, id)) && fits(i))
+                id = i;
+        return id;
+    }
+    size_t best() const
+    {
+        return best([](size_t) { return true; });
+    }
+
+    void take(size_t id) { std::erase(m_ready, id); }
+
+    static constexpr size_t NONE = SIZE_MAX;
+
+private:
+    const plan_t&       m_plan;
+    bool                m_by_chain;
+    std::vector<size_t> m_ready;
+
+    bool before(size_t a, size_t b) const
+    {
+        if (m_by_chain && m_plan.chain[a] != m_plan.chain[b])
+            return m_plan.chain[a] > m_plan.chain[b];
+        return a < b;
+    }
+};
+
+}  // namespace
+
+static plan_t make_plan(const std::vector<task_t>& tasks, const TaskHistory* history)
+{
+    const size_t n = tasks.size();
+    plan_t       plan;
+    plan.estimate.resize(n);
+    plan.known.resize(n);
+    plan.chain.resize(n);
+    plan.memory.resize(n);
+    plan.dependents.resize(n);
+    plan.waiting.resize(n);
+
+    uint64_t known_total = 0, known_count = 0, memory_total = 0, memory_count = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const std::string& key = tasks[i].key.empty() ? tasks[i].name : tasks[i].key;
+        plan.estimate[i]       = history ? history->duration(key) : 0;
+        plan.memory[i]         = history ? history->memory(key) : 0;
+        plan.known[i]          = plan.estimate[i] > 0;
+        known_total += plan.estimate[i];
+        known_count += plan.known[i];
+        memory_total += plan.memory[i];
+        memory_count += plan.memory[i] > 0;
+        for (const size_t a : tasks[i].after)
+            if (a < n && a != i)
+            {
+                plan.dependents[a].push_back(i);
+                ++plan.waiting[i];
+            }
+    }
+    // the unknown ones are guessed to be like the average known one
+    const uint64_t guess        = known_count ? known_total / known_count : DEFAULT_ESTIMATE_MS;
+    const uint64_t memory_guess = memory_count ? memory_total / memory_count : 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!plan.known[i])
+            plan.estimate[i] = guess;
+        if (plan.memory[i] == 0)
+            plan.memory[i] = memory_guess;
+    }
+
+    // Kahn's algorithm, then the chains from the last tasks back to the first.
+    // Tasks in a cycle never get ready, their chain is only themselves.
+    std::vector<size_t> order, waiting = plan.waiting;
+    for (size_t i = 0; i < n; ++i)
+        if (waiting[i] == 0)
+            order.push_back(i);
+    for (size_t i = 0; i < order.size(); ++i)
+        for (const size_t d : plan.dependents[order[i]])
+            if (--waiting[d] == 0)
+                order.push_back(d);
+    for (size_t i = 0; i < n; ++i)
+        plan.chain[i] = plan.estimate[i];
+    for (auto it = order.rbegin(); it != order.rend(); ++it)
+        for (const size_t d : plan.dependents[*it])
+            plan.chain[*it] = std::max(plan.chain[*it], plan.estimate[*it] + plan.chain[d]);
+    return plan;
+}
+
+// How long running the tasks would take if they took exactly their estimate,
+// jobs at a time, picked by chain or in order. starts gets when each would start.
+static uint64_t simulate(const plan_t& plan, const size_t jobs, const bool by_chain, std::vector<uint64_t>* starts = nullptr)
+{
+    const size_t        n = plan.estimate.size();
+    std::vector<size_t> waiting = plan.waiting;
+    std::vector<char>   started(n);
+    ReadyQueue          ready(plan, by_chain);
+    for (size_t i = 0; i < n; ++i)
+        if (waiting[i] == 0)
+            ready.push(i);
+
+    using event_t = std::pair<uint64_t, size_t>;  // end, task
+    std::priority_queue<event_t, std::vector<event_t>, std::greater<event_t>> running;
+    uint64_t                                                                   now = 0;
+    for (size_t left = n; left > 0;)
+    {
+        // a cycle, started in order like run_tasks() does
+        if (ready.empty() && running.empty())
+            ready.push(std::find(started.begin(), started.end(), 0) - started.begin());
+        while (!ready.empty() && running.size() < jobs)
+        {
+            const size_t id = ready.best();
+            ready.take(id);
+            started[id] = true;
+            if (starts)
+                (*starts)[id] = now;
+            running.emplace(now + plan.estimate[id], id);
+        }
+
+        const auto [end, id] = running.top();
+        running.pop();
+        now = end;
+        --left;
+        for (const size_t d : plan.dependents[id])
+            if (--waiting[d] == 0 && !started[d])
+                ready.push(d);
+    }
+    return now;
+}
+
+static std::string seconds(const uint64_t ms)
+{
+    return fmt::format("{:.1f}s", ms / 1000.0);
+}
+
+static void explain_schedule(const std::vector<task_t>&                 tasks,
+                             const plan_t&                              plan,
+                             const size_t                               jobs,
+                             const uint64_t                             budget,
+                             const std::vector<uint64_t>&               peaks,
+                             const std::vector<uint64_t>&               cpu,
+                             const std::vector<clock_type::time_point>& starts,
+                             const std::vector<clock_type::time_point>& ends)
+{
+    std::vector<uint64_t> predicted(tasks.size());
+    const uint64_t        makespan = simulate(plan, jobs, true, &predicted);
+    const uint64_t        in_order = simulate(plan, jobs, false);
+
+    auto ms = [](const clock_type::duration d) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(d).count());
+    };
+    std::optional<clock_type::time_point> first, last;
+    for (size_t i = 0; i < tasks.size(); ++i)
+        if (starts[i] != clock_type::time_point{})
+        {
+            first = std::min(first.value_or(starts[i]), starts[i]);
+            last  = std::max(last.value_or(ends[i]), ends[i]);
+        }
+
+    std::vector<size_t> rows(tasks.size());
+    for (size_t i = 0; i < rows.size(); ++i)
+        rows[i] = i;
+    std::stable_sort(rows.begin(), rows.end(), [&](size_t a, size_t b) { return predicted[a] < predicted[b]; });
+
+    size_t width = 4;
+    for (const task_t& task : tasks)
+        width = std::max(width, task.name.size());
+
+    fmt::println("\nSchedule of {} tasks, {} at a time, longest chain first (~ for guessed durations):",
+                 tasks.size(),
+                 std::min(jobs, tasks.size()));
+    fmt::println("    {:<{}}  {:>9}  {:>9}  {:>9}  {:>9}  {:>9}  {:>9}  {:>9}  {:>9}",
+                 "task", width, "estimate", "chain", "planned", "started", "took", "cpu", "memory", "peak");
+    for (const size_t i : rows)
+    {
+        const bool ran = starts[i] != clock_type::time_point{};
+        fmt::println("    {:<{}}  {:>9}  {:>9}  {:>9}  {:>9}  {:>9}  {:>9}  {:>9}  {:>9}",
+                     tasks[i].name,
+                     width,
+                     (plan.known[i] ? "" : "~") + seconds(plan.estimate[i]),
+                     seconds(plan.chain[i]),
+                     seconds(predicted[i]),
+                     ran ? seconds(ms(starts[i] - *first)) : "-",
+                     ran ? seconds(ms(ends[i] - starts[i])) : "-",
+                     cpu[i] ? seconds(cpu[i]) : "-",
+                     plan.memory[i] ? human_size(plan.memory[i]) : "-",
+                     peaks[i] ? human_size(peaks[i]) : "-");
+    }
+    fmt::println("Predicted makespan: {} (in the given order: {}), actual: {}",
+                 seconds(makespan),
+                 seconds(in_order),
+                 first ? seconds(ms(*last - *first)) : "-");
+    fmt::println("Memory budget: {} (the planned makespan doesn't account for it)",
+                 budget ? human_size(budget) : "none");
+}
+
+size_t run_tasks(const std::vector<task_t>& tasks, const run_options_t& opts)
+{
+    std::optional<TaskHistory> history;
+    if (!opts.history.empty())
+        history.emplace(opts.history);
+    const plan_t plan = make_plan(tasks, history ? &*history : nullptr);
+
+    TaskDashboard dash;
+    for (const task_t& task : tasks)
+        dash.addTask(task.name);
+    dash.start();
+
+    std::mutex              done_mutex;
+    std::condition_variable done_cv;
+    size_t                  running = 0;
+    size_t                  failed  = 0;
+
+    // Tasks only get admitted while what the running ones are expected to
+    // use, or already use if that's more, plus what the new one is expected
+    // to use fits in the budget. One always may when nothing else runs.
+    MemoryMonitor  monitor;
+    const uint64_t budget = opts.memory ? opts.memory : MemoryMonitor::available();
+
+    // each in a cgroup of its own where possible, for its limits and exact
+    // usage, only if some have limits or it was asked for
+    std::optional<CgroupTree> cgroups;
+    if (opts.cgroups || std::any_of(tasks.begin(), tasks.end(), [](const task_t& t) { return !t.limits.empty(); }))
+        cgroups.emplace();
+    std::vector<std::optional<cgroup_stats_t>> usage(tasks.size());
+
+    // Ctrl-C only reaches ulpm, the tasks being in process groups of their
+    // own, so the relay passes it on and the tasks get cancelled like after
+    // a failure, minus the SIGTERM
+    int         interrupted = 0;
+    SignalRelay relay([&](int sig) {
+        std::lock_guard<std::mutex> lock(done_mutex);
+        if (interrupted == 0)
+            interrupted = sig;
+        done_cv.notify_all();
+    });
+
+    std::vector<size_t>                 waiting = plan.waiting;
+    std::vector<char>                   started(tasks.size()), cancelled(tasks.size());
+    std::vector<int>                    results(tasks.size(), -1);
+    std::vector<clock_type::time_point> starts(tasks.size()), ends(tasks.size());
+    std::vector<size_t>                 over;  // finished tasks whose process is still around
+    std::vector<std::thread>            releasers;  // of the cgroups of finished tasks
+    ReadyQueue                          ready(plan);
+    for (size_t i = 0; i < tasks.size(); ++i)
+        if (waiting[i] == 0)
+            ready.push(i);
+
+    auto finish = [&](size_t id, int status) {
+        // the relay may have passed on an interruption before it told us
+        const bool stopped = [&] {
+            std::lock_guard<std::mutex> lock(done_mutex);
+            return cancelled[id] || interrupted;
+        }();
+        if (status == 0)
+            dash.setState(id, TaskDashboard::State::Done);
+        else if (stopped)
+            dash.setState(id, TaskDashboard::State::Cancelled, status);
+        else
+            dash.setState(id, TaskDashboard::State::Failed, status);
+
+        monitor.unwatch(id);
+        std::lock_guard<std::mutex> lock(done_mutex);
+        // killing what the task left behind may take a second, not on the
+        // reactor thread, the other tasks' output would wait for it
+        if (cgroups)
+            releasers.emplace_back([&, id] {
+                if ((usage[id] = cgroups->release(id)))
+                    debug("{} used {} user and {} system CPU time, {} of memory at most, read {} and wrote {}",
+                          tasks[id].name,
+                          seconds(usage[id]->user_usec / 1000),
+                          seconds(usage[id]->system_usec / 1000),
+                          usage[id]->memory_peak ? human_size(usage[id]->memory_peak) : "?",
+                          human_size(usage[id]->read_bytes),
+                          human_size(usage[id]->write_bytes));
+            });
+        ends[id]    = clock_type::now();
+        results[id] = status;
+        over.push_back(id);
+        --running;
+        failed += (status != 0 && !stopped);
+        cancelled[id] = status != 0 && stopped;
+        for (const size_t d : plan.dependents[id])
+            if (--waiting[d] == 0 && !started[d])
+                ready.push(d);
+        done_cv.notify_all();
+    };
+
+#ifndef _WIN32
+    // A single thread reads the output of every child, and gets told through
+    // pidfds when they exit, instead of a reader and a waiter thread each.
+    // A task is over once it exited and both its pipes are drained, all of
+    // which is reported on the reactor thread.
+    TinyProcessLib::Reactor reactor;
+    std::vector<int>        pending(tasks.size(), 3);
+    std::vector<int>        statuses(tasks.size(), -1);
+#endif
+
+    std::vector<std::unique_ptr<Process>> procs(tasks.size());  // by id, until the task is over
+    std::vector<std::thread>              waiters;
+
+    auto spawn = [&](size_t id) {
+        const task_t& task   = tasks[id];
+        auto          output = [&dash, id](const char* bytes, size_t n) { dash.onOutput(id, bytes, n); };
+
+        TinyProcessLib::Config config;
+        config.priority = task.priority;
+#ifndef _WIN32
+        auto step = [&, id] {
+            if (--pending[id] == 0)
+                finish(id, statuses[id]);
+        };
+        config.cgroup_procs_fd = cgroups ? cgroups->create(id, task.limits) : -1;
+        config.reactor         = &reactor;
+        config.on_stdout_close = step;
+        config.on_stderr_close = step;
+        config.on_exit         = [&, id, step](int status) {
+            statuses[id] = status;
+            step();
+        };
+#endif
+
+        dash.setState(id, TaskDashboard::State::Running);
+        if (!task.argv.empty() && task.env.empty())
+            procs[id] = std::make_unique<Process>(task.argv, task.cwd, output, output, false, config);
+        else if (!task.argv.empty())
+            procs[id] = std::make_unique<Process>(task.argv, task.cwd, task.env, output, output, false, config);
+        else if (task.env.empty())
+            procs[id] = std::make_unique<Process>(task.shell, task.cwd, output, output, false, config);
+        else
+            procs[id] = std::make_unique<Process>(task.shell, task.cwd, task.env, output, output, false, config);
+
+        // Without pidfd support get_exit_status() is the only way to know,
+        // and it blocks, so each of those children needs its own waiter
+        Process* proc = procs[id].get();
+        if (proc->get_id() > 0)
+        {
+            monitor.watch(id, proc->get_id());
+            SignalRelay::add(proc->get_id());
+        }
+#ifndef _WIN32
+        if (proc->notifies_exit())
+            return;
+#endif
+        waiters.emplace_back([&finish, id, proc] { finish(id, proc->get_exit_status()); });
+    };
+
+    // Tasks left waiting on each other in a cycle are started in order once
+    // nothing else is running, there's no right order for them
+    const size_t limit    = opts.jobs == 0 ? std::max<size_t>(tasks.size(), 1) : opts.jobs;
+    size_t       nstarted = 0;
+    bool         held     = false;  // whether tasks were last held back for memory
+    auto         fits     = [&](size_t id) {
+        if (budget == 0 || running == 0)
+            return true;
+        uint64_t in_use = 0;
+        for (size_t i = 0; i < tasks.size(); ++i)
+            if (started[i] && ends[i] == clock_type::time_point{})
+                in_use += std::max(plan.memory[i], monitor.current(i));
+        return in_use + plan.memory[id] <= budget;
+    };
+    auto can_spawn = [&] {
+        if (nstarted == tasks.size() || running >= limit || (!opts.keep_going && failed > 0) || interrupted)
+            return false;
+        if (running == 0)
+            return true;
+        if (ready.empty())
+            return false;
+        const bool admitted = ready.best(fits) != ReadyQueue::NONE;
+        if (!admitted && !held)
+            debug("Holding back ready tasks, {} running ones would leave too little of the {} memory budget",
+                  running,
+                  human_size(budget));
+        held = !admitted;
+        return admitted;
+    };
+    auto next = [&] {
+        if (ready.empty())
+            ready.push(std::find(started.begin(), started.end(), 0) - started.begin());
+        size_t id = ready.best(fits);
+        if (id == ReadyQueue::NONE)
+            id = ready.best();
+        ready.take(id);
+        started[id] = true;
+        starts[id]  = clock_type::now();
+        ++nstarted;
+        return id;
+    };
+
+    // Once a task failed, unless opts.keep_going is set, or ulpm got
+    // interrupted, the running ones are asked to stop, and killed if they're
+    // still there opts.grace later
+    std::unique_lock<std::mutex>          lock(done_mutex);
+    std::optional<clock_type::time_point> deadline;
+    bool                                  killed   = false;
+    auto                                  stopping = [&] { return interrupted || (!opts.keep_going && failed > 0); };
+    auto                                  stop     = [&](int sig) {
+        std::vector<Process*> targets;
+        for (size_t i = 0; i < tasks.size(); ++i)
+            if (started[i] && ends[i] == clock_type::time_point{})
+            {
+                cancelled[i] = true;
+                targets.push_back(procs[i].get());
+            }
+        if (sig == 0)
+            return;
+        // the whole group, the leader may be gone while the rest of it still
+        // holds the pipes of the task
+        lock.unlock();
+        for (Process* proc : targets)
+        {
+            if (!proc)
+                continue;
+#ifdef _WIN32
+            proc->kill(true);
+#else
+            proc->signal(sig);
+#endif
+        }
+        lock.lock();
+    };
+    // A task's pipes and pidfd are closed once it's over rather than once
+    // they all are, or long runs would run out of file descriptors. Not
+    // under the lock, the reactor may be waiting for it to report another.
+    auto reap = [&] {
+        std::vector<std::unique_ptr<Process>> reaped;
+        for (const size_t id : over)
+            if (procs[id])
+                reaped.push_back(std::move(procs[id]));
+        over.clear();
+        if (reaped.empty())
+            return;
+        lock.unlock();
+        for (const std::unique_ptr<Process>& proc : reaped)
+            SignalRelay::remove(proc->get_id());
+        reaped.clear();
+        lock.lock();
+    };
+    for (;;)
+    {
+        while (can_spawn())
+        {
+            const size_t id = next();
+            ++running;
+            lock.unlock();
+            spawn(id);
+            lock.lock();
+            reap();
+        }
+        reap();
+        if (running == 0)
+            break;
+
+        if (stopping() && !deadline)
+        {
+            debug("Stopping the {} running tasks", running);
+            deadline = clock_type::now() + opts.grace;
+            // the relay already passed the interruption on
+            stop(interrupted ? 0 : SIGTERM);
+        }
+        else if (deadline && !killed && clock_type::now() >= *deadline)
+        {
+            debug("Killing the {} tasks still running after {}ms", running, opts.grace.count());
+            killed = true;
+#ifdef _WIN32
+            stop(SIGTERM);
+#else
+            stop(SIGKILL);
+#endif
+        }
+        if (running == 0)
+            break;
+
+        auto pred = [&] { return running == 0 || can_spawn() || (stopping() && !deadline); };
+        if (deadline && !killed)
+            done_cv.wait_until(lock, *deadline, pred);
+        else
+            done_cv.wait(lock, pred);
+    }
+    reap();
+    lock.unlock();
+
+    for (std::thread& t : waiters)
+        t.join();
+    for (std::thread& t : releasers)
+        t.join();
+
+    dash.stop();
+
+    // the cgroup's peak is exact where there is one, the samples may miss it
+    std::vector<uint64_t> peaks(tasks.size()), cpu(tasks.size());
+    for (size_t i = 0; i < tasks.size(); ++i)
+    {
+        peaks[i] = usage[i] && usage[i]->memory_peak ? usage[i]->memory_peak : monitor.peak(i);
+        cpu[i]   = usage[i] ? (usage[i]->user_usec + usage[i]->system_usec) / 1000 : 0;
+    }
+
+    if (history)
+    {
+        for (size_t i = 0; i < tasks.size(); ++i)
+            if (started[i] && results[i] == 0)
+                history->record(tasks[i].key.empty() ? tasks[i].name : tasks[i].key,
+                                std::chrono::duration_cast<std::chrono::milliseconds>(ends[i] - starts[i]).count(),
+                                peaks[i]);
+        history->save();
+    }
+    if (opts.explain)
+        explain_schedule(tasks, plan, limit, budget, peaks, cpu, starts, ends);
+
+    // what cancelling saved, going by the estimates of the tasks. Those are
+    // wall times of earlier runs, CPU time isn't recorded, so it's their sum
+    if (stopping())
+    {
+        size_t   nstopped = 0, nskipped = 0;
+        uint64_t saved    = 0;
+        for (size_t i = 0; i < tasks.size(); ++i)
+        {
+            if (cancelled[i])
+            {
+                const auto took = std::chrono::duration_cast<std::chrono::milliseconds>(ends[i] - starts[i]).count();
+                saved += plan.estimate[i] - std::min<uint64_t>(plan.estimate[i], took);
+                ++nstopped;
+            }
+            else if (!started[i])
+            {
+                saved += plan.estimate[i];
+                ++nskipped;
+            }
+        }
+        info("Cancelled {} running and {} queued tasks, saving an estimated {} of summed task wall time",
+             nstopped,
+             nskipped,
+             seconds(saved));
+    }
+
+    if (interrupted)
+    {
+        cgroups.reset();
+        SignalRelay::reraise(interrupted);
+    }
+    return failed;
+}
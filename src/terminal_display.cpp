@@ -1,12 +1,17 @@
 #include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 
 #define TB_IMPL 1
 #include "terminal_display.hpp"
+#include "headless_screen.hpp"
 #include "utf8.h"
 
+static constexpr std::string_view PASTE_START_SEQ = "\x1b[200~";
+static constexpr std::string_view PASTE_END_SEQ   = "\x1b[201~";
+
 // utf8len requires const utf8_int8_t* (aka char8_t* in C++20), but
 // std::string::c_str() returns const char*. This helper silences the
 // conversion at a single place rather than scattering casts everywhere.
@@ -15,6 +20,37 @@ size_t utf8_len(const std::string& s)
     return utf8len(reinterpret_cast<const utf8_int8_t*>(s.c_str()));
 }
 
+std::string codepoint_to_utf8(uint32_t cp)
+{
+    char         buf[5] = {};
+    utf8_int8_t* end    = utf8catcodepoint(reinterpret_cast<utf8_int8_t*>(buf), cp, sizeof(buf) - 1);
+    *end                = '\0';
+    return buf;
+}
+
+// termbox2 doesn't know about bracketed paste, and would otherwise
+// report the markers as an ESC keypress followed by garbage.
+static int extract_bracketed_paste(struct tb_event* event, size_t* consumed)
+{
+    const std::string_view in(global.in.buf, global.in.len);
+    for (const std::string_view seq : { PASTE_START_SEQ, PASTE_END_SEQ })
+    {
+        if (hasStart(in, seq))
+        {
+            event->type = TB_EVENT_KEY;
+            event->key  = (seq == PASTE_START_SEQ) ? TB_KEY_PASTE_START : TB_KEY_PASTE_END;
+            event->ch   = 0;
+            event->mod  = 0;
+            *consumed   = seq.length();
+            return TB_OK;
+        }
+        if (hasStart(seq, in))
+            return TB_ERR_NEED_MORE;
+    }
+
+    return TB_ERR;
+}
+
 static void enable_ansi_colors()
 {
 #ifdef _WIN32
@@ -31,6 +67,10 @@ static void enable_ansi_colors()
 #endif
 }
 
+TerminalDisplay::TerminalDisplay()
+    : m_has_init(false), m_width(0), m_height(0), m_cursor_x(0), m_cursor_y(0), m_fg_col(0), m_bg_col(0)
+{}
+
 TerminalDisplay::~TerminalDisplay()
 {
     shutdown();
@@ -41,10 +81,29 @@ bool TerminalDisplay::begin()
     if (m_has_init)
         return true;
 
+    if (const char* spec = std::getenv("ULPM_HEADLESS"))
+    {
+        m_headless = HeadlessScreen::fromSpec(spec);
+        if (!m_headless)
+            die("ULPM_HEADLESS must be <width>x<height>, got '{}'", spec);
+
+        if (const char* keys = std::getenv("ULPM_HEADLESS_KEYS"); keys && !m_headless->loadKeys(keys))
+            die("Failed to read keys script '{}'", keys);
+        if (const char* snapshots = std::getenv("ULPM_HEADLESS_SNAPSHOTS"))
+            m_headless->setSnapshotPath(snapshots);
+
+        updateDims();
+        m_has_init = true;
+        return true;
+    }
+
     enable_ansi_colors();
     if (tb_init() < 0)
         return false;
 
+    tb_set_func(TB_FUNC_EXTRACT_PRE, extract_bracketed_paste);
+    tb_sendf("\x1b[?2004h");
+
     updateDims();
     tb_hide_cursor();
     m_has_init = true;
@@ -55,15 +114,29 @@ void TerminalDisplay::shutdown()
 {
     if (!m_has_init)
         return;
+
+    m_has_init = false;
+    if (m_headless)
+    {
+        const HeadlessScreen::stats_t& st = m_headless->stats();
+        info_stat("headless: {} frames for {} events, {} cells changed, ~{} bytes",
+                  st.frames,
+                  st.events,
+                  st.cells_changed,
+                  st.bytes);
+        m_headless.reset();
+        return;
+    }
+
     clearDisplay();
+    tb_sendf("\x1b[?2004l");
     tb_shutdown();
-    m_has_init = false;
 }
 
 void TerminalDisplay::updateDims()
 {
-    m_width  = tb_width();
-    m_height = tb_height();
+    m_width  = m_headless ? m_headless->width() : tb_width();
+    m_height = m_headless ? m_headless->height() : tb_height();
 
     m_cursor_x = std::clamp(m_cursor_x, 0, std::max(0, m_width - 1));
     m_cursor_y = std::clamp(m_cursor_y, 0, std::max(0, m_height - 1));
@@ -73,7 +146,10 @@ void TerminalDisplay::clearDisplay()
 {
     updateDims();
     resetColors();
-    tb_clear();
+    if (m_headless)
+        m_headless->clear();
+    else
+        tb_clear();
     m_cursor_x = 0;
     m_cursor_y = 0;
 }
@@ -81,7 +157,90 @@ void TerminalDisplay::clearDisplay()
 void TerminalDisplay::display()
 {
     updateDims();
-    tb_present();
+    if (m_headless)
+        m_headless->present();
+    else
+        tb_present();
+    m_last_frame = std::chrono::steady_clock::now();
+}
+
+std::vector<input_event_t> TerminalDisplay::pollInput()
+{
+    std::vector<input_event_t> events;
+    struct tb_event            ev = {};
+
+    if (waitEvent(&ev, -1) != TB_OK)
+        return events;
+
+    const auto deadline = m_last_frame + FRAME_INTERVAL;
+    bool       in_paste = false;
+    for (;;)
+    {
+        if (ev.type == TB_EVENT_KEY && ev.key == TB_KEY_PASTE_START)
+        {
+            in_paste = true;
+            events.push_back({ ev, {} });
+        }
+        else if (ev.type == TB_EVENT_KEY && ev.key == TB_KEY_PASTE_END)
+        {
+            in_paste = false;
+        }
+        else if (in_paste)
+        {
+            // our input fields are single line, drop newlines and other control keys
+            if (ev.type == TB_EVENT_KEY && ev.ch != 0)
+                events.back().paste += codepoint_to_utf8(ev.ch);
+        }
+        else
+        {
+            events.push_back({ ev, {} });
+        }
+
+        int timeout_ms = PASTE_TIMEOUT_MS;
+        if (!in_paste)
+        {
+            const auto left =
+                std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            timeout_ms = std::max<int>(0, left.count());
+        }
+
+        if (waitEvent(&ev, timeout_ms) != TB_OK)
+            break;
+    }
+
+    return events;
+}
+
+int TerminalDisplay::waitEvent(struct tb_event* ev, int timeout_ms)
+{
+    if (m_headless)
+        return m_headless->nextEvent(*ev, timeout_ms < 0) ? TB_OK : TB_ERR_NO_EVENT;
+
+    return timeout_ms < 0 ? tb_poll_event(ev) : tb_peek_event(ev, timeout_ms);
+}
+
+void TerminalDisplay::printLine(int x, int y, const std::string& line)
+{
+    if (m_headless)
+        m_headless->print(x, y, m_fg_col, m_bg_col, line);
+    else
+        tb_print(x, y, m_fg_col, m_bg_col, line.c_str());
+}
+
+void TerminalDisplay::hideCursor()
+{
+    if (m_headless)
+        m_headless->hideCursor();
+    else
+        tb_hide_cursor();
+}
+
+void TerminalDisplay::showCursor(int cx, int cy)
+{
+    if (m_headless)
+        m_headless->setCursor(cx, cy);
+    else
+        tb_set_cursor(cx, cy);
 }
 
 void TerminalDisplay::resetColors()
@@ -111,7 +270,10 @@ void TerminalDisplay::drawPixel(int x, int y, uint32_t ch)
     if (x < 0 || x >= m_width || y < 0 || y >= m_height)
         return;
 
-    tb_set_cell(x, y, ch, m_fg_col, m_bg_col);
+    if (m_headless)
+        m_headless->setCell(x, y, ch, m_fg_col, m_bg_col);
+    else
+        tb_set_cell(x, y, ch, m_fg_col, m_bg_col);
 }
 
 void TerminalDisplay::drawLine(int x0, int y0, int x1, int y1, uint32_t ch)
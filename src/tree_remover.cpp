@@ -0,0 +1,322 @@
+#include "tree_remover.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#include "fmt/format.h"
+
+#ifndef _WIN32
+#  include <dirent.h>
+#  include <fcntl.h>
+#  include <sys/resource.h>
+#  include <sys/stat.h>
+#  include <sys/wait.h>
+#  include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+#ifdef _WIN32
+remove_stats_t remove_tree(const std::string& path)
+{
+    remove_stats_t  stats;
+    std::error_code ec;
+    stats.files = fs::remove_all(path, ec);
+    if (ec)
+    {
+        stats.failed = 1;
+        stats.error  = ec.value();
+    }
+    return stats;
+}
+
+bool remove_in_background(const std::vector<std::string>& /*paths*/)
+{
+    return false;
+}
+#else
+static void fail(remove_stats_t& stats)
+{
+    if (stats.failed++ == 0)
+        stats.error = errno;
+}
+
+// A directory being emptied. It stays open until everything in it is gone,
+// for its subdirectories to be opened and removed relative to its fd.
+struct dir_node_t
+{
+    std::shared_ptr<dir_node_t> parent;  // nullptr for the root, opened from the cwd
+    std::string                 name;    // in parent
+    int                         fd      = -1;
+    int                         retries = 0;
+    std::atomic<size_t>         left{ 1 };         // its own listing plus its subdirectories not removed yet
+    std::atomic<bool>           failed{ false };  // something in it couldn't be removed, so it can't be either
+};
+
+// rmdir() refusing a directory means entries were created while it was
+// emptied, it's listed again this many times before giving up
+static constexpr int MAX_RETRIES = 3;
+
+class Remover
+{
+public:
+    explicit Remover(size_t threads) : m_stats(std::max<size_t>(1, threads)) {}
+
+    remove_stats_t run(std::shared_ptr<dir_node_t> root)
+    {
+        m_jobs.push_back(std::move(root));
+
+        std::vector<std::thread> threads;
+        for (size_t id = 1; id < m_stats.size(); ++id)
+            threads.emplace_back(&Remover::work, this, id);
+        work(0);
+        for (std::thread& t : threads)
+            t.join();
+
+        remove_stats_t stats;
+        for (const remove_stats_t& worker : m_stats)
+        {
+            stats.files += worker.files;
+            stats.dirs += worker.dirs;
+            if (worker.failed > 0 && stats.failed == 0)
+                stats.error = worker.error;
+            stats.failed += worker.failed;
+        }
+        return stats;
+    }
+
+private:
+    std::mutex                               m_mutex;
+    std::condition_variable                  m_cv;
+    std::vector<std::shared_ptr<dir_node_t>> m_jobs;  // opened depth first from the back
+    size_t                                   m_busy = 0;
+    std::vector<remove_stats_t>              m_stats;  // one per worker
+
+    void work(const size_t id)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;)
+        {
+            m_cv.wait(lock, [&] { return !m_jobs.empty() || m_busy == 0; });
+            if (m_jobs.empty())
+                break;
+
+            std::shared_ptr<dir_node_t> node = std::move(m_jobs.back());
+            m_jobs.pop_back();
+            ++m_busy;
+            lock.unlock();
+
+            std::vector<std::shared_ptr<dir_node_t>> children = empty(node, m_stats[id]);
+            finish(std::move(node), m_stats[id], children);
+
+            lock.lock();
+            --m_busy;
+            for (std::shared_ptr<dir_node_t>& child : children)
+                m_jobs.push_back(std::move(child));
+            m_cv.notify_all();
+        }
+    }
+
+    // Unlinks everything in node but its subdirectories, which are returned
+    static std::vector<std::shared_ptr<dir_node_t>> empty(const std::shared_ptr<dir_node_t>& node,
+                                                          remove_stats_t&                    stats)
+    {
+        std::vector<std::shared_ptr<dir_node_t>> children;
+        const int parent_fd = node->parent ? node->parent->fd : AT_FDCWD;
+
+        // O_NOFOLLOW: a directory swapped for a symlink meanwhile is unlinked
+        // as one, instead of being followed out of the tree
+        node->fd = openat(parent_fd, node->name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (node->fd < 0)
+        {
+            if (errno == ENOTDIR || errno == ELOOP)
+            {
+                if (unlinkat(parent_fd, node->name.c_str(), 0) == 0)
+                    ++stats.files;
+                else if (errno != ENOENT)
+                    fail(stats);
+            }
+            else if (errno != ENOENT)
+            {
+                fail(stats);
+                node->failed = true;
+            }
+            return children;
+        }
+
+        const int list_fd = dup(node->fd);
+        DIR*      dir     = list_fd >= 0 ? fdopendir(list_fd) : nullptr;
+        if (!dir)
+        {
+            if (list_fd >= 0)
+                close(list_fd);
+            fail(stats);
+            node->failed = true;
+            return children;
+        }
+
+        while (const dirent* d = readdir(dir))
+        {
+            const char* name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+
+            bool        is_dir = d->d_type == DT_DIR;
+            struct stat st;
+            if (d->d_type == DT_UNKNOWN && fstatat(node->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+                is_dir = S_ISDIR(st.st_mode);
+
+            if (is_dir)
+            {
+                auto child    = std::make_shared<dir_node_t>();
+                child->parent = node;
+                child->name   = name;
+                ++node->left;
+                children.push_back(std::move(child));
+            }
+            else if (unlinkat(node->fd, name, 0) == 0)
+            {
+                ++stats.files;
+            }
+            else if (errno != ENOENT)
+            {
+                fail(stats);
+                node->failed = true;
+            }
+        }
+        closedir(dir);
+        return children;
+    }
+
+    // Drops one of what node was waiting for, and removes it, then maybe its
+    // parents, once that was the last one. A directory that got new entries
+    // meanwhile is queued in children to be emptied again, one that failed
+    // only fails its parents, without counting as another failure.
+    static void finish(std::shared_ptr<dir_node_t>               node,
+                       remove_stats_t&                           stats,
+                       std::vector<std::shared_ptr<dir_node_t>>& children)
+    {
+        while (node && --node->left == 0)
+        {
+            if (node->fd >= 0)
+            {
+                close(node->fd);
+                node->fd = -1;
+            }
+
+            const int parent_fd = node->parent ? node->parent->fd : AT_FDCWD;
+            if (node->failed)
+            {
+                if (node->parent)
+                    node->parent->failed = true;
+            }
+            else if (unlinkat(parent_fd, node->name.c_str(), AT_REMOVEDIR) == 0)
+            {
+                ++stats.dirs;
+            }
+            else if ((errno == ENOTEMPTY || errno == EEXIST) && node->retries++ < MAX_RETRIES)
+            {
+                node->left = 1;
+                children.push_back(std::move(node));
+                return;
+            }
+            else if (errno != ENOENT)
+            {
+                fail(stats);
+                if (node->parent)
+                    node->parent->failed = true;
+            }
+
+            node = node->parent;
+        }
+    }
+};
+
+remove_stats_t remove_tree(const std::string& path)
+{
+    remove_stats_t stats;
+
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0)
+    {
+        if (errno != ENOENT)
+            fail(stats);
+        return stats;
+    }
+    if (!S_ISDIR(st.st_mode))
+    {
+        if (unlink(path.c_str()) == 0)
+            ++stats.files;
+        else
+            fail(stats);
+        return stats;
+    }
+
+    auto root  = std::make_shared<dir_node_t>();
+    root->name = path;
+    return Remover(std::thread::hardware_concurrency()).run(std::move(root));
+}
+
+bool remove_in_background(const std::vector<std::string>& paths)
+{
+    const pid_t pid = fork();
+    if (pid < 0)
+        return false;
+
+    if (pid == 0)
+    {
+        // Fork again so the one doing the work gets reparented to init and
+        // nobody has to wait for it, then get off the terminal
+        setsid();
+        const pid_t worker = fork();
+        if (worker != 0)
+            _exit(worker < 0 ? 1 : 0);
+
+        const int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd >= 0)
+        {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        setpriority(PRIO_PROCESS, 0, 10);
+
+        for (const std::string& path : paths)
+            remove_tree(path);
+        _exit(0);
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+#endif
+
+std::string move_aside(const std::string& path, const std::string& trash_dir)
+{
+    std::error_code ec;
+    fs::create_directories(trash_dir, ec);
+    if (ec)
+        return {};
+
+    const std::string name = fs::path(path).filename().string();
+    for (size_t n = 0;; ++n)
+    {
+        const std::string dest = fmt::format("{}/{}.{}", trash_dir, name, n);
+        fs::rename(path, dest, ec);
+        if (!ec)
+            return dest;
+        // a leftover from an earlier run, try the next name
+        if (ec != std::errc::directory_not_empty && ec != std::errc::file_exists && ec != std::errc::is_a_directory &&
+            ec != std::errc::not_a_directory)
+            return {};
+    }
+}
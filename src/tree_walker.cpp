@@ -0,0 +1,240 @@
+#include "tree_walker.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#  include <filesystem>
+#else
+#  include <dirent.h>
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+#ifdef __linux__
+#  include <sys/syscall.h>
+#endif
+
+TreeWalker::TreeWalker(size_t threads, bool stat)
+    : m_threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency())), m_stat(stat)
+{}
+
+#ifdef _WIN32
+bool TreeWalker::walk(const std::string& root, const Visitor& visit)
+{
+    namespace fs = std::filesystem;
+
+    std::error_code ec;
+    if (!fs::is_directory(root, ec))
+        return false;
+
+    std::vector<dir_t> stack{ { "", 0 } };
+    while (!stack.empty())
+    {
+        const dir_t dir = std::move(stack.back());
+        stack.pop_back();
+
+        for (const fs::directory_entry& de : fs::directory_iterator(fs::path(root) / dir.path, ec))
+        {
+            const std::string name = de.path().filename().string();
+            entry_t           e;
+            e.name   = name;
+            e.is_dir = de.is_directory(ec) && !de.is_symlink(ec);
+            if (m_stat && !e.is_dir)
+            {
+                e.size   = de.file_size(ec);
+                e.blocks = (e.size + 511) / 512;
+                e.nlink  = 1;
+            }
+
+            uint32_t tag = dir.tag;
+            if (visit(0, dir, e, tag) && e.is_dir)
+                stack.push_back({ dir.path.empty() ? name : dir.path + "/" + name, tag });
+        }
+    }
+    return true;
+}
+#else
+static bool is_dot(const char* name)
+{
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+// Calls f(name, d_type) for every entry but "." and ".."
+template <typename F>
+static void list_dir(const int fd, F&& f)
+{
+#  if defined(__linux__) && defined(SYS_getdents64)
+    // struct linux_dirent64 { u64 d_ino; s64 d_off; u16 d_reclen; u8 d_type; char d_name[]; }
+    alignas(8) char buf[64 * 1024];
+    for (;;)
+    {
+        const long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+
+        for (long off = 0; off < n;)
+        {
+            unsigned short reclen;
+            std::memcpy(&reclen, buf + off + 16, sizeof(reclen));
+            const unsigned char type = buf[off + 18];
+            const char*         name = buf + off + 19;
+            off += reclen;
+
+            if (!is_dot(name))
+                f(name, type);
+        }
+    }
+#  else
+    const int dir_fd = dup(fd);
+    DIR*      dir    = fdopendir(dir_fd);
+    if (!dir)
+    {
+        close(dir_fd);
+        return;
+    }
+    while (const dirent* d = readdir(dir))
+        if (!is_dot(d->d_name))
+            f(d->d_name, d->d_type);
+    closedir(dir);
+#  endif
+}
+
+static bool stat_entry(const int dir_fd, const char* name, TreeWalker::entry_t& e)
+{
+#  if defined(__linux__) && defined(STATX_BASIC_STATS)
+    // AT_STATX_DONT_SYNC: whatever is cached is good enough, never ask a network fs
+    struct statx stx;
+    const unsigned mask = STATX_TYPE | STATX_MODE | STATX_INO | STATX_NLINK | STATX_SIZE | STATX_BLOCKS;
+    if (statx(dir_fd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, mask, &stx) != 0)
+        return false;
+
+    e.is_dir = S_ISDIR(stx.stx_mode);
+    e.dev    = (static_cast<uint64_t>(stx.stx_dev_major) << 32) | stx.stx_dev_minor;
+    e.ino    = stx.stx_ino;
+    e.nlink  = stx.stx_nlink;
+    e.size   = stx.stx_size;
+    e.blocks = stx.stx_blocks;
+#  else
+    struct stat st;
+    if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+        return false;
+
+    e.is_dir = S_ISDIR(st.st_mode);
+    e.dev    = st.st_dev;
+    e.ino    = st.st_ino;
+    e.nlink  = st.st_nlink;
+    e.size   = st.st_size;
+    e.blocks = st.st_blocks;
+#  endif
+    return true;
+}
+
+bool TreeWalker::walk(const std::string& root, const Visitor& visit)
+{
+    const int root_fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd < 0)
+        return false;
+
+    struct worker_t
+    {
+        std::mutex        mutex;
+        std::deque<dir_t> jobs;
+    };
+
+    // Directories are opened relative to the root from their path, keeping
+    // an fd around for every queued one could run out of them.
+    std::vector<worker_t> workers(m_threads);
+    std::atomic<size_t>   pending = 1;  // queued or being read
+    workers[0].jobs.push_back({ "", 0 });
+
+    auto process = [&](const size_t id, const dir_t& dir) {
+        const int fd = openat(root_fd,
+                              dir.path.empty() ? "." : dir.path.c_str(),
+                              O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0)
+            return;
+
+        std::vector<dir_t> children;
+        list_dir(fd, [&](const char* name, const unsigned char type) {
+            entry_t e;
+            e.name   = name;
+            e.is_dir = type == DT_DIR;
+            e.dir_fd = fd;
+            if ((m_stat || type == DT_UNKNOWN) && !stat_entry(fd, name, e))
+                return;
+
+            uint32_t tag = dir.tag;
+            if (visit(id, dir, e, tag) && e.is_dir)
+                children.push_back({ dir.path.empty() ? std::string(name) : dir.path + "/" + name, tag });
+        });
+        close(fd);
+
+        if (children.empty())
+            return;
+        pending += children.size();
+        std::lock_guard<std::mutex> lock(workers[id].mutex);
+        for (dir_t& child : children)
+            workers[id].jobs.push_back(std::move(child));
+    };
+
+    // Own jobs are taken depth first from the back, stolen ones from the
+    // front, which are the biggest subtrees still waiting.
+    auto run = [&](const size_t id) {
+        size_t idle = 0;
+        while (pending > 0)
+        {
+            dir_t job;
+            bool  got = false;
+            for (size_t k = 0; !got && k < m_threads; ++k)
+            {
+                worker_t&                   w = workers[(id + k) % m_threads];
+                std::lock_guard<std::mutex> lock(w.mutex);
+                if (w.jobs.empty())
+                    continue;
+
+                if (k == 0)
+                {
+                    job = std::move(w.jobs.back());
+                    w.jobs.pop_back();
+                }
+                else
+                {
+                    job = std::move(w.jobs.front());
+                    w.jobs.pop_front();
+                }
+                got = true;
+            }
+
+            if (!got)
+            {
+                if (++idle < 64)
+                    std::this_thread::yield();
+                else
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                continue;
+            }
+
+            idle = 0;
+            process(id, job);
+            --pending;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t id = 1; id < m_threads; ++id)
+        threads.emplace_back(run, id);
+    run(0);
+    for (std::thread& t : threads)
+        t.join();
+
+    close(root_fd);
+    return true;
+}
+#endif
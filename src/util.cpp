@@ -31,8 +31,11 @@
 
 #include <algorithm>
 #include <cctype>
+#include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <iterator>
 #include <sstream>
 #include <string>
@@ -49,14 +52,6 @@
 
 constexpr size_t SEARCH_TITLE_LEN = 2 + 8;  // 2 for box border, 8 for "Search: "
 
-static std::string codepoint_to_utf8(uint32_t cp)
-{
-    char         buf[5] = {};
-    utf8_int8_t* end    = utf8catcodepoint(reinterpret_cast<utf8_int8_t*>(buf), cp, sizeof(buf) - 1);
-    *end                = '\0';
-    return buf;
-}
-
 bool hasStart(const std::string_view fullString, const std::string_view start)
 {
     if (start.length() > fullString.length())
@@ -64,11 +59,190 @@ bool hasStart(const std::string_view fullString, const std::string_view start)
     return (fullString.substr(0, start.size()) == start);
 }
 
+// Quote arg so /bin/sh passes it through as a single, literal argument
+std::string shell_quote(const std::string_view arg)
+{
+    std::string ret = "'";
+    for (const char c : arg)
+    {
+        if (c == '\'')
+            ret += "'\\''";
+        else
+            ret += c;
+    }
+    ret += '\'';
+    return ret;
+}
+
+bool glob_match(std::string_view pattern, std::string_view str, const char sep)
+{
+    while (!pattern.empty())
+    {
+        if (pattern[0] == '*')
+        {
+            const bool any = hasStart(pattern, "**");
+            pattern.remove_prefix(any ? 2 : 1);
+            for (size_t i = 0;; ++i)
+            {
+                if (glob_match(pattern, str.substr(i), sep))
+                    return true;
+                if (i == str.length() || (!any && str[i] == sep))
+                    return false;
+            }
+        }
+
+        if (str.empty() || (pattern[0] == '?' ? str[0] == sep : str[0] != pattern[0]))
+            return false;
+        pattern.remove_prefix(1);
+        str.remove_prefix(1);
+    }
+    return str.empty();
+}
+
+std::string find_in_path(const std::string_view name, const std::string_view path)
+{
+#ifdef _WIN32
+    constexpr char PATH_SEP = ';';
+#else
+    constexpr char PATH_SEP = ':';
+#endif
+    if (name.find('/') != name.npos)
+        return std::string(name);
+
+    for (const std::string& dir : split(path, PATH_SEP))
+    {
+        const std::filesystem::path exe = std::filesystem::path(dir.empty() ? "." : dir) / name;
+        std::error_code             ec;
+        if (std::filesystem::is_regular_file(exe, ec) && access(exe.string().c_str(), X_OK) == 0)
+            return exe.string();
+    }
+    return {};
+}
+
+std::string user_cache_dir(const std::string_view name)
+{
+#ifdef _WIN32
+    if (const char* dir = std::getenv("LOCALAPPDATA"); dir && *dir)
+        return fmt::format("{}\\ulpm\\{}", dir, name);
+#endif
+    if (const char* dir = std::getenv("XDG_CACHE_HOME"); dir && *dir)
+        return fmt::format("{}/ulpm/{}", dir, name);
+    if (const char* home = std::getenv("HOME"); home && *home)
+        return fmt::format("{}/.cache/ulpm/{}", home, name);
+    return fmt::format(".ulpm/{}", name);
+}
+
+std::string human_size(const uint64_t bytes)
+{
+    static constexpr std::string_view units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+
+    double size = static_cast<double>(bytes);
+    size_t unit = 0;
+    while (size >= 1024 && unit + 1 < std::size(units))
+    {
+        size /= 1024;
+        ++unit;
+    }
+    return unit == 0 ? fmt::format("{} B", bytes) : fmt::format("{:.1f} {}", size, units[unit]);
+}
+
+// a number with an optional K, M, G or T suffix (powers of 1024), "iB" or "B" allowed after it
+bool parse_size(const std::string_view str, uint64_t& bytes)
+{
+    size_t i = 0;
+    while (i < str.size() && std::isdigit(static_cast<unsigned char>(str[i])))
+        ++i;
+    if (i == 0 || i > 18)
+        return false;
+    bytes = std::stoull(std::string(str.substr(0, i)));
+
+    std::string_view unit = str.substr(i);
+    if (hasStart(unit, " "))
+        unit.remove_prefix(1);
+    int shift = 0;
+    if (!unit.empty())
+    {
+        switch (std::toupper(static_cast<unsigned char>(unit[0])))
+        {
+            case 'K': shift = 10; break;
+            case 'M': shift = 20; break;
+            case 'G': shift = 30; break;
+            case 'T': shift = 40; break;
+            case 'B': shift = 0; break;
+            default:  return false;
+        }
+        unit.remove_prefix(1);
+    }
+    if (unit != "" && unit != "B" && unit != "iB")
+        return false;
+    bytes <<= shift;
+    return true;
+}
+
+// a number with an optional s, m, h, d or w suffix (seconds by default)
+bool parse_duration(const std::string_view str, int64_t& seconds)
+{
+    size_t i = 0;
+    while (i < str.size() && std::isdigit(static_cast<unsigned char>(str[i])))
+        ++i;
+    if (i == 0 || i > 12 || str.size() > i + 1)
+        return false;
+    seconds = std::stoll(std::string(str.substr(0, i)));
+    switch (i < str.size() ? str[i] : 's')
+    {
+        case 's': break;
+        case 'm': seconds *= 60; break;
+        case 'h': seconds *= 60 * 60; break;
+        case 'd': seconds *= 24 * 60 * 60; break;
+        case 'w': seconds *= 7 * 24 * 60 * 60; break;
+        default:  return false;
+    }
+    return true;
+}
+
+bool is_under(const std::string_view path, const std::string_view dir)
+{
+    return dir.empty() || path == dir || (hasStart(path, dir) && path[dir.size()] == '/');
+}
+
+bool atomic_write_file(const std::string& path, const std::function<bool(std::ostream& f)>& write)
+{
+    static std::atomic<unsigned> count = 0;
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+
+    // unique in the process too, several threads may write the same file
+    const std::string tmp = fmt::format("{}.{}.{}.tmp", path, getpid(), count++);
+    bool              ok;
+    {
+        std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+        ok = f && write(f) && f.flush();
+    }
+    if (ok)
+    {
+        std::filesystem::rename(tmp, path, ec);
+        ok = !ec;
+    }
+    if (!ok)
+        std::filesystem::remove(tmp, ec);
+    return ok;
+}
+
+bool read_bytes(std::string_view& data, void* v, const size_t n)
+{
+    if (data.size() < n)
+        return false;
+    std::memcpy(v, data.data(), n);
+    data.remove_prefix(n);
+    return true;
+}
+
 std::vector<std::string> split(const std::string_view text, const char delim)
 {
     std::string              line;
     std::vector<std::string> vec;
-    std::stringstream        ss(text.data());
+    std::stringstream        ss{ std::string(text) };
     while (std::getline(ss, line, delim))
         vec.push_back(line);
     return vec;
@@ -106,12 +280,11 @@ std::string draw_entry_menu(const std::string&              prompt,
         return "";
     }
 
-    std::string     query         = default_option;
-    struct tb_event ev            = {};
-    size_t          selected      = 0;
-    size_t          scroll_offset = 0;
-    size_t          cursor_x      = SEARCH_TITLE_LEN + query.length() + default_option.length();
-    bool            is_search_tab = true;
+    std::string query         = default_option;
+    size_t      selected      = 0;
+    size_t      scroll_offset = 0;
+    size_t      cursor_x      = SEARCH_TITLE_LEN + query.length() + default_option.length();
+    bool        is_search_tab = true;
 
     if (!default_option.empty())
     {
@@ -128,124 +301,138 @@ std::string draw_entry_menu(const std::string&              prompt,
     termbox.clearDisplay();
     termbox.DrawSearchBox(query, prompt, results, selected, scroll_offset, cursor_x, is_search_tab);
 
-    bool exit          = false;
-    bool exit_selected = false;
-    while (tb_poll_event(&ev) == TB_OK)
+    bool                       exit          = false;
+    bool                       exit_selected = false;
+    std::vector<input_event_t> events;
+    while (!(events = termbox.pollInput()).empty())
     {
-        if (ev.type != TB_EVENT_KEY)
-            continue;
+        for (const input_event_t& in : events)
+        {
+            const struct tb_event& ev = in.ev;
+            if (ev.type != TB_EVENT_KEY)
+                continue;
 
-        const uint32_t ch  = ev.ch;   // Unicode codepoint (printable input)
-        const uint16_t key = ev.key;  // Special key (TB_KEY_*)
+            const uint32_t ch  = ev.ch;   // Unicode codepoint (printable input)
+            const uint16_t key = ev.key;  // Special key (TB_KEY_*)
 
-        if (key == TB_KEY_TAB)
-        {
-            is_search_tab = !is_search_tab;
-        }
-        else if (is_search_tab && key != TB_KEY_ESC && !exit)
-        {
-            bool erased = false;
-            if (key == TB_KEY_BACKSPACE || key == TB_KEY_BACKSPACE2)
-            {
-                if (!query.empty() && cursor_x > SEARCH_TITLE_LEN)
-                {
-                    query.erase(--cursor_x - SEARCH_TITLE_LEN, 1);
-                    erased  = true;
-                    results = entries;
-                    remove_entries(results, query);
-                }
-            }
-            else if (key == TB_KEY_DELETE)
-            {
-                if (cursor_x < SEARCH_TITLE_LEN + query.size())
-                    query.erase(cursor_x - SEARCH_TITLE_LEN, 1);
-            }
-            else if (key == TB_KEY_ARROW_LEFT)
-            {
-                if (cursor_x > SEARCH_TITLE_LEN)
-                    --cursor_x;
-            }
-            else if (key == TB_KEY_ARROW_RIGHT)
-            {
-                if (cursor_x < SEARCH_TITLE_LEN + query.length())
-                    ++cursor_x;
-            }
-            else if (key == TB_KEY_ARROW_DOWN || key == TB_KEY_ENTER)
-            {
-                is_search_tab = false;
-            }
-            else if (key == TB_KEY_HOME)
-            {
-                cursor_x = SEARCH_TITLE_LEN;
-            }
-            else if (key == TB_KEY_END)
+            if (key == TB_KEY_TAB)
             {
-                cursor_x = SEARCH_TITLE_LEN + query.length();
+                is_search_tab = !is_search_tab;
             }
-            else if (ch != 0)  // Printable character
+            else if (is_search_tab && key != TB_KEY_ESC && !exit)
             {
-                if (!erased)
+                bool erased = false;
+                if (key == TB_KEY_BACKSPACE || key == TB_KEY_BACKSPACE2)
                 {
-                    query.insert(cursor_x - SEARCH_TITLE_LEN, codepoint_to_utf8(ch));
-                    ++cursor_x;
+                    if (!query.empty() && cursor_x > SEARCH_TITLE_LEN)
+                    {
+                        query.erase(--cursor_x - SEARCH_TITLE_LEN, 1);
+                        erased  = true;
+                        results = entries;
+                        remove_entries(results, query);
+                    }
+                }
+                else if (key == TB_KEY_DELETE)
+                {
+                    if (cursor_x < SEARCH_TITLE_LEN + query.size())
+                        query.erase(cursor_x - SEARCH_TITLE_LEN, 1);
                 }
-                erased = false;
+                else if (key == TB_KEY_ARROW_LEFT)
+                {
+                    if (cursor_x > SEARCH_TITLE_LEN)
+                        --cursor_x;
+                }
+                else if (key == TB_KEY_ARROW_RIGHT)
+                {
+                    if (cursor_x < SEARCH_TITLE_LEN + query.length())
+                        ++cursor_x;
+                }
+                else if (key == TB_KEY_ARROW_DOWN || key == TB_KEY_ENTER)
+                {
+                    is_search_tab = false;
+                }
+                else if (key == TB_KEY_HOME)
+                {
+                    cursor_x = SEARCH_TITLE_LEN;
+                }
+                else if (key == TB_KEY_END)
+                {
+                    cursor_x = SEARCH_TITLE_LEN + query.length();
+                }
+                else if (key == TB_KEY_PASTE_START)
+                {
+                    query.insert(cursor_x - SEARCH_TITLE_LEN, in.paste);
+                    cursor_x += in.paste.length();
 
-                selected      = 0;
-                scroll_offset = 0;
-                remove_entries(results, query);
-            }
-        }
-        else
-        {
-            // go up
-            if (key == TB_KEY_ARROW_DOWN || key == TB_KEY_ARROW_RIGHT ||
-                (ch != 0 && tolower(static_cast<int>(ch)) == 'j'))
-            {
-                if (exit)
-                    exit_selected = false;
-                else if (selected < results.size() - 1)
-                    ++selected;
+                    selected      = 0;
+                    scroll_offset = 0;
+                    remove_entries(results, query);
+                }
+                else if (ch != 0)  // Printable character
+                {
+                    if (!erased)
+                    {
+                        query.insert(cursor_x - SEARCH_TITLE_LEN, codepoint_to_utf8(ch));
+                        ++cursor_x;
+                    }
+                    erased = false;
+
+                    selected      = 0;
+                    scroll_offset = 0;
+                    remove_entries(results, query);
+                }
             }
-            // go down
-            else if (key == TB_KEY_ARROW_UP || key == TB_KEY_ARROW_LEFT ||
-                     (ch != 0 && tolower(static_cast<int>(ch)) == 'k'))
+            else
             {
-                if (exit)
+                // go up
+                if (key == TB_KEY_ARROW_DOWN || key == TB_KEY_ARROW_RIGHT ||
+                    (ch != 0 && tolower(static_cast<int>(ch)) == 'j'))
                 {
-                    exit_selected = true;
+                    if (exit)
+                        exit_selected = false;
+                    else if (selected < results.size() - 1)
+                        ++selected;
                 }
-                else if (selected == 0)
+                // go down
+                else if (key == TB_KEY_ARROW_UP || key == TB_KEY_ARROW_LEFT ||
+                         (ch != 0 && tolower(static_cast<int>(ch)) == 'k'))
                 {
-                    is_search_tab = true;
+                    if (exit)
+                    {
+                        exit_selected = true;
+                    }
+                    else if (selected == 0)
+                    {
+                        is_search_tab = true;
+                    }
+                    else
+                    {
+                        --selected;
+                        if (selected < scroll_offset)
+                            --scroll_offset;
+                    }
                 }
-                else
+                // ESC pressed
+                else if (key == TB_KEY_ESC && !exit)
                 {
-                    --selected;
-                    if (selected < scroll_offset)
-                        --scroll_offset;
+                    exit = true;
+                }
+                // operation delete and choose "yes"
+                else if (exit && key == TB_KEY_ENTER && exit_selected)
+                {
+                    warn("Balling out. All changes are lost");
+                    std::exit(1);
+                }
+                // operation delete and pressed 'q' or "no"
+                else if (exit && key != TB_KEY_ESC && (!exit_selected || (ch != 0 && ch == 'q')))
+                {
+                    exit = false;
+                }
+                // pressed an item
+                else if (key == TB_KEY_ENTER && !results.empty())
+                {
+                    return results[selected];
                 }
-            }
-            // ESC pressed
-            else if (key == TB_KEY_ESC && !exit)
-            {
-                exit = true;
-            }
-            // operation delete and choose "yes"
-            else if (exit && key == TB_KEY_ENTER && exit_selected)
-            {
-                warn("Balling out. All changes are lost");
-                std::exit(1);
-            }
-            // operation delete and pressed 'q' or "no"
-            else if (exit && key != TB_KEY_ESC && (!exit_selected || (ch != 0 && ch == 'q')))
-            {
-                exit = false;
-            }
-            // pressed an item
-            else if (key == TB_KEY_ENTER && !results.empty())
-            {
-                return results[selected];
             }
         }
 
@@ -265,10 +452,9 @@ std::string draw_entry_menu(const std::string&              prompt,
 
 std::string draw_input_menu(const std::string& prompt, const std::string& default_option)
 {
-    const size_t    INPUT_TITLE_LEN = prompt.length() + 1;
-    std::string     input           = default_option;
-    struct tb_event ev              = {};
-    size_t          cursor_x        = INPUT_TITLE_LEN + default_option.size();
+    const size_t INPUT_TITLE_LEN = prompt.length() + 1;
+    std::string  input           = default_option;
+    size_t       cursor_x        = INPUT_TITLE_LEN + default_option.size();
 
     if (!termbox.isInit())
         termbox.begin();
@@ -276,73 +462,86 @@ std::string draw_input_menu(const std::string& prompt, const std::string& defaul
     termbox.clearDisplay();
     termbox.DrawInputBox(prompt, input, cursor_x - INPUT_TITLE_LEN);
 
-    bool exit          = false;
-    bool exit_selected = false;
-    while (tb_poll_event(&ev) == TB_OK)
+    bool                       exit          = false;
+    bool                       exit_selected = false;
+    std::vector<input_event_t> events;
+    while (!(events = termbox.pollInput()).empty())
     {
-        if (ev.type != TB_EVENT_KEY)
-            continue;
+        for (const input_event_t& in : events)
+        {
+            const struct tb_event& ev = in.ev;
+            if (ev.type != TB_EVENT_KEY)
+                continue;
 
-        const uint32_t ch  = ev.ch;
-        const uint16_t key = ev.key;
+            const uint32_t ch  = ev.ch;
+            const uint16_t key = ev.key;
 
-        if (key == TB_KEY_ESC)  // ESC to exit
-        {
-            exit = true;
-        }
-        else if (key == TB_KEY_ENTER)  // Enter to submit
-        {
-            if (exit && exit_selected)
+            if (key == TB_KEY_ESC)  // ESC to exit
             {
-                warn("Balling out. All changes are lost");
-                std::exit(1);
+                exit = true;
             }
-            // operation delete and pressed 'q' or "no"
-            else if (exit && (!exit_selected || (ch != 0 && ch == 'q')))
+            else if (key == TB_KEY_ENTER)  // Enter to submit
             {
-                exit = false;
+                if (exit && exit_selected)
+                {
+                    warn("Balling out. All changes are lost");
+                    std::exit(1);
+                }
+                // operation delete and pressed 'q' or "no"
+                else if (exit && (!exit_selected || (ch != 0 && ch == 'q')))
+                {
+                    exit = false;
+                }
+                else
+                {
+                    return input;
+                }
             }
-            else
+            else if (key == TB_KEY_BACKSPACE || key == TB_KEY_BACKSPACE2)
             {
-                return input;
+                if (!input.empty() && cursor_x > INPUT_TITLE_LEN)
+                    input.erase(--cursor_x - INPUT_TITLE_LEN, 1);
             }
-        }
-        else if (key == TB_KEY_BACKSPACE || key == TB_KEY_BACKSPACE2)
-        {
-            if (!input.empty() && cursor_x > INPUT_TITLE_LEN)
-                input.erase(--cursor_x - INPUT_TITLE_LEN, 1);
-        }
-        else if (key == TB_KEY_ARROW_LEFT)
-        {
-            if (exit)
-                exit_selected = true;
-            else if (cursor_x > INPUT_TITLE_LEN)
-                --cursor_x;
-        }
-        else if (key == TB_KEY_ARROW_RIGHT)
-        {
-            if (exit)
-                exit_selected = false;
-            else if (cursor_x < INPUT_TITLE_LEN + input.size())
+            else if (key == TB_KEY_ARROW_LEFT)
+            {
+                if (exit)
+                    exit_selected = true;
+                else if (cursor_x > INPUT_TITLE_LEN)
+                    --cursor_x;
+            }
+            else if (key == TB_KEY_ARROW_RIGHT)
+            {
+                if (exit)
+                    exit_selected = false;
+                else if (cursor_x < INPUT_TITLE_LEN + input.size())
+                    ++cursor_x;
+            }
+            else if (key == TB_KEY_DELETE)
+            {
+                if (cursor_x < INPUT_TITLE_LEN + input.size())
+                    input.erase(cursor_x - INPUT_TITLE_LEN, 1);
+            }
+            else if (key == TB_KEY_HOME)
+            {
+                cursor_x = INPUT_TITLE_LEN;
+            }
+            else if (key == TB_KEY_END)
+            {
+                cursor_x = INPUT_TITLE_LEN + input.size();
+            }
+            else if (key == TB_KEY_PASTE_START)
+            {
+                if (!exit)
+                {
+                    input.insert(cursor_x - INPUT_TITLE_LEN, in.paste);
+                    cursor_x += in.paste.length();
+                }
+            }
+            else if (ch != 0)  // Printable character
+            {
+                input.insert(cursor_x - INPUT_TITLE_LEN, codepoint_to_utf8(ch));
                 ++cursor_x;
-        }
-        else if (key == TB_KEY_DELETE)
-        {
-            if (cursor_x < INPUT_TITLE_LEN + input.size())
-                input.erase(cursor_x - INPUT_TITLE_LEN, 1);
-        }
-        else if (key == TB_KEY_HOME)
-        {
-            cursor_x = INPUT_TITLE_LEN;
-        }
-        else if (key == TB_KEY_END)
-        {
-            cursor_x = INPUT_TITLE_LEN + input.size();
-        }
-        else if (ch != 0)  // Printable character
-        {
-            input.insert(cursor_x - INPUT_TITLE_LEN, codepoint_to_utf8(ch));
-            ++cursor_x;
+            }
         }
 
         if (exit)